@@ -0,0 +1,53 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include "common.h"
+
+/* A point light with a finite range */
+typedef struct {
+  vec3 pos;
+  float radius;
+  vec3 color;
+} PointLight;
+
+/* Clustered forward lighting
+ *
+ * The view frustum is split into a dimX x dimY x dimZ grid of froxels
+ * (screen tiles x exponential depth slices).
+ * Each frame, lights are assigned to the froxels they touch on the CPU,
+ * and three texture buffers are uploaded for the fragment shaders:
+ *   lights:  2 RGBA32F texels per light, (pos, radius) and (color, 0)
+ *   grid:    1 RG32UI texel per froxel, (offset, count) into indices
+ *   indices: R32UI light indices, packed froxel after froxel
+ */
+class LightCluster {
+public:
+  int dimX, dimY, dimZ;
+  float nearPlane, farPlane;
+
+  // per froxel light lists, filled slice by slice in parallel
+  vector<vector<GLuint>> lists;
+
+  // compact data uploaded to the gpu
+  vector<vec4> aLights;
+  vector<GLuint> aGrid;
+  vector<GLuint> aIndices;
+
+  // opengl data
+  GLuint bufLights, bufGrid, bufIndices;
+  GLuint tboLights, tboGrid, tboIndices;
+  int unitLights, unitGrid, unitIndices;
+
+  LightCluster(int, int, int);
+  ~LightCluster();
+
+  void build(vector<PointLight> &, mat4, mat4, float, float);
+  void upload();
+  void setUniforms(GLint, GLint, GLint, GLint, GLint, GLint);
+
+private:
+  void assignSlices(vector<vec4> &, mat4 &, size_t, size_t);
+  float sliceDepth(int);
+};
+
+#endif
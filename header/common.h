@@ -1,3 +1,6 @@
+#ifndef COMMON_H
+#define COMMON_H
+
 #include <iostream>
 #include <string>
 #include <fstream>
@@ -27,6 +30,12 @@ typedef struct {
   float m;
 } Point;
 
+class LightCluster;
+class ShadowCube;
+class LodChain;
+class VirtualTexture;
+class DynamicMesh;
+
 typedef struct {
   // data index
   GLuint v1, v2, v3;
@@ -46,28 +55,96 @@ public:
   GLuint vboVtxs, vboUvs, vboNormals;
   GLuint vao;
   GLuint shader;
-  GLuint tboBase, tboNormal;
+  int program;
+  GLuint tboBase, tboNormal, tboHeight;
   GLint uniModel, uniView, uniProjection;
   GLint uniEyePoint, uniLightColor, uniLightPosition;
   GLint uniTexBase, uniTexNormal;
 
+  // POM with a height map instead of plain normal mapping
+  bool parallax;
+  GLint uniTexHeight, uniLodLevel;
+
+  // the height map is the alpha channel of the normal map
+  bool packed;
+
+  // tessellated and displaced by the height map instead of POM, edges are
+  // split to about tessPixels on screen, see tcsDisplace.glsl
+  bool displaced;
+  float tessPixels;
+  GLint uniViewport, uniTessPixels;
+
+  // object units per uv unit, the displacement depth scales with it
+  float uvToWorld;
+  GLint uniUvToWorld;
+
+  // shading level, see ShadingLod
+  float lodLevel;
+
+  // clustered lighting, disabled when cluster is NULL
+  LightCluster *cluster;
+  GLint uniClusterLights, uniClusterGrid, uniClusterIndices;
+  GLint uniClusterDims, uniClusterDepth, uniClusterViewport;
+
+  // cube shadow maps of the point light, disabled when shadow is NULL
+  ShadowCube *shadow;
+  GLint uniShadowStatic, uniShadowDynamic, uniShadowLight;
+
+  // vertex buffers edited in place, see setDynamic(); translate(), scale()
+  // and rotate() attach one to a mesh with GL
+  DynamicMesh *dynamic;
+
+  // simplified index buffers, drawn indexed when not NULL
+  LodChain *lods;
+  GLuint ibo;
+
+  // level of the current draw, and the screen space error it may have
+  int lodIndex;
+  float lodPixels;
+
+  // instanced draws of GpuCuller, the model matrices are read from
+  // a buffer texture at the index of a per instance attribute
+  bool instanced;
+  GLint uniInstances;
+
   // aabb
   vec3 min, max;
 
   mat4 model, view, projection;
 
+  // false for CPU only meshes, e.g. for SoftRaster without a GL context
+  bool hasGL;
+
   /* Constructors */
-  Mesh(const string);
+  Mesh(const string, bool withGL = true);
   ~Mesh();
 
   /* Member functions */
   void loadObj(const string);
   void initBuffers();
+  void expandFaces(GLfloat *, GLfloat *, GLfloat *);
   void initShader();
   void initUniform();
-  void draw(mat4, mat4, mat4, vec3, vec3, vec3, int, int);
+  void draw(mat4, mat4, mat4, vec3, vec3, vec3, int, int, int unitHeight = -1);
+  bool useProgram(mat4, mat4, mat4, vec3, vec3, vec3, int, int,
+                  int unitHeight = -1);
+  void drawGeometry(GLenum mode = GL_TRIANGLES);
   void setTexture(GLuint &, int, const string, FREE_IMAGE_FORMAT);
-
+  void setCluster(LightCluster *);
+  void setShadow(ShadowCube *);
+  void setParallax(bool);
+  void setPacked(bool);
+  void setDisplacement(bool);
+  void setInstanced(bool);
+  void setInstanceIds(GLuint);
+  string shaderDefines();
+  void buildLods();
+  void initLodBuffers();
+  void selectLod(mat4, mat4, mat4);
+  int triangleCount();
+
+  void setDynamic(bool);
+  void transform(mat4);
   void translate(vec3);
   void scale(vec3);
   void rotate(vec3);
@@ -86,14 +163,48 @@ public:
   GLuint vboVtxs, vboUvs, vboNormals, vboTangents, vboBitangents;
   GLuint vao;
   GLuint shader;
+  int program;
   GLuint tboBase, tboNormal, tboHeight;
   GLint uniModel, uniView, uniProjection;
   GLint uniEyePoint, uniLightColor, uniLightPosition;
   GLint uniTexBase, uniTexNormal, uniTexHeight;
 
+  // shading level, see ShadingLod
+  float lodLevel;
+  GLint uniLodLevel;
+
+  // clustered lighting, disabled when cluster is NULL
+  LightCluster *cluster;
+  GLint uniClusterLights, uniClusterGrid, uniClusterIndices;
+  GLint uniClusterDims, uniClusterDepth, uniClusterViewport;
+
+  // cube shadow maps of the point light, disabled when shadow is NULL
+  ShadowCube *shadow;
+  GLint uniShadowStatic, uniShadowDynamic, uniShadowLight;
+
+  // the height map is the alpha channel of the normal map
+  bool packed;
+
+  // tessellated and displaced by the height map instead of POM, edges are
+  // split to about tessPixels on screen, see tcsDisplace.glsl
+  bool displaced;
+  float tessPixels;
+  GLint uniViewport, uniTessPixels;
+
+  // object units per uv unit, the displacement depth scales with it
+  float uvToWorld;
+  GLint uniUvToWorld;
+
+  // normal and height maps paged in from disk, disabled when vt is NULL
+  VirtualTexture *vt;
+  GLint uniVtIndirection, uniVtPhysical, uniVtSize, uniVtPage, uniVtBias;
+
   mat4 model, view, projection;
 
-  Quad();
+  // false for CPU only quads, e.g. for SoftRaster without a GL context
+  bool hasGL;
+
+  Quad(bool withGL = true);
   ~Quad();
 
   void initData();
@@ -101,14 +212,29 @@ public:
   void initShader();
   void initUniform();
   void draw(mat4, mat4, mat4, vec3, vec3, vec3, int, int, int);
+  void drawGeometry(GLenum mode = GL_TRIANGLES);
   void setTexture(GLuint &, int, const string, FREE_IMAGE_FORMAT);
+  void setCluster(LightCluster *);
+  void setShadow(ShadowCube *);
+  void setVirtualTexture(VirtualTexture *);
+  void setPacked(bool);
+  void setDisplacement(bool);
+  string shaderDefines();
 };
 
 string readFile(const string);
+void triangleTangent(vec3, vec3, vec3, vec2, vec2, vec2, vec3 &, vec3 &);
 void printLog(GLuint &);
 GLint myGetUniformLocation(GLuint &, string);
 GLuint buildShader(string, string);
 GLuint compileShader(string, GLenum);
 GLuint linkShader(GLuint, GLuint);
+GLuint submitShader(string, GLenum, string defines = "");
+GLuint submitProgram(vector<GLuint> &, vector<string> varyings = {});
+bool checkShader(GLuint, string);
+bool checkProgram(GLuint);
+bool hasExtension(const string);
 void drawBox(vec3, vec3);
 void drawPoints(vector<Point> &);
+
+#endif
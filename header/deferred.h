@@ -0,0 +1,69 @@
+#ifndef DEFERRED_H
+#define DEFERRED_H
+
+#include "common.h"
+
+/* Uniform locations of a G-buffer program */
+typedef struct {
+  GLint model, view, projection;
+  GLint eyePoint, lightPosition;
+  GLint texBase, texNormal, texHeight;
+  GLint materialId;
+} GBufferUniforms;
+
+/* Material ids stored in the G-buffer, 0 means nothing was drawn */
+enum { MATERIAL_NONE = 0, MATERIAL_NORMAL_MAP = 1, MATERIAL_POM = 2 };
+
+/* Deferred shading
+ *
+ * A G-buffer pass writes
+ *   texAlbedo: RGBA8,   albedo and material id
+ *   texNormal: RGBA16F, octahedral normal and self-shadow factor
+ *   texDepth:  DEPTH24
+ * POM surfaces resolve their uv displacement in this pass,
+ * then a full-screen lighting pass shades every pixel exactly once.
+ */
+class GBuffer {
+public:
+  int width, height;
+
+  GLuint fbo;
+  GLuint texAlbedo, texNormal, texDepth;
+  int unitAlbedo, unitNormal, unitDepth;
+
+  // viewport to restore after the G-buffer pass
+  GLint viewport[4];
+
+  // empty vao for the full-screen triangle
+  GLuint vaoScreen;
+
+  GLuint shaderMesh, shaderPOM, shaderLight;
+  int programMesh, programPOM, programLight;
+  GBufferUniforms uniMesh, uniPOM;
+  GLint uniAlbedo, uniNormal, uniDepth, uniInvViewProj;
+  GLint uniEyePoint, uniLightColor, uniLightPosition;
+
+  // clustered lighting, disabled when cluster is NULL
+  LightCluster *cluster;
+  GLint uniClusterLights, uniClusterGrid, uniClusterIndices;
+  GLint uniClusterDims, uniClusterDepth, uniClusterViewport;
+
+  GBuffer(int, int);
+  ~GBuffer();
+
+  void initBuffers();
+  void initShader();
+  void initUniform();
+  void setCluster(LightCluster *);
+
+  void begin();
+  void drawMesh(Mesh *, mat4, mat4, mat4, int, int);
+  void drawQuad(Quad *, mat4, mat4, mat4, vec3, vec3, int, int, int);
+  void end();
+  void light(mat4, mat4, vec3, vec3, vec3);
+
+private:
+  void locate(GLuint, GBufferUniforms &, bool);
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef DYNAMIC_MESH_H
+#define DYNAMIC_MESH_H
+
+#include "common.h"
+
+/* Vertices of a mesh edited every frame, with partial uploads
+ *
+ * Positions and normals are kept as structures of arrays in the order of
+ * the mesh's vertex buffers (the face soup, or the welded vertices of
+ * its LOD chain), so a transform runs 8 vertices at a time with simd8.h,
+ * split over the thread pool above parallelGrain vertices. Edits grow a
+ * dirty range and upload() sends only that range with glBufferSubData.
+ *
+ * Once attached, the mesh's buffers belong to the DynamicMesh. The one
+ * a mesh owns (Mesh::setDynamic) is edited through Mesh::transform, which
+ * keeps vertices / faceNormals in sync; edits made here directly leave
+ * them behind.
+ */
+class DynamicMesh {
+public:
+  Mesh *mesh;
+  size_t nOfVtxs;
+
+  vector<float> x, y, z;
+  vector<float> nx, ny, nz;
+
+  // vertices [dirtyFirst, dirtyLast) changed since the last upload
+  size_t dirtyFirst, dirtyLast;
+
+  // interleaved copy of the dirty range, reused between uploads
+  vector<vec3> staging;
+
+  size_t parallelGrain;
+
+  // totals since the start
+  int nOfUploads;
+  size_t uploadedBytes;
+
+  DynamicMesh(Mesh *);
+
+  void transform(mat4, size_t first = 0, size_t count = SIZE_MAX);
+  void transformScalar(mat4, size_t first = 0, size_t count = SIZE_MAX);
+  void upload();
+  void uploadAll();
+
+private:
+  void transformRange(mat4 &, mat3 &, size_t, size_t);
+  void markDirty(size_t, size_t);
+  void uploadRange(size_t, size_t, bool);
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef DYNAMIC_RES_H
+#define DYNAMIC_RES_H
+
+#include "common.h"
+
+/* Dynamic resolution driven by the measured GPU time of the scene
+ *
+ * The scene is rendered into the lower left scale x scale part of an
+ * offscreen target as large as the window, so changing the scale never
+ * reallocates anything. GL_TIME_ELAPSED queries time each frame and are
+ * read a few frames later, like FragmentCounter. Every interval frames
+ * the average time is compared with the target: outside of the
+ * hysteresis band the scale moves by the square root of the ratio, as
+ * the cost is per pixel, going down at once and up at most step at a
+ * time. end() upscales to the window with a sharpening filter.
+ */
+class DynamicResolution {
+public:
+  static const int nOfQueries = 4;
+
+  int width, height;
+
+  GLuint fbo, tboColor, rboDepth;
+  int unitColor;
+
+  GLuint queries[nOfQueries];
+  bool issued[nOfQueries];
+  int current;
+
+  // milliseconds
+  float targetTime, gpuTime;
+
+  // fraction of the window's width and height
+  float scale, minScale, maxScale;
+
+  // relative band around the target where the scale is kept, and the
+  // largest increase per adjustment
+  float hysteresis, step;
+  float sharpness;
+
+  int interval;
+  int nOfSamples;
+  double sumTime;
+
+  GLint viewport[4];
+
+  // empty vao for the full-screen triangle
+  GLuint vaoScreen;
+
+  GLuint shader;
+  int program;
+  GLint uniSource, uniScale, uniTexel, uniSharpness;
+
+  DynamicResolution(int, int, float);
+  ~DynamicResolution();
+
+  void initShader();
+  void begin();
+  void end();
+
+  int renderWidth() { return glm::max(int(width * scale), 1); }
+  int renderHeight() { return glm::max(int(height * scale), 1); }
+
+private:
+  void adjust();
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef FRAME_SNAPSHOT_H
+#define FRAME_SNAPSHOT_H
+
+#include "common.h"
+#include <atomic>
+
+// fences of frames whose GPU work may still be running
+#define NUM_LATENCY_FENCES 8
+
+/* What a frame is drawn from, sampled by the input thread */
+typedef struct {
+  mat4 view, projection;
+  vec3 eyePoint, lightPosition;
+
+  // transform of the mesh, see --shadow-spin
+  float meshAngle;
+
+  // glfwGetTime() when the input was sampled
+  double inputTime;
+
+  // key requests, applied by the GL thread when they change
+  GLenum polygonMode;
+  int nOfRebuilds, nOfStatsPrints, nOfRecordToggles;
+} FrameSnapshot;
+
+/* Single producer, single consumer triple buffer
+ *
+ * The writer fills write() and publishes it, the reader takes the latest
+ * published value with acquire() and reads it until the next one; neither
+ * side ever waits for the other, values the reader was too slow for are
+ * overwritten. The middle slot's index carries a bit telling whether it
+ * is newer than what the reader has.
+ */
+template <typename T> class TripleBuffer {
+public:
+  static const int FRESH = 4;
+
+  T slots[3];
+  int back, front;
+  std::atomic<int> middle;
+
+  TripleBuffer() : back(0), front(1), middle(2) {}
+
+  T &write() { return slots[back]; }
+  void publish() { back = middle.exchange(back | FRESH) & 3; }
+
+  // false if nothing was published since the last call
+  bool acquire() {
+    if (!(middle.load() & FRESH)) {
+      return false;
+    }
+    front = middle.exchange(front) & 3;
+    return true;
+  }
+  const T &read() const { return slots[front]; }
+};
+
+/* Time from sampling the input a frame was drawn with until the GPU has
+ * finished the frame, the display's scan-out not included
+ *
+ * A fence is inserted after each swap and polled without waiting on the
+ * following frames. GL thread only. The gain of --render-thread depends
+ * on the driver and the display, so it has to be read off the report of
+ * two runs, with and without it.
+ */
+class LatencyMeter {
+public:
+  GLsync fences[NUM_LATENCY_FENCES];
+  double inputTimes[NUM_LATENCY_FENCES];
+  int first, count;
+
+  // since the last call of average()
+  double sum;
+  int nOfFrames;
+
+  LatencyMeter();
+  ~LatencyMeter();
+
+  void submitted(double);
+  void poll();
+  double average();
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include "common.h"
+#include <unordered_map>
+
+// texture units tracked by GLStateCache::bindTexture
+#define NUM_STATE_UNITS 32
+
+// uniform locations above this are always uploaded
+#define MAX_CACHED_UNIFORM 256
+
+/* A uniform's last value, size 0 when unknown */
+typedef struct {
+  int size;
+  float v[16];
+} UniformValue;
+
+/* Skips program, VAO, texture and uniform changes that change nothing
+ *
+ * Every program and VAO bind goes through useProgram() / bindVao(), so
+ * the cache always knows what is bound. Textures are tracked per unit
+ * for the binds made through bindTexture(), which never changes the
+ * active unit when it skips; a unit bound through it must not be bound
+ * directly to anything else. Uniform values are kept per program and
+ * location; a location set through the cache must only ever be set
+ * through it. Arrays are not cached and are set directly, e.g. the cull
+ * planes or the per view matrices of MultiView. The changes issued and
+ * the ones elided are counted in frameStats.
+ *
+ * invalidate() forgets the bindings, main calls it at the start of each
+ * frame; programs deleted by ShaderQueue and VAOs deleted through
+ * deleteVaos() are forgotten at once, as GL may reuse their names.
+ * With enabled false every call goes through, to compare.
+ */
+class GLStateCache {
+public:
+  bool enabled;
+
+  GLuint program, vao;
+  GLenum targets[NUM_STATE_UNITS];
+  GLuint textures[NUM_STATE_UNITS];
+
+  std::unordered_map<GLuint, vector<UniformValue>> uniforms;
+  vector<UniformValue> *current;
+
+  GLStateCache();
+
+  void invalidate();
+
+  void useProgram(GLuint);
+  void bindVao(GLuint);
+  void bindTexture(int, GLenum, GLuint);
+
+  void uniform1i(GLint, int);
+  void uniform1f(GLint, float);
+  void uniform2f(GLint, float, float);
+  void uniform3i(GLint, int, int, int);
+  void uniform3f(GLint, vec3);
+  void uniform4f(GLint, vec4);
+  void uniformMatrix4f(GLint, mat4 &);
+
+  void forgetProgram(GLuint);
+  void deleteVaos(GLsizei, GLuint *);
+
+private:
+  bool same(GLint, int, const float *);
+};
+
+extern GLStateCache glState;
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef GPU_CULL_H
+#define GPU_CULL_H
+
+#include "common.h"
+
+// results in flight per LOD level
+#define NUM_CULL_SLOTS 3
+
+/* Visible instances of one LOD level of a group, written by transform
+ * feedback into a ring of buffers so a result is never overwritten
+ * while it may still be drawn
+ */
+typedef struct {
+  // R32UI instance indices
+  GLuint vboVisible[NUM_CULL_SLOTS];
+
+  // GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, frame they were issued
+  GLuint queries[NUM_CULL_SLOTS];
+  int frames[NUM_CULL_SLOTS];
+
+  // the newest result read back, drawn without indirect draws
+  int drawSlot, drawFrame;
+  GLuint drawCount;
+
+  // one draw command per slot, the query writes its instance count
+  GLuint bufIndirect;
+
+  // object space error of the level and of the next coarser one
+  float errorMin, errorMax;
+} CullLevel;
+
+/* All instances of one mesh */
+typedef struct {
+  Mesh *mesh;
+  int nOfInstances;
+
+  // 5 RGBA32F texels per instance: model matrix, bounding sphere
+  GLuint vboInstances, tboInstances;
+  GLuint vao;
+
+  vector<CullLevel> levels;
+} CullGroup;
+
+/* Frustum and LOD culling of instances on the GPU (GL 3.3)
+ *
+ * Instance data stays on the GPU. Every frame each instance is drawn as
+ * a point through a vertex shader testing its bounding sphere against
+ * the frustum planes and picking its LOD like Mesh::selectLod(), and a
+ * geometry shader emitting its index only for the level of the pass.
+ * Transform feedback captures the compacted index lists, which the
+ * instanced draws read through an instanced vertex attribute.
+ *
+ * With GL_ARB_draw_indirect and GL_ARB_query_buffer_object the visible
+ * count is written into the draw command on the GPU and this frame's
+ * lists are drawn. Otherwise the count is read back asynchronously and
+ * the newest list whose count has arrived (usually 1 - 2 frames old) is
+ * drawn, so objects entering the view may show up a frame late.
+ */
+class GpuCuller {
+public:
+  vector<CullGroup> groups;
+
+  GLuint shader;
+  int program;
+  GLint uniPlanes, uniEyePoint, uniLodScale, uniErrorRange;
+
+  bool indirect;
+  int frame, current;
+  int unitInstances;
+
+  // sums over the levels of the results read back last
+  int nOfVisible, nOfTriangles;
+
+  GpuCuller();
+  ~GpuCuller();
+
+  void initShader();
+  void addGroup(Mesh *, vector<mat4> &);
+  void cull(mat4, mat4);
+  void draw(mat4, mat4, vec3, vec3, vec3, int, int, int);
+
+private:
+  void readBack(CullLevel &);
+  void drawLevel(CullGroup &, int);
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef LOAD_BENCH_H
+#define LOAD_BENCH_H
+
+#include "common.h"
+#include <functional>
+
+// seconds each case is repeated for, after one untimed run
+#define BENCH_MIN_TIME 0.5
+
+/* One case, times are per iteration in ns */
+typedef struct {
+  string name;
+  long iterations;
+  double realTime, cpuTime;
+  double itemsPerSecond, bytesPerSecond;
+} BenchResult;
+
+/* Micro-benchmarks of loading and preprocessing, without a GL context
+ *
+ * Covers Mesh::loadObj, the face expansion of Mesh::initBuffers,
+ * Mesh::findAABB, the tangents of Quad::initData over every face of a
+ * mesh, the image decode and conversion of setTexture, and readFile of
+ * the shaders. The meshes are the ones in ./mesh plus synthetic grids of
+ * 16K faces up to maxFaces, in steps of 4x. Each case runs until it took
+ * minTime; the results are printed and written to a file in the JSON
+ * layout of Google Benchmark (--benchmark_format=json), so its compare.py
+ * can diff two runs.
+ */
+class LoadBench {
+public:
+  size_t maxFaces;
+  double minTime;
+  vector<BenchResult> results;
+
+  LoadBench(size_t maxFaces, double minTime = BENCH_MIN_TIME);
+
+  void run();
+  bool write(const string);
+
+  // fn runs one iteration, of items things and bytes bytes
+  void measure(const string, size_t items, size_t bytes,
+               std::function<void()> fn);
+
+private:
+  void benchMesh(const string name, const string fileName);
+  void benchTextures();
+  void benchShaders();
+};
+
+vector<string> listFiles(const string dir, const string suffix);
+bool writeGridObj(const string, size_t nOfFaces);
+
+#endif
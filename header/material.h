@@ -0,0 +1,40 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include "common.h"
+
+/* Materials as layers of texture arrays
+ *
+ * The base color, normal and height maps of a material go into the
+ * same layer of three GL_TEXTURE_2D_ARRAYs, rescaled to the size of the
+ * arrays, so the index of a material is all a draw needs to select its
+ * textures. Draws of any material then share one set of bindings and
+ * can be batched, see MeshArena::setMaterials().
+ */
+class MaterialArray {
+public:
+  int width, height, maxLayers, nOfLayers;
+  int nOfLevels;
+
+  // opengl data
+  GLuint tboBase, tboNormal, tboHeight;
+  int unitBase, unitNormal, unitHeight;
+
+  // base color file of each layer
+  vector<string> names;
+
+  // layers were added, the mip levels are built by the next bind()
+  bool mipmapsDirty;
+
+  MaterialArray(int, int, int);
+  ~MaterialArray();
+
+  int add(const string, const string, const string, FREE_IMAGE_FORMAT);
+  void bind();
+
+private:
+  void initArray(GLuint &);
+  bool loadLayer(GLuint, int, const string, FREE_IMAGE_FORMAT);
+};
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef MESH_ARENA_H
+#define MESH_ARENA_H
+
+#include "common.h"
+#include "material.h"
+#include "meshLod.h"
+#include <map>
+
+/* First-fit allocator of ranges of a buffer, in elements,
+ * freed ranges are merged with their neighbours
+ */
+class RangeAllocator {
+public:
+  GLuint capacity;
+
+  // free ranges, offset -> size
+  std::map<GLuint, GLuint> freeRanges;
+
+  RangeAllocator(GLuint cap = 0);
+
+  bool alloc(GLuint, GLuint &);
+  void free(GLuint, GLuint);
+  void grow(GLuint);
+};
+
+/* A vertex of the arena, interleaved */
+typedef struct {
+  vec3 pos;
+  vec2 uv;
+  vec3 n;
+} ArenaVertex;
+
+/* A mesh packed into the arena */
+typedef struct {
+  Mesh *mesh;
+  GLuint baseVertex, nOfVertices;
+  GLuint firstIndex, nOfIndices;
+
+  // relative to firstIndex, a single level for meshes without LODs
+  vector<LodLevel> levels;
+
+  bool alive;
+} ArenaMesh;
+
+/* glMultiDrawElementsIndirect command */
+typedef struct {
+  GLuint count, instanceCount, firstIndex;
+  GLint baseVertex;
+  GLuint baseInstance;
+} DrawElementsCommand;
+
+/* Every mesh in one vertex / index buffer, drawn with one call
+ *
+ * Meshes are packed into a shared vertex arena and index arena by
+ * sub-allocation (buffers grow by doubling), so one VAO serves them
+ * all. Draws are collected during the frame, then end() uploads
+ * 5 texels per draw (model matrix, material) to a buffer texture and
+ * the commands to an indirect buffer, and submits everything with a
+ * single glMultiDrawElementsIndirect.
+ *
+ * A draw finds its data through the instanced attribute of the
+ * INSTANCED shader variant: baseInstance of its command is its index.
+ * Without GL_ARB_multi_draw_indirect the commands are issued one by one
+ * with glDrawElementsBaseVertex, still from the shared VAO.
+ *
+ * With a MaterialArray the textures are sampled from the layer of each
+ * draw's material, so draws of different materials stay in one batch.
+ */
+class MeshArena {
+public:
+  vector<ArenaMesh> meshes;
+  RangeAllocator vertexRanges, indexRanges;
+
+  // opengl data
+  GLuint vboVertices, iboIndices, vboIds, vboDraws, tboDraws;
+  GLuint vao, bufCommands;
+  GLuint nOfIds;
+
+  // GL_ARB_multi_draw_indirect, may be turned off to compare
+  bool multiDraw;
+
+  // draws of the current frame
+  vector<DrawElementsCommand> commands;
+  vector<vec4> drawData;
+
+  // textures of the draws' materials, the textures bound by the caller
+  // are used for every draw when NULL
+  MaterialArray *materials;
+
+  GLuint shader;
+  int program;
+  GLint uniView, uniProjection, uniEyePoint, uniLightColor, uniLightPosition;
+  GLint uniTexBase, uniTexNormal, uniInstances;
+  int unitDraws;
+
+  // draw calls of the last end(), triangles of the current frame
+  int nOfCalls, nOfTriangles;
+
+  MeshArena(bool allowMultiDraw = true);
+  ~MeshArena();
+
+  void initShader();
+  void setMaterials(MaterialArray *);
+  string shaderDefines();
+  int add(Mesh *);
+  void remove(int);
+
+  void begin();
+  void draw(int, mat4, mat4, mat4, vec4 tint = vec4(1.f), int material = 0);
+  void end(mat4, mat4, vec3, vec3, vec3, int, int);
+
+private:
+  void initVao();
+  void growVertices(GLuint);
+  void growIndices(GLuint);
+  void growIds(GLuint);
+};
+
+#endif
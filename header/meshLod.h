@@ -0,0 +1,74 @@
+#ifndef MESH_LOD_H
+#define MESH_LOD_H
+
+#include "common.h"
+
+/* One level of a LOD chain, a range of the shared index buffer */
+typedef struct {
+  // in indices
+  GLuint offset, count;
+
+  // object space distance between this level and the full mesh
+  float error;
+} LodLevel;
+
+/* Symmetric 4x4 error quadric, sum of squared distances to planes */
+typedef struct {
+  double a[10];
+
+  // total area of the planes, to turn the error back into a distance
+  double weight;
+} Quadric;
+
+/* A chain of simplified index buffers of a mesh
+ *
+ * The obj data is welded into indexed vertices, one per distinct
+ * v/vt/vn triple, and shared by every level.
+ * Levels are made with half-edge collapses ordered by quadric error
+ * (Garland & Heckbert), so no new vertices are ever created.
+ *
+ * Seams are preserved: a collapse u -> v is only allowed when every
+ * attribute copy of u sits on a triangle of the edge, so it can be
+ * moved onto the matching copy of v. Open borders get penalty planes.
+ *
+ * build() only touches CPU data and may run on any thread.
+ */
+class LodChain {
+public:
+  // welded vertices
+  vector<vec3> vtxs;
+  vector<vec2> uvs;
+  vector<vec3> nms;
+
+  // position (obj vertex) of each welded vertex
+  vector<GLuint> vtxPos;
+
+  // every level, finest first
+  vector<GLuint> indices;
+  vector<LodLevel> levels;
+
+  // each level keeps at most ratio of the triangles of the previous one
+  float ratio;
+  int maxLevels, minTriangles;
+
+  LodChain();
+
+  void build(Mesh *);
+
+private:
+  vector<vec3> positions;
+  vector<Quadric> quadrics;
+  vector<uvec3> tris;
+  vector<bool> alive;
+  vector<vector<GLuint>> posTris;
+  vector<int> versions;
+  int nOfAlive;
+
+  void weld(Mesh *);
+  void initQuadrics();
+  bool collapse(GLuint, GLuint);
+  float cost(GLuint, GLuint);
+  void emitLevel(float);
+};
+
+#endif
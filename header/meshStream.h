@@ -0,0 +1,124 @@
+#ifndef MESH_STREAM_H
+#define MESH_STREAM_H
+
+#include "common.h"
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <unordered_set>
+
+// triangles of a full cluster, the size of a slot of the GPU pool
+#define CLUSTER_TRIANGLES 4096
+
+/* Header of a clustered mesh file
+ *
+ * The header is followed by the clusters, each a triangle soup of
+ * McVertex ready to be copied into a vertex buffer, and by the table of
+ * clusters at tableOffset.
+ */
+typedef struct {
+  char magic[4];
+  uint32_t nOfClusters;
+  uint64_t tableOffset;
+  float min[3], max[3];
+} McHeader;
+
+/* An entry of the table of clusters */
+typedef struct {
+  uint64_t offset;
+  uint32_t nOfVertices;
+  float min[3], max[3];
+} McCluster;
+
+/* An interleaved vertex as stored and uploaded */
+typedef struct {
+  float pos[3];
+  float uv[2];
+  float n[3];
+} McVertex;
+
+/* A cluster read by a loader thread */
+typedef struct {
+  int id;
+  vector<McVertex> vertices;
+} StreamedCluster;
+
+/* Split an OBJ into clusters of at most CLUSTER_TRIANGLES triangles
+ * without loading it: positions, uvs and normals are first written to
+ * temporary files next to outFile and mapped, then the faces are
+ * streamed into the cells of a grid x grid x grid grid over the bounds,
+ * each cell buffered in memory / grid^3 bytes and spilled to another
+ * temporary file when full. Each cell is finally cut into clusters.
+ */
+bool bakeMeshClusters(const string, const string, int grid = 16,
+                      size_t memory = (size_t)256 << 20);
+
+/* Streams the clusters of a baked file through a fixed pool of slots
+ *
+ * The file is mapped with mmap. A single vertex buffer holds nOfSlots
+ * clusters. Each update() culls the clusters' boxes against the frustum;
+ * visible clusters that are not resident are read from the mapping on the
+ * thread pool, nearest first, and uploaded a few per frame into free
+ * slots or slots of the least recently visible (then farthest)
+ * clusters. draw() issues the resident visible clusters with a single
+ * glMultiDrawArrays.
+ */
+class MeshStreamer {
+public:
+  McHeader header;
+  vector<McCluster> clusters;
+
+  // the mapped file
+  int fd;
+  uint8_t *data;
+  size_t dataSize;
+
+  // GPU pool
+  GLuint vao, vbo;
+  int nOfSlots;
+  vector<int> slotClusters;
+
+  // per cluster: slot, -1 when not resident, last frame visible, and
+  // distance from the eye in the last update()
+  vector<int> clusterSlots;
+  vector<int> lastVisible;
+  vector<float> distances;
+
+  // clusters being read by the thread pool and clusters read
+  std::unordered_set<int> pending;
+  std::deque<std::future<void>> loads;
+  std::mutex arrivedMutex;
+  vector<StreamedCluster> arrived;
+  int maxPending, maxUploads;
+
+  int frame;
+
+  // the draws of the last update(), first vertex and count per cluster
+  vector<GLint> firsts;
+  vector<GLsizei> counts;
+
+  GLuint shader;
+  int program;
+  GLint uniModel, uniView, uniProjection;
+  GLint uniEyePoint, uniLightColor, uniLightPosition;
+  GLint uniTexBase, uniTexNormal;
+
+  // counts of the last update()
+  int nOfVisible, nOfResident, nOfUploaded;
+
+  MeshStreamer(const string, int slots = 128);
+  ~MeshStreamer();
+
+  bool valid() { return data != NULL; }
+
+  void initShader();
+  void update(mat4, mat4, mat4);
+  void draw(mat4, mat4, mat4, vec3, vec3, vec3, int, int);
+
+private:
+  int findSlot();
+  void request(int);
+};
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef MULTI_VIEW_H
+#define MULTI_VIEW_H
+
+#include "common.h"
+
+// views rendered by one pass, must match gsMultiView.glsl
+#define NUM_BATCH_VIEWS 8
+
+/* A camera and a light of a batch */
+typedef struct {
+  mat4 view, projection;
+  vec3 eye, light;
+} BatchView;
+
+/* Views of a text file, a line per view:
+ * eye.xyz target.xyz fovy(degrees) light.xyz, # starts a comment
+ */
+vector<BatchView> loadBatchViews(const string, float, float, float);
+
+/* n cameras on a circle around center looking at it, each with its own
+ * light position, for when no views are given
+ */
+vector<BatchView> orbitBatchViews(int, vec3, float, float, float, float,
+                                  float);
+
+/* Renders the POM quad from NUM_BATCH_VIEWS cameras in one pass
+ *
+ * The vertex shader of the quad only computes world positions, a
+ * geometry shader copies every triangle into each layer of a layered
+ * framebuffer with that layer's view projection, camera and light. The
+ * vertex work and draw calls are shared by all views of the pass,
+ * fragments are not.
+ *
+ * Every layer also has a framebuffer of its own, for reading it back and
+ * for rendering one view at a time to compare with.
+ */
+class MultiView {
+public:
+  int width, height;
+
+  // color and depth texture arrays, NUM_BATCH_VIEWS layers each
+  GLuint fbo, tboColor, tboDepth;
+  GLuint layerFbos[NUM_BATCH_VIEWS];
+
+  GLuint shader;
+  int program;
+  GLint uniModel, uniViewProjections, uniEyes, uniLights, uniNOfViews;
+  GLint uniLightColor, uniTexBase, uniTexNormal, uniTexHeight, uniLodLevel;
+
+  int nOfViews;
+
+  MultiView(int, int);
+  ~MultiView();
+
+  void initShader();
+  bool begin(vector<BatchView> &, int);
+  void drawQuad(Quad *, mat4, vec3, int, int, int);
+  void beginLayer(int);
+  void end();
+
+private:
+  GLint savedViewport[4];
+};
+
+#endif
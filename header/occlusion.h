@@ -0,0 +1,75 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include "common.h"
+
+/* An object of the draw list */
+typedef struct {
+  Mesh *mesh;
+  mat4 model;
+
+  // world space bounding box
+  vec3 min, max;
+
+  // result of the last OcclusionCuller::cull()
+  bool visible;
+} Instance;
+
+Instance makeInstance(Mesh *, mat4);
+
+/* An occluder triangle in the culler's window coordinates */
+typedef struct {
+  // edge functions a * x + b * y + c, inside >= 0
+  float edgeA[3], edgeB[3], edgeC[3];
+
+  // window depth plane a * x + b * y + c
+  float zA, zB, zC;
+
+  int x0, y0, x1, y1;
+} OccluderTriangle;
+
+/* Software occlusion culling with a CPU hierarchical depth buffer
+ *
+ * Occluders (world space triangles, e.g. walls or simplified LODs) are
+ * rasterized 8 pixels at a time into a small depth buffer, in parallel
+ * bands of rows. A max-depth pyramid is built on top of it, so the
+ * screen rectangle of a bounding box is tested against a few texels of
+ * the level where it spans 4 at most.
+ *
+ * A box is occluded when its nearest point is behind the farthest
+ * occluder depth of every texel it covers.
+ */
+class OcclusionCuller {
+public:
+  int width, height;
+
+  // level 0 is the depth buffer with rows of pitch (8-aligned) texels
+  int pitch;
+  vector<vector<float>> levels;
+  vector<ivec2> levelSizes;
+
+  // world space, 3 vertices per triangle
+  vector<vec3> occluders;
+  vector<OccluderTriangle> tris;
+
+  // counts of the last cull()
+  int nOfTested, nOfOutside, nOfOccluded;
+
+  OcclusionCuller(int, int);
+
+  void clearOccluders();
+  void addOccluder(Mesh *, mat4, float maxError = 0.f);
+
+  void render(mat4, mat4);
+  void cull(vector<Instance> &);
+
+private:
+  mat4 viewProjection;
+
+  bool setup(vec4 *, OccluderTriangle &);
+  void rasterRows(int, int);
+  void buildPyramid();
+  int test(vec3, vec3);
+};
+
+#endif
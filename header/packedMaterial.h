@@ -0,0 +1,40 @@
+#ifndef PACKED_MATERIAL_H
+#define PACKED_MATERIAL_H
+
+#include "common.h"
+#include <cstdint>
+
+// height scale of the POM shaders, the slopes of derived normals match it
+#define PACKED_DEPTH_SCALE 0.1f
+
+/* Tangent space normals of a depth map (white is deep, as the POM
+ * shaders read it) with a 3x3 Scharr filter, wrapping at the borders.
+ * Written as rgb into 4 byte texels in FreeImage order (FI_RGBA_*), rows
+ * bottom up; the alpha bytes are left alone. Rows are split over the
+ * thread pool, 8 texels at a time with simd8.h.
+ *
+ * The scalar version runs one texel at a time on the calling thread. The
+ * 8-wide one fuses multiplies and adds, so a byte may round to the other
+ * side of a step; compareDerivedNormals() counts how often.
+ */
+void deriveNormals(const uint8_t *, int, int, float, uint8_t *);
+void deriveNormalsScalar(const uint8_t *, int, int, float, uint8_t *);
+
+// both of the above on prefix_height.jpg, prints the bytes that differ
+// and by how much, true if none is off by more than one step
+bool compareDerivedNormals(const string);
+
+/* prefix_normal.jpg (rgb) and prefix_height.jpg (a) of a material as one
+ * RGBA8 image; the normals are derived from the height map when there
+ * is no normal map, or always with derive.
+ */
+bool packMaterial(const string, vector<uint8_t> &, int &, int &,
+                  bool derive = false);
+
+/* Load the packed texture of a material into tbo on unit, from
+ * prefix_packed.png (prefix_derived.png with derive), packed and written
+ * first when it is missing or older than the sources.
+ */
+bool loadPackedMaterial(GLuint &, int, const string, bool derive = false);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef PREPASS_H
+#define PREPASS_H
+
+#include "common.h"
+
+/* Depth-only pre-pass
+ *
+ * Lays down the depth of the scene with a trivial program,
+ * then the main pass runs with GL_EQUAL and depth writes off,
+ * so the expensive fragment shaders run once per visible pixel.
+ */
+class DepthPrepass {
+public:
+  GLuint shader;
+  int program;
+  GLint uniModel, uniView, uniProjection;
+
+  DepthPrepass();
+  ~DepthPrepass();
+
+  void initShader();
+  void begin();
+  void drawMesh(Mesh *, mat4, mat4, mat4);
+  void drawQuad(Quad *, mat4, mat4, mat4);
+  void end();
+  void beginMain();
+  void endMain();
+};
+
+/* Counts the samples that pass the depth test in a pass
+ *
+ * Results are read from a ring of occlusion queries a few frames later,
+ * so counting never waits for the gpu.
+ */
+class FragmentCounter {
+public:
+  static const int nOfQueries = 4;
+
+  GLuint queries[nOfQueries];
+  bool issued[nOfQueries];
+  int current;
+
+  // samples per pixel of the framebuffer (e.g. with MSAA)
+  GLint nOfSamples;
+
+  // latest available result
+  GLuint64 shadedFragments;
+
+  FragmentCounter();
+  ~FragmentCounter();
+
+  void begin();
+  void end();
+};
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include "common.h"
+#include <atomic>
+#include <deque>
+#include <future>
+
+// frames between glReadPixels and mapping its buffer
+#define NUM_CAPTURE_SLOTS 3
+
+/* Records the back buffer into numbered image files without stalling
+ *
+ * capture() only queues glReadPixels into a pixel pack buffer and a
+ * fence. The buffer is mapped once every other slot has been captured,
+ * NUM_CAPTURE_SLOTS - 1 frames later by default, when the GPU is long
+ * done with it. The pixels are copied out and the thread pool encodes
+ * them through FreeImage, PNG or JPEG by the file name.
+ * When the encoders fall behind, capture() waits for the oldest one
+ * rather than queueing frames without bound.
+ */
+class FrameRecorder {
+public:
+  // printf pattern of the file names, e.g. "/tmp/frame_%05d.png"
+  string pattern;
+  FREE_IMAGE_FORMAT type;
+  int width, height, pitch;
+
+  // images in flight, a ring of slots
+  vector<GLuint> pbos;
+  vector<GLsync> fences;
+  vector<int> frames;
+  int slot;
+
+  std::deque<std::future<void>> encodes;
+  int maxEncodes;
+
+  bool recording;
+
+  // frames captured, written by the encoders, and that failed to write
+  int nOfFrames;
+  std::atomic<int> nOfWritten, nOfFailed;
+
+  FrameRecorder(const string, int, int, int slots = NUM_CAPTURE_SLOTS);
+  ~FrameRecorder();
+
+  bool valid() { return type != FIF_UNKNOWN; }
+
+  void capture(GLuint fbo = 0);
+  void flush();
+
+private:
+  void readSlot(int);
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include "common.h"
+#include <cstdint>
+
+// fields of a sort key, from the most significant bits
+#define KEY_PASS_SHIFT 56     // 8 bits
+#define KEY_PROGRAM_SHIFT 40  // 16 bits
+#define KEY_MATERIAL_SHIFT 24 // 16 bits
+#define KEY_DEPTH_BITS 24
+
+/* A recorded draw of a mesh or a quad */
+typedef struct {
+  Mesh *mesh;
+  Quad *quad;
+  mat4 model;
+  float lodLevel;
+  int unitBaseColor, unitNormal, unitHeight;
+} RenderItem;
+
+/* Draws recorded with a 64 bit key and submitted sorted
+ *
+ * The key orders by pass, then program, then material (anything that is
+ * bound per draw, e.g. the VAO), then depth, front to back. flush()
+ * sorts the keys with an 8 bit LSD radix sort, skipping the bytes every
+ * key shares, and draws in that order through Mesh::draw / Quad::draw,
+ * so consecutive draws of a program only upload what changed (see
+ * GLStateCache).
+ */
+class RenderQueue {
+public:
+  vector<RenderItem> items;
+
+  // key and index of each item, sorted by flush()
+  vector<uint64_t> keys, keysTmp;
+  vector<uint32_t> order, orderTmp;
+
+  // triangles of the last flush()
+  int nOfTriangles;
+
+  RenderQueue();
+
+  static uint64_t makeKey(int, GLuint, int, float);
+
+  void add(uint64_t, Mesh *, mat4, int, int, int);
+  void add(uint64_t, Quad *, mat4, int, int, int);
+  void sort();
+  void flush(mat4, mat4, vec3, vec3, vec3);
+  void clear();
+};
+
+#endif
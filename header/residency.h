@@ -0,0 +1,86 @@
+#ifndef RESIDENCY_H
+#define RESIDENCY_H
+
+#include "common.h"
+#include <deque>
+#include <future>
+#include <mutex>
+
+/* A texture whose finest mip levels may be evicted */
+typedef struct {
+  // stays bound to its unit, updates never touch other units
+  GLuint tbo;
+  int unit;
+
+  // cleared when a restream could not read it, no more levels come back
+  string file;
+  FREE_IMAGE_FORMAT type;
+  int width, height, nOfLevels;
+
+  // finest level resident, levels up to keepLevel are never evicted
+  int baseLevel, keepLevel;
+
+  // finest level asked for since the last update(), and when
+  int wantedLevel, lastUsed;
+
+  // a finer level is being decoded
+  bool streaming;
+} ResidentTexture;
+
+/* A mip level decoded by a loader thread */
+typedef struct {
+  int id, level;
+  int width, height;
+  vector<BYTE> texels;
+} StreamedLevel;
+
+/* Texture memory budget with LRU eviction of high mips
+ *
+ * Textures are uploaded with their full mip chain and draws report the
+ * finest level they need with use(). When the resident bytes exceed the
+ * budget, the finest level of the least recently used texture is
+ * released: GL_TEXTURE_BASE_LEVEL moves up and the level is redefined
+ * empty, so the driver can free it. Low mips stay resident, sampling
+ * just gets blurrier.
+ *
+ * A texture used with a finer level than resident gets it back one level
+ * at a time, coarse to fine: the file is decoded and downsampled on the
+ * thread pool, and update() uploads the level. Levels are only streamed
+ * when the budget allows, after evicting textures not used last frame.
+ */
+class TextureResidency {
+public:
+  vector<ResidentTexture> textures;
+
+  // bytes, in flight levels are counted as resident
+  size_t budget, residentBytes;
+
+  // levels of at most keepSize texels are never evicted
+  int keepSize;
+  int maxStreams;
+
+  int frame;
+
+  // totals since the start
+  int nOfEvictions, nOfRestreams;
+
+  std::mutex arrivedMutex;
+  vector<StreamedLevel> arrived;
+  std::deque<std::future<void>> loads;
+
+  TextureResidency(size_t);
+  ~TextureResidency();
+
+  int load(GLuint &, int, const string, FREE_IMAGE_FORMAT);
+  void use(int, int level = 0);
+  int levelFor(int, float);
+  void update();
+
+private:
+  size_t levelBytes(ResidentTexture &, int);
+  void reportBytes(ResidentTexture &);
+  bool evictOne(bool);
+  void restream(int);
+};
+
+#endif
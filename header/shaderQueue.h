@@ -0,0 +1,104 @@
+#ifndef SHADER_QUEUE_H
+#define SHADER_QUEUE_H
+
+#include "common.h"
+#include <functional>
+#include <map>
+
+// some GLEW versions do not know GL_KHR_parallel_shader_compile yet,
+// the ARB version of the extension uses the same value
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+/* One shader stage of a program, e.g. {GL_VERTEX_SHADER, "./shader/vs.glsl"} */
+typedef struct {
+  GLenum type;
+  string fileName;
+} ShaderStage;
+
+/* A program managed by the ShaderQueue */
+typedef struct {
+  vector<ShaderStage> stages;
+
+  // inserted after the #version line of every stage, e.g. "#define X\n"
+  string defines;
+
+  // outputs captured by transform feedback, set before linking
+  vector<string> varyings;
+
+  // the program in use, 0 until the first build is ready
+  GLuint exe;
+
+  // the program being compiled and linked by the driver
+  GLuint pending;
+  vector<GLuint> objs;
+  int submitFrame;
+
+  // called with the new program once it has been linked successfully
+  std::function<void(GLuint)> onReady;
+
+  // deleted by remove(), the handle is never reused
+  bool removed;
+} ShaderProgram;
+
+/* Compile queue for shader programs
+ *
+ * All programs are submitted up front and never checked right away.
+ * With GL_KHR_parallel_shader_compile the driver compiles them
+ * on its own threads and we poll GL_COMPLETION_STATUS_KHR each frame.
+ * Without it, the status query is deferred by a few frames,
+ * so that the driver has finished by the time we ask.
+ *
+ * The previous program is kept until the new one is linked,
+ * so a rebuild (or a broken shader) never leaves an object undrawn.
+ */
+class ShaderQueue {
+public:
+  vector<ShaderProgram> programs;
+
+  bool parallel;
+  int frame;
+
+  // frames to wait before querying the status without the extension
+  int deferFrames;
+
+  // shader directory watching
+  string watchDir;
+  int inotifyFd, watchFd;
+
+  // fallback without inotify: poll modification times every few frames
+  int pollInterval;
+  std::map<string, long> mtimes;
+
+  ShaderQueue();
+  ~ShaderQueue();
+
+  void init();
+  int submit(string, string, std::function<void(GLuint)>,
+             string defines = "");
+  int submit(vector<ShaderStage>, std::function<void(GLuint)>,
+             string defines = "", vector<string> varyings = {});
+  void setDefines(int, string);
+  void setStages(int, vector<ShaderStage>);
+  void rebuild(int);
+  void remove(int);
+  void rebuildAll();
+  void rebuildFile(const string);
+  void update();
+  void finish();
+  void watch(const string);
+  void release();
+
+  bool isPending(int);
+
+private:
+  void compile(ShaderProgram &);
+  bool isReady(ShaderProgram &);
+  void complete(ShaderProgram &);
+  void checkWatch();
+};
+
+extern ShaderQueue shaderQueue;
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef SHADING_LOD_H
+#define SHADING_LOD_H
+
+#include "common.h"
+
+/* Shading levels, from the most to the least expensive */
+enum {
+  LOD_POM_SHADOW = 0,
+  LOD_POM = 1,
+  LOD_NORMAL_MAP = 2,
+  LOD_FLAT = 3,
+  NUM_SHADING_LODS = 4
+};
+
+/* Picks a shading level per object per frame
+ *
+ * POM only pays off when the parallax shift covers several pixels.
+ * The shift grows with the projected size of the surface
+ * and with tan(view angle), so both are combined into one estimate.
+ * Normal maps are dropped when the whole object covers a few pixels.
+ *
+ * The level is continuous: within fade x threshold above a threshold
+ * it blends towards the next level, fsPOM.glsl cross-fades accordingly.
+ */
+class ShadingLod {
+public:
+  // parallax shift in pixels below which self-shadow / POM are dropped
+  float shadowPixels, parallaxPixels;
+
+  // projected diameter in pixels below which normal mapping is dropped
+  float flatPixels;
+
+  // height scale of the POM shader
+  float heightScale;
+
+  float fade;
+
+  // draws per level of the current frame
+  int drawCounts[NUM_SHADING_LODS];
+
+  ShadingLod();
+
+  float select(vec3, float, vec3, vec3, mat4 &, float);
+  void resetCounts();
+
+private:
+  float fadeLevel(float, float);
+};
+
+#endif
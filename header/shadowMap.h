@@ -0,0 +1,70 @@
+#ifndef SHADOW_MAP_H
+#define SHADOW_MAP_H
+
+#include "common.h"
+
+// the static and the dynamic layer
+#define NUM_SHADOW_LAYERS 2
+#define SHADOW_STATIC 0
+#define SHADOW_DYNAMIC 1
+
+/* A mesh or a quad casting shadows, with its bounding sphere */
+typedef struct {
+  Mesh *mesh;
+  Quad *quad;
+  mat4 model;
+  vec3 center;
+  float radius;
+  int layer;
+} ShadowCaster;
+
+/* Cube shadow maps of a point light, re-rendered only when invalidated
+ *
+ * Every cube stores the distance to the light over range, rendered in a
+ * single pass: a geometry shader copies each triangle of a caster into
+ * the faces of a layered framebuffer it may touch. Casters are static or
+ * dynamic and each kind has a cube of its own, the receivers take the
+ * nearer of both. Moving the light dirties both cubes, moving a caster
+ * only the cube of its kind, and only when its bounds were or are within
+ * range of the light; update() renders the dirty cubes, so a moving
+ * object does not redraw the static scene.
+ */
+class ShadowCube {
+public:
+  int size;
+  float nearPlane, range;
+
+  GLuint fbos[NUM_SHADOW_LAYERS], cubes[NUM_SHADOW_LAYERS];
+  int units[NUM_SHADOW_LAYERS];
+
+  GLuint shader;
+  int program;
+  GLint uniModel, uniFaces, uniLightPosition, uniRange;
+
+  vector<ShadowCaster> casters;
+  vec3 lightPosition;
+  bool dirty[NUM_SHADOW_LAYERS];
+
+  // renders of each cube and casters drawn by them, since construction
+  int nOfRenders[NUM_SHADOW_LAYERS];
+  size_t nOfCastersDrawn;
+
+  ShadowCube(int, float);
+  ~ShadowCube();
+
+  void initShader();
+  int addCaster(Mesh *, mat4, bool dynamic = false);
+  int addCaster(Quad *, mat4, bool dynamic = false);
+  void moveCaster(int, mat4);
+  void setLight(vec3);
+  void update();
+  void setUniforms(GLint, GLint, GLint);
+
+private:
+  int add(ShadowCaster);
+  void bounds(ShadowCaster &);
+  bool inRange(ShadowCaster &);
+  void render(int);
+};
+
+#endif
@@ -0,0 +1,341 @@
+#ifndef SIMD8_H
+#define SIMD8_H
+
+#include <cmath>
+#include <cstdint>
+
+/* 8-wide float / int / mask vectors
+ *
+ * AVX2 + FMA when the file is compiled with -mavx2 -mfma,
+ * plain 8 element arrays otherwise (the compiler may still vectorize them).
+ * Both versions give the same results up to FMA rounding.
+ */
+#ifdef __AVX2__
+#include <immintrin.h>
+
+struct M8 {
+  __m256 v;
+
+  M8() {}
+  M8(__m256 x) : v(x) {}
+
+  M8 operator&(M8 b) const { return _mm256_and_ps(v, b.v); }
+  M8 operator|(M8 b) const { return _mm256_or_ps(v, b.v); }
+
+  // lanes of this mask without the lanes of b
+  M8 andNot(M8 b) const { return _mm256_andnot_ps(b.v, v); }
+
+  int bits() const { return _mm256_movemask_ps(v); }
+  bool any() const { return bits() != 0; }
+
+  static M8 all() { return _mm256_castsi256_ps(_mm256_set1_epi32(-1)); }
+  static M8 none() { return _mm256_setzero_ps(); }
+};
+
+struct F8 {
+  __m256 v;
+
+  F8() {}
+  F8(__m256 x) : v(x) {}
+  F8(float x) : v(_mm256_set1_ps(x)) {}
+
+  static F8 load(const float *p) { return _mm256_loadu_ps(p); }
+  void store(float *p) const { _mm256_storeu_ps(p, v); }
+
+  // 0, 1, ..., 7
+  static F8 iota() { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+
+  F8 operator+(F8 b) const { return _mm256_add_ps(v, b.v); }
+  F8 operator-(F8 b) const { return _mm256_sub_ps(v, b.v); }
+  F8 operator*(F8 b) const { return _mm256_mul_ps(v, b.v); }
+  F8 operator/(F8 b) const { return _mm256_div_ps(v, b.v); }
+  F8 operator-() const { return _mm256_sub_ps(_mm256_setzero_ps(), v); }
+  F8 &operator+=(F8 b) { return *this = *this + b; }
+  F8 &operator-=(F8 b) { return *this = *this - b; }
+  F8 &operator*=(F8 b) { return *this = *this * b; }
+
+  M8 operator<(F8 b) const { return _mm256_cmp_ps(v, b.v, _CMP_LT_OQ); }
+  M8 operator<=(F8 b) const { return _mm256_cmp_ps(v, b.v, _CMP_LE_OQ); }
+  M8 operator>(F8 b) const { return _mm256_cmp_ps(v, b.v, _CMP_GT_OQ); }
+  M8 operator>=(F8 b) const { return _mm256_cmp_ps(v, b.v, _CMP_GE_OQ); }
+  M8 operator==(F8 b) const { return _mm256_cmp_ps(v, b.v, _CMP_EQ_OQ); }
+};
+
+struct I8 {
+  __m256i v;
+
+  I8() {}
+  I8(__m256i x) : v(x) {}
+  I8(int x) : v(_mm256_set1_epi32(x)) {}
+
+  static I8 load(const int32_t *p) {
+    return _mm256_loadu_si256((const __m256i *)p);
+  }
+  void store(int32_t *p) const { _mm256_storeu_si256((__m256i *)p, v); }
+
+  I8 operator+(I8 b) const { return _mm256_add_epi32(v, b.v); }
+  I8 operator-(I8 b) const { return _mm256_sub_epi32(v, b.v); }
+  I8 operator*(I8 b) const { return _mm256_mullo_epi32(v, b.v); }
+  I8 operator&(I8 b) const { return _mm256_and_si256(v, b.v); }
+  I8 operator>>(int n) const { return _mm256_srli_epi32(v, n); }
+
+  M8 operator==(I8 b) const {
+    return _mm256_castsi256_ps(_mm256_cmpeq_epi32(v, b.v));
+  }
+};
+
+inline F8 fmadd(F8 a, F8 b, F8 c) { return _mm256_fmadd_ps(a.v, b.v, c.v); }
+inline F8 min(F8 a, F8 b) { return _mm256_min_ps(a.v, b.v); }
+inline F8 max(F8 a, F8 b) { return _mm256_max_ps(a.v, b.v); }
+inline F8 sqrt(F8 a) { return _mm256_sqrt_ps(a.v); }
+inline F8 floor(F8 a) { return _mm256_floor_ps(a.v); }
+inline F8 abs(F8 a) {
+  return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a.v);
+}
+
+// mask ? a : b
+inline F8 select(M8 m, F8 a, F8 b) { return _mm256_blendv_ps(b.v, a.v, m.v); }
+inline I8 select(M8 m, I8 a, I8 b) {
+  return _mm256_castps_si256(_mm256_blendv_ps(
+      _mm256_castsi256_ps(b.v), _mm256_castsi256_ps(a.v), m.v));
+}
+
+// truncation, like a C cast
+inline I8 toInt(F8 a) { return _mm256_cvttps_epi32(a.v); }
+inline F8 toFloat(I8 a) { return _mm256_cvtepi32_ps(a.v); }
+
+inline I8 gather(const uint32_t *base, I8 idx) {
+  return _mm256_i32gather_epi32((const int *)base, idx.v, 4);
+}
+
+#else
+
+struct M8 {
+  bool v[8];
+
+  M8 operator&(M8 b) const {
+    M8 r;
+    for (int i = 0; i < 8; i++) {
+      r.v[i] = v[i] && b.v[i];
+    }
+    return r;
+  }
+  M8 operator|(M8 b) const {
+    M8 r;
+    for (int i = 0; i < 8; i++) {
+      r.v[i] = v[i] || b.v[i];
+    }
+    return r;
+  }
+
+  // lanes of this mask without the lanes of b
+  M8 andNot(M8 b) const {
+    M8 r;
+    for (int i = 0; i < 8; i++) {
+      r.v[i] = v[i] && !b.v[i];
+    }
+    return r;
+  }
+
+  int bits() const {
+    int r = 0;
+    for (int i = 0; i < 8; i++) {
+      r |= v[i] << i;
+    }
+    return r;
+  }
+  bool any() const { return bits() != 0; }
+
+  static M8 all() {
+    M8 r;
+    for (int i = 0; i < 8; i++) {
+      r.v[i] = true;
+    }
+    return r;
+  }
+  static M8 none() {
+    M8 r;
+    for (int i = 0; i < 8; i++) {
+      r.v[i] = false;
+    }
+    return r;
+  }
+};
+
+#define SIMD8_MAP(expr)                                                        \
+  F8 r;                                                                        \
+  for (int i = 0; i < 8; i++) {                                                \
+    r.v[i] = expr;                                                             \
+  }                                                                            \
+  return r;
+
+#define SIMD8_CMP(expr)                                                        \
+  M8 r;                                                                        \
+  for (int i = 0; i < 8; i++) {                                                \
+    r.v[i] = expr;                                                             \
+  }                                                                            \
+  return r;
+
+struct F8 {
+  float v[8];
+
+  F8() {}
+  F8(float x) {
+    for (int i = 0; i < 8; i++) {
+      v[i] = x;
+    }
+  }
+
+  static F8 load(const float *p) { SIMD8_MAP(p[i]) }
+  void store(float *p) const {
+    for (int i = 0; i < 8; i++) {
+      p[i] = v[i];
+    }
+  }
+
+  // 0, 1, ..., 7
+  static F8 iota() { SIMD8_MAP(float(i)) }
+
+  F8 operator+(F8 b) const { SIMD8_MAP(v[i] + b.v[i]) }
+  F8 operator-(F8 b) const { SIMD8_MAP(v[i] - b.v[i]) }
+  F8 operator*(F8 b) const { SIMD8_MAP(v[i] * b.v[i]) }
+  F8 operator/(F8 b) const { SIMD8_MAP(v[i] / b.v[i]) }
+  F8 operator-() const { SIMD8_MAP(-v[i]) }
+  F8 &operator+=(F8 b) { return *this = *this + b; }
+  F8 &operator-=(F8 b) { return *this = *this - b; }
+  F8 &operator*=(F8 b) { return *this = *this * b; }
+
+  M8 operator<(F8 b) const { SIMD8_CMP(v[i] < b.v[i]) }
+  M8 operator<=(F8 b) const { SIMD8_CMP(v[i] <= b.v[i]) }
+  M8 operator>(F8 b) const { SIMD8_CMP(v[i] > b.v[i]) }
+  M8 operator>=(F8 b) const { SIMD8_CMP(v[i] >= b.v[i]) }
+  M8 operator==(F8 b) const { SIMD8_CMP(v[i] == b.v[i]) }
+};
+
+struct I8 {
+  int32_t v[8];
+
+  I8() {}
+  I8(int x) {
+    for (int i = 0; i < 8; i++) {
+      v[i] = x;
+    }
+  }
+
+  static I8 load(const int32_t *p) {
+    I8 r;
+    for (int i = 0; i < 8; i++) {
+      r.v[i] = p[i];
+    }
+    return r;
+  }
+  void store(int32_t *p) const {
+    for (int i = 0; i < 8; i++) {
+      p[i] = v[i];
+    }
+  }
+
+  I8 operator+(I8 b) const {
+    I8 r;
+    for (int i = 0; i < 8; i++) {
+      r.v[i] = v[i] + b.v[i];
+    }
+    return r;
+  }
+  I8 operator-(I8 b) const {
+    I8 r;
+    for (int i = 0; i < 8; i++) {
+      r.v[i] = v[i] - b.v[i];
+    }
+    return r;
+  }
+  I8 operator*(I8 b) const {
+    I8 r;
+    for (int i = 0; i < 8; i++) {
+      r.v[i] = v[i] * b.v[i];
+    }
+    return r;
+  }
+  I8 operator&(I8 b) const {
+    I8 r;
+    for (int i = 0; i < 8; i++) {
+      r.v[i] = v[i] & b.v[i];
+    }
+    return r;
+  }
+  I8 operator>>(int n) const {
+    I8 r;
+    for (int i = 0; i < 8; i++) {
+      r.v[i] = int32_t(uint32_t(v[i]) >> n);
+    }
+    return r;
+  }
+
+  M8 operator==(I8 b) const { SIMD8_CMP(v[i] == b.v[i]) }
+};
+
+inline F8 fmadd(F8 a, F8 b, F8 c) { SIMD8_MAP(a.v[i] * b.v[i] + c.v[i]) }
+inline F8 min(F8 a, F8 b) { SIMD8_MAP(a.v[i] < b.v[i] ? a.v[i] : b.v[i]) }
+inline F8 max(F8 a, F8 b) { SIMD8_MAP(a.v[i] > b.v[i] ? a.v[i] : b.v[i]) }
+inline F8 sqrt(F8 a) { SIMD8_MAP(std::sqrt(a.v[i])) }
+inline F8 floor(F8 a) { SIMD8_MAP(std::floor(a.v[i])) }
+inline F8 abs(F8 a) { SIMD8_MAP(std::fabs(a.v[i])) }
+
+// mask ? a : b
+inline F8 select(M8 m, F8 a, F8 b) { SIMD8_MAP(m.v[i] ? a.v[i] : b.v[i]) }
+inline I8 select(M8 m, I8 a, I8 b) {
+  I8 r;
+  for (int i = 0; i < 8; i++) {
+    r.v[i] = m.v[i] ? a.v[i] : b.v[i];
+  }
+  return r;
+}
+
+// truncation, like a C cast
+inline I8 toInt(F8 a) {
+  I8 r;
+  for (int i = 0; i < 8; i++) {
+    r.v[i] = int32_t(a.v[i]);
+  }
+  return r;
+}
+inline F8 toFloat(I8 a) { SIMD8_MAP(float(a.v[i])) }
+
+inline I8 gather(const uint32_t *base, I8 idx) {
+  I8 r;
+  for (int i = 0; i < 8; i++) {
+    r.v[i] = int32_t(base[idx.v[i]]);
+  }
+  return r;
+}
+
+#undef SIMD8_MAP
+#undef SIMD8_CMP
+
+#endif
+
+/* Three lanes of F8, a vec3 per lane */
+struct V8 {
+  F8 x, y, z;
+
+  V8() {}
+  V8(F8 a, F8 b, F8 c) : x(a), y(b), z(c) {}
+  V8(float a, float b, float c) : x(a), y(b), z(c) {}
+
+  V8 operator+(V8 b) const { return V8(x + b.x, y + b.y, z + b.z); }
+  V8 operator-(V8 b) const { return V8(x - b.x, y - b.y, z - b.z); }
+  V8 operator*(F8 s) const { return V8(x * s, y * s, z * s); }
+};
+
+inline F8 dot(V8 a, V8 b) { return fmadd(a.x, b.x, fmadd(a.y, b.y, a.z * b.z)); }
+
+inline V8 normalize(V8 a) {
+  F8 inv = F8(1.f) / sqrt(dot(a, a));
+  return a * inv;
+}
+
+inline V8 select(M8 m, V8 a, V8 b) {
+  return V8(select(m, a.x, b.x), select(m, a.y, b.y), select(m, a.z, b.z));
+}
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef SOFT_RASTER_H
+#define SOFT_RASTER_H
+
+#include "common.h"
+#include <cstdint>
+
+/* An RGB8 texture in memory, sampled like the GL textures of this demo:
+ * GL_LINEAR, GL_REPEAT, no mipmaps
+ */
+class SoftTexture {
+public:
+  int width, height;
+
+  // 0x00BBGGRR, rows bottom up like glTexImage2D
+  vector<uint32_t> texels;
+
+  SoftTexture();
+  SoftTexture(const string, FREE_IMAGE_FORMAT);
+
+  bool load(const string, FREE_IMAGE_FORMAT);
+};
+
+/* Material and uniforms of one draw, the same as the GL programs get */
+typedef struct {
+  SoftTexture *base, *normal, *height;
+
+  // fsPOM with the height map, otherwise fsPhong
+  bool parallax;
+  float lodLevel;
+
+  vec3 eye, lightColor, lightPosition;
+} SoftDraw;
+
+/* A vertex before (object space) or after the vertex stage */
+typedef struct {
+  vec4 clip;
+  vec2 uv;
+  vec3 worldPos, worldN;
+} SoftVertex;
+
+// z, 1 / w, then uv, worldPos and worldN divided by w
+#define SOFT_NUM_PLANES 10
+
+/* A triangle after setup, all equations are in window coordinates */
+typedef struct {
+  // edge functions a * x + b * y + c, inside >= 0
+  float edgeA[3], edgeB[3], edgeC[3];
+  bool topLeft[3];
+
+  // attribute planes a * x + b * y + c
+  float planeA[SOFT_NUM_PLANES], planeB[SOFT_NUM_PLANES],
+      planeC[SOFT_NUM_PLANES];
+
+  // constant per triangle, see computeTBN() of the shaders
+  vec3 tangent, bitangent;
+
+  int x0, y0, x1, y1;
+  int draw;
+} SoftTriangle;
+
+/* Multithreaded CPU renderer for the Mesh / Quad scene
+ *
+ * Draws are set up in parallel (transform, near plane clipping,
+ * back face culling, triangle setup) and binned into screen tiles.
+ * Tiles are then rasterized by the thread pool, each in two passes:
+ *   1. depth: 8-wide edge functions, the nearest triangle id per pixel
+ *   2. shading: 8 pixels of the same triangle at a time, with the
+ *      Blinn-Phong / normal mapping / POM code of fsPhong and fsPOM
+ * so every pixel is shaded once, whatever the overdraw.
+ *
+ * Matches the GL output up to derivative and filtering precision.
+ * Clustered point lights are not supported.
+ */
+class SoftRaster {
+public:
+  static const int tileSize = 64;
+
+  int width, height;
+  int tilesX, tilesY;
+
+  // rows of tilesX * tileSize pixels, bottom up like glReadPixels
+  int pitch;
+  vector<uint32_t> color;
+  vector<float> depth;
+  vector<int32_t> ids;
+
+  vector<SoftDraw> draws;
+  vector<SoftTriangle> tris;
+  vector<vector<int>> bins;
+
+  SoftRaster(int, int);
+
+  void clear(vec3);
+  void drawMesh(Mesh *, mat4, mat4, mat4, SoftDraw);
+  void drawQuad(Quad *, mat4, mat4, mat4, SoftDraw);
+  void flush();
+  bool save(const string);
+
+private:
+  void drawTriangles(vector<SoftVertex> &, mat4, mat4, mat4, int);
+  int clipNear(SoftVertex *, SoftVertex *);
+  bool setup(SoftVertex *, int, SoftTriangle &);
+  void rasterTile(int);
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "common.h"
+#include <chrono>
+#include <cstdio>
+#include <map>
+
+/* Counts of the GL work of a frame */
+typedef struct {
+  size_t drawCalls, vertices, triangles;
+  size_t programBinds, vaoBinds, textureBinds, uniformUploads;
+  size_t elidedChanges;
+} DrawCounts;
+
+/* Per frame costs and GL memory, counted by the drawing code
+ *
+ * Mesh, Quad, drawPoints, drawBox and the passes that draw through them
+ * report draws, GLStateCache reports the binds and uniform uploads it
+ * issues or elides; objects report the bytes of the buffers, textures
+ * and renderbuffers they allocate by name, so a re-specified object
+ * replaces its old size. Renderbuffers count as texture memory, RGB8 and
+ * depth texels as 4 bytes, as drivers pad them. Not counted: the buffers
+ * drawPoints and drawBox create and delete within one call, the target
+ * of --compare-soft, and buffer textures, whose store is their buffer.
+ * endFrame() closes a frame's counts; with open() the averages are
+ * appended every interval seconds to a JSON lines file, and print()
+ * dumps them on demand. GL thread only.
+ */
+class FrameStats {
+public:
+  DrawCounts frame; // being counted
+  DrawCounts last;  // the last finished frame
+
+  // since the last line of the log
+  DrawCounts sum;
+  int nOfFrames;
+  double sumTime, lastTime;
+
+  size_t totalFrames;
+
+  std::map<GLuint, size_t> buffers, textures, renderbuffers;
+  size_t bufferBytes, textureBytes;
+
+  FILE *log;
+  double interval;
+  std::chrono::steady_clock::time_point start, frameStart, lastFlush;
+
+  FrameStats();
+  ~FrameStats();
+
+  bool open(const string, double seconds = 1.0);
+  void close();
+
+  void draw(GLenum, size_t, size_t instances = 1);
+  void bindProgram() { frame.programBinds++; }
+  void bindVao() { frame.vaoBinds++; }
+  void bindTexture(int n = 1) { frame.textureBinds += n; }
+  void uniforms(int n = 1) { frame.uniformUploads += n; }
+  void elide() { frame.elidedChanges++; }
+
+  void setBuffer(GLuint, size_t);
+  void releaseBuffer(GLuint);
+  void setTexture(GLuint, size_t);
+  void releaseTexture(GLuint);
+  void setRenderbuffer(GLuint, size_t);
+  void releaseRenderbuffer(GLuint);
+
+  void endFrame();
+  void print();
+
+private:
+  void writeLine();
+};
+
+extern FrameStats frameStats;
+
+#endif
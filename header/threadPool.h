@@ -0,0 +1,37 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/* A fixed set of worker threads consuming a task queue */
+class ThreadPool {
+public:
+  std::vector<std::thread> workers;
+  std::queue<std::function<void()>> tasks;
+
+  std::mutex mtx;
+  std::condition_variable cv;
+  bool stop;
+
+  ThreadPool(int nOfThreads = 0);
+  ~ThreadPool();
+
+  int size();
+  std::future<void> enqueue(std::function<void()>);
+  void parallelFor(size_t, std::function<void(size_t, size_t)>,
+                   size_t grain = 1);
+
+private:
+  void work();
+};
+
+extern ThreadPool threadPool;
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#include "common.h"
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <unordered_set>
+
+// readbacks of the feedback buffer in flight
+#define NUM_FEEDBACK_SLOTS 3
+
+/* Header of a tiled virtual texture file
+ *
+ * The header is followed by the pages of every level, finest first, each
+ * level in rows of pages. A page is (tileSize + 2 * border)^2 RGBA8
+ * texels: the tile and a border copied from its neighbours (wrapping
+ * around the texture), so bilinear filtering never reads another page.
+ */
+typedef struct {
+  char magic[4];
+  uint32_t size;
+  uint32_t tileSize, border;
+  uint32_t nOfLevels;
+} VtHeader;
+
+/* A page of the cache */
+typedef struct {
+  // (level << 24) | (y << 12) | x, -1 when the slot is free
+  int64_t key;
+  int lastUsed;
+  bool pinned;
+} VtSlot;
+
+/* A page read from the file by a loader thread */
+typedef struct {
+  uint32_t key;
+  vector<uint8_t> texels;
+} VtTile;
+
+/* Bake a square power of two texture of size texels into a tiled file,
+ * rgb: the normal map, a: the height map, both repeated to cover it.
+ * Writes one page at a time, so size is only limited by the disk.
+ */
+bool bakeVirtualTexture(const string, const string, const string, int,
+                        int tileSize = 128, int border = 1);
+
+/* Virtual texturing of a normal + height map too large for GL_TEXTURE_2D
+ *
+ * The tiled file is mapped with mmap. Pages live in a physical texture
+ * of slots x slots pages and are found through an indirection texture
+ * with one texel per page of every level: the slot of the page, or of
+ * the finest resident page above it, and that page's level. The single
+ * page of the coarsest level is always resident.
+ *
+ * Each frame the textured objects are drawn into a small RGBA16UI
+ * feedback buffer, every fragment writing the page and level it samples.
+ * The buffer is read back through pixel buffer objects and fences
+ * without stalling; missing pages are read from the mapping on the
+ * thread pool (coarser ones first), uploaded a few per frame, and the
+ * least recently used unpinned page is evicted for each of them.
+ */
+class VirtualTexture {
+public:
+  VtHeader header;
+  int nOfPagesX, paddedSize;
+  size_t pageBytes;
+  vector<size_t> levelOffsets;
+
+  // the mapped file
+  int fd;
+  uint8_t *data;
+  size_t dataSize;
+
+  // cache
+  int nOfSlotsX;
+  vector<VtSlot> slots;
+
+  // slot of each page of each level, -1 when it is not resident
+  vector<vector<int>> pageSlots;
+
+  // RGBA8UI indirection texels of each level, slot x, slot y, level
+  vector<vector<uint8_t>> indirection;
+  bool indirectionDirty;
+
+  // opengl data
+  GLuint tboPhysical, tboIndirection;
+  int unitPhysical, unitIndirection;
+
+  // feedback pass
+  GLuint fbo, tboFeedback, rboDepth;
+  int feedbackWidth, feedbackHeight, feedbackScale;
+  GLuint pbos[NUM_FEEDBACK_SLOTS];
+  GLsync fences[NUM_FEEDBACK_SLOTS];
+  int feedbackSlot;
+  GLint savedViewport[4];
+
+  GLuint shader;
+  int program;
+  GLint uniModel, uniView, uniProjection;
+  GLint uniVtSize, uniVtPage, uniVtBias;
+
+  // pages being read by the thread pool and pages read
+  std::unordered_set<uint32_t> pending;
+  std::deque<std::future<void>> loads;
+  std::mutex arrivedMutex;
+  vector<VtTile> arrived;
+  int maxPending, maxUploads;
+
+  int frame;
+
+  // counts of the last update()
+  int nOfRequested, nOfUploaded, nOfResident;
+
+  VirtualTexture(const string, int slots = 16, int scale = 8);
+  ~VirtualTexture();
+
+  bool valid() { return data != NULL; }
+
+  void initShader();
+  void setUniforms(GLint, GLint, GLint, GLint, GLint);
+
+  void update();
+  bool beginFeedback(mat4, mat4);
+  void drawFeedback(Quad *, mat4);
+  void endFeedback();
+
+private:
+  uint32_t pageKey(int, int, int);
+  int pagesAt(int);
+  const uint8_t *page(int, int, int);
+  void upload(uint32_t, const uint8_t *, bool);
+  int findSlot();
+  void request(int, int, int);
+  void touch(int, int, int);
+  void readFeedback(int);
+  void buildIndirection();
+};
+
+#endif
@@ -0,0 +1,143 @@
+#version 330
+
+// lighting pass of the deferred path, one full-screen triangle
+
+in vec2 screenUv;
+
+uniform sampler2D gAlbedo, gNormal, gDepth;
+uniform mat4 invViewProj;
+uniform vec3 lightColor;
+uniform vec3 lightPosition;
+uniform vec3 eyePoint;
+
+out vec4 outputColor;
+
+// reconstructed from the depth buffer
+vec3 worldPos;
+
+#ifdef CLUSTERED
+// point lights assigned to froxels on the cpu, see LightCluster
+uniform samplerBuffer clusterLights;
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterIndices;
+uniform ivec3 clusterDims;
+uniform vec2 clusterDepth;
+uniform vec4 clusterViewport;
+
+// (offset, count) of the light list of this fragment's froxel
+uvec2 getCluster(float windowDepth)
+{
+    float n = clusterDepth.x, f = clusterDepth.y;
+
+    // view distance from the window space depth
+    float zNdc = windowDepth * 2.0 - 1.0;
+    float depth = 2.0 * n * f / (f + n - zNdc * (f - n));
+
+    vec2 tile = (gl_FragCoord.xy - clusterViewport.xy) / clusterViewport.zw;
+    int slice = int(log(depth / n) / log(f / n) * float(clusterDims.z));
+
+    ivec3 c = ivec3(ivec2(tile * vec2(clusterDims.xy)), slice);
+    c = clamp(c, ivec3(0), clusterDims - 1);
+
+    return texelFetch(clusterGrid, (c.z * clusterDims.y + c.y) * clusterDims.x + c.x).xy;
+}
+
+// diffuse and specular from the lights of this fragment's froxel
+vec4 shadeClustered(vec4 diffuse, float ks, float alpha, vec3 N, vec3 V,
+                    float windowDepth)
+{
+    vec4 result = vec4(0);
+    uvec2 cluster = getCluster(windowDepth);
+
+    for (uint i = 0u; i < cluster.y; i++) {
+        int idx = int(texelFetch(clusterIndices, int(cluster.x + i)).r);
+        vec4 posRadius = texelFetch(clusterLights, idx * 2);
+        vec3 color = texelFetch(clusterLights, idx * 2 + 1).rgb;
+
+        vec3 L = posRadius.xyz - worldPos;
+        float dist = length(L);
+
+        if (dist > posRadius.w) {
+            continue;
+        }
+
+        L /= dist;
+        vec3 H = normalize(L + V);
+
+        // smooth window so that a light fades out at its radius
+        float falloff = clamp(1.0 - pow(dist / posRadius.w, 4.0), 0.0, 1.0);
+        float attenuation = falloff * falloff / (dist * dist + 1.0);
+
+        float dc = max(dot(N, L), 0.0);
+        float sc = pow(max(dot(H, N), 0.0), alpha);
+
+        result += diffuse * vec4(color, 1.0) * dc * attenuation;
+        result += vec4(color * ks, 0.0) * sc * attenuation;
+    }
+
+    return result;
+}
+#endif
+
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+
+    if (n.z < 0.0) {
+        vec2 s = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+        n.xy = (1.0 - abs(n.yx)) * s;
+    }
+
+    return normalize(n);
+}
+
+void main(){
+    vec4 albedo = texture(gAlbedo, screenUv);
+    int materialId = int(albedo.a * 255.0 + 0.5);
+
+    // nothing was drawn here, keep the clear color
+    if (materialId == 0) {
+        discard;
+    }
+
+    float depth = texture(gDepth, screenUv).r;
+    vec4 ndc = vec4(screenUv * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+    vec4 world = invViewProj * ndc;
+    worldPos = world.xyz / world.w;
+
+    // later forward passes depth test against the scene
+    gl_FragDepth = depth;
+
+    vec4 normalShadow = texture(gNormal, screenUv);
+    float shadow = normalShadow.z;
+
+    // same shading as fsPhong.glsl and fsPOM.glsl
+    vec4 texColor = vec4(albedo.rgb, 1.0) * 0.75;
+
+    vec3 N = octDecode(normalShadow.xy);
+    vec3 L = normalize(lightPosition - worldPos);
+    vec3 V = normalize(eyePoint - worldPos);
+    vec3 H = normalize(L + V);
+
+    float ka = 0.2, kd = 0.75, ks = 0.55;
+    float alpha = 20;
+
+    outputColor = vec4(0);
+
+    vec4 ambient = texColor * ka;
+    vec4 diffuse = texColor * kd;
+    vec4 specular = vec4(lightColor * ks, 1.0);
+
+    float dist = length(L);
+    float attenuation = 1.0 / (dist * dist);
+    float dc = max(dot(N, L), 0.0);
+    float sc = pow(max(dot(H, N), 0.0), alpha);
+
+    outputColor += ambient;
+    outputColor += diffuse * dc * attenuation * shadow;
+    outputColor += specular * sc * attenuation * shadow;
+
+#ifdef CLUSTERED
+    outputColor += shadeClustered(diffuse, ks, alpha, N, V, depth);
+#endif
+}
@@ -0,0 +1,163 @@
+#version 330
+
+// G-buffer pass of the deferred path
+// PARALLAX: resolve the POM uv displacement and the self-shadow
+// of the main light here, so the lighting pass only runs once per pixel
+
+in vec2 uv;
+in vec3 worldPos;
+in vec3 worldN;
+
+uniform sampler2D texBase, texNormal;
+uniform float materialId;
+
+#ifdef PARALLAX
+uniform sampler2D texHeight;
+uniform vec3 lightPosition;
+uniform vec3 eyePoint;
+#endif
+
+// albedo.rgb, material id / 255
+layout(location = 0) out vec4 outAlbedo;
+// octahedral normal, self-shadow factor
+layout(location = 1) out vec4 outNormal;
+
+// the code is from https://github.com/JoeyDeVries/LearnOpenGL
+// check the theory at https://learnopengl.com/Advanced-Lighting/Normal-Mapping
+//----------------------------------------------------------------
+mat3 computeTBN(vec2 tempUv){
+    vec3 Q1  = dFdx(worldPos);
+    vec3 Q2  = dFdy(worldPos);
+    vec2 st1 = dFdx(tempUv);
+    vec2 st2 = dFdy(tempUv);
+
+    vec3 n   = normalize(worldN);
+    vec3 t  = normalize(Q1*st2.t - Q2*st1.t);
+
+    // in the tutorial, they use vec3 b = -normalize(cross(n, t))
+    // but it generates weird result
+    // vec3 b  = normalize(cross(n, t));
+
+    vec3 b = normalize(-Q1*st2.s + Q2*st1.s);
+
+    mat3 tbn = mat3(t, b, n);
+
+    return tbn;
+}
+
+//----------------------------------------------------------------
+
+#ifdef PARALLAX
+// refer to https://learnopengl.com/Advanced-Lighting/Parallax-Mapping
+// code: https://github.com/JoeyDeVries/LearnOpenGL/tree/master/src/5.advanced_lighting/5.3.parallax_occlusion_mapping
+vec2 parallaxOcclusionMapping(vec2 texCoords, vec3 viewDir)
+{
+    // number of depth layers
+    const float minLayers = 8.0;
+    const float maxLayers = 32.0;
+    float heightScale = 0.1;
+
+    float numLayers = mix(maxLayers, minLayers, abs(dot(vec3(0.0, 0.0, 1.0), viewDir)));
+    // calculate the size of each layer
+    float layerDepth = 1.0 / numLayers;
+    // depth of current layer
+    float currentLayerDepth = 0.0;
+    // the amount to shift the texture coordinates per layer (from vector P)
+    vec2 P = viewDir.xy / viewDir.z * heightScale;
+    vec2 deltaTexCoords = P / numLayers;
+
+    // get initial values
+    vec2  currentTexCoords     = texCoords;
+    float currentDepthMapValue = texture(texHeight, currentTexCoords).r;
+
+    while(currentLayerDepth < currentDepthMapValue)
+    {
+        // shift texture coordinates along direction of P
+        currentTexCoords -= deltaTexCoords;
+        // get depthmap value at current texture coordinates
+        currentDepthMapValue = texture(texHeight, currentTexCoords).r;
+        // get depth of next layer
+        currentLayerDepth += layerDepth;
+    }
+
+    // get texture coordinates before collision (reverse operations)
+    vec2 prevTexCoords = currentTexCoords + deltaTexCoords;
+
+    // get depth after and before collision for linear interpolation
+    float afterDepth  = currentDepthMapValue - currentLayerDepth;
+    float beforeDepth = texture(texHeight, prevTexCoords).r - currentLayerDepth + layerDepth;
+
+    // interpolation of texture coordinates
+    float weight = afterDepth / (afterDepth - beforeDepth);
+    vec2 finalTexCoords = prevTexCoords * weight + currentTexCoords * (1.0 - weight);
+
+    return finalTexCoords;
+}
+
+// hard shadow: https://stackoverflow.com/a/55091654/3584162
+// soft shadow: https://github.com/piellardj/parallax-mapping/blob/master/shaders/parallax.frag (better effect)
+float calcShadow(vec2 texCoords, vec3 lightDir)
+{
+    float selfShadowFactor = 1.0f;
+
+    float minLayers = 8;
+    float maxLayers = 32;
+    float numLayers = mix(maxLayers, minLayers, abs(dot(vec3(0.0, 0.0, 1.0), lightDir)));
+    float heightScale = 0.1f;
+
+    vec2 currentTexCoords = texCoords;
+    float currentDepthMapValue = texture(texHeight, currentTexCoords).r;
+    float currentLayerDepth = currentDepthMapValue;
+
+    float layerDepth = 1.0 / numLayers;
+    vec2 P = lightDir.xy / lightDir.z * heightScale;
+    vec2 deltaTexCoords = P / numLayers;
+
+    while (currentLayerDepth > 0.0)
+    {
+        currentTexCoords += deltaTexCoords;
+        currentDepthMapValue = texture(texHeight, currentTexCoords).r;
+        currentLayerDepth -= layerDepth;
+
+        if(currentDepthMapValue < currentLayerDepth){
+            selfShadowFactor -= (currentLayerDepth - currentDepthMapValue) / layerDepth;
+        }
+    }
+
+    selfShadowFactor = max(0.0, selfShadowFactor);
+
+    return selfShadowFactor;
+}
+#endif
+
+// map a unit vector onto the [-1, 1] square
+vec2 octEncode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+
+    if (n.z < 0.0) {
+        vec2 s = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+        n.xy = (1.0 - abs(n.yx)) * s;
+    }
+
+    return n.xy;
+}
+
+void main(){
+    vec2 texUv = uv;
+    float shadow = 1.0;
+
+#ifdef PARALLAX
+    vec3 tanViewDir = normalize(computeTBN(uv) * (eyePoint - worldPos));
+    texUv = parallaxOcclusionMapping(uv, tanViewDir);
+
+    vec3 tanLightDir = normalize(computeTBN(uv) * (lightPosition - worldPos));
+    shadow = calcShadow(texUv, tanLightDir);
+#endif
+
+    vec3 tangentNormal = texture(texNormal, texUv).xyz * 2.0 - 1.0;
+    vec3 N = normalize(computeTBN(texUv) * tangentNormal);
+
+    outAlbedo = vec4(texture(texBase, texUv).rgb, materialId / 255.0);
+    outNormal = vec4(octEncode(N), shadow, 0.0);
+}
@@ -9,8 +9,69 @@ in vec3 tanFragPos;
 
 uniform sampler2D texBase, texNormal, texHeight;
 uniform vec3 lightColor;
+#ifdef MULTI_VIEW
+// camera and light of this fragment's layer, see gsMultiView.glsl
+flat in vec3 layerEye;
+flat in vec3 layerLight;
+#define eyePoint layerEye
+#define lightPosition layerLight
+#else
 uniform vec3 lightPosition;
 uniform vec3 eyePoint;
+#endif
+
+// shading LOD, see ShadingLod
+// 0: POM + self-shadow, 1: POM, 2: normal mapping, 3: flat
+// fractional levels cross-fade between two neighbouring levels
+uniform float lodLevel;
+
+#ifdef VIRTUAL_TEXTURE
+// normal (rgb) and height (a) pages, see VirtualTexture
+// texBase stays a regular texture, a macro color over the paged detail
+uniform usampler2D vtIndirection;
+uniform sampler2D vtPhysical;
+uniform float vtSize;
+// x: tile size, y: border, z: physical texture size, w: levels
+uniform vec4 vtPage;
+uniform float vtBias;
+
+// level of this fragment, set once as the ray march has no derivatives
+float vtLevel;
+
+// the same level the feedback pass asks for, see fsVtFeedback.glsl
+float vtMipLevel(vec2 st)
+{
+    vec2 t = st * vtSize;
+    vec2 dx = dFdx(t), dy = dFdy(t);
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy))) - vtBias;
+    return clamp(floor(lod), 0.0, vtPage.w - 1.0);
+}
+
+vec4 vtSample(vec2 st)
+{
+    int level = int(vtLevel);
+    int pages = max(int(vtSize / vtPage.x) >> level, 1);
+    uvec4 entry = texelFetch(vtIndirection, ivec2(fract(st) * float(pages)), level);
+
+    // the page found may be a coarser fallback
+    float n = float(max(int(vtSize / vtPage.x) >> int(entry.z), 1));
+    vec2 inPage = fract(fract(st) * n);
+
+    float padded = vtPage.x + 2.0 * vtPage.y;
+    vec2 texel = vec2(entry.xy) * padded + vtPage.y + inPage * vtPage.x;
+    return textureLod(vtPhysical, texel / vtPage.z, 0.0);
+}
+
+#define SAMPLE_NORMAL(st) vtSample(st).xyz
+#define SAMPLE_HEIGHT(st) vtSample(st).a
+#elif defined(PACKED_NORMAL_HEIGHT)
+// normal in rgb and height in alpha of one texture, see packedMaterial.h
+#define SAMPLE_NORMAL(st) texture(texNormal, st).xyz
+#define SAMPLE_HEIGHT(st) texture(texNormal, st).a
+#else
+#define SAMPLE_NORMAL(st) texture(texNormal, st).xyz
+#define SAMPLE_HEIGHT(st) texture(texHeight, st).r
+#endif
 
 out vec4 outputColor;
 
@@ -41,7 +102,7 @@ mat3 computeTBN(vec2 tempUv){
 
 vec3 getNormalFromMap(vec2 tempUv)
 {
-    vec3 tangentNormal = texture(texNormal, tempUv).xyz * 2.0 - 1.0;
+    vec3 tangentNormal = SAMPLE_NORMAL(tempUv) * 2.0 - 1.0;
 
     mat3 tbn = computeTBN(tempUv);
 
@@ -49,6 +110,70 @@ vec3 getNormalFromMap(vec2 tempUv)
 }
 //----------------------------------------------------------------
 
+#ifdef CLUSTERED
+// point lights assigned to froxels on the cpu, see LightCluster
+uniform samplerBuffer clusterLights;
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterIndices;
+uniform ivec3 clusterDims;
+uniform vec2 clusterDepth;
+uniform vec4 clusterViewport;
+
+// (offset, count) of the light list of this fragment's froxel
+uvec2 getCluster(float windowDepth)
+{
+    float n = clusterDepth.x, f = clusterDepth.y;
+
+    // view distance from the window space depth
+    float zNdc = windowDepth * 2.0 - 1.0;
+    float depth = 2.0 * n * f / (f + n - zNdc * (f - n));
+
+    vec2 tile = (gl_FragCoord.xy - clusterViewport.xy) / clusterViewport.zw;
+    int slice = int(log(depth / n) / log(f / n) * float(clusterDims.z));
+
+    ivec3 c = ivec3(ivec2(tile * vec2(clusterDims.xy)), slice);
+    c = clamp(c, ivec3(0), clusterDims - 1);
+
+    return texelFetch(clusterGrid, (c.z * clusterDims.y + c.y) * clusterDims.x + c.x).xy;
+}
+
+// diffuse and specular from the lights of this fragment's froxel
+vec4 shadeClustered(vec4 diffuse, float ks, float alpha, vec3 N, vec3 V,
+                    float windowDepth)
+{
+    vec4 result = vec4(0);
+    uvec2 cluster = getCluster(windowDepth);
+
+    for (uint i = 0u; i < cluster.y; i++) {
+        int idx = int(texelFetch(clusterIndices, int(cluster.x + i)).r);
+        vec4 posRadius = texelFetch(clusterLights, idx * 2);
+        vec3 color = texelFetch(clusterLights, idx * 2 + 1).rgb;
+
+        vec3 L = posRadius.xyz - worldPos;
+        float dist = length(L);
+
+        if (dist > posRadius.w) {
+            continue;
+        }
+
+        L /= dist;
+        vec3 H = normalize(L + V);
+
+        // smooth window so that a light fades out at its radius
+        float falloff = clamp(1.0 - pow(dist / posRadius.w, 4.0), 0.0, 1.0);
+        float attenuation = falloff * falloff / (dist * dist + 1.0);
+
+        float dc = max(dot(N, L), 0.0);
+        float sc = pow(max(dot(H, N), 0.0), alpha);
+
+        result += diffuse * vec4(color, 1.0) * dc * attenuation;
+        result += vec4(color * ks, 0.0) * sc * attenuation;
+    }
+
+    return result;
+}
+#endif
+
 // refer to https://learnopengl.com/Advanced-Lighting/Parallax-Mapping
 // code: https://github.com/JoeyDeVries/LearnOpenGL/tree/master/src/5.advanced_lighting/5.3.parallax_occlusion_mapping
 vec2 parallaxOcclusionMapping(vec2 texCoords, vec3 viewDir)
@@ -69,14 +194,14 @@ vec2 parallaxOcclusionMapping(vec2 texCoords, vec3 viewDir)
 
     // get initial values
     vec2  currentTexCoords     = texCoords;
-    float currentDepthMapValue = texture(texHeight, currentTexCoords).r;
+    float currentDepthMapValue = SAMPLE_HEIGHT(currentTexCoords);
 
     while(currentLayerDepth < currentDepthMapValue)
     {
         // shift texture coordinates along direction of P
         currentTexCoords -= deltaTexCoords;
         // get depthmap value at current texture coordinates
-        currentDepthMapValue = texture(texHeight, currentTexCoords).r;
+        currentDepthMapValue = SAMPLE_HEIGHT(currentTexCoords);
         // get depth of next layer
         currentLayerDepth += layerDepth;
     }
@@ -86,7 +211,7 @@ vec2 parallaxOcclusionMapping(vec2 texCoords, vec3 viewDir)
 
     // get depth after and before collision for linear interpolation
     float afterDepth  = currentDepthMapValue - currentLayerDepth;
-    float beforeDepth = texture(texHeight, prevTexCoords).r - currentLayerDepth + layerDepth;
+    float beforeDepth = SAMPLE_HEIGHT(prevTexCoords) - currentLayerDepth + layerDepth;
 
     // interpolation of texture coordinates
     float weight = afterDepth / (afterDepth - beforeDepth);
@@ -107,7 +232,7 @@ float calcShadow(vec2 texCoords, vec3 lightDir)
     float heightScale = 0.1f;
 
     vec2 currentTexCoords = texCoords;
-    float currentDepthMapValue = texture(texHeight, currentTexCoords).r;
+    float currentDepthMapValue = SAMPLE_HEIGHT(currentTexCoords);
     float currentLayerDepth = currentDepthMapValue;
 
     float layerDepth = 1.0 / numLayers;
@@ -117,7 +242,7 @@ float calcShadow(vec2 texCoords, vec3 lightDir)
     while (currentLayerDepth > 0.0)
     {
         currentTexCoords += deltaTexCoords;
-        currentDepthMapValue = texture(texHeight, currentTexCoords).r;
+        currentDepthMapValue = SAMPLE_HEIGHT(currentTexCoords);
         currentLayerDepth -= layerDepth;
 
         if(currentDepthMapValue < currentLayerDepth){
@@ -130,16 +255,61 @@ float calcShadow(vec2 texCoords, vec3 lightDir)
     return selfShadowFactor;
 }
 
+#ifdef SHADOW_CUBE
+// distances to the light of the static and the dynamic casters, see ShadowCube
+uniform samplerCubeShadow shadowStatic, shadowDynamic;
+// xyz: the light the cubes were rendered from, w: their range
+uniform vec4 shadowLight;
+
+// 1 where the point light reaches the fragment, 0 in a shadow
+float cubeShadow()
+{
+    // off the surface along its normal, against acne
+    vec3 d = worldPos + normalize(worldN) * 0.02 - shadowLight.xyz;
+    float ref = length(d) / shadowLight.w;
+
+    if (ref >= 1.0) {
+        return 1.0;
+    }
+
+    return min(texture(shadowStatic, vec4(d, ref)),
+               texture(shadowDynamic, vec4(d, ref)));
+}
+#endif
+
 void main(){
-    vec3 tanViewDir = normalize(computeTBN(uv) * (eyePoint - worldPos));
-    vec2 distortedUv = parallaxOcclusionMapping(uv, tanViewDir);
+#ifdef VIRTUAL_TEXTURE
+    vtLevel = vtMipLevel(uv);
+#endif
+
+    // lodLevel is uniform, so these branches do not diverge
+    float shadowFade = clamp(1.0 - lodLevel, 0.0, 1.0);
+#ifdef DISPLACEMENT
+    // the surface is displaced already, see tesDisplace.glsl
+    float parallaxFade = 0.0;
+#else
+    float parallaxFade = clamp(2.0 - lodLevel, 0.0, 1.0);
+#endif
+    float flatFade = clamp(lodLevel - 2.0, 0.0, 1.0);
+
+    vec2 distortedUv = uv;
+
+    if (parallaxFade > 0.0) {
+        vec3 tanViewDir = normalize(computeTBN(uv) * (eyePoint - worldPos));
+        distortedUv = mix(uv, parallaxOcclusionMapping(uv, tanViewDir), parallaxFade);
+    }
 
     // if(distortedUv.x > 1.0 || distortedUv.y > 1.0 || distortedUv.x < 0.0 || distortedUv.y < 0.0)
     //     discard;
 
     vec4 texColor = texture(texBase, distortedUv) * 0.75;
 
-    vec3 N = getNormalFromMap(distortedUv);
+    vec3 N = normalize(worldN);
+
+    if (flatFade < 1.0) {
+        N = normalize(mix(getNormalFromMap(distortedUv), N, flatFade));
+    }
+
     vec3 L = normalize(lightPosition - worldPos);
     vec3 V = normalize(eyePoint - worldPos);
     vec3 H = normalize(L + V);
@@ -158,10 +328,23 @@ void main(){
     float dc = max(dot(N, L), 0.0);
     float sc = pow(max(dot(H, N), 0.0), alpha);
 
-    vec3 tanLightDir = normalize(computeTBN(uv) * (lightPosition - worldPos));
-    float shadow = calcShadow(distortedUv, tanLightDir);
+    float shadow = 1.0;
+
+    if (shadowFade > 0.0) {
+        vec3 tanLightDir = normalize(computeTBN(uv) * (lightPosition - worldPos));
+        shadow = mix(1.0, calcShadow(distortedUv, tanLightDir), shadowFade);
+    }
+
+#ifdef SHADOW_CUBE
+    shadow *= cubeShadow();
+#endif
 
     outputColor += ambient;
     outputColor += diffuse * dc * attenuation * shadow;
     outputColor += specular * sc * attenuation * shadow;
+
+    // Note: the height-field self-shadow is only traced for the main light
+#ifdef CLUSTERED
+    outputColor += shadeClustered(diffuse, ks, alpha, N, V, gl_FragCoord.z);
+#endif
 }
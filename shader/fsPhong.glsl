@@ -4,11 +4,26 @@ in vec2 uv;
 in vec3 worldPos;
 in vec3 worldN;
 
-uniform sampler2D texBase, texNormal;
 uniform vec3 lightColor;
 uniform vec3 lightPosition;
 uniform vec3 eyePoint;
 
+#ifdef DRAW_MATERIAL
+// rgb: base color tint of the draw, a: its layer, see MeshArena
+flat in vec4 material;
+#endif
+
+#ifdef MATERIAL_ARRAY
+// every material is a layer of the arrays, see MaterialArray
+uniform sampler2DArray texBase, texNormal;
+#define TEX_BASE(st) texture(texBase, vec3(st, material.a))
+#define TEX_NORMAL(st) texture(texNormal, vec3(st, material.a))
+#else
+uniform sampler2D texBase, texNormal;
+#define TEX_BASE(st) texture(texBase, st)
+#define TEX_NORMAL(st) texture(texNormal, st)
+#endif
+
 out vec4 outputColor;
 
 // compute fragment normal from a normal map
@@ -17,7 +32,7 @@ out vec4 outputColor;
 // check the theory at https://learnopengl.com/Advanced-Lighting/Normal-Mapping
 vec3 getNormalFromMap()
 {
-    vec3 tangentNormal = texture(texNormal, uv).xyz * 2.0 - 1.0;
+    vec3 tangentNormal = TEX_NORMAL(uv).xyz * 2.0 - 1.0;
 
     vec3 Q1  = dFdx(worldPos);
     vec3 Q2  = dFdy(worldPos);
@@ -38,9 +53,97 @@ vec3 getNormalFromMap()
     return normalize(tbn * tangentNormal);
 }
 
+#ifdef CLUSTERED
+// point lights assigned to froxels on the cpu, see LightCluster
+uniform samplerBuffer clusterLights;
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterIndices;
+uniform ivec3 clusterDims;
+uniform vec2 clusterDepth;
+uniform vec4 clusterViewport;
+
+// (offset, count) of the light list of this fragment's froxel
+uvec2 getCluster(float windowDepth)
+{
+    float n = clusterDepth.x, f = clusterDepth.y;
+
+    // view distance from the window space depth
+    float zNdc = windowDepth * 2.0 - 1.0;
+    float depth = 2.0 * n * f / (f + n - zNdc * (f - n));
+
+    vec2 tile = (gl_FragCoord.xy - clusterViewport.xy) / clusterViewport.zw;
+    int slice = int(log(depth / n) / log(f / n) * float(clusterDims.z));
+
+    ivec3 c = ivec3(ivec2(tile * vec2(clusterDims.xy)), slice);
+    c = clamp(c, ivec3(0), clusterDims - 1);
+
+    return texelFetch(clusterGrid, (c.z * clusterDims.y + c.y) * clusterDims.x + c.x).xy;
+}
+
+// diffuse and specular from the lights of this fragment's froxel
+vec4 shadeClustered(vec4 diffuse, float ks, float alpha, vec3 N, vec3 V,
+                    float windowDepth)
+{
+    vec4 result = vec4(0);
+    uvec2 cluster = getCluster(windowDepth);
+
+    for (uint i = 0u; i < cluster.y; i++) {
+        int idx = int(texelFetch(clusterIndices, int(cluster.x + i)).r);
+        vec4 posRadius = texelFetch(clusterLights, idx * 2);
+        vec3 color = texelFetch(clusterLights, idx * 2 + 1).rgb;
+
+        vec3 L = posRadius.xyz - worldPos;
+        float dist = length(L);
+
+        if (dist > posRadius.w) {
+            continue;
+        }
+
+        L /= dist;
+        vec3 H = normalize(L + V);
+
+        // smooth window so that a light fades out at its radius
+        float falloff = clamp(1.0 - pow(dist / posRadius.w, 4.0), 0.0, 1.0);
+        float attenuation = falloff * falloff / (dist * dist + 1.0);
+
+        float dc = max(dot(N, L), 0.0);
+        float sc = pow(max(dot(H, N), 0.0), alpha);
+
+        result += diffuse * vec4(color, 1.0) * dc * attenuation;
+        result += vec4(color * ks, 0.0) * sc * attenuation;
+    }
+
+    return result;
+}
+#endif
+
+#ifdef SHADOW_CUBE
+// distances to the light of the static and the dynamic casters, see ShadowCube
+uniform samplerCubeShadow shadowStatic, shadowDynamic;
+// xyz: the light the cubes were rendered from, w: their range
+uniform vec4 shadowLight;
+
+// 1 where the point light reaches the fragment, 0 in a shadow
+float cubeShadow()
+{
+    // off the surface along its normal, against acne
+    vec3 d = worldPos + normalize(worldN) * 0.02 - shadowLight.xyz;
+    float ref = length(d) / shadowLight.w;
+
+    if (ref >= 1.0) {
+        return 1.0;
+    }
+
+    return min(texture(shadowStatic, vec4(d, ref)),
+               texture(shadowDynamic, vec4(d, ref)));
+}
+#endif
 
 void main(){
-    vec4 texColor = texture(texBase, uv) * 0.75;
+    vec4 texColor = TEX_BASE(uv) * 0.75;
+#ifdef DRAW_MATERIAL
+    texColor.rgb *= material.rgb;
+#endif
 
     vec3 N = getNormalFromMap();
     vec3 L = normalize(lightPosition - worldPos);
@@ -61,7 +164,16 @@ void main(){
     float dc = max(dot(N, L), 0.0);
     float sc = pow(max(dot(H, N), 0.0), alpha);
 
+    float shadow = 1.0;
+#ifdef SHADOW_CUBE
+    shadow = cubeShadow();
+#endif
+
     outputColor += ambient;
-    outputColor += diffuse * dc * attenuation;
-    outputColor += specular * sc * attenuation;
+    outputColor += diffuse * dc * attenuation * shadow;
+    outputColor += specular * sc * attenuation * shadow;
+
+#ifdef CLUSTERED
+    outputColor += shadeClustered(diffuse, ks, alpha, N, V, gl_FragCoord.z);
+#endif
 }
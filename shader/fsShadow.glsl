@@ -0,0 +1,12 @@
+#version 330
+
+in vec3 worldPos;
+
+uniform vec3 lightPosition;
+uniform float range;
+
+// distance to the light instead of the projected depth, so receivers
+// compare against their own distance in any direction
+void main(){
+    gl_FragDepth = length(worldPos - lightPosition) / range;
+}
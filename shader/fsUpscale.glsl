@@ -0,0 +1,36 @@
+#version 330
+
+// upscale of a dynamic resolution frame, see DynamicResolution
+
+in vec2 screenUv;
+
+uniform sampler2D source;
+// part of the source covered by the frame, and one source texel in uv
+uniform vec2 scale;
+uniform vec2 texel;
+uniform float sharpness;
+
+out vec4 outputColor;
+
+vec3 fetch(vec2 uv)
+{
+    // never filter in texels outside of the frame
+    return texture(source, clamp(uv, 0.5 * texel, scale - 0.5 * texel)).rgb;
+}
+
+void main(){
+    vec2 uv = screenUv * scale;
+
+    vec3 c = fetch(uv);
+    vec3 n = fetch(uv + vec2(0.0, texel.y));
+    vec3 s = fetch(uv - vec2(0.0, texel.y));
+    vec3 e = fetch(uv + vec2(texel.x, 0.0));
+    vec3 w = fetch(uv - vec2(texel.x, 0.0));
+
+    // unsharp mask, limited to the neighbours' range so edges do not ring
+    vec3 sharp = c + sharpness * (4.0 * c - n - s - e - w) * 0.25;
+    vec3 lo = min(c, min(min(n, s), min(e, w)));
+    vec3 hi = max(c, max(max(n, s), max(e, w)));
+
+    outputColor = vec4(clamp(sharp, lo, hi), 1.0);
+}
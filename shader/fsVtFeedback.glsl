@@ -0,0 +1,25 @@
+#version 330
+
+in vec2 uv;
+
+// size of level 0 in texels
+uniform float vtSize;
+// x: tile size, y: border, z: physical texture size, w: levels
+uniform vec4 vtPage;
+// log2 of how much smaller than the window the feedback buffer is
+uniform float vtBias;
+
+// page x, page y, level, 1 where something was drawn
+out uvec4 outputPage;
+
+void main(){
+    vec2 t = uv * vtSize;
+    vec2 dx = dFdx(t), dy = dFdy(t);
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy))) - vtBias;
+    int level = int(clamp(floor(lod), 0.0, vtPage.w - 1.0));
+
+    int pages = max(int(vtSize / vtPage.x) >> level, 1);
+    ivec2 page = ivec2(fract(uv) * float(pages));
+
+    outputPage = uvec4(uvec2(page), uint(level), 1u);
+}
@@ -0,0 +1,16 @@
+#version 330
+layout( points ) in;
+layout( points, max_vertices = 1 ) out;
+
+flat in int visible[];
+
+// captured by transform feedback, one per visible instance
+flat out uint instanceId;
+
+void main(){
+    if (visible[0] != 0) {
+        instanceId = uint(gl_PrimitiveIDIn);
+        EmitVertex();
+        EndPrimitive();
+    }
+}
@@ -0,0 +1,53 @@
+#version 330
+// copies each triangle into the layers of a layered framebuffer,
+// a camera and a light per layer, see MultiView
+
+// must match NUM_BATCH_VIEWS, max_vertices is 3 per view
+#define NUM_VIEWS 8
+layout( triangles ) in;
+layout( triangle_strip, max_vertices = 24 ) out;
+
+in vec2 vsUv[];
+in vec3 vsWorldPos[];
+in vec3 vsWorldN[];
+
+out vec2 uv;
+out vec3 worldPos;
+out vec3 worldN;
+flat out vec3 layerEye;
+flat out vec3 layerLight;
+
+uniform mat4 viewProjections[NUM_VIEWS];
+uniform vec3 eyes[NUM_VIEWS];
+uniform vec3 lights[NUM_VIEWS];
+uniform int nOfViews;
+
+void main(){
+    for (int v = 0; v < nOfViews; v++) {
+        vec4 clip[3];
+        for (int i = 0; i < 3; i++) {
+            clip[i] = viewProjections[v] * vec4(vsWorldPos[i], 1.0);
+        }
+
+        // skip the layers whose frustum the triangle is outside of
+        vec3 x = vec3(clip[0].x, clip[1].x, clip[2].x);
+        vec3 y = vec3(clip[0].y, clip[1].y, clip[2].y);
+        vec3 w = vec3(clip[0].w, clip[1].w, clip[2].w);
+        if (all(lessThan(x, -w)) || all(greaterThan(x, w)) ||
+            all(lessThan(y, -w)) || all(greaterThan(y, w))) {
+            continue;
+        }
+
+        for (int i = 0; i < 3; i++) {
+            gl_Layer = v;
+            gl_Position = clip[i];
+            uv = vsUv[i];
+            worldPos = vsWorldPos[i];
+            worldN = vsWorldN[i];
+            layerEye = eyes[v];
+            layerLight = lights[v];
+            EmitVertex();
+        }
+        EndPrimitive();
+    }
+}
@@ -0,0 +1,42 @@
+#version 330
+// copies each triangle onto the faces of a cube shadow map it touches,
+// see ShadowCube
+layout( triangles ) in;
+layout( triangle_strip, max_vertices = 18 ) out;
+
+in vec3 vsWorldPos[];
+
+out vec3 worldPos;
+
+// view projections of the faces, in the order of GL_TEXTURE_CUBE_MAP_*
+uniform mat4 faces[6];
+
+void main(){
+    for (int face = 0; face < 6; face++) {
+        vec4 clip[3];
+        for (int i = 0; i < 3; i++) {
+            clip[i] = faces[face] * vec4(vsWorldPos[i], 1.0);
+        }
+
+        // all three corners beyond one plane of the face's frustum
+        bool culled = false;
+        for (int axis = 0; axis < 3; axis++) {
+            culled = culled ||
+                     (clip[0][axis] < -clip[0].w && clip[1][axis] < -clip[1].w &&
+                      clip[2][axis] < -clip[2].w) ||
+                     (clip[0][axis] > clip[0].w && clip[1][axis] > clip[1].w &&
+                      clip[2][axis] > clip[2].w);
+        }
+        if (culled) {
+            continue;
+        }
+
+        for (int i = 0; i < 3; i++) {
+            gl_Layer = face;
+            worldPos = vsWorldPos[i];
+            gl_Position = clip[i];
+            EmitVertex();
+        }
+        EndPrimitive();
+    }
+}
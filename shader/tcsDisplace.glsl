@@ -0,0 +1,88 @@
+#version 400
+// tessellation of vsPOM.glsl's triangles for tesDisplace.glsl, edges are
+// split to about tessPixels on screen, patches out of view are dropped
+layout( vertices = 3 ) out;
+
+in vec2 uv[];
+in vec3 worldPos[];
+in vec3 worldN[];
+
+out vec2 tcsUv[];
+out vec3 tcsWorldPos[];
+out vec3 tcsWorldN[];
+
+uniform mat4 V, P;
+uniform vec2 viewport;
+uniform float tessPixels;
+
+// world units per uv unit of the whole object, the height map's depth
+// scales with it; one value, so patches sharing an edge displace it alike
+uniform float uvToWorld;
+
+// must match heightScale of fsPOM.glsl
+#define HEIGHT_SCALE 0.1
+
+vec2 toScreen(vec4 clip)
+{
+    return (clip.xy / clip.w * 0.5 + 0.5) * viewport;
+}
+
+float edgeLevel(vec4 a, vec4 b)
+{
+    // an edge reaching behind the eye has no screen length
+    if (a.w <= 0.0 || b.w <= 0.0) {
+        return float(gl_MaxTessGenLevel);
+    }
+
+    float pixels = distance(toScreen(a), toScreen(b));
+    return clamp(pixels / tessPixels, 1.0, float(gl_MaxTessGenLevel));
+}
+
+// all corners of the displaced patch beyond one frustum plane
+bool outside(vec4 c[6])
+{
+    for (int axis = 0; axis < 3; axis++) {
+        bool lo = true, hi = true;
+        for (int i = 0; i < 6; i++) {
+            lo = lo && c[i][axis] < -c[i].w;
+            hi = hi && c[i][axis] > c[i].w;
+        }
+        if (lo || hi) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void main(){
+    tcsUv[gl_InvocationID] = uv[gl_InvocationID];
+    tcsWorldPos[gl_InvocationID] = worldPos[gl_InvocationID];
+    tcsWorldN[gl_InvocationID] = worldN[gl_InvocationID];
+
+    if (gl_InvocationID != 0) {
+        return;
+    }
+
+    mat4 PV = P * V;
+    float depth = HEIGHT_SCALE * uvToWorld;
+
+    vec4 c[6];
+    for (int i = 0; i < 3; i++) {
+        c[i] = PV * vec4(worldPos[i], 1.0);
+        c[i + 3] = PV * vec4(worldPos[i] - normalize(worldN[i]) * depth, 1.0);
+    }
+
+    // a level of 0 discards the patch
+    if (outside(c)) {
+        gl_TessLevelOuter[0] = gl_TessLevelOuter[1] = gl_TessLevelOuter[2] = 0.0;
+        gl_TessLevelInner[0] = 0.0;
+        return;
+    }
+
+    // outer level i is the edge opposite to vertex i
+    gl_TessLevelOuter[0] = edgeLevel(c[1], c[2]);
+    gl_TessLevelOuter[1] = edgeLevel(c[2], c[0]);
+    gl_TessLevelOuter[2] = edgeLevel(c[0], c[1]);
+    gl_TessLevelInner[0] = max(gl_TessLevelOuter[0],
+                               max(gl_TessLevelOuter[1], gl_TessLevelOuter[2]));
+}
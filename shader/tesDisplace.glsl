@@ -0,0 +1,43 @@
+#version 400
+// vertices of tcsDisplace.glsl's patches pushed into the surface by the
+// height map, which is a depth map as in fsPOM.glsl
+layout( triangles, fractional_odd_spacing, ccw ) in;
+
+in vec2 tcsUv[];
+in vec3 tcsWorldPos[];
+in vec3 tcsWorldN[];
+
+out vec2 uv;
+out vec3 worldPos;
+out vec3 worldN;
+
+uniform mat4 V, P;
+uniform sampler2D texNormal, texHeight;
+
+// world units per uv unit of the object, see tcsDisplace.glsl
+uniform float uvToWorld;
+
+// must match heightScale of fsPOM.glsl
+#define HEIGHT_SCALE 0.1
+
+float sampleDepth(vec2 st)
+{
+#ifdef PACKED_NORMAL_HEIGHT
+    return textureLod(texNormal, st, 0.0).a;
+#else
+    return textureLod(texHeight, st, 0.0).r;
+#endif
+}
+
+void main(){
+    vec3 w = gl_TessCoord;
+
+    uv = w.x * tcsUv[0] + w.y * tcsUv[1] + w.z * tcsUv[2];
+    worldN = normalize(w.x * tcsWorldN[0] + w.y * tcsWorldN[1] +
+                       w.z * tcsWorldN[2]);
+
+    vec3 p = w.x * tcsWorldPos[0] + w.y * tcsWorldPos[1] + w.z * tcsWorldPos[2];
+    worldPos = p - worldN * sampleDepth(uv) * HEIGHT_SCALE * uvToWorld;
+
+    gl_Position = P * V * vec4(worldPos, 1.0);
+}
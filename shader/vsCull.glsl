@@ -0,0 +1,33 @@
+#version 330
+// instance data of GpuCuller: model matrix columns, bounding sphere
+layout( location = 0 ) in vec4 column0;
+layout( location = 1 ) in vec4 column1;
+layout( location = 2 ) in vec4 column2;
+layout( location = 3 ) in vec4 sphere;
+
+flat out int visible;
+
+// normalized, inside when dot(plane.xyz, p) + plane.w >= 0
+uniform vec4 planes[6];
+uniform vec3 eyePoint;
+
+// P[1][1] * 0.5 * viewport height / lodPixels, see Mesh::selectLod()
+uniform float lodScale;
+
+// object space errors of the level of this pass and of the next one
+uniform vec2 errorRange;
+
+void main(){
+    bool inside = true;
+    for (int i = 0; i < 6; i++) {
+        inside = inside && dot(planes[i].xyz, sphere.xyz) + planes[i].w >= -sphere.w;
+    }
+
+    float scale = max(length(column0.xyz), max(length(column1.xyz), length(column2.xyz)));
+    float dist = max(length(sphere.xyz - eyePoint) - sphere.w, 0.0);
+
+    // the coarsest level whose error projects to lodPixels at most
+    float error = dist / (scale * lodScale);
+
+    visible = (inside && errorRange.x <= error && error < errorRange.y) ? 1 : 0;
+}
@@ -0,0 +1,12 @@
+#version 330
+layout( location = 0 ) in vec3 vtxCoord;
+
+uniform mat4 M, V, P;
+
+// the same position as vsPhong.glsl and vsPOM.glsl,
+// so the main pass can use GL_EQUAL against this depth
+invariant gl_Position;
+
+void main(){
+    gl_Position = P * V * M * vec4( vtxCoord, 1.0 );
+}
@@ -5,17 +5,40 @@ layout( location = 2 ) in vec3 vtxN;
 layout( location = 3 ) in vec3 vtxT;
 layout( location = 4 ) in vec3 vtxB;
 
+#ifdef MULTI_VIEW
+// gsMultiView.glsl passes these on per layer under the names below
+#define uv vsUv
+#define worldPos vsWorldPos
+#define worldN vsWorldN
+#endif
+
 out vec2 uv;
 out vec3 worldPos;
 out vec3 worldN;
 // out vec3 tanViewPos;
 // out vec3 tanFragPos;
 
-uniform mat4 M, V, P;
+#ifdef INSTANCED
+// index into the instance data of GpuCuller, 5 texels per instance
+layout( location = 5 ) in uint instanceId;
+uniform samplerBuffer instances;
+#else
+uniform mat4 M;
+#endif
+uniform mat4 V, P;
+
+// must match vsDepth.glsl bit for bit for the GL_EQUAL depth test
+invariant gl_Position;
 uniform vec3 lightPosition;
 uniform vec3 eyePoint;
 
 void main(){
+#ifdef INSTANCED
+    int base = int(instanceId) * 5;
+    mat4 M = mat4(texelFetch(instances, base), texelFetch(instances, base + 1),
+                  texelFetch(instances, base + 2), texelFetch(instances, base + 3));
+#endif
+
     //projection plane
     gl_Position = P * V * M * vec4( vtxCoord, 1.0 );
 
@@ -7,9 +7,32 @@ out vec2 uv;
 out vec3 worldPos;
 out vec3 worldN;
 
-uniform mat4 M, V, P;
+#ifdef INSTANCED
+// index into the instance data of GpuCuller, 5 texels per instance
+layout( location = 5 ) in uint instanceId;
+uniform samplerBuffer instances;
+#ifdef DRAW_MATERIAL
+// 5th texel of a draw of MeshArena
+flat out vec4 material;
+#endif
+#else
+uniform mat4 M;
+#endif
+uniform mat4 V, P;
+
+// must match vsDepth.glsl bit for bit for the GL_EQUAL depth test
+invariant gl_Position;
 
 void main(){
+#ifdef INSTANCED
+    int base = int(instanceId) * 5;
+    mat4 M = mat4(texelFetch(instances, base), texelFetch(instances, base + 1),
+                  texelFetch(instances, base + 2), texelFetch(instances, base + 3));
+#ifdef DRAW_MATERIAL
+    material = texelFetch(instances, base + 4);
+#endif
+#endif
+
     //projection plane
     gl_Position = P * V * M * vec4( vtxCoord, 1.0 );
 
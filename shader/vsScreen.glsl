@@ -0,0 +1,12 @@
+#version 330
+
+// full-screen triangle without vertex buffers, draw with 3 vertices
+
+out vec2 screenUv;
+
+void main(){
+    vec2 pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+
+    screenUv = pos;
+    gl_Position = vec4(pos * 2.0 - 1.0, 0.0, 1.0);
+}
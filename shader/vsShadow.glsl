@@ -0,0 +1,11 @@
+#version 330
+layout( location = 0 ) in vec3 vtxCoord;
+
+uniform mat4 M;
+
+// world space, gsShadow.glsl projects it onto the cube faces
+out vec3 vsWorldPos;
+
+void main(){
+    vsWorldPos = (M * vec4( vtxCoord, 1.0 )).xyz;
+}
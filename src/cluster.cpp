@@ -0,0 +1,224 @@
+#include "cluster.h"
+#include "threadPool.h"
+#include "glState.h"
+#include "stats.h"
+
+LightCluster::LightCluster(int x, int y, int z) {
+  dimX = x;
+  dimY = y;
+  dimZ = z;
+  nearPlane = 0.01f;
+  farPlane = 1000.f;
+
+  unitLights = 15;
+  unitGrid = 16;
+  unitIndices = 17;
+
+  lists.resize(dimX * dimY * dimZ);
+
+  // Note: GL 3.3 only guarantees 65536 texels per texture buffer,
+  // desktop drivers offer far more
+  GLint maxTexels;
+  glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+  if (maxTexels < dimX * dimY * dimZ * 2) {
+    std::cout << "LightCluster: texture buffers are too small ("
+              << maxTexels << " texels)" << std::endl;
+  }
+
+  // buffers and the texture views of them
+  glGenBuffers(1, &bufLights);
+  glGenBuffers(1, &bufGrid);
+  glGenBuffers(1, &bufIndices);
+  glGenTextures(1, &tboLights);
+  glGenTextures(1, &tboGrid);
+  glGenTextures(1, &tboIndices);
+
+  upload();
+
+  glBindTexture(GL_TEXTURE_BUFFER, tboLights);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, bufLights);
+  glBindTexture(GL_TEXTURE_BUFFER, tboGrid);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, bufGrid);
+  glBindTexture(GL_TEXTURE_BUFFER, tboIndices);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, bufIndices);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+LightCluster::~LightCluster() {
+  glDeleteTextures(1, &tboLights);
+  glDeleteTextures(1, &tboGrid);
+  glDeleteTextures(1, &tboIndices);
+  frameStats.releaseBuffer(bufLights);
+  frameStats.releaseBuffer(bufGrid);
+  frameStats.releaseBuffer(bufIndices);
+  glDeleteBuffers(1, &bufLights);
+  glDeleteBuffers(1, &bufGrid);
+  glDeleteBuffers(1, &bufIndices);
+}
+
+// view distance of the near side of slice k,
+// slices are exponential so that froxels keep a similar shape
+float LightCluster::sliceDepth(int k) {
+  return nearPlane * pow(farPlane / nearPlane, float(k) / dimZ);
+}
+
+void LightCluster::build(vector<PointLight> &lights, mat4 V, mat4 P, float n,
+                         float f) {
+  nearPlane = n;
+  farPlane = f;
+
+  int nOfLights = lights.size();
+
+  // world space data for the shaders,
+  // view space spheres for the assignment
+  aLights.resize(nOfLights * 2);
+  vector<vec4> viewLights(nOfLights);
+
+  for (int i = 0; i < nOfLights; i++) {
+    PointLight &l = lights[i];
+    aLights[i * 2 + 0] = vec4(l.pos, l.radius);
+    aLights[i * 2 + 1] = vec4(l.color, 0.f);
+    viewLights[i] = vec4(vec3(V * vec4(l.pos, 1.f)), l.radius);
+  }
+
+  // each task owns whole depth slices, so no locking is needed
+  threadPool.parallelFor(dimZ, [&](size_t begin, size_t end) {
+    assignSlices(viewLights, P, begin, end);
+  });
+
+  // compact the lists: (offset, count) per froxel
+  int nOfClusters = dimX * dimY * dimZ;
+  aGrid.resize(nOfClusters * 2);
+
+  GLuint offset = 0;
+  for (int i = 0; i < nOfClusters; i++) {
+    GLuint count = lists[i].size();
+    aGrid[i * 2 + 0] = offset;
+    aGrid[i * 2 + 1] = count;
+    offset += count;
+  }
+
+  aIndices.resize(offset);
+
+  threadPool.parallelFor(nOfClusters, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      std::copy(lists[i].begin(), lists[i].end(),
+                aIndices.begin() + aGrid[i * 2 + 0]);
+    }
+  }, 64);
+
+  upload();
+}
+
+void LightCluster::assignSlices(vector<vec4> &viewLights, mat4 &P,
+                                size_t zBegin, size_t zEnd) {
+  int nOfLights = viewLights.size();
+
+  for (size_t z = zBegin; z < zEnd; z++) {
+    float d0 = sliceDepth(z);
+    float d1 = sliceDepth(z + 1);
+
+    for (int y = 0; y < dimY; y++) {
+      for (int x = 0; x < dimX; x++) {
+        lists[(z * dimY + y) * dimX + x].clear();
+      }
+    }
+
+    for (int i = 0; i < nOfLights; i++) {
+      vec3 c = vec3(viewLights[i]);
+      float r = viewLights[i].w;
+      float depth = -c.z;
+
+      // outside of this slice
+      if (depth + r < d0 || depth - r > d1) {
+        continue;
+      }
+
+      // the part of the light's bounding box inside this slice
+      float dn = glm::max(d0, depth - r);
+      float df = glm::min(d1, depth + r);
+
+      // x / d and y / d reach their extremes at the corners of the box
+      float xs[2] = {c.x - r, c.x + r};
+      float ys[2] = {c.y - r, c.y + r};
+      float ds[2] = {dn, df};
+      vec2 ndcMin(1e10f), ndcMax(-1e10f);
+
+      for (int a = 0; a < 2; a++) {
+        for (int b = 0; b < 2; b++) {
+          vec2 ndc(P[0][0] * xs[a] / ds[b], P[1][1] * ys[a] / ds[b]);
+          ndcMin = glm::min(ndcMin, ndc);
+          ndcMax = glm::max(ndcMax, ndc);
+        }
+      }
+
+      if (ndcMax.x < -1.f || ndcMin.x > 1.f || ndcMax.y < -1.f ||
+          ndcMin.y > 1.f) {
+        continue;
+      }
+
+      int x0 = glm::clamp(int((ndcMin.x * 0.5f + 0.5f) * dimX), 0, dimX - 1);
+      int x1 = glm::clamp(int((ndcMax.x * 0.5f + 0.5f) * dimX), 0, dimX - 1);
+      int y0 = glm::clamp(int((ndcMin.y * 0.5f + 0.5f) * dimY), 0, dimY - 1);
+      int y1 = glm::clamp(int((ndcMax.y * 0.5f + 0.5f) * dimY), 0, dimY - 1);
+
+      for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++) {
+          lists[(z * dimY + y) * dimX + x].push_back(i);
+        }
+      }
+    }
+  }
+}
+
+void LightCluster::upload() {
+  // an empty buffer can not back a texture buffer
+  if (aLights.empty()) {
+    aLights.push_back(vec4(0.f));
+  }
+  if (aGrid.empty()) {
+    aGrid.resize(dimX * dimY * dimZ * 2, 0);
+  }
+  if (aIndices.empty()) {
+    aIndices.push_back(0);
+  }
+
+  // glBufferData orphans the storage of the previous frame
+  glBindBuffer(GL_TEXTURE_BUFFER, bufLights);
+  glBufferData(GL_TEXTURE_BUFFER, sizeof(vec4) * aLights.size(),
+               aLights.data(), GL_STREAM_DRAW);
+
+  glBindBuffer(GL_TEXTURE_BUFFER, bufGrid);
+  glBufferData(GL_TEXTURE_BUFFER, sizeof(GLuint) * aGrid.size(), aGrid.data(),
+               GL_STREAM_DRAW);
+
+  glBindBuffer(GL_TEXTURE_BUFFER, bufIndices);
+  glBufferData(GL_TEXTURE_BUFFER, sizeof(GLuint) * aIndices.size(),
+               aIndices.data(), GL_STREAM_DRAW);
+
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+  frameStats.setBuffer(bufLights, sizeof(vec4) * aLights.size());
+  frameStats.setBuffer(bufGrid, sizeof(GLuint) * aGrid.size());
+  frameStats.setBuffer(bufIndices, sizeof(GLuint) * aIndices.size());
+}
+
+// bind the texture buffers and set the uniforms of the current program
+void LightCluster::setUniforms(GLint uniLights, GLint uniGrid,
+                               GLint uniIndices, GLint uniDims,
+                               GLint uniDepth, GLint uniViewport) {
+  glState.bindTexture(unitLights, GL_TEXTURE_BUFFER, tboLights);
+  glState.bindTexture(unitGrid, GL_TEXTURE_BUFFER, tboGrid);
+  glState.bindTexture(unitIndices, GL_TEXTURE_BUFFER, tboIndices);
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+
+  glState.uniform1i(uniLights, unitLights);
+  glState.uniform1i(uniGrid, unitGrid);
+  glState.uniform1i(uniIndices, unitIndices);
+  glState.uniform3i(uniDims, dimX, dimY, dimZ);
+  glState.uniform2f(uniDepth, nearPlane, farPlane);
+  glState.uniform4f(uniViewport,
+                    vec4(viewport[0], viewport[1], viewport[2], viewport[3]));
+}
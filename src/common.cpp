@@ -1,4 +1,12 @@
 #include "common.h"
+#include "shaderQueue.h"
+#include "glState.h"
+#include "cluster.h"
+#include "meshLod.h"
+#include "dynamicMesh.h"
+#include "virtualTexture.h"
+#include "shadowMap.h"
+#include "stats.h"
 
 std::string readFile(const std::string fileName) {
   std::ifstream in;
@@ -28,64 +36,120 @@ GLuint buildShader(string vsDir, string fsDir) {
 }
 
 GLuint compileShader(string fileName, GLenum type) {
+  GLuint objShader = submitShader(fileName, type);
+
+  if (objShader == 0 || !checkShader(objShader, fileName)) {
+    glDeleteShader(objShader);
+    return 0;
+  }
+
+  return objShader;
+}
+
+GLuint linkShader(GLuint vsObj, GLuint fsObj) {
+  vector<GLuint> objs = {vsObj, fsObj};
+  GLuint exe = submitProgram(objs);
+
+  if (!checkProgram(exe)) {
+    glDeleteProgram(exe);
+    return 0;
+  }
+
+  return exe;
+}
+
+// only hand the source to the driver,
+// the compile status is queried later by checkShader()
+// defines are inserted right after the #version line
+GLuint submitShader(string fileName, GLenum type, string defines) {
   /* read source code */
   string sTemp = readFile(fileName);
-  string info;
-  const GLchar *source = sTemp.c_str();
 
-  switch (type) {
-  case GL_VERTEX_SHADER:
-    info = "Vertex";
-    break;
-  case GL_FRAGMENT_SHADER:
-    info = "Fragment";
-    break;
+  if (sTemp.empty()) {
+    std::cout << fileName << " : Can't read shader source file." << std::endl;
+    return 0;
   }
 
-  if (source == NULL) {
-    std::cout << info << " Shader : Can't read shader source file."
-              << std::endl;
-    return 0;
+  if (!defines.empty()) {
+    size_t pos = sTemp.find('\n');
+    pos = (pos == string::npos) ? sTemp.size() : pos + 1;
+    sTemp.insert(pos, defines);
   }
 
+  const GLchar *source = sTemp.c_str();
+
   const GLchar *sources[] = {source};
   GLuint objShader = glCreateShader(type);
   glShaderSource(objShader, 1, sources, NULL);
   glCompileShader(objShader);
 
-  GLint compile_ok;
-  glGetShaderiv(objShader, GL_COMPILE_STATUS, &compile_ok);
-  if (compile_ok == GL_FALSE) {
-    std::cout << info << " Shader : Fail to compile." << std::endl;
-    printLog(objShader);
-    glDeleteShader(objShader);
-    return 0;
-  }
-
   return objShader;
 }
 
-GLuint linkShader(GLuint vsObj, GLuint fsObj) {
-  GLuint exe;
-  GLint linkOk;
+// only issue the link,
+// the link status is queried later by checkProgram()
+GLuint submitProgram(vector<GLuint> &objs, vector<string> varyings) {
+  GLuint exe = glCreateProgram();
+
+  for (size_t i = 0; i < objs.size(); i++) {
+    glAttachShader(exe, objs[i]);
+  }
+
+  // transform feedback outputs, interleaved into a single buffer
+  if (!varyings.empty()) {
+    vector<const GLchar *> names;
+    for (size_t i = 0; i < varyings.size(); i++) {
+      names.push_back(varyings[i].c_str());
+    }
+    glTransformFeedbackVaryings(exe, names.size(), names.data(),
+                                GL_INTERLEAVED_ATTRIBS);
+  }
 
-  exe = glCreateProgram();
-  glAttachShader(exe, vsObj);
-  glAttachShader(exe, fsObj);
   glLinkProgram(exe);
 
-  // check result
+  return exe;
+}
+
+// Note: querying GL_COMPILE_STATUS waits for the driver to finish compiling
+bool checkShader(GLuint objShader, string info) {
+  GLint compileOk;
+  glGetShaderiv(objShader, GL_COMPILE_STATUS, &compileOk);
+
+  if (compileOk == GL_FALSE) {
+    std::cout << info << " : Fail to compile." << std::endl;
+    printLog(objShader);
+    return false;
+  }
+
+  return true;
+}
+
+// Note: querying GL_LINK_STATUS waits for the driver to finish linking
+bool checkProgram(GLuint exe) {
+  GLint linkOk;
   glGetProgramiv(exe, GL_LINK_STATUS, &linkOk);
 
   if (linkOk == GL_FALSE) {
     std::cout << "Failed to link shader program." << std::endl;
     printLog(exe);
-    glDeleteProgram(exe);
+    return false;
+  }
 
-    return 0;
+  return true;
+}
+
+bool hasExtension(const string name) {
+  GLint nOfExts = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &nOfExts);
+
+  for (GLint i = 0; i < nOfExts; i++) {
+    const char *ext = (const char *)glGetStringi(GL_EXTENSIONS, i);
+    if (ext && name == ext) {
+      return true;
+    }
   }
 
-  return exe;
+  return false;
 }
 
 void printLog(GLuint &object) {
@@ -246,7 +310,7 @@ void drawBox(vec3 min, vec3 max) {
   // prepare buffers to draw
   GLuint vao;
   glGenVertexArrays(1, &vao);
-  glBindVertexArray(vao);
+  glState.bindVao(vao);
 
   GLuint vboVtx;
   glGenBuffers(1, &vboVtx);
@@ -272,35 +336,223 @@ void drawBox(vec3 min, vec3 max) {
   for (size_t i = 0; i < 6; i++) {
     glDrawElements(GL_LINE_LOOP, 4, GL_UNSIGNED_SHORT,
                    (GLvoid *)(sizeof(GLushort) * 4 * i));
+    frameStats.draw(GL_LINE_LOOP, 4);
   }
 
   glDeleteBuffers(1, &vboVtx);
   // glDeleteBuffers(1, &vboColor);
   glDeleteBuffers(1, &ibo);
-  glDeleteVertexArrays(1, &vao);
+  glState.deleteVaos(1, &vao);
 }
 
 /* Mesh class */
-Mesh::Mesh(const string fileName) {
+Mesh::Mesh(const string fileName, bool withGL) {
+  hasGL = withGL;
+  dynamic = NULL;
+  lods = NULL;
+  ibo = 0;
+  lodIndex = 0;
+  lodPixels = 1.f;
+
   loadObj(fileName);
-  initBuffers();
+  findAABB();
+  if (hasGL) {
+    initBuffers();
+  }
   initShader();
-  initUniform();
 }
 
 Mesh::~Mesh() {
+  delete lods;
+  delete dynamic;
+  shaderQueue.remove(program);
+
+  if (!hasGL) {
+    return;
+  }
+
   glDeleteBuffers(1, &vboVtxs);
   glDeleteBuffers(1, &vboUvs);
   glDeleteBuffers(1, &vboNormals);
-  glDeleteVertexArrays(1, &vao);
+  glState.deleteVaos(1, &vao);
+  frameStats.releaseBuffer(vboVtxs);
+  frameStats.releaseBuffer(vboUvs);
+  frameStats.releaseBuffer(vboNormals);
+
+  if (ibo != 0) {
+    glDeleteBuffers(1, &ibo);
+    frameStats.releaseBuffer(ibo);
+  }
 }
 
+// the program is compiled in the background,
+// uniforms are located again whenever a new build is ready
 void Mesh::initShader() {
-  shader = buildShader("./shader/vsPhong.glsl", "./shader/fsPhong.glsl");
+  shader = 0;
+  parallax = false;
+  packed = false;
+  displaced = false;
+  tessPixels = 8.f;
+  uvToWorld = 1.f;
+  uniViewport = uniTessPixels = uniUvToWorld = -1;
+  lodLevel = 0.f;
+  uniTexHeight = uniLodLevel = -1;
+  cluster = NULL;
+  uniClusterLights = uniClusterGrid = uniClusterIndices = -1;
+  uniClusterDims = uniClusterDepth = uniClusterViewport = -1;
+  shadow = NULL;
+  uniShadowStatic = uniShadowDynamic = uniShadowLight = -1;
+  instanced = false;
+  uniInstances = -1;
+
+  if (!hasGL) {
+    program = -1;
+    return;
+  }
+
+  program = shaderQueue.submit("./shader/vsPhong.glsl", "./shader/fsPhong.glsl",
+                               [this](GLuint exe) {
+                                 shader = exe;
+                                 initUniform();
+                               });
+}
+
+// switch to the shader variant looping over clustered point lights
+void Mesh::setCluster(LightCluster *c) {
+  cluster = c;
+  shaderQueue.setDefines(program, shaderDefines());
+}
+
+// switch to the shader variant shadowing the point light with s
+void Mesh::setShadow(ShadowCube *s) {
+  shadow = s;
+  shaderQueue.setDefines(program, shaderDefines());
+}
+
+// switch to the shader variant reading the model matrix per instance
+void Mesh::setInstanced(bool i) {
+  instanced = i;
+  shaderQueue.setDefines(program, shaderDefines());
+}
+
+// sample the height from the alpha of the normal map, see packedMaterial.h
+void Mesh::setPacked(bool p) {
+  packed = p;
+  shaderQueue.setDefines(program, shaderDefines());
+}
+
+string Mesh::shaderDefines() {
+  string defines;
+
+  if (cluster) {
+    defines += "#define CLUSTERED\n";
+  }
+  if (shadow) {
+    defines += "#define SHADOW_CUBE\n";
+  }
+  if (instanced) {
+    defines += "#define INSTANCED\n";
+  }
+  if (packed) {
+    defines += "#define PACKED_NORMAL_HEIGHT\n";
+  }
+  if (displaced) {
+    defines += "#define DISPLACEMENT\n";
+  }
+
+  return defines;
+}
+
+// the POM program, with the tessellation stages when displaced; the
+// triangles are drawn as patches of 3, GL_PATCH_VERTICES' default
+static vector<ShaderStage> pomStages(bool displaced) {
+  if (!displaced) {
+    return {{GL_VERTEX_SHADER, "./shader/vsPOM.glsl"},
+            {GL_FRAGMENT_SHADER, "./shader/fsPOM.glsl"}};
+  }
+
+  return {{GL_VERTEX_SHADER, "./shader/vsPOM.glsl"},
+          {GL_TESS_CONTROL_SHADER, "./shader/tcsDisplace.glsl"},
+          {GL_TESS_EVALUATION_SHADER, "./shader/tesDisplace.glsl"},
+          {GL_FRAGMENT_SHADER, "./shader/fsPOM.glsl"}};
+}
+
+// viewport, edge length and displacement scale of the tessellation stages;
+// the scale is one per object, so both sides of a shared edge move alike
+static void setTessUniforms(GLint uniViewport, GLint uniTessPixels,
+                            GLint uniUvToWorld, float tessPixels,
+                            float uvToWorld, mat4 M) {
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+
+  // the average scale of M, in world units per object unit
+  float scale = std::cbrt(std::abs(determinant(mat3(M))));
+
+  glState.uniform2f(uniViewport, viewport[2], viewport[3]);
+  glState.uniform1f(uniTessPixels, tessPixels);
+  glState.uniform1f(uniUvToWorld, uvToWorld * scale);
+}
+
+// object units per uv unit over all triangles of a mesh, from the total
+// lengths of their edges
+static float uvToWorldRatio(const vector<vec3> &p, const vector<vec2> &t) {
+  float worldLength = 0.f, uvLength = 0.f;
+
+  for (size_t i = 0; i + 2 < p.size(); i += 3) {
+    for (int e = 0; e < 3; e++) {
+      int a = i + e, b = i + (e + 1) % 3;
+      worldLength += distance(p[a], p[b]);
+      uvLength += distance(t[a], t[b]);
+    }
+  }
+
+  return uvLength > 0.f ? worldLength / uvLength : 1.f;
+}
+
+// switch between the POM program (needs a height map) and plain normal mapping
+void Mesh::setParallax(bool p) {
+  if (parallax == p) {
+    return;
+  }
+
+  parallax = p;
+
+  vector<ShaderStage> stages;
+  if (parallax) {
+    stages = pomStages(false);
+  } else {
+    stages = {{GL_VERTEX_SHADER, "./shader/vsPhong.glsl"},
+              {GL_FRAGMENT_SHADER, "./shader/fsPhong.glsl"}};
+  }
+
+  displaced = false;
+  shaderQueue.programs[program].defines = shaderDefines();
+  shaderQueue.setStages(program, stages);
+}
+
+// displace the POM surface with tessellation (GL 4.0) instead of marching
+// the height map per fragment, needs the height map like setParallax()
+void Mesh::setDisplacement(bool d) {
+  parallax = true;
+  displaced = d;
+
+  if (displaced) {
+    vector<vec3> p;
+    vector<vec2> t;
+    for (Face &f : faces) {
+      p.insert(p.end(), {vertices[f.v1], vertices[f.v2], vertices[f.v3]});
+      t.insert(t.end(), {uvs[f.vt1], uvs[f.vt2], uvs[f.vt3]});
+    }
+    uvToWorld = uvToWorldRatio(p, t);
+  }
+
+  // one rebuild for the stages and the defines
+  shaderQueue.programs[program].defines = shaderDefines();
+  shaderQueue.setStages(program, pomStages(displaced));
 }
 
 void Mesh::initUniform() {
-  uniModel = myGetUniformLocation(shader, "M");
+  uniModel = instanced ? -1 : myGetUniformLocation(shader, "M");
   uniView = myGetUniformLocation(shader, "V");
   uniProjection = myGetUniformLocation(shader, "P");
   uniEyePoint = myGetUniformLocation(shader, "eyePoint");
@@ -308,6 +560,36 @@ void Mesh::initUniform() {
   uniLightPosition = myGetUniformLocation(shader, "lightPosition");
   uniTexBase = myGetUniformLocation(shader, "texBase");
   uniTexNormal = myGetUniformLocation(shader, "texNormal");
+
+  if (parallax) {
+    uniTexHeight = myGetUniformLocation(shader, "texHeight");
+    uniLodLevel = myGetUniformLocation(shader, "lodLevel");
+  }
+
+  if (displaced) {
+    uniViewport = myGetUniformLocation(shader, "viewport");
+    uniTessPixels = myGetUniformLocation(shader, "tessPixels");
+    uniUvToWorld = myGetUniformLocation(shader, "uvToWorld");
+  }
+
+  if (cluster) {
+    uniClusterLights = myGetUniformLocation(shader, "clusterLights");
+    uniClusterGrid = myGetUniformLocation(shader, "clusterGrid");
+    uniClusterIndices = myGetUniformLocation(shader, "clusterIndices");
+    uniClusterDims = myGetUniformLocation(shader, "clusterDims");
+    uniClusterDepth = myGetUniformLocation(shader, "clusterDepth");
+    uniClusterViewport = myGetUniformLocation(shader, "clusterViewport");
+  }
+
+  if (shadow) {
+    uniShadowStatic = myGetUniformLocation(shader, "shadowStatic");
+    uniShadowDynamic = myGetUniformLocation(shader, "shadowDynamic");
+    uniShadowLight = myGetUniformLocation(shader, "shadowLight");
+  }
+
+  if (instanced) {
+    uniInstances = myGetUniformLocation(shader, "instances");
+  }
 }
 
 void Mesh::loadObj(const string fileName) {
@@ -404,7 +686,50 @@ void Mesh::initBuffers() {
   GLfloat *aUvs = new GLfloat[nOfFaces * 3 * 2];
   GLfloat *aNormals = new GLfloat[nOfFaces * 3 * 3];
 
-  for (size_t i = 0; i < nOfFaces; i++) {
+  expandFaces(aVtxCoords, aUvs, aNormals);
+
+  // vao
+  glGenVertexArrays(1, &vao);
+  glState.bindVao(vao);
+
+  // vbo for vertex
+  glGenBuffers(1, &vboVtxs);
+  glBindBuffer(GL_ARRAY_BUFFER, vboVtxs);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * nOfFaces * 3 * 3, aVtxCoords,
+               GL_STATIC_DRAW);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+  glEnableVertexAttribArray(0);
+
+  // vbo for texture
+  glGenBuffers(1, &vboUvs);
+  glBindBuffer(GL_ARRAY_BUFFER, vboUvs);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * nOfFaces * 3 * 2, aUvs,
+               GL_STATIC_DRAW);
+  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
+  glEnableVertexAttribArray(1);
+
+  // vbo for normal
+  glGenBuffers(1, &vboNormals);
+  glBindBuffer(GL_ARRAY_BUFFER, vboNormals);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * nOfFaces * 3 * 3, aNormals,
+               GL_STATIC_DRAW);
+  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, 0);
+  glEnableVertexAttribArray(2);
+
+  frameStats.setBuffer(vboVtxs, sizeof(GLfloat) * nOfFaces * 3 * 3);
+  frameStats.setBuffer(vboUvs, sizeof(GLfloat) * nOfFaces * 3 * 2);
+  frameStats.setBuffer(vboNormals, sizeof(GLfloat) * nOfFaces * 3 * 3);
+
+  // delete client data
+  delete[] aVtxCoords;
+  delete[] aUvs;
+  delete[] aNormals;
+}
+
+// 3 vertices per face, each with its own position, uv and normal
+void Mesh::expandFaces(GLfloat *aVtxCoords, GLfloat *aUvs,
+                       GLfloat *aNormals) {
+  for (size_t i = 0; i < faces.size(); i++) {
     // vertex 1
     int vtxIdx = faces[i].v1;
     aVtxCoords[i * 9 + 0] = vertices[vtxIdx].x;
@@ -456,39 +781,6 @@ void Mesh::initBuffers() {
     aUvs[i * 6 + 4] = uvs[uvIdx].x;
     aUvs[i * 6 + 5] = uvs[uvIdx].y;
   }
-
-  // vao
-  glGenVertexArrays(1, &vao);
-  glBindVertexArray(vao);
-
-  // vbo for vertex
-  glGenBuffers(1, &vboVtxs);
-  glBindBuffer(GL_ARRAY_BUFFER, vboVtxs);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * nOfFaces * 3 * 3, aVtxCoords,
-               GL_STATIC_DRAW);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-  glEnableVertexAttribArray(0);
-
-  // vbo for texture
-  glGenBuffers(1, &vboUvs);
-  glBindBuffer(GL_ARRAY_BUFFER, vboUvs);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * nOfFaces * 3 * 2, aUvs,
-               GL_STATIC_DRAW);
-  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
-  glEnableVertexAttribArray(1);
-
-  // vbo for normal
-  glGenBuffers(1, &vboNormals);
-  glBindBuffer(GL_ARRAY_BUFFER, vboNormals);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * nOfFaces * 3 * 3, aNormals,
-               GL_STATIC_DRAW);
-  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, 0);
-  glEnableVertexAttribArray(2);
-
-  // delete client data
-  delete[] aVtxCoords;
-  delete[] aUvs;
-  delete[] aNormals;
 }
 
 void Mesh::setTexture(GLuint &tbo, int texUnit, const string texDir,
@@ -504,68 +796,248 @@ void Mesh::setTexture(GLuint &tbo, int texUnit, const string texDir,
                FreeImage_GetHeight(texImage), 0, GL_BGR, GL_UNSIGNED_BYTE,
                (void *)FreeImage_GetBits(texImage));
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  frameStats.setTexture(tbo, (size_t)FreeImage_GetWidth(texImage) *
+                                 FreeImage_GetHeight(texImage) * 3);
 
   // release
   FreeImage_Unload(texImage);
 }
 
+// unitHeight is only used by the POM program, see setParallax()
 void Mesh::draw(mat4 M, mat4 V, mat4 P, vec3 eye, vec3 lightColor,
-                vec3 lightPosition, int unitBaseColor, int unitNormal) {
-  glUseProgram(shader);
+                vec3 lightPosition, int unitBaseColor, int unitNormal,
+                int unitHeight) {
+  if (!useProgram(M, V, P, eye, lightColor, lightPosition, unitBaseColor,
+                  unitNormal, unitHeight)) {
+    return;
+  }
+
+  selectLod(M, V, P);
+  drawGeometry(displaced ? GL_PATCHES : GL_TRIANGLES);
+}
+
+// bind the program and set its uniforms, false if it is not ready yet
+bool Mesh::useProgram(mat4 M, mat4 V, mat4 P, vec3 eye, vec3 lightColor,
+                      vec3 lightPosition, int unitBaseColor, int unitNormal,
+                      int unitHeight) {
+  if (shader == 0) {
+    return false;
+  }
 
-  glUniformMatrix4fv(uniModel, 1, GL_FALSE, value_ptr(M));
-  glUniformMatrix4fv(uniView, 1, GL_FALSE, value_ptr(V));
-  glUniformMatrix4fv(uniProjection, 1, GL_FALSE, value_ptr(P));
+  // only the uniforms that differ from the last draw are uploaded
+  glState.useProgram(shader);
 
-  glUniform3fv(uniEyePoint, 1, value_ptr(eye));
+  glState.uniformMatrix4f(uniModel, M);
+  glState.uniformMatrix4f(uniView, V);
+  glState.uniformMatrix4f(uniProjection, P);
 
-  glUniform3fv(uniLightColor, 1, value_ptr(lightColor));
-  glUniform3fv(uniLightPosition, 1, value_ptr(lightPosition));
+  glState.uniform3f(uniEyePoint, eye);
 
-  glUniform1i(uniTexBase, unitBaseColor); // change base color
-  glUniform1i(uniTexNormal, unitNormal);  // change normal
+  glState.uniform3f(uniLightColor, lightColor);
+  glState.uniform3f(uniLightPosition, lightPosition);
 
-  glBindVertexArray(vao);
-  glDrawArrays(GL_TRIANGLES, 0, faces.size() * 3);
+  glState.uniform1i(uniTexBase, unitBaseColor); // change base color
+  glState.uniform1i(uniTexNormal, unitNormal);  // change normal
+
+  if (parallax && unitHeight >= 0) {
+    glState.uniform1i(uniTexHeight, unitHeight); // change height map
+    glState.uniform1f(uniLodLevel, lodLevel);
+  }
+
+  if (displaced) {
+    setTessUniforms(uniViewport, uniTessPixels, uniUvToWorld, tessPixels,
+                    uvToWorld, M);
+  }
+
+  if (cluster) {
+    cluster->setUniforms(uniClusterLights, uniClusterGrid, uniClusterIndices,
+                         uniClusterDims, uniClusterDepth, uniClusterViewport);
+  }
+
+  if (shadow) {
+    shadow->setUniforms(uniShadowStatic, uniShadowDynamic, uniShadowLight);
+  }
+
+  return true;
 }
 
-void Mesh::translate(glm::vec3 xyz) {
-  // move each vertex with xyz
-  for (size_t i = 0; i < vertices.size(); i++) {
-    vertices[i] += xyz;
+// draw with whatever program is in use, e.g. by a G-buffer pass,
+// GL_PATCHES for programs with tessellation stages
+void Mesh::drawGeometry(GLenum mode) {
+  // vertices edited since the last draw
+  if (dynamic) {
+    dynamic->upload();
+  }
+
+  glState.bindVao(vao);
+
+  if (lods) {
+    LodLevel &level = lods->levels[lodIndex];
+    glDrawElements(mode, level.count, GL_UNSIGNED_INT,
+                   (GLvoid *)(sizeof(GLuint) * level.offset));
+    frameStats.draw(mode, level.count);
+  } else {
+    glDrawArrays(mode, 0, faces.size() * 3);
+    frameStats.draw(mode, faces.size() * 3);
+  }
+}
+
+// source the per instance index (attribute 5) from vbo
+void Mesh::setInstanceIds(GLuint vbo) {
+  glState.bindVao(vao);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glVertexAttribIPointer(5, 1, GL_UNSIGNED_INT, 0, 0);
+  glVertexAttribDivisor(5, 1);
+  glEnableVertexAttribArray(5);
+}
+
+// keep the vertex buffers in a DynamicMesh of the mesh's own, edits are
+// uploaded as ranges by drawGeometry()
+void Mesh::setDynamic(bool d) {
+  delete dynamic;
+  dynamic = d && hasGL ? new DynamicMesh(this) : NULL;
+}
+
+// simplify the mesh, no GL calls so it may run on a worker thread,
+// initLodBuffers() must follow on the GL thread
+void Mesh::buildLods() {
+  delete lods;
+  lods = new LodChain();
+  lods->build(this);
+}
+
+// replace the triangle soup with the welded vertices and the index chain
+void Mesh::initLodBuffers() {
+  glState.bindVao(vao);
+
+  glBindBuffer(GL_ARRAY_BUFFER, vboVtxs);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * lods->vtxs.size(),
+               lods->vtxs.data(), GL_STATIC_DRAW);
+
+  glBindBuffer(GL_ARRAY_BUFFER, vboUvs);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(vec2) * lods->uvs.size(),
+               lods->uvs.data(), GL_STATIC_DRAW);
+
+  glBindBuffer(GL_ARRAY_BUFFER, vboNormals);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * lods->nms.size(),
+               lods->nms.data(), GL_STATIC_DRAW);
+
+  // the element buffer binding is part of the vao
+  glGenBuffers(1, &ibo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * lods->indices.size(),
+               lods->indices.data(), GL_STATIC_DRAW);
+
+  glState.bindVao(0);
+
+  frameStats.setBuffer(vboVtxs, sizeof(vec3) * lods->vtxs.size());
+  frameStats.setBuffer(vboUvs, sizeof(vec2) * lods->uvs.size());
+  frameStats.setBuffer(vboNormals, sizeof(vec3) * lods->nms.size());
+  frameStats.setBuffer(ibo, sizeof(GLuint) * lods->indices.size());
+
+  // the buffers are in the order of the welded vertices now
+  if (dynamic) {
+    setDynamic(true);
+  }
+}
+
+// pick the coarsest level whose error projects to at most lodPixels,
+// all passes of a frame get the same level for the same matrices
+void Mesh::selectLod(mat4 M, mat4 V, mat4 P) {
+  lodIndex = 0;
+
+  if (!lods || lodPixels <= 0.f) {
+    return;
+  }
+
+  float scale = glm::max(length(vec3(M[0])),
+                         glm::max(length(vec3(M[1])), length(vec3(M[2]))));
+  vec3 eye = vec3(inverse(V)[3]);
+  vec3 center = vec3(M * vec4((min + max) * 0.5f, 1.f));
+  float radius = length(max - min) * 0.5f * scale;
+
+  // distance to the nearest point of the bounding sphere
+  float dist = length(center - eye) - radius;
+  if (dist <= 0.f) {
+    return;
+  }
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  float pixelsPerUnit = P[1][1] * 0.5f * viewport[3] / dist;
+
+  for (int i = lods->levels.size() - 1; i > 0; i--) {
+    if (lods->levels[i].error * scale * pixelsPerUnit <= lodPixels) {
+      lodIndex = i;
+      break;
+    }
   }
+}
 
-  // update aabb
-  min += xyz;
-  max += xyz;
+int Mesh::triangleCount() {
+  if (lods) {
+    return lods->levels[lodIndex].count / 3;
+  }
+
+  return faces.size();
 }
 
-void Mesh::scale(glm::vec3 xyz) {
-  // scale each vertex with xyz
+// with GL the buffers follow, only the edited vertices are uploaded by
+// the next draw
+void Mesh::transform(mat4 M) {
+  if (hasGL && !dynamic) {
+    setDynamic(true);
+  }
+
+  mat3 N = transpose(inverse(mat3(M)));
+
   for (size_t i = 0; i < vertices.size(); i++) {
-    vertices[i].x *= xyz.x;
-    vertices[i].y *= xyz.y;
-    vertices[i].z *= xyz.z;
+    vertices[i] = vec3(M * vec4(vertices[i], 1.f));
+  }
+  for (size_t i = 0; i < faceNormals.size(); i++) {
+    faceNormals[i] = normalize(N * faceNormals[i]);
   }
 
-  // update aabb
-  min.x *= xyz.x;
-  min.y *= xyz.y;
-  min.z *= xyz.z;
+  // the welded vertices of the LOD chain are drawn instead
+  if (lods) {
+    for (size_t i = 0; i < lods->vtxs.size(); i++) {
+      lods->vtxs[i] = vec3(M * vec4(lods->vtxs[i], 1.f));
+      lods->nms[i] = normalize(N * lods->nms[i]);
+    }
+  }
 
-  max.x *= xyz.x;
-  max.y *= xyz.y;
-  max.z *= xyz.z;
+  if (dynamic) {
+    dynamic->transform(M);
+  }
+
+  // a rotated box is not the box of the rotated vertices
+  findAABB();
+}
+
+void Mesh::translate(glm::vec3 xyz) {
+  transform(glm::translate(mat4(1.f), xyz));
 }
 
+void Mesh::scale(glm::vec3 xyz) { transform(glm::scale(mat4(1.f), xyz)); }
+
 // rotate mesh along x, y, z axes
 // xyz specifies the rotated angle along each axis
-void Mesh::rotate(glm::vec3 xyz) {}
+void Mesh::rotate(glm::vec3 xyz) {
+  // x first, then y, then z, in radians
+  mat4 R = glm::rotate(mat4(1.f), xyz.z, vec3(0.f, 0.f, 1.f));
+  R = glm::rotate(R, xyz.y, vec3(0.f, 1.f, 0.f));
+  R = glm::rotate(R, xyz.x, vec3(1.f, 0.f, 0.f));
+  transform(R);
+}
 
 void Mesh::findAABB() {
   int nOfVtxs = vertices.size();
   vec3 min(0, 0, 0), max(0, 0, 0);
 
+  if (nOfVtxs > 0) {
+    min = max = vertices[0];
+  }
+
   for (size_t i = 0; i < nOfVtxs; i++) {
     vec3 vtx = vertices[i];
 
@@ -592,8 +1064,8 @@ void Mesh::findAABB() {
     }
   }
 
-  min = min;
-  max = max;
+  this->min = min;
+  this->max = max;
 }
 
 void drawPoints(vector<Point> &pts) { // array data
@@ -619,7 +1091,7 @@ void drawPoints(vector<Point> &pts) { // array data
   // selete vao
   GLuint vao;
   glGenVertexArrays(1, &vao);
-  glBindVertexArray(vao);
+  glState.bindVao(vao);
 
   // position
   GLuint vboPos;
@@ -640,23 +1112,26 @@ void drawPoints(vector<Point> &pts) { // array data
   glEnableVertexAttribArray(1);
 
   glDrawArrays(GL_POINTS, 0, nOfPs);
+  frameStats.draw(GL_POINTS, nOfPs);
 
   // release
   delete[] aPos;
   delete[] aColor;
   glDeleteBuffers(1, &vboPos);
   glDeleteBuffers(1, &vboColor);
-  glDeleteVertexArrays(1, &vao);
+  glState.deleteVaos(1, &vao);
 }
 
-Quad::Quad() {
+Quad::Quad(bool withGL) {
+  hasGL = withGL;
   initData();
-  initBuffers();
+  if (hasGL) {
+    initBuffers();
+  }
   initShader();
-  initUniform();
 }
 
-Quad::~Quad() {}
+Quad::~Quad() { shaderQueue.remove(program); }
 
 void Quad::initData() {
   // vertices
@@ -678,43 +1153,118 @@ void Quad::initData() {
   nms.push_back(vec3(0.0f, 0.0f, 1.0f));
 
   // tangent for two triangles
+  vec3 tangent, bitangent;
+
   // triangle 1
-  // ----------
-  vec3 edge1 = vtxs[1] - vtxs[0];
-  vec3 edge2 = vtxs[2] - vtxs[0];
-  vec2 deltaUV1 = uvs[1] - uvs[0];
-  vec2 deltaUV2 = uvs[2] - uvs[0];
+  triangleTangent(vtxs[0], vtxs[1], vtxs[2], uvs[0], uvs[1], uvs[2], tangent,
+                  bitangent);
+  tangents.push_back(tangent);
+  bitangents.push_back(bitangent);
 
-  vec3 tangent1, bitangent1;
+  // triangle 2
+  triangleTangent(vtxs[0], vtxs[2], vtxs[3], uvs[0], uvs[2], uvs[3], tangent,
+                  bitangent);
+  tangents.push_back(tangent);
+  bitangents.push_back(bitangent);
+
+  // object units per uv unit, see setTessUniforms
+  uvToWorld =
+      uvToWorldRatio({vtxs[0], vtxs[1], vtxs[2], vtxs[0], vtxs[2], vtxs[3]},
+                     {uvs[0], uvs[1], uvs[2], uvs[0], uvs[2], uvs[3]});
+}
 
-  tangent1 = deltaUV2.y * edge1 - deltaUV1.y * edge2;
-  tangent1 = normalize(tangent1);
-  tangents.push_back(tangent1);
+// tangent and bitangent of the triangle (v0, v1, v2) with uvs (t0, t1, t2)
+void triangleTangent(vec3 v0, vec3 v1, vec3 v2, vec2 t0, vec2 t1, vec2 t2,
+                     vec3 &tangent, vec3 &bitangent) {
+  vec3 edge1 = v1 - v0;
+  vec3 edge2 = v2 - v0;
+  vec2 deltaUV1 = t1 - t0;
+  vec2 deltaUV2 = t2 - t0;
 
-  bitangent1 = -deltaUV2.x * edge1 + deltaUV1.x * edge2;
-  bitangent1 = normalize(bitangent1);
-  bitangents.push_back(bitangent1);
+  tangent = normalize(deltaUV2.y * edge1 - deltaUV1.y * edge2);
+  bitangent = normalize(-deltaUV2.x * edge1 + deltaUV1.x * edge2);
+}
 
-  // triangle 2
-  // ----------
-  edge1 = vtxs[2] - vtxs[0];
-  edge2 = vtxs[3] - vtxs[0];
-  deltaUV1 = uvs[2] - uvs[0];
-  deltaUV2 = uvs[3] - uvs[0];
+void Quad::initShader() {
+  shader = 0;
+  lodLevel = 0.f;
+  cluster = NULL;
+  uniClusterLights = uniClusterGrid = uniClusterIndices = -1;
+  uniClusterDims = uniClusterDepth = uniClusterViewport = -1;
+  shadow = NULL;
+  uniShadowStatic = uniShadowDynamic = uniShadowLight = -1;
+  packed = false;
+  displaced = false;
+  tessPixels = 8.f;
+  uniViewport = uniTessPixels = uniUvToWorld = -1;
+  vt = NULL;
+
+  if (!hasGL) {
+    program = -1;
+    return;
+  }
 
-  vec3 tangent2, bitangent2;
+  program = shaderQueue.submit("./shader/vsPOM.glsl", "./shader/fsPOM.glsl",
+                               [this](GLuint exe) {
+                                 shader = exe;
+                                 initUniform();
+                               });
+}
 
-  tangent2 = deltaUV2.y * edge1 - deltaUV1.y * edge2;
-  tangent2 = normalize(tangent2);
-  tangents.push_back(tangent2);
+// switch to the shader variant looping over clustered point lights
+void Quad::setCluster(LightCluster *c) {
+  cluster = c;
+  shaderQueue.setDefines(program, shaderDefines());
+}
 
-  bitangent2 = -deltaUV2.x * edge1 + deltaUV1.x * edge2;
-  bitangent2 = normalize(bitangent2);
-  bitangents.push_back(bitangent2);
+// switch to the shader variant shadowing the point light with s
+void Quad::setShadow(ShadowCube *s) {
+  shadow = s;
+  shaderQueue.setDefines(program, shaderDefines());
 }
 
-void Quad::initShader() {
-  shader = buildShader("./shader/vsPOM.glsl", "./shader/fsPOM.glsl");
+// sample normals and heights through the page cache of v
+void Quad::setVirtualTexture(VirtualTexture *v) {
+  vt = v;
+  shaderQueue.setDefines(program, shaderDefines());
+}
+
+// sample the height from the alpha of the normal map, see packedMaterial.h
+void Quad::setPacked(bool p) {
+  packed = p;
+  shaderQueue.setDefines(program, shaderDefines());
+}
+
+// displace the surface with tessellation (GL 4.0) instead of marching the
+// height map per fragment
+void Quad::setDisplacement(bool d) {
+  displaced = d;
+
+  // one rebuild for the stages and the defines
+  shaderQueue.programs[program].defines = shaderDefines();
+  shaderQueue.setStages(program, pomStages(displaced));
+}
+
+string Quad::shaderDefines() {
+  string defines;
+
+  if (cluster) {
+    defines += "#define CLUSTERED\n";
+  }
+  if (shadow) {
+    defines += "#define SHADOW_CUBE\n";
+  }
+  if (vt) {
+    defines += "#define VIRTUAL_TEXTURE\n";
+  }
+  if (packed) {
+    defines += "#define PACKED_NORMAL_HEIGHT\n";
+  }
+  if (displaced) {
+    defines += "#define DISPLACEMENT\n";
+  }
+
+  return defines;
 }
 
 void Quad::initUniform() {
@@ -727,6 +1277,36 @@ void Quad::initUniform() {
   uniTexBase = myGetUniformLocation(shader, "texBase");
   uniTexNormal = myGetUniformLocation(shader, "texNormal");
   uniTexHeight = myGetUniformLocation(shader, "texHeight");
+  uniLodLevel = myGetUniformLocation(shader, "lodLevel");
+
+  if (displaced) {
+    uniViewport = myGetUniformLocation(shader, "viewport");
+    uniTessPixels = myGetUniformLocation(shader, "tessPixels");
+    uniUvToWorld = myGetUniformLocation(shader, "uvToWorld");
+  }
+
+  if (cluster) {
+    uniClusterLights = myGetUniformLocation(shader, "clusterLights");
+    uniClusterGrid = myGetUniformLocation(shader, "clusterGrid");
+    uniClusterIndices = myGetUniformLocation(shader, "clusterIndices");
+    uniClusterDims = myGetUniformLocation(shader, "clusterDims");
+    uniClusterDepth = myGetUniformLocation(shader, "clusterDepth");
+    uniClusterViewport = myGetUniformLocation(shader, "clusterViewport");
+  }
+
+  if (shadow) {
+    uniShadowStatic = myGetUniformLocation(shader, "shadowStatic");
+    uniShadowDynamic = myGetUniformLocation(shader, "shadowDynamic");
+    uniShadowLight = myGetUniformLocation(shader, "shadowLight");
+  }
+
+  if (vt) {
+    uniVtIndirection = myGetUniformLocation(shader, "vtIndirection");
+    uniVtPhysical = myGetUniformLocation(shader, "vtPhysical");
+    uniVtSize = myGetUniformLocation(shader, "vtSize");
+    uniVtPage = myGetUniformLocation(shader, "vtPage");
+    uniVtBias = myGetUniformLocation(shader, "vtBias");
+  }
 }
 
 void Quad::initBuffers() {
@@ -800,7 +1380,7 @@ void Quad::initBuffers() {
 
   // vao
   glGenVertexArrays(1, &vao);
-  glBindVertexArray(vao);
+  glState.bindVao(vao);
 
   // vbo for vertex
   glGenBuffers(1, &vboVtxs);
@@ -839,6 +1419,12 @@ void Quad::initBuffers() {
                GL_STATIC_DRAW);
   glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 0, 0);
   glEnableVertexAttribArray(4);
+
+  frameStats.setBuffer(vboVtxs, sizeof(GLfloat) * 18);
+  frameStats.setBuffer(vboUvs, sizeof(GLfloat) * 12);
+  frameStats.setBuffer(vboNormals, sizeof(GLfloat) * 18);
+  frameStats.setBuffer(vboTangents, sizeof(GLfloat) * 18);
+  frameStats.setBuffer(vboBitangents, sizeof(GLfloat) * 18);
 }
 
 void Quad::setTexture(GLuint &tbo, int texUnit, const string texDir,
@@ -854,6 +1440,8 @@ void Quad::setTexture(GLuint &tbo, int texUnit, const string texDir,
                FreeImage_GetHeight(texImage), 0, GL_BGR, GL_UNSIGNED_BYTE,
                (void *)FreeImage_GetBits(texImage));
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  frameStats.setTexture(tbo, (size_t)FreeImage_GetWidth(texImage) *
+                                 FreeImage_GetHeight(texImage) * 3);
 
   // release
   FreeImage_Unload(texImage);
@@ -862,21 +1450,53 @@ void Quad::setTexture(GLuint &tbo, int texUnit, const string texDir,
 void Quad::draw(mat4 M, mat4 V, mat4 P, vec3 eye, vec3 lightColor,
                 vec3 lightPosition, int unitBaseColor, int unitNormal,
                 int unitHeight) {
-  glUseProgram(shader);
+  // the program is not ready yet
+  if (shader == 0) {
+    return;
+  }
+
+  glState.useProgram(shader);
+
+  glState.uniformMatrix4f(uniModel, M);
+  glState.uniformMatrix4f(uniView, V);
+  glState.uniformMatrix4f(uniProjection, P);
 
-  glUniformMatrix4fv(uniModel, 1, GL_FALSE, value_ptr(M));
-  glUniformMatrix4fv(uniView, 1, GL_FALSE, value_ptr(V));
-  glUniformMatrix4fv(uniProjection, 1, GL_FALSE, value_ptr(P));
+  glState.uniform3f(uniEyePoint, eye);
 
-  glUniform3fv(uniEyePoint, 1, value_ptr(eye));
+  glState.uniform3f(uniLightColor, lightColor);
+  glState.uniform3f(uniLightPosition, lightPosition);
 
-  glUniform3fv(uniLightColor, 1, value_ptr(lightColor));
-  glUniform3fv(uniLightPosition, 1, value_ptr(lightPosition));
+  glState.uniform1i(uniTexBase, unitBaseColor); // change base color
+  glState.uniform1i(uniTexNormal, unitNormal);  // change normal
+  glState.uniform1i(uniTexHeight, unitHeight);  // change height map
+  glState.uniform1f(uniLodLevel, lodLevel);
 
-  glUniform1i(uniTexBase, unitBaseColor); // change base color
-  glUniform1i(uniTexNormal, unitNormal);  // change normal
-  glUniform1i(uniTexHeight, unitHeight);  // change height map
+  if (cluster) {
+    cluster->setUniforms(uniClusterLights, uniClusterGrid, uniClusterIndices,
+                         uniClusterDims, uniClusterDepth, uniClusterViewport);
+  }
+
+  if (shadow) {
+    shadow->setUniforms(uniShadowStatic, uniShadowDynamic, uniShadowLight);
+  }
+
+  if (vt) {
+    vt->setUniforms(uniVtIndirection, uniVtPhysical, uniVtSize, uniVtPage,
+                    uniVtBias);
+  }
+
+  if (displaced) {
+    setTessUniforms(uniViewport, uniTessPixels, uniUvToWorld, tessPixels,
+                    uvToWorld, M);
+  }
+
+  drawGeometry(displaced ? GL_PATCHES : GL_TRIANGLES);
+}
 
-  glBindVertexArray(vao);
-  glDrawArrays(GL_TRIANGLES, 0, 6);
+// draw with whatever program is in use, e.g. by a G-buffer pass,
+// GL_PATCHES for programs with tessellation stages
+void Quad::drawGeometry(GLenum mode) {
+  glState.bindVao(vao);
+  glDrawArrays(mode, 0, 6);
+  frameStats.draw(mode, 6);
 }
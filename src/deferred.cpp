@@ -0,0 +1,254 @@
+#include "deferred.h"
+#include "shaderQueue.h"
+#include "glState.h"
+#include "stats.h"
+#include "cluster.h"
+
+GBuffer::GBuffer(int w, int h) {
+  width = w;
+  height = h;
+
+  unitAlbedo = 18;
+  unitNormal = 19;
+  unitDepth = 20;
+
+  initBuffers();
+  initShader();
+}
+
+GBuffer::~GBuffer() {
+  shaderQueue.remove(programMesh);
+  shaderQueue.remove(programPOM);
+  shaderQueue.remove(programLight);
+  frameStats.releaseTexture(texAlbedo);
+  frameStats.releaseTexture(texNormal);
+  frameStats.releaseTexture(texDepth);
+  glDeleteTextures(1, &texAlbedo);
+  glDeleteTextures(1, &texNormal);
+  glDeleteTextures(1, &texDepth);
+  glDeleteFramebuffers(1, &fbo);
+  glState.deleteVaos(1, &vaoScreen);
+}
+
+void GBuffer::initBuffers() {
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+  // albedo and material id
+  glGenTextures(1, &texAlbedo);
+  glBindTexture(GL_TEXTURE_2D, texAlbedo);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA,
+               GL_UNSIGNED_BYTE, NULL);
+  frameStats.setTexture(texAlbedo, (size_t)width * height * 4);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                         texAlbedo, 0);
+
+  // packed normal and self-shadow
+  glGenTextures(1, &texNormal);
+  glBindTexture(GL_TEXTURE_2D, texNormal);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA,
+               GL_HALF_FLOAT, NULL);
+  frameStats.setTexture(texNormal, (size_t)width * height * 8);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D,
+                         texNormal, 0);
+
+  // depth, the lighting pass reconstructs positions from it
+  glGenTextures(1, &texDepth);
+  glBindTexture(GL_TEXTURE_2D, texDepth);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0,
+               GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+  frameStats.setTexture(texDepth, (size_t)width * height * 4);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+                         texDepth, 0);
+
+  GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+  glDrawBuffers(2, drawBuffers);
+
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    std::cout << "G-buffer is incomplete." << std::endl;
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  glGenVertexArrays(1, &vaoScreen);
+}
+
+void GBuffer::initShader() {
+  shaderMesh = shaderPOM = shaderLight = 0;
+  cluster = NULL;
+  uniClusterLights = uniClusterGrid = uniClusterIndices = -1;
+  uniClusterDims = uniClusterDepth = uniClusterViewport = -1;
+
+  programMesh = shaderQueue.submit(
+      "./shader/vsPhong.glsl", "./shader/fsGBuffer.glsl",
+      [this](GLuint exe) {
+        shaderMesh = exe;
+        locate(shaderMesh, uniMesh, false);
+      });
+
+  programPOM = shaderQueue.submit(
+      "./shader/vsPOM.glsl", "./shader/fsGBuffer.glsl",
+      [this](GLuint exe) {
+        shaderPOM = exe;
+        locate(shaderPOM, uniPOM, true);
+      },
+      "#define PARALLAX\n");
+
+  programLight =
+      shaderQueue.submit("./shader/vsScreen.glsl", "./shader/fsDeferred.glsl",
+                         [this](GLuint exe) {
+                           shaderLight = exe;
+                           initUniform();
+                         });
+}
+
+void GBuffer::locate(GLuint shader, GBufferUniforms &uni, bool parallax) {
+  uni.model = myGetUniformLocation(shader, "M");
+  uni.view = myGetUniformLocation(shader, "V");
+  uni.projection = myGetUniformLocation(shader, "P");
+  uni.texBase = myGetUniformLocation(shader, "texBase");
+  uni.texNormal = myGetUniformLocation(shader, "texNormal");
+  uni.materialId = myGetUniformLocation(shader, "materialId");
+
+  uni.eyePoint = uni.lightPosition = uni.texHeight = -1;
+
+  if (parallax) {
+    uni.eyePoint = myGetUniformLocation(shader, "eyePoint");
+    uni.lightPosition = myGetUniformLocation(shader, "lightPosition");
+    uni.texHeight = myGetUniformLocation(shader, "texHeight");
+  }
+}
+
+void GBuffer::initUniform() {
+  uniAlbedo = myGetUniformLocation(shaderLight, "gAlbedo");
+  uniNormal = myGetUniformLocation(shaderLight, "gNormal");
+  uniDepth = myGetUniformLocation(shaderLight, "gDepth");
+  uniInvViewProj = myGetUniformLocation(shaderLight, "invViewProj");
+  uniEyePoint = myGetUniformLocation(shaderLight, "eyePoint");
+  uniLightColor = myGetUniformLocation(shaderLight, "lightColor");
+  uniLightPosition = myGetUniformLocation(shaderLight, "lightPosition");
+
+  if (cluster) {
+    uniClusterLights = myGetUniformLocation(shaderLight, "clusterLights");
+    uniClusterGrid = myGetUniformLocation(shaderLight, "clusterGrid");
+    uniClusterIndices = myGetUniformLocation(shaderLight, "clusterIndices");
+    uniClusterDims = myGetUniformLocation(shaderLight, "clusterDims");
+    uniClusterDepth = myGetUniformLocation(shaderLight, "clusterDepth");
+    uniClusterViewport = myGetUniformLocation(shaderLight, "clusterViewport");
+  }
+}
+
+// clustered lights are only evaluated in the lighting pass
+void GBuffer::setCluster(LightCluster *c) {
+  cluster = c;
+  shaderQueue.setDefines(programLight, c ? "#define CLUSTERED\n" : "");
+}
+
+void GBuffer::begin() {
+  glGetIntegerv(GL_VIEWPORT, viewport);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glViewport(0, 0, width, height);
+
+  // material id 0 marks empty pixels
+  glClearColor(0.f, 0.f, 0.f, 0.f);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void GBuffer::drawMesh(Mesh *mesh, mat4 M, mat4 V, mat4 P, int unitBaseColor,
+                       int unitNormal) {
+  if (shaderMesh == 0) {
+    return;
+  }
+
+  glState.useProgram(shaderMesh);
+
+  glUniformMatrix4fv(uniMesh.model, 1, GL_FALSE, value_ptr(M));
+  glUniformMatrix4fv(uniMesh.view, 1, GL_FALSE, value_ptr(V));
+  glUniformMatrix4fv(uniMesh.projection, 1, GL_FALSE, value_ptr(P));
+
+  glUniform1i(uniMesh.texBase, unitBaseColor);
+  glUniform1i(uniMesh.texNormal, unitNormal);
+  glUniform1f(uniMesh.materialId, MATERIAL_NORMAL_MAP);
+
+  mesh->selectLod(M, V, P);
+  mesh->drawGeometry();
+}
+
+void GBuffer::drawQuad(Quad *quad, mat4 M, mat4 V, mat4 P, vec3 eye,
+                       vec3 lightPosition, int unitBaseColor, int unitNormal,
+                       int unitHeight) {
+  if (shaderPOM == 0) {
+    return;
+  }
+
+  glState.useProgram(shaderPOM);
+
+  glUniformMatrix4fv(uniPOM.model, 1, GL_FALSE, value_ptr(M));
+  glUniformMatrix4fv(uniPOM.view, 1, GL_FALSE, value_ptr(V));
+  glUniformMatrix4fv(uniPOM.projection, 1, GL_FALSE, value_ptr(P));
+
+  glUniform3fv(uniPOM.eyePoint, 1, value_ptr(eye));
+  glUniform3fv(uniPOM.lightPosition, 1, value_ptr(lightPosition));
+
+  glUniform1i(uniPOM.texBase, unitBaseColor);
+  glUniform1i(uniPOM.texNormal, unitNormal);
+  glUniform1i(uniPOM.texHeight, unitHeight);
+  glUniform1f(uniPOM.materialId, MATERIAL_POM);
+
+  quad->drawGeometry();
+}
+
+void GBuffer::end() {
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+// shade the G-buffer into the bound framebuffer,
+// the depth of the scene is written too
+void GBuffer::light(mat4 V, mat4 P, vec3 eye, vec3 lightColor,
+                    vec3 lightPosition) {
+  if (shaderLight == 0) {
+    return;
+  }
+
+  mat4 invViewProj = inverse(P * V);
+
+  glState.useProgram(shaderLight);
+
+  glActiveTexture(GL_TEXTURE0 + unitAlbedo);
+  glBindTexture(GL_TEXTURE_2D, texAlbedo);
+  glActiveTexture(GL_TEXTURE0 + unitNormal);
+  glBindTexture(GL_TEXTURE_2D, texNormal);
+  glActiveTexture(GL_TEXTURE0 + unitDepth);
+  glBindTexture(GL_TEXTURE_2D, texDepth);
+
+  glUniform1i(uniAlbedo, unitAlbedo);
+  glUniform1i(uniNormal, unitNormal);
+  glUniform1i(uniDepth, unitDepth);
+  glUniformMatrix4fv(uniInvViewProj, 1, GL_FALSE, value_ptr(invViewProj));
+  glUniform3fv(uniEyePoint, 1, value_ptr(eye));
+  glUniform3fv(uniLightColor, 1, value_ptr(lightColor));
+  glUniform3fv(uniLightPosition, 1, value_ptr(lightPosition));
+
+  if (cluster) {
+    cluster->setUniforms(uniClusterLights, uniClusterGrid, uniClusterIndices,
+                         uniClusterDims, uniClusterDepth, uniClusterViewport);
+  }
+
+  // every pixel must pass, the shader writes the stored depth
+  glDepthFunc(GL_ALWAYS);
+  glDisable(GL_CULL_FACE);
+
+  glState.bindVao(vaoScreen);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+
+  glEnable(GL_CULL_FACE);
+  glDepthFunc(GL_LESS);
+}
@@ -0,0 +1,209 @@
+#include "dynamicMesh.h"
+#include "meshLod.h"
+#include "simd8.h"
+#include "stats.h"
+#include "threadPool.h"
+
+DynamicMesh::DynamicMesh(Mesh *m) {
+  mesh = m;
+
+  // the order of the vertex buffers, see Mesh::initBuffers and
+  // Mesh::initLodBuffers
+  vector<vec3> vtxs, nms;
+  if (mesh->lods) {
+    vtxs = mesh->lods->vtxs;
+    nms = mesh->lods->nms;
+  } else {
+    for (Face &f : mesh->faces) {
+      vtxs.push_back(mesh->vertices[f.v1]);
+      vtxs.push_back(mesh->vertices[f.v2]);
+      vtxs.push_back(mesh->vertices[f.v3]);
+      nms.push_back(mesh->faceNormals[f.vn1]);
+      nms.push_back(mesh->faceNormals[f.vn2]);
+      nms.push_back(mesh->faceNormals[f.vn3]);
+    }
+  }
+
+  nOfVtxs = vtxs.size();
+  x.resize(nOfVtxs);
+  y.resize(nOfVtxs);
+  z.resize(nOfVtxs);
+  nx.resize(nOfVtxs);
+  ny.resize(nOfVtxs);
+  nz.resize(nOfVtxs);
+
+  for (size_t i = 0; i < nOfVtxs; i++) {
+    x[i] = vtxs[i].x;
+    y[i] = vtxs[i].y;
+    z[i] = vtxs[i].z;
+    nx[i] = nms[i].x;
+    ny[i] = nms[i].y;
+    nz[i] = nms[i].z;
+  }
+
+  dirtyFirst = dirtyLast = 0;
+  parallelGrain = 16384;
+  nOfUploads = 0;
+  uploadedBytes = 0;
+
+  // respecified once as dynamic, later uploads never reallocate
+  if (mesh->hasGL) {
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->vboVtxs);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * nOfVtxs, vtxs.data(),
+                 GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->vboNormals);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * nOfVtxs, nms.data(),
+                 GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    frameStats.setBuffer(mesh->vboVtxs, sizeof(vec3) * nOfVtxs);
+    frameStats.setBuffer(mesh->vboNormals, sizeof(vec3) * nOfVtxs);
+  }
+}
+
+void DynamicMesh::markDirty(size_t first, size_t last) {
+  if (dirtyFirst >= dirtyLast) {
+    dirtyFirst = first;
+    dirtyLast = last;
+  } else {
+    dirtyFirst = std::min(dirtyFirst, first);
+    dirtyLast = std::max(dirtyLast, last);
+  }
+}
+
+// 8 vertices at a time, the tail one by one
+void DynamicMesh::transformRange(mat4 &M, mat3 &N, size_t first,
+                                 size_t last) {
+  size_t i = first;
+
+  for (; i + 8 <= last; i += 8) {
+    F8 px = F8::load(&x[i]), py = F8::load(&y[i]), pz = F8::load(&z[i]);
+    F8 qx = fmadd(F8(M[0][0]), px,
+                  fmadd(F8(M[1][0]), py, fmadd(F8(M[2][0]), pz, F8(M[3][0]))));
+    F8 qy = fmadd(F8(M[0][1]), px,
+                  fmadd(F8(M[1][1]), py, fmadd(F8(M[2][1]), pz, F8(M[3][1]))));
+    F8 qz = fmadd(F8(M[0][2]), px,
+                  fmadd(F8(M[1][2]), py, fmadd(F8(M[2][2]), pz, F8(M[3][2]))));
+    qx.store(&x[i]);
+    qy.store(&y[i]);
+    qz.store(&z[i]);
+
+    F8 ax = F8::load(&nx[i]), ay = F8::load(&ny[i]), az = F8::load(&nz[i]);
+    F8 bx = fmadd(F8(N[0][0]), ax, fmadd(F8(N[1][0]), ay, F8(N[2][0]) * az));
+    F8 by = fmadd(F8(N[0][1]), ax, fmadd(F8(N[1][1]), ay, F8(N[2][1]) * az));
+    F8 bz = fmadd(F8(N[0][2]), ax, fmadd(F8(N[1][2]), ay, F8(N[2][2]) * az));
+    F8 inv = F8(1.f) / sqrt(fmadd(bx, bx, fmadd(by, by, bz * bz)));
+    (bx * inv).store(&nx[i]);
+    (by * inv).store(&ny[i]);
+    (bz * inv).store(&nz[i]);
+  }
+
+  for (; i < last; i++) {
+    vec3 p = vec3(M * vec4(x[i], y[i], z[i], 1.f));
+    vec3 n = normalize(N * vec3(nx[i], ny[i], nz[i]));
+    x[i] = p.x;
+    y[i] = p.y;
+    z[i] = p.z;
+    nx[i] = n.x;
+    ny[i] = n.y;
+    nz[i] = n.z;
+  }
+}
+
+// transform vertices [first, first + count), normals by the inverse
+// transpose
+void DynamicMesh::transform(mat4 M, size_t first, size_t count) {
+  if (first >= nOfVtxs) {
+    return;
+  }
+  size_t last = first + std::min(count, nOfVtxs - first);
+
+  mat3 N = transpose(inverse(mat3(M)));
+
+  if (last - first > parallelGrain) {
+    threadPool.parallelFor(
+        last - first,
+        [&](size_t begin, size_t end) {
+          transformRange(M, N, first + begin, first + end);
+        },
+        parallelGrain);
+  } else {
+    transformRange(M, N, first, last);
+  }
+
+  markDirty(first, last);
+}
+
+// the same one vertex at a time, to compare with
+void DynamicMesh::transformScalar(mat4 M, size_t first, size_t count) {
+  if (first >= nOfVtxs) {
+    return;
+  }
+  size_t last = first + std::min(count, nOfVtxs - first);
+  mat3 N = transpose(inverse(mat3(M)));
+
+  for (size_t i = first; i < last; i++) {
+    vec3 p = vec3(M * vec4(x[i], y[i], z[i], 1.f));
+    vec3 n = normalize(N * vec3(nx[i], ny[i], nz[i]));
+    x[i] = p.x;
+    y[i] = p.y;
+    z[i] = p.z;
+    nx[i] = n.x;
+    ny[i] = n.y;
+    nz[i] = n.z;
+  }
+
+  markDirty(first, last);
+}
+
+// whole: reallocate the buffers with glBufferData, first must be 0
+void DynamicMesh::uploadRange(size_t first, size_t last, bool whole) {
+  size_t n = last - first;
+  staging.resize(n);
+
+  glBindBuffer(GL_ARRAY_BUFFER, mesh->vboVtxs);
+  for (size_t i = 0; i < n; i++) {
+    staging[i] = vec3(x[first + i], y[first + i], z[first + i]);
+  }
+  if (whole) {
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * n, staging.data(),
+                 GL_DYNAMIC_DRAW);
+  } else {
+    glBufferSubData(GL_ARRAY_BUFFER, sizeof(vec3) * first, sizeof(vec3) * n,
+                    staging.data());
+  }
+
+  glBindBuffer(GL_ARRAY_BUFFER, mesh->vboNormals);
+  for (size_t i = 0; i < n; i++) {
+    staging[i] = vec3(nx[first + i], ny[first + i], nz[first + i]);
+  }
+  if (whole) {
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * n, staging.data(),
+                 GL_DYNAMIC_DRAW);
+  } else {
+    glBufferSubData(GL_ARRAY_BUFFER, sizeof(vec3) * first, sizeof(vec3) * n,
+                    staging.data());
+  }
+
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  if (whole) {
+    frameStats.setBuffer(mesh->vboVtxs, sizeof(vec3) * n);
+    frameStats.setBuffer(mesh->vboNormals, sizeof(vec3) * n);
+  }
+
+  nOfUploads++;
+  uploadedBytes += 2 * sizeof(vec3) * n;
+}
+
+// send the vertices changed since the last upload
+void DynamicMesh::upload() {
+  if (dirtyFirst < dirtyLast) {
+    uploadRange(dirtyFirst, dirtyLast, false);
+  }
+  dirtyFirst = dirtyLast = 0;
+}
+
+// send every vertex into new storage, like the old updateMesh()
+void DynamicMesh::uploadAll() {
+  uploadRange(0, nOfVtxs, true);
+  dirtyFirst = dirtyLast = 0;
+}
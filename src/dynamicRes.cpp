@@ -0,0 +1,173 @@
+#include "dynamicRes.h"
+#include "shaderQueue.h"
+#include "glState.h"
+#include "stats.h"
+
+DynamicResolution::DynamicResolution(int w, int h, float target) {
+  width = w;
+  height = h;
+  unitColor = 27;
+
+  targetTime = target;
+  gpuTime = 0.f;
+  scale = maxScale = 1.f;
+  minScale = 0.5f;
+  hysteresis = 0.1f;
+  step = 0.05f;
+  sharpness = 0.5f;
+  interval = 8;
+  nOfSamples = 0;
+  sumTime = 0.0;
+
+  // its own unit, so the target never replaces a material texture
+  glActiveTexture(GL_TEXTURE0 + unitColor);
+  glGenTextures(1, &tboColor);
+  glBindTexture(GL_TEXTURE_2D, tboColor);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA,
+               GL_UNSIGNED_BYTE, NULL);
+  frameStats.setTexture(tboColor, (size_t)width * height * 4);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  glGenRenderbuffers(1, &rboDepth);
+  glBindRenderbuffer(GL_RENDERBUFFER, rboDepth);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+  frameStats.setRenderbuffer(rboDepth, (size_t)width * height * 4);
+
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                         tboColor, 0);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                            GL_RENDERBUFFER, rboDepth);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    std::cout << "Dynamic resolution target is incomplete." << std::endl;
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  glGenQueries(nOfQueries, queries);
+  for (int i = 0; i < nOfQueries; i++) {
+    issued[i] = false;
+  }
+  current = 0;
+
+  glGenVertexArrays(1, &vaoScreen);
+
+  initShader();
+}
+
+DynamicResolution::~DynamicResolution() {
+  shaderQueue.remove(program);
+  glDeleteQueries(nOfQueries, queries);
+  glDeleteFramebuffers(1, &fbo);
+  frameStats.releaseTexture(tboColor);
+  frameStats.releaseRenderbuffer(rboDepth);
+  glDeleteTextures(1, &tboColor);
+  glDeleteRenderbuffers(1, &rboDepth);
+  glState.deleteVaos(1, &vaoScreen);
+}
+
+void DynamicResolution::initShader() {
+  shader = 0;
+  program = shaderQueue.submit(
+      "./shader/vsScreen.glsl", "./shader/fsUpscale.glsl",
+      [this](GLuint exe) {
+        shader = exe;
+        uniSource = myGetUniformLocation(shader, "source");
+        uniScale = myGetUniformLocation(shader, "scale");
+        uniTexel = myGetUniformLocation(shader, "texel");
+        uniSharpness = myGetUniformLocation(shader, "sharpness");
+      });
+}
+
+// render the frame after this into the scaled target
+void DynamicResolution::begin() {
+  // the oldest query has had nOfQueries - 1 frames to finish
+  if (issued[current]) {
+    GLuint available = GL_FALSE;
+    glGetQueryObjectuiv(queries[current], GL_QUERY_RESULT_AVAILABLE,
+                        &available);
+
+    if (available) {
+      GLuint64 ns;
+      glGetQueryObjectui64v(queries[current], GL_QUERY_RESULT, &ns);
+      gpuTime = ns * 1e-6f;
+      sumTime += gpuTime;
+      nOfSamples++;
+    }
+    issued[current] = false;
+  }
+
+  if (nOfSamples >= interval) {
+    adjust();
+  }
+
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glViewport(0, 0, renderWidth(), renderHeight());
+
+  glBeginQuery(GL_TIME_ELAPSED, queries[current]);
+}
+
+// stop timing and upscale to the window
+void DynamicResolution::end() {
+  glEndQuery(GL_TIME_ELAPSED);
+  issued[current] = true;
+  current = (current + 1) % nOfQueries;
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+  if (shader == 0) {
+    return;
+  }
+
+  glState.useProgram(shader);
+
+  glActiveTexture(GL_TEXTURE0 + unitColor);
+  glBindTexture(GL_TEXTURE_2D, tboColor);
+  glUniform1i(uniSource, unitColor);
+  glUniform2f(uniScale, float(renderWidth()) / width,
+              float(renderHeight()) / height);
+  glUniform2f(uniTexel, 1.f / width, 1.f / height);
+  glUniform1f(uniSharpness, scale < 1.f ? sharpness : 0.f);
+
+  // every pixel of the window is replaced
+  glDisable(GL_DEPTH_TEST);
+  glDisable(GL_CULL_FACE);
+
+  glState.bindVao(vaoScreen);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+
+  glEnable(GL_CULL_FACE);
+  glEnable(GL_DEPTH_TEST);
+}
+
+// move the scale towards the target time, the cost is per pixel
+void DynamicResolution::adjust() {
+  float average = sumTime / nOfSamples;
+  sumTime = 0.0;
+  nOfSamples = 0;
+
+  if (average <= 0.f) {
+    return;
+  }
+
+  float newScale = scale;
+  if (average > targetTime * (1.f + hysteresis)) {
+    newScale = scale * sqrt(targetTime / average);
+  } else if (average < targetTime * (1.f - hysteresis)) {
+    newScale = glm::min(scale * sqrt(targetTime / average), scale + step);
+  }
+  newScale = glm::clamp(newScale, minScale, maxScale);
+
+  // results of frames at the old scale are still in flight
+  if (newScale != scale) {
+    scale = newScale;
+    for (int i = 0; i < nOfQueries; i++) {
+      issued[i] = false;
+    }
+  }
+}
@@ -0,0 +1,53 @@
+#include "frameSnapshot.h"
+
+LatencyMeter::LatencyMeter() {
+  first = count = 0;
+  sum = 0.0;
+  nOfFrames = 0;
+}
+
+LatencyMeter::~LatencyMeter() {
+  for (int i = 0; i < count; i++) {
+    glDeleteSync(fences[(first + i) % NUM_LATENCY_FENCES]);
+  }
+}
+
+// after the swap of a frame drawn with input sampled at inputTime
+void LatencyMeter::submitted(double inputTime) {
+  // the oldest frame is dropped when the GPU is that far behind
+  if (count == NUM_LATENCY_FENCES) {
+    glDeleteSync(fences[first]);
+    first = (first + 1) % NUM_LATENCY_FENCES;
+    count--;
+  }
+
+  int slot = (first + count) % NUM_LATENCY_FENCES;
+  fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  inputTimes[slot] = inputTime;
+  count++;
+}
+
+// frames finish in order, stop at the first one still running
+void LatencyMeter::poll() {
+  while (count > 0) {
+    GLenum status = glClientWaitSync(fences[first], 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+      break;
+    }
+
+    sum += glfwGetTime() - inputTimes[first];
+    nOfFrames++;
+
+    glDeleteSync(fences[first]);
+    first = (first + 1) % NUM_LATENCY_FENCES;
+    count--;
+  }
+}
+
+// in ms, then start over
+double LatencyMeter::average() {
+  double ms = nOfFrames > 0 ? 1000.0 * sum / nOfFrames : 0.0;
+  sum = 0.0;
+  nOfFrames = 0;
+  return ms;
+}
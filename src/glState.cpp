@@ -0,0 +1,150 @@
+#include "glState.h"
+#include "stats.h"
+#include <cstring>
+
+GLStateCache glState;
+
+GLStateCache::GLStateCache() {
+  enabled = true;
+  invalidate();
+}
+
+// after bindings were changed behind the cache's back, the uniforms of
+// a program stay with it
+void GLStateCache::invalidate() {
+  program = vao = (GLuint)-1;
+  current = NULL;
+  for (int i = 0; i < NUM_STATE_UNITS; i++) {
+    targets[i] = GL_NONE;
+    textures[i] = (GLuint)-1;
+  }
+}
+
+void GLStateCache::useProgram(GLuint p) {
+  if (enabled && p == program) {
+    frameStats.elide();
+    return;
+  }
+
+  glUseProgram(p);
+  frameStats.bindProgram();
+  program = p;
+  current = p != 0 ? &uniforms[p] : NULL;
+}
+
+void GLStateCache::bindVao(GLuint v) {
+  if (enabled && v == vao) {
+    frameStats.elide();
+    return;
+  }
+
+  glBindVertexArray(v);
+  frameStats.bindVao();
+  vao = v;
+}
+
+// leaves unit active when it binds
+void GLStateCache::bindTexture(int unit, GLenum target, GLuint tex) {
+  bool tracked = unit >= 0 && unit < NUM_STATE_UNITS;
+  if (enabled && tracked && targets[unit] == target &&
+      textures[unit] == tex) {
+    frameStats.elide();
+    return;
+  }
+
+  glActiveTexture(GL_TEXTURE0 + unit);
+  glBindTexture(target, tex);
+  frameStats.bindTexture();
+  if (tracked) {
+    targets[unit] = target;
+    textures[unit] = tex;
+  }
+}
+
+// true if location already holds the value, else remember it
+bool GLStateCache::same(GLint location, int size, const float *v) {
+  if (enabled && current && location >= 0 && location < MAX_CACHED_UNIFORM) {
+    if ((int)current->size() <= location) {
+      current->resize(location + 1, UniformValue{0, {}});
+    }
+
+    UniformValue &u = (*current)[location];
+    if (u.size == size && memcmp(u.v, v, sizeof(float) * size) == 0) {
+      frameStats.elide();
+      return true;
+    }
+    u.size = size;
+    memcpy(u.v, v, sizeof(float) * size);
+  }
+
+  frameStats.uniforms();
+  return false;
+}
+
+// integers are compared by their bits
+void GLStateCache::uniform1i(GLint location, int x) {
+  float v[1];
+  memcpy(v, &x, sizeof(int));
+  if (!same(location, 1, v)) {
+    glUniform1i(location, x);
+  }
+}
+
+void GLStateCache::uniform1f(GLint location, float x) {
+  if (!same(location, 1, &x)) {
+    glUniform1f(location, x);
+  }
+}
+
+void GLStateCache::uniform2f(GLint location, float x, float y) {
+  float v[2] = {x, y};
+  if (!same(location, 2, v)) {
+    glUniform2f(location, x, y);
+  }
+}
+
+void GLStateCache::uniform3i(GLint location, int x, int y, int z) {
+  int i[3] = {x, y, z};
+  float v[3];
+  memcpy(v, i, sizeof(i));
+  if (!same(location, 3, v)) {
+    glUniform3i(location, x, y, z);
+  }
+}
+
+void GLStateCache::uniform3f(GLint location, vec3 x) {
+  if (!same(location, 3, value_ptr(x))) {
+    glUniform3fv(location, 1, value_ptr(x));
+  }
+}
+
+void GLStateCache::uniform4f(GLint location, vec4 x) {
+  if (!same(location, 4, value_ptr(x))) {
+    glUniform4fv(location, 1, value_ptr(x));
+  }
+}
+
+void GLStateCache::uniformMatrix4f(GLint location, mat4 &x) {
+  if (!same(location, 16, value_ptr(x))) {
+    glUniformMatrix4fv(location, 1, GL_FALSE, value_ptr(x));
+  }
+}
+
+// before or after p is deleted, a new program may get its name
+void GLStateCache::forgetProgram(GLuint p) {
+  uniforms.erase(p);
+  if (program == p) {
+    program = (GLuint)-1;
+    current = NULL;
+  }
+}
+
+// a deleted VAO that is bound reverts the binding to 0
+void GLStateCache::deleteVaos(GLsizei n, GLuint *vaos) {
+  for (GLsizei i = 0; i < n; i++) {
+    if (vaos[i] == vao) {
+      vao = 0;
+    }
+  }
+  glDeleteVertexArrays(n, vaos);
+}
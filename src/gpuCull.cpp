@@ -0,0 +1,344 @@
+#include "gpuCull.h"
+#include "meshLod.h"
+#include "shaderQueue.h"
+#include "glState.h"
+#include "stats.h"
+#include <cfloat>
+
+// GLuints per draw command, DrawArraysIndirectCommand is one shorter
+static const int commandSize = 5;
+
+GpuCuller::GpuCuller() {
+  frame = 0;
+  current = 0;
+  unitInstances = 21;
+  nOfVisible = nOfTriangles = 0;
+
+  indirect = hasExtension("GL_ARB_draw_indirect") &&
+             hasExtension("GL_ARB_query_buffer_object");
+
+  std::cout << "GPU culling: "
+            << (indirect ? "indirect draws (GL_ARB_query_buffer_object)"
+                         : "asynchronous read back of the visible counts")
+            << std::endl;
+
+  initShader();
+}
+
+GpuCuller::~GpuCuller() {
+  shaderQueue.remove(program);
+  for (CullGroup &g : groups) {
+    for (CullLevel &level : g.levels) {
+      for (int s = 0; s < NUM_CULL_SLOTS; s++) {
+        frameStats.releaseBuffer(level.vboVisible[s]);
+      }
+      glDeleteBuffers(NUM_CULL_SLOTS, level.vboVisible);
+      glDeleteQueries(NUM_CULL_SLOTS, level.queries);
+      if (level.bufIndirect) {
+        frameStats.releaseBuffer(level.bufIndirect);
+        glDeleteBuffers(1, &level.bufIndirect);
+      }
+    }
+
+    glDeleteTextures(1, &g.tboInstances);
+    frameStats.releaseBuffer(g.vboInstances);
+    glDeleteBuffers(1, &g.vboInstances);
+    glState.deleteVaos(1, &g.vao);
+  }
+}
+
+void GpuCuller::initShader() {
+  shader = 0;
+
+  // no fragment shader, nothing is rasterized
+  vector<ShaderStage> stages = {{GL_VERTEX_SHADER, "./shader/vsCull.glsl"},
+                                {GL_GEOMETRY_SHADER, "./shader/gsCull.glsl"}};
+
+  program = shaderQueue.submit(
+      stages,
+      [this](GLuint exe) {
+        shader = exe;
+        uniPlanes = myGetUniformLocation(shader, "planes");
+        uniEyePoint = myGetUniformLocation(shader, "eyePoint");
+        uniLodScale = myGetUniformLocation(shader, "lodScale");
+        uniErrorRange = myGetUniformLocation(shader, "errorRange");
+      },
+      "", {"instanceId"});
+}
+
+// upload the instances of a mesh, the mesh switches to instanced draws
+void GpuCuller::addGroup(Mesh *mesh, vector<mat4> &models) {
+  CullGroup g;
+  g.mesh = mesh;
+  g.nOfInstances = models.size();
+
+  vec3 center = (mesh->min + mesh->max) * 0.5f;
+  float radius = length(mesh->max - mesh->min) * 0.5f;
+
+  vector<vec4> data;
+  for (mat4 &M : models) {
+    float scale = glm::max(length(vec3(M[0])),
+                           glm::max(length(vec3(M[1])), length(vec3(M[2]))));
+
+    for (int c = 0; c < 4; c++) {
+      data.push_back(M[c]);
+    }
+    data.push_back(vec4(vec3(M * vec4(center, 1.f)), radius * scale));
+  }
+
+  GLint maxTexels;
+  glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+  if ((GLint)data.size() > maxTexels) {
+    std::cout << "GPU culling: " << g.nOfInstances
+              << " instances exceed GL_MAX_TEXTURE_BUFFER_SIZE" << std::endl;
+  }
+
+  glGenBuffers(1, &g.vboInstances);
+  glBindBuffer(GL_ARRAY_BUFFER, g.vboInstances);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(vec4) * data.size(), data.data(),
+               GL_STATIC_DRAW);
+  frameStats.setBuffer(g.vboInstances, sizeof(vec4) * data.size());
+
+  // the cull pass reads the instances as vertex attributes
+  GLsizei stride = sizeof(vec4) * 5;
+  glGenVertexArrays(1, &g.vao);
+  glState.bindVao(g.vao);
+  for (int i = 0; i < 3; i++) {
+    glVertexAttribPointer(i, 4, GL_FLOAT, GL_FALSE, stride,
+                          (GLvoid *)(sizeof(vec4) * i));
+    glEnableVertexAttribArray(i);
+  }
+  glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, stride,
+                        (GLvoid *)(sizeof(vec4) * 4));
+  glEnableVertexAttribArray(3);
+  glState.bindVao(0);
+
+  // the draws read the matrices through a buffer texture
+  glGenTextures(1, &g.tboInstances);
+  glBindTexture(GL_TEXTURE_BUFFER, g.tboInstances);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, g.vboInstances);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+  // one pass per LOD level, each instance passes in one of them
+  LodChain *lods = mesh->lods;
+  int nOfLevels =
+      (lods && mesh->lodPixels > 0.f) ? (int)lods->levels.size() : 1;
+
+  for (int i = 0; i < nOfLevels; i++) {
+    CullLevel level;
+
+    glGenBuffers(NUM_CULL_SLOTS, level.vboVisible);
+    for (int s = 0; s < NUM_CULL_SLOTS; s++) {
+      glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, level.vboVisible[s]);
+      glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER,
+                   sizeof(GLuint) * glm::max(g.nOfInstances, 1), NULL,
+                   GL_DYNAMIC_COPY);
+      frameStats.setBuffer(level.vboVisible[s],
+                           sizeof(GLuint) * glm::max(g.nOfInstances, 1));
+      level.frames[s] = -1;
+    }
+    glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 0);
+    glGenQueries(NUM_CULL_SLOTS, level.queries);
+
+    level.drawSlot = level.drawFrame = -1;
+    level.drawCount = 0;
+    level.errorMin = (i == 0) ? -1.f : lods->levels[i].error;
+    level.errorMax = (i + 1 < nOfLevels) ? lods->levels[i + 1].error : FLT_MAX;
+
+    // instance counts are filled in by the queries
+    level.bufIndirect = 0;
+    if (indirect) {
+      vector<GLuint> commands(commandSize * NUM_CULL_SLOTS, 0);
+      for (int s = 0; s < NUM_CULL_SLOTS; s++) {
+        GLuint *cmd = &commands[commandSize * s];
+        if (lods) {
+          cmd[0] = lods->levels[i].count;
+          cmd[2] = lods->levels[i].offset;
+        } else {
+          cmd[0] = mesh->faces.size() * 3;
+        }
+      }
+
+      glGenBuffers(1, &level.bufIndirect);
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, level.bufIndirect);
+      glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(GLuint) * commands.size(),
+                   commands.data(), GL_DYNAMIC_COPY);
+      frameStats.setBuffer(level.bufIndirect, sizeof(GLuint) * commands.size());
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+
+    g.levels.push_back(level);
+  }
+
+  mesh->setInstanced(true);
+  groups.push_back(g);
+}
+
+// write the visible instances of every level into this frame's slot
+void GpuCuller::cull(mat4 V, mat4 P) {
+  current = frame % NUM_CULL_SLOTS;
+  frame++;
+
+  if (shader == 0) {
+    return;
+  }
+
+  for (CullGroup &g : groups) {
+    for (CullLevel &level : g.levels) {
+      readBack(level);
+    }
+  }
+
+  // Gribb-Hartmann, rows of P * V
+  mat4 PV = P * V;
+  vec4 rows[4], planes[6];
+  for (int i = 0; i < 4; i++) {
+    rows[i] = vec4(PV[0][i], PV[1][i], PV[2][i], PV[3][i]);
+  }
+  for (int i = 0; i < 3; i++) {
+    planes[i * 2] = rows[3] + rows[i];
+    planes[i * 2 + 1] = rows[3] - rows[i];
+  }
+  for (int i = 0; i < 6; i++) {
+    planes[i] /= length(vec3(planes[i]));
+  }
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  vec3 eye = vec3(inverse(V)[3]);
+
+  glState.useProgram(shader);
+  glUniform4fv(uniPlanes, 6, value_ptr(planes[0]));
+  glState.uniform3f(uniEyePoint, eye);
+
+  glEnable(GL_RASTERIZER_DISCARD);
+
+  for (CullGroup &g : groups) {
+    float lodPixels = glm::max(g.mesh->lodPixels, 1e-6f);
+    glState.uniform1f(uniLodScale, P[1][1] * 0.5f * viewport[3] / lodPixels);
+    glState.bindVao(g.vao);
+
+    for (CullLevel &level : g.levels) {
+      // the GPU is NUM_CULL_SLOTS frames behind and still draws this
+      // slot's list: keep drawing it and skip this frame's cull instead of
+      // waiting, readBack() picks up a newer slot once its count arrives
+      if (!indirect && level.drawSlot == current) {
+        continue;
+      }
+
+      glState.uniform2f(uniErrorRange, level.errorMin, level.errorMax);
+
+      glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0,
+                       level.vboVisible[current]);
+      glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN,
+                   level.queries[current]);
+      glBeginTransformFeedback(GL_POINTS);
+      glDrawArrays(GL_POINTS, 0, g.nOfInstances);
+      glEndTransformFeedback();
+      glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+      level.frames[current] = frame;
+
+      if (indirect) {
+        // the count goes straight into instanceCount of the command
+        glBindBuffer(GL_QUERY_BUFFER, level.bufIndirect);
+        glGetQueryObjectuiv(
+            level.queries[current], GL_QUERY_RESULT,
+            (GLuint *)(sizeof(GLuint) * (commandSize * current + 1)));
+        glBindBuffer(GL_QUERY_BUFFER, 0);
+      }
+    }
+  }
+
+  glDisable(GL_RASTERIZER_DISCARD);
+  glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+  glState.bindVao(0);
+}
+
+// take the newest count which has arrived, never waits
+void GpuCuller::readBack(CullLevel &level) {
+  for (int k = 1; k < NUM_CULL_SLOTS; k++) {
+    int s = (current - k + NUM_CULL_SLOTS) % NUM_CULL_SLOTS;
+
+    if (level.frames[s] <= level.drawFrame) {
+      continue;
+    }
+
+    GLuint available = GL_FALSE;
+    glGetQueryObjectuiv(level.queries[s], GL_QUERY_RESULT_AVAILABLE,
+                        &available);
+
+    if (available) {
+      glGetQueryObjectuiv(level.queries[s], GL_QUERY_RESULT,
+                          &level.drawCount);
+      level.drawSlot = s;
+      level.drawFrame = level.frames[s];
+      return;
+    }
+  }
+}
+
+// instanced draws of every group with the forward program of its mesh
+void GpuCuller::draw(mat4 V, mat4 P, vec3 eye, vec3 lightColor,
+                     vec3 lightPosition, int unitBaseColor, int unitNormal,
+                     int unitHeight) {
+  nOfVisible = nOfTriangles = 0;
+
+  for (CullGroup &g : groups) {
+    if (!g.mesh->useProgram(mat4(1.f), V, P, eye, lightColor, lightPosition,
+                            unitBaseColor, unitNormal, unitHeight)) {
+      continue;
+    }
+
+    // the variant without INSTANCED is still in use
+    if (g.mesh->uniInstances < 0) {
+      continue;
+    }
+
+    glState.bindTexture(unitInstances, GL_TEXTURE_BUFFER, g.tboInstances);
+    glState.uniform1i(g.mesh->uniInstances, unitInstances);
+
+    for (size_t i = 0; i < g.levels.size(); i++) {
+      drawLevel(g, i);
+    }
+  }
+}
+
+void GpuCuller::drawLevel(CullGroup &g, int l) {
+  CullLevel &level = g.levels[l];
+  Mesh *mesh = g.mesh;
+  int slot = indirect ? current : level.drawSlot;
+
+  // counts of the results read back, this frame's with indirect draws
+  int nOfTris = mesh->lods ? mesh->lods->levels[l].count / 3
+                           : mesh->faces.size();
+  nOfVisible += level.drawCount;
+  nOfTriangles += level.drawCount * nOfTris;
+
+  if (slot < 0 || level.frames[slot] < 0) {
+    return;
+  }
+
+  mesh->setInstanceIds(level.vboVisible[slot]);
+
+  if (indirect) {
+    GLvoid *cmd = (GLvoid *)(sizeof(GLuint) * commandSize * slot);
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, level.bufIndirect);
+    if (mesh->lods) {
+      glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, cmd);
+    } else {
+      glDrawArraysIndirect(GL_TRIANGLES, cmd);
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  } else if (level.drawCount > 0) {
+    if (mesh->lods) {
+      LodLevel &lod = mesh->lods->levels[l];
+      glDrawElementsInstanced(GL_TRIANGLES, lod.count, GL_UNSIGNED_INT,
+                              (GLvoid *)(sizeof(GLuint) * lod.offset),
+                              level.drawCount);
+    } else {
+      glDrawArraysInstanced(GL_TRIANGLES, 0, mesh->faces.size() * 3,
+                            level.drawCount);
+    }
+  }
+}
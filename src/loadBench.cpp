@@ -0,0 +1,248 @@
+#include "loadBench.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <thread>
+
+static size_t fileSize(const string fileName) {
+  struct stat st;
+  return stat(fileName.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+// names of the files in dir ending with suffix, sorted
+vector<string> listFiles(const string dir, const string suffix) {
+  vector<string> names;
+
+  DIR *d = opendir(dir.c_str());
+  if (!d) {
+    std::cout << "load bench: can't list " << dir << std::endl;
+    return names;
+  }
+
+  while (struct dirent *e = readdir(d)) {
+    string name = e->d_name;
+    if (name.size() > suffix.size() &&
+        name.compare(name.size() - suffix.size(), suffix.size(), suffix) ==
+            0) {
+      names.push_back(name);
+    }
+  }
+  closedir(d);
+
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+// an n x n grid of quads in the xz plane, two faces each
+bool writeGridObj(const string fileName, size_t nOfFaces) {
+  FILE *f = fopen(fileName.c_str(), "w");
+  if (!f) {
+    std::cout << "load bench: can't write " << fileName << std::endl;
+    return false;
+  }
+
+  size_t n = std::max(size_t(std::sqrt(nOfFaces / 2.0)), size_t(1));
+
+  for (size_t z = 0; z <= n; z++) {
+    for (size_t x = 0; x <= n; x++) {
+      fprintf(f, "v %f 0.0 %f\n", float(x) / n - 0.5f, float(z) / n - 0.5f);
+    }
+  }
+  for (size_t z = 0; z <= n; z++) {
+    for (size_t x = 0; x <= n; x++) {
+      fprintf(f, "vt %f %f\n", float(x) / n, float(z) / n);
+    }
+  }
+  fprintf(f, "vn 0.0 1.0 0.0\n");
+
+  // indices start from 1
+  for (size_t z = 0; z < n; z++) {
+    for (size_t x = 0; x < n; x++) {
+      size_t i = z * (n + 1) + x + 1, j = i + n + 1;
+      fprintf(f, "f %zu/%zu/1 %zu/%zu/1 %zu/%zu/1\n", i, i, j, j, i + 1, i + 1);
+      fprintf(f, "f %zu/%zu/1 %zu/%zu/1 %zu/%zu/1\n", i + 1, i + 1, j, j,
+              j + 1, j + 1);
+    }
+  }
+
+  fclose(f);
+  return true;
+}
+
+LoadBench::LoadBench(size_t m, double t) {
+  maxFaces = m;
+  minTime = t;
+}
+
+void LoadBench::run() {
+  std::cout << "load bench: name, time (ns), CPU (ns), iterations, "
+            << "items/s, bytes/s" << std::endl;
+
+  for (const string &name : listFiles("./mesh", ".obj")) {
+    benchMesh(name.substr(0, name.size() - 4), "./mesh/" + name);
+  }
+
+  const string gridFile = "./bench_grid.obj";
+  for (size_t n = 16384; n <= maxFaces; n *= 4) {
+    if (writeGridObj(gridFile, n)) {
+      benchMesh("grid" + std::to_string(n), gridFile);
+      remove(gridFile.c_str());
+    }
+  }
+
+  benchTextures();
+  benchShaders();
+}
+
+// like Google Benchmark: batches grow until one takes minTime
+void LoadBench::measure(const string name, size_t items, size_t bytes,
+                        std::function<void()> fn) {
+  // caches, page faults of first touches
+  fn();
+
+  long n = 1;
+  double realTime, cpuTime;
+
+  while (true) {
+    auto t0 = std::chrono::steady_clock::now();
+    std::clock_t c0 = std::clock();
+    for (long i = 0; i < n; i++) {
+      fn();
+    }
+    std::clock_t c1 = std::clock();
+    auto t1 = std::chrono::steady_clock::now();
+
+    realTime = std::chrono::duration<double>(t1 - t0).count();
+    cpuTime = double(c1 - c0) / CLOCKS_PER_SEC;
+
+    if (realTime >= minTime || n >= 1000000000L) {
+      break;
+    }
+
+    // aim a little past minTime, grow at most 10x at a time
+    double factor = realTime > 0.0 ? 1.4 * minTime / realTime : 10.0;
+    n = std::max(n + 1, long(n * std::min(factor, 10.0)));
+  }
+
+  BenchResult r;
+  r.name = name;
+  r.iterations = n;
+  r.realTime = 1e9 * realTime / n;
+  r.cpuTime = 1e9 * cpuTime / n;
+  r.itemsPerSecond = items * n / realTime;
+  r.bytesPerSecond = bytes * n / realTime;
+  results.push_back(r);
+
+  std::cout << r.name << ", " << r.realTime << ", " << r.cpuTime << ", "
+            << r.iterations << ", " << r.itemsPerSecond << ", "
+            << r.bytesPerSecond << std::endl;
+}
+
+void LoadBench::benchMesh(const string name, const string fileName) {
+  Mesh m(fileName, false);
+  size_t nOfFaces = m.faces.size();
+  if (nOfFaces == 0) {
+    return;
+  }
+
+  measure("loadObj/" + name, nOfFaces, fileSize(fileName), [&]() {
+    m.vertices.clear();
+    m.uvs.clear();
+    m.faceNormals.clear();
+    m.faces.clear();
+    m.loadObj(fileName);
+  });
+
+  // what initBuffers uploads
+  vector<GLfloat> vtxs(nOfFaces * 9), uvs(nOfFaces * 6),
+      normals(nOfFaces * 9);
+  measure("expandFaces/" + name, nOfFaces, sizeof(GLfloat) * nOfFaces * 24,
+          [&]() { m.expandFaces(vtxs.data(), uvs.data(), normals.data()); });
+
+  measure("findAABB/" + name, m.vertices.size(),
+          sizeof(vec3) * m.vertices.size(), [&]() { m.findAABB(); });
+
+  vector<vec3> tangents(nOfFaces), bitangents(nOfFaces);
+  measure("tangents/" + name, nOfFaces, 0, [&]() {
+    for (size_t i = 0; i < nOfFaces; i++) {
+      const Face &f = m.faces[i];
+      triangleTangent(m.vertices[f.v1], m.vertices[f.v2], m.vertices[f.v3],
+                      m.uvs[f.vt1], m.uvs[f.vt2], m.uvs[f.vt3], tangents[i],
+                      bitangents[i]);
+    }
+  });
+}
+
+// the two steps of setTexture before the upload
+void LoadBench::benchTextures() {
+  for (const string &name : listFiles("./res", ".jpg")) {
+    // the material maps, not the images of the README
+    if (name.find('_') == string::npos) {
+      continue;
+    }
+
+    string fileName = "./res/" + name;
+    FIBITMAP *img = FreeImage_Load(FIF_JPEG, fileName.c_str());
+    if (!img) {
+      continue;
+    }
+    size_t pixels = (size_t)FreeImage_GetWidth(img) * FreeImage_GetHeight(img);
+    string base = name.substr(0, name.size() - 4);
+
+    measure("decode/" + base, pixels, fileSize(fileName), [&]() {
+      FreeImage_Unload(FreeImage_Load(FIF_JPEG, fileName.c_str()));
+    });
+
+    measure("convert24/" + base, pixels, pixels * 3,
+            [&]() { FreeImage_Unload(FreeImage_ConvertTo24Bits(img)); });
+
+    FreeImage_Unload(img);
+  }
+}
+
+void LoadBench::benchShaders() {
+  for (const string &name : listFiles("./shader", ".glsl")) {
+    string fileName = "./shader/" + name;
+    measure("readFile/" + name.substr(0, name.size() - 5), 1,
+            fileSize(fileName), [&]() { readFile(fileName); });
+  }
+}
+
+bool LoadBench::write(const string fileName) {
+  FILE *f = fopen(fileName.c_str(), "w");
+  if (!f) {
+    std::cout << "load bench: can't write " << fileName << std::endl;
+    return false;
+  }
+
+  char date[64];
+  std::time_t now = std::time(NULL);
+  std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z",
+                std::localtime(&now));
+
+  fprintf(f,
+          "{\n  \"context\": {\n    \"date\": \"%s\",\n"
+          "    \"executable\": \"./main --bench-load\",\n"
+          "    \"num_cpus\": %u,\n    \"max_faces\": %zu\n  },\n"
+          "  \"benchmarks\": [\n",
+          date, std::thread::hardware_concurrency(), maxFaces);
+
+  for (size_t i = 0; i < results.size(); i++) {
+    const BenchResult &r = results[i];
+    fprintf(f,
+            "    {\"name\": \"%s\", \"run_name\": \"%s\", "
+            "\"run_type\": \"iteration\", \"iterations\": %ld, "
+            "\"real_time\": %.3f, \"cpu_time\": %.3f, \"time_unit\": \"ns\", "
+            "\"items_per_second\": %.3f, \"bytes_per_second\": %.3f}%s\n",
+            r.name.c_str(), r.name.c_str(), r.iterations, r.realTime,
+            r.cpuTime, r.itemsPerSecond, r.bytesPerSecond,
+            i + 1 < results.size() ? "," : "");
+  }
+
+  fprintf(f, "  ]\n}\n");
+  fclose(f);
+  return true;
+}
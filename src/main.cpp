@@ -1,9 +1,39 @@
 #include "common.h"
+#include "shaderQueue.h"
+#include "glState.h"
+#include "cluster.h"
+#include "deferred.h"
+#include "prepass.h"
+#include "shadingLod.h"
+#include "meshLod.h"
+#include "threadPool.h"
+#include "softRaster.h"
+#include "occlusion.h"
+#include "gpuCull.h"
+#include "meshArena.h"
+#include "material.h"
+#include "virtualTexture.h"
+#include "residency.h"
+#include "recorder.h"
+#include "multiView.h"
+#include "dynamicRes.h"
+#include "dynamicMesh.h"
+#include "meshStream.h"
+#include "stats.h"
+#include "renderQueue.h"
+#include "packedMaterial.h"
+#include "shadowMap.h"
+#include "frameSnapshot.h"
+#include "loadBench.h"
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <thread>
 
 GLFWwindow *window;
 
 Mesh *mesh;
-// Quad *quad;
+Quad *quad = NULL;
 
 vec3 lightPosition = vec3(1.25f, 1.f, 1.f);
 vec3 lightColor = vec3(1.f, 1.f, 1.f);
@@ -28,22 +58,328 @@ vector<Point> pts;
 GLuint pointShader;
 GLint uniPointM, uniPointV, uniPointP;
 
-void computeMatricesFromInputs();
+// clustered point lights, enabled with --lights N
+vector<PointLight> pointLights;
+LightCluster *lightCluster = NULL;
+int nOfPointLights = 0;
+bool benchLights = false;
+
+// a grid of nOfQuads x nOfQuads POM quads, enabled with --quads N
+int nOfQuads = 0;
+
+// deferred shading, enabled with --deferred
+GBuffer *gBuffer = NULL;
+bool useDeferred = false;
+
+// depth pre-pass, enabled with --prepass
+DepthPrepass *prepass = NULL;
+bool usePrepass = false;
+
+// fragments shaded by the main pass
+FragmentCounter *fragmentCounter = NULL;
+
+// shading LOD from POM down to flat shading, enabled with --shading-lod
+ShadingLod *shadingLod = NULL;
+
+// rows of boats (and a torus now and then) with LOD chains,
+// enabled with --boats N, --lod-pixels 0 draws the full meshes
+vector<Mesh *> boatMeshes;
+int nOfBoats = 0;
+float lodPixels = 1.f;
+int trianglesDrawn = 0;
+vector<Instance> boatInstances;
+
+// CPU occlusion culling of the boats, walls in front of the rows of
+// boats are the occluders
+OcclusionCuller *culler = NULL;
+bool useOcclusion = false;
+Mesh *wallMesh = NULL;
+int nOfWalls = 0;
+double cullTime = 0.0;
+
+// frustum and LOD culling of the boats on the GPU, instanced draws
+GpuCuller *gpuCuller = NULL;
+bool useGpuCull = false;
+
+// every mesh in shared buffers drawn by one multi-draw, enabled with
+// --arena, --distinct N adds N distinct (jittered) cubes to it and
+// --arena-loop issues one draw call per mesh instead
+MeshArena *arena = NULL;
+bool useArena = false, arenaLoop = false;
+int nOfDistinct = 0;
+vector<int> boatHandles;
+vector<Mesh *> distinctMeshes;
+vector<int> distinctHandles;
+vector<vec4> distinctColors;
+
+// the materials of res/ as texture array layers, one per arena draw,
+// enabled with --materials
+MaterialArray *materials = NULL;
+bool useMaterials = false;
+
+// normal and height maps of the quads paged in from a tiled file,
+// enabled with --vt FILE, --vt-bake SIZE writes FILE from res/ first
+VirtualTexture *virtualTexture = NULL;
+string vtFile;
+int vtBakeSize = 0;
+
+// mesh and quad textures under a memory budget, --texture-budget MB
+TextureResidency *residency = NULL;
+size_t textureBudget = 0;
+vector<int> meshTextures, quadTextures;
+
+// image sequence of the frames, --record PATTERN, C pauses / resumes,
+// --record-frames N closes the window after N frames
+FrameRecorder *recorder = NULL;
+string recordPattern;
+int recordFrames = 0;
+
+// render the quads from the views of --batch FILE, or from --batch-orbit N
+// cameras, NUM_BATCH_VIEWS per pass, and exit; --record writes the images
+string batchFile;
+int batchOrbit = 0;
+
+// scene resolution adjusted to hold --dynamic-res MS of GPU time,
+// between --res-limits MIN MAX of the window's size
+DynamicResolution *dynamicRes = NULL;
+float targetGpuTime = 0.f;
+float minResScale = 0.5f, maxResScale = 1.f;
+
+// per frame vertex update cost of an obj, --bench-dynamic FILE
+string benchDynamicFile;
+
+// clustered mesh streamed from disk, --ooc FILE, --ooc-bake OBJ writes
+// FILE from OBJ first, --ooc-pool N clusters resident on the GPU
+MeshStreamer *meshStreamer = NULL;
+string oocFile, oocObj;
+int oocSlots = 128;
+
+// draw calls, binds and GL memory appended to --stats FILE every
+// --stats-interval S seconds as JSON lines, P prints them
+string statsFile;
+double statsInterval = 1.0;
+
+// forward draws recorded and submitted sorted by program, VAO and depth,
+// --sort-draws; --no-state-cache issues every bind and uniform upload
+RenderQueue *renderQueue = NULL;
+bool sortDraws = false;
+
+// normal and height of the mesh and the quads in one texture, --packed;
+// --derive-normals derives the normals from the height maps;
+// --check-normals compares its 8-wide and scalar filters on ./res, no GL
+bool usePacked = false, deriveFromHeight = false, checkNormals = false;
+
+// POM surfaces tessellated and displaced instead (GL 4.0), --displace
+// quads|mesh|all, edges split to --tess-pixels N on screen;
+// --bench-displace compares both on a quad over camera distances
+bool displaceQuads = false, displaceMesh = false, benchDisplace = false;
+float tessPixels = 8.f;
+
+// cube shadow maps of the point light, --shadows SIZE per face, of the
+// casters within --shadow-range R; --shadow-spin turns the mesh, so only
+// the dynamic cube is redrawn each frame; the arrow keys move the light
+ShadowCube *shadowCube = NULL;
+int shadowSize = 0, meshCaster = -1;
+float shadowRange = 20.f, meshAngle = 0.f;
+bool spinMesh = false;
+
+// GL calls on a render thread of their own, --render-thread; the main
+// thread samples the input into snapshots the frames are drawn from, the
+// camera is latched again right before the scene is submitted
+bool useRenderThread = false;
+FrameSnapshot input;
+TripleBuffer<FrameSnapshot> snapshots;
+LatencyMeter *latency = NULL;
+double latchedInputTime = 0.0;
+
+// loading and preprocessing micro-benchmarks without a GL context,
+// --bench-load FILE writes them as JSON, synthetic meshes of up to
+// --bench-faces N faces
+string benchLoadFile;
+size_t benchFaces = 4 << 20;
+
+// CPU renderer, --soft FILE renders the mesh and the quads without GL,
+// --compare-soft checks it against the GL output
+string softFile;
+bool compareSoft = false;
+
+void computeMatricesFromInputs(FrameSnapshot &);
+void updateMatrices();
+void cameraMatrices(vec3, mat4 &, mat4 &);
+void sampleInput();
+void applySnapshot(const FrameSnapshot &);
+void latchCamera(const FrameSnapshot &);
+void drawFrame();
 void keyCallback(GLFWwindow *, int, int, int, int);
 
+void parseArgs(int, char **);
 void initGL();
 void initOthers();
 void initMatrix();
 void initTexture();
+void initLights(int);
+void initBoats();
+void initOcclusion();
+void initGpuCull();
+void initArena();
+void initVirtualTexture();
+void initMeshStreamer();
+void initShadows();
+void renderFeedback();
+float screenPixels(vec3, float);
+float sortDepth(mat4);
+void drawObject(Mesh *, mat4, bool);
+void drawQuadObject(mat4, bool);
+void drawScene(bool);
+mat4 meshModel();
+mat4 quadModel(int, int);
+mat4 wallModel(int);
+mat4 distinctModel(int);
+void renderFrame();
+void drawSoftScene(SoftRaster &, SoftTexture *);
+void renderSoft();
+void compareSoftRaster();
+void runBatch();
+void benchmarkLights();
+void benchmarkDynamicMesh();
+void benchmarkDisplacement();
 void releaseResource();
 
 int main(int argc, char **argv) {
+  parseArgs(argc, argv);
+
+  if (useGpuCull && (usePrepass || useDeferred || useOcclusion)) {
+    std::cout << "--gpu-cull draws the boats in the forward pass only, "
+              << "--prepass, --deferred and --occlusion are ignored"
+              << std::endl;
+    usePrepass = useDeferred = useOcclusion = false;
+  }
+
+  if (!vtFile.empty() && useDeferred) {
+    std::cout << "--vt pages the textures of the forward pass, "
+              << "--deferred is ignored" << std::endl;
+    useDeferred = false;
+  }
+
+  if (targetGpuTime > 0.f && useDeferred) {
+    std::cout << "--dynamic-res scales the forward pass only, "
+              << "--deferred is ignored" << std::endl;
+    useDeferred = false;
+  }
+
+  if (usePacked && useDeferred) {
+    std::cout << "--packed samples heights in the forward pass only, "
+              << "--deferred is ignored" << std::endl;
+    useDeferred = false;
+  }
+
+  if (usePacked && textureBudget > 0) {
+    std::cout << "--texture-budget loads the separate maps, "
+              << "--packed is ignored" << std::endl;
+    usePacked = false;
+  }
+
+  if ((displaceQuads || displaceMesh) && (usePrepass || useDeferred)) {
+    std::cout << "--displace tessellates in the forward pass only, "
+              << "--prepass and --deferred are ignored" << std::endl;
+    usePrepass = useDeferred = false;
+  }
+
+  if (shadowSize > 0 && useDeferred) {
+    std::cout << "--shadows lights the forward pass only, "
+              << "--deferred is ignored" << std::endl;
+    useDeferred = false;
+  }
+
+  if (!oocFile.empty() && (usePrepass || useDeferred)) {
+    std::cout << "--ooc draws in the forward pass only, "
+              << "--prepass and --deferred are ignored" << std::endl;
+    usePrepass = useDeferred = false;
+  }
+
+  if (useArena && (usePrepass || useDeferred)) {
+    std::cout << "--arena draws in the forward pass only, "
+              << "--prepass and --deferred are ignored" << std::endl;
+    usePrepass = useDeferred = false;
+  }
+
+  // render nodes without a GPU never open a window
+  if (!softFile.empty()) {
+    renderSoft();
+    return EXIT_SUCCESS;
+  }
+
+  // neither do the loading benchmarks
+  if (!benchLoadFile.empty()) {
+    FreeImage_Initialise(true);
+    LoadBench bench(benchFaces);
+    bench.run();
+    bench.write(benchLoadFile);
+    FreeImage_DeInitialise();
+    return EXIT_SUCCESS;
+  }
+
+  // nor the comparison of the normal filters
+  if (checkNormals) {
+    FreeImage_Initialise(true);
+    bool withinStep = true;
+    for (const string &name : listFiles("./res", "_height.jpg")) {
+      string prefix = "./res/" + name.substr(0, name.size() - 11);
+      withinStep = compareDerivedNormals(prefix) && withinStep;
+    }
+    FreeImage_DeInitialise();
+    return withinStep ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
   initGL();
   initOthers();
 
+  if (!statsFile.empty()) {
+    frameStats.open(statsFile, statsInterval);
+  }
+
+  if (sortDraws) {
+    renderQueue = new RenderQueue();
+  }
+
   // prepare mesh data
   mesh = new Mesh("./mesh/quad.obj");
-  // quad = new Quad();
+
+  if (nOfQuads > 0) {
+    quad = new Quad();
+  }
+
+  if (nOfWalls > 0) {
+    wallMesh = new Mesh("./mesh/cube.obj");
+  }
+
+  if (nOfBoats > 0) {
+    initBoats();
+  }
+
+  if (useOcclusion) {
+    initOcclusion();
+  }
+
+  if (useGpuCull && nOfBoats > 0) {
+    initGpuCull();
+  }
+
+  if (useArena) {
+    initArena();
+  }
+
+  if (!vtFile.empty() && quad) {
+    initVirtualTexture();
+  }
+
+  if (!oocFile.empty()) {
+    initMeshStreamer();
+  }
+
+  if (textureBudget > 0) {
+    residency = new TextureResidency(textureBudget);
+  }
 
   initTexture();
   initMatrix();
@@ -59,48 +395,142 @@ int main(int argc, char **argv) {
   glfwPollEvents();
   glfwSetCursorPos(window, WINDOW_WIDTH / 2, WINDOW_HEIGHT / 2);
 
-  /* Loop until the user closes the window */
-  while (!glfwWindowShouldClose(window)) {
-    // reset
-    glClearColor(0.f, 0.f, 0.4f, 0.f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  if (compareSoft) {
+    compareSoftRaster();
+    releaseResource();
+    return EXIT_SUCCESS;
+  }
 
-    // view control
-    computeMatricesFromInputs();
-
-    mat4 tempModel = translate(mat4(1.f), vec3(2.5f, 0.f, 0.f));
-    // tempModel = rotate(tempModel, 3.14f / 2.0f, vec3(1, 0, 0));
-    // tempModel = scale(tempModel, vec3(0.5, 0.5, 0.5));
-    mesh->draw(tempModel, view, projection, eyePoint, lightColor, lightPosition,
-               13, 14);
-
-    // It is better to always use transform matrix
-    // to move, rotate and scale objects.
-    // This can avoid updating vertex buffers.
-    // for (int r = 0; r < 1; r++) {
-    //   for (int c = 0; c < 1; c++) {
-    //     tempModel = translate(mat4(1.f), vec3(-4.f * r, 0.f, 4.f * c));
-    //     // tempModel = rotate(tempModel, -3.14f / 2.0f, vec3(1, 0, 0));
-    //
-    //     // mesh->draw(tempModel, view, projection, eyePoint, lightColor,
-    //     //            lightPosition, 10, 11);
-    //
-    //     quad->draw(tempModel, view, projection, eyePoint, lightColor,
-    //                lightPosition, 10, 11, 12);
-    //   }
-    // }
-
-    glUseProgram(pointShader);
-    glUniformMatrix4fv(uniPointM, 1, GL_FALSE, value_ptr(model));
-    glUniformMatrix4fv(uniPointV, 1, GL_FALSE, value_ptr(view));
-    glUniformMatrix4fv(uniPointP, 1, GL_FALSE, value_ptr(projection));
-    drawPoints(pts);
+  if (!batchFile.empty() || batchOrbit > 0) {
+    runBatch();
+    releaseResource();
+    return EXIT_SUCCESS;
+  }
+
+  if (shadingLod || displaceMesh) {
+    // the mesh gets POM too, so it has levels to choose from
+    mesh->setParallax(true);
+    if (!mesh->packed) {
+      mesh->setTexture(mesh->tboHeight, 9, "./res/stone_height.jpg",
+                       FIF_JPEG);
+    }
+  }
 
-    /* Swap front and back buffers */
-    glfwSwapBuffers(window);
+  if (displaceMesh) {
+    mesh->tessPixels = tessPixels;
+    mesh->setDisplacement(true);
+  }
+
+  // virtual texture pages are sampled with screen space derivatives,
+  // which the tessellation stages do not have
+  if (displaceQuads && quad && !virtualTexture) {
+    quad->tessPixels = tessPixels;
+    quad->setDisplacement(true);
+  }
 
-    /* Poll for and process events */
-    glfwPollEvents();
+  if (usePrepass) {
+    prepass = new DepthPrepass();
+  }
+  fragmentCounter = new FragmentCounter();
+
+  if (targetGpuTime > 0.f) {
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    dynamicRes = new DynamicResolution(width, height, targetGpuTime);
+    dynamicRes->minScale = minResScale;
+    dynamicRes->maxScale = maxResScale;
+    dynamicRes->scale = maxResScale;
+  }
+
+  if (!recordPattern.empty()) {
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    recorder = new FrameRecorder(recordPattern, width, height);
+  }
+
+  if (useDeferred) {
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    gBuffer = new GBuffer(width, height);
+  }
+
+  if (nOfPointLights > 0 || benchLights) {
+    lightCluster = new LightCluster(16, 9, 24);
+    mesh->setCluster(lightCluster);
+    if (quad) {
+      quad->setCluster(lightCluster);
+    }
+    for (Mesh *m : boatMeshes) {
+      m->setCluster(lightCluster);
+    }
+    if (gBuffer) {
+      gBuffer->setCluster(lightCluster);
+    }
+    initLights(nOfPointLights);
+  }
+
+  if (shadowSize > 0) {
+    initShadows();
+  }
+
+  if (benchLights) {
+    benchmarkLights();
+    releaseResource();
+    return EXIT_SUCCESS;
+  }
+
+  if (!benchDynamicFile.empty()) {
+    benchmarkDynamicMesh();
+    releaseResource();
+    return EXIT_SUCCESS;
+  }
+
+  if (benchDisplace && quad) {
+    benchmarkDisplacement();
+    releaseResource();
+    return EXIT_SUCCESS;
+  }
+
+  // what the first frame is drawn from
+  input.view = view;
+  input.projection = projection;
+  input.eyePoint = eyePoint;
+  input.lightPosition = lightPosition;
+  input.meshAngle = meshAngle;
+  input.polygonMode = GL_FILL;
+  input.nOfRebuilds = input.nOfStatsPrints = input.nOfRecordToggles = 0;
+  latency = new LatencyMeter();
+
+  if (useRenderThread) {
+    // the context moves to the render thread, events and input stay on
+    // the main thread as GLFW requires
+    sampleInput();
+    glfwMakeContextCurrent(NULL);
+    std::thread renderer([]() {
+      glfwMakeContextCurrent(window);
+      while (!glfwWindowShouldClose(window)) {
+        drawFrame();
+      }
+      glfwMakeContextCurrent(NULL);
+    });
+
+    // sampled far more often than frames are drawn
+    while (!glfwWindowShouldClose(window)) {
+      glfwWaitEventsTimeout(0.001);
+      sampleInput();
+    }
+
+    renderer.join();
+    glfwMakeContextCurrent(window);
+  } else {
+    /* Loop until the user closes the window */
+    while (!glfwWindowShouldClose(window)) {
+      sampleInput();
+      drawFrame();
+
+      /* Poll for and process events */
+      glfwPollEvents();
+    }
   }
 
   releaseResource();
@@ -108,7 +538,389 @@ int main(int argc, char **argv) {
   return EXIT_SUCCESS;
 }
 
-void computeMatricesFromInputs() {
+// one frame on the GL thread, from the input sampled last
+void drawFrame() {
+  static double reportTime = glfwGetTime();
+  static int nOfFrames = 0;
+
+  // swap in shader programs which have finished compiling
+  shaderQueue.update();
+
+  // anything bound behind the state cache's back, e.g. by initialization
+  glState.invalidate();
+
+  // the latest input, the camera may still move until submission
+  snapshots.acquire();
+  applySnapshot(snapshots.read());
+
+  // no GL calls of this frame are issued yet, so culling on the CPU
+  // overlaps with the GPU still working on the previous frame
+  if (culler) {
+    double t0 = glfwGetTime();
+    culler->render(view, projection);
+    culler->cull(boatInstances);
+    cullTime += glfwGetTime() - t0;
+  }
+
+  // assign point lights to froxels of this frame's view
+  if (lightCluster) {
+    lightCluster->build(pointLights, view, projection, nearPlane, farPlane);
+  }
+
+  if (gpuCuller) {
+    gpuCuller->cull(view, projection);
+  }
+
+  // pages requested by earlier frames' feedback
+  if (virtualTexture) {
+    virtualTexture->update();
+  }
+
+  // clusters in view, uploads of the ones read since the last frame
+  if (meshStreamer) {
+    meshStreamer->update(mat4(1.f), view, projection);
+  }
+
+  // evict or restream levels for what the last frame sampled
+  if (residency) {
+    residency->update();
+  }
+
+  // redraw the shadow cubes a moved light or caster invalidated
+  if (shadowCube) {
+    if (spinMesh) {
+      shadowCube->moveCaster(meshCaster, meshModel());
+    }
+    shadowCube->setLight(lightPosition);
+    shadowCube->update();
+  }
+
+  // late latch: input sampled during the CPU work above moves the camera
+  // of this frame, culling and the light clusters keep the earlier one
+  if (snapshots.acquire()) {
+    latchCamera(snapshots.read());
+  }
+
+  if (dynamicRes) {
+    dynamicRes->begin();
+  }
+
+  renderFrame();
+
+  if (dynamicRes) {
+    dynamicRes->end();
+  }
+
+  if (recorder) {
+    recorder->capture();
+    if (recordFrames > 0 && recorder->nOfFrames >= recordFrames) {
+      glfwSetWindowShouldClose(window, GLFW_TRUE);
+    }
+  }
+
+  if (virtualTexture) {
+    renderFeedback();
+  }
+
+  frameStats.endFrame();
+
+  /* Swap front and back buffers */
+  glfwSwapBuffers(window);
+
+  latency->submitted(latchedInputTime);
+  latency->poll();
+
+  // average frame time, to compare the forward and deferred paths
+  nOfFrames++;
+  double now = glfwGetTime();
+  if (now - reportTime > 2.0) {
+    std::cout << (gBuffer ? "deferred" : "forward")
+              << (prepass ? " + pre-pass" : "")
+              << (useRenderThread ? " on the render thread" : "")
+              << " frame: " << 1000.0 * (now - reportTime) / nOfFrames
+              << " ms, input latency: " << latency->average() << " ms, "
+              << "shaded fragments: " << fragmentCounter->shadedFragments;
+    if (nOfBoats > 0) {
+      std::cout << ", triangles: " << trianglesDrawn;
+    }
+    if (culler) {
+      std::cout << ", culled boats: " << culler->nOfOccluded
+                << " occluded + " << culler->nOfOutside << " outside of "
+                << culler->nOfTested << " ("
+                << 100.0 * (culler->nOfOccluded + culler->nOfOutside) /
+                       glm::max(culler->nOfTested, 1)
+                << "%), cull: " << 1000.0 * cullTime / nOfFrames << " ms";
+      cullTime = 0.0;
+    }
+    if (gpuCuller) {
+      std::cout << ", GPU culled boats: " << gpuCuller->nOfVisible
+                << " visible of " << nOfBoats;
+    }
+    if (arena) {
+      std::cout << ", arena draws: " << arena->commands.size() << " in "
+                << arena->nOfCalls << " calls";
+    }
+    if (virtualTexture) {
+      std::cout << ", VT pages: " << virtualTexture->nOfResident
+                << " resident, " << virtualTexture->nOfRequested
+                << " seen";
+    }
+    if (meshStreamer) {
+      std::cout << ", streamed clusters: " << meshStreamer->nOfVisible
+                << " visible, " << meshStreamer->nOfResident << " / "
+                << meshStreamer->nOfSlots << " resident of "
+                << meshStreamer->clusters.size() << ", "
+                << meshStreamer->nOfUploaded << " uploaded";
+    }
+    if (residency) {
+      std::cout << ", textures: " << (residency->residentBytes >> 20)
+                << " / " << (residency->budget >> 20) << " MB, "
+                << residency->nOfEvictions << " evictions, "
+                << residency->nOfRestreams << " restreams";
+    }
+    if (dynamicRes) {
+      std::cout << ", resolution: " << dynamicRes->renderWidth() << "x"
+                << dynamicRes->renderHeight() << ", GPU scene: "
+                << dynamicRes->gpuTime << " ms";
+    }
+    if (shadowCube) {
+      std::cout << ", shadow renders: "
+                << shadowCube->nOfRenders[SHADOW_STATIC] << " static, "
+                << shadowCube->nOfRenders[SHADOW_DYNAMIC] << " dynamic";
+    }
+    if (recorder) {
+      std::cout << ", recorded: " << recorder->nOfFrames << " frames, "
+                << recorder->nOfWritten << " written";
+    }
+    if (shadingLod) {
+      std::cout << ", draws per shading LOD:";
+      for (int i = 0; i < NUM_SHADING_LODS; i++) {
+        std::cout << " " << shadingLod->drawCounts[i];
+      }
+    }
+    std::cout << std::endl;
+    reportTime = now;
+    nOfFrames = 0;
+  }
+}
+
+// depthOnly: draw with the pre-pass program
+void drawScene(bool depthOnly) {
+  mat4 tempModel = meshModel();
+  // tempModel = rotate(tempModel, 3.14f / 2.0f, vec3(1, 0, 0));
+  // tempModel = scale(tempModel, vec3(0.5, 0.5, 0.5));
+  if (shadingLod && !depthOnly) {
+    shadingLod->resetCounts();
+
+    vec3 center = vec3(tempModel * vec4((mesh->min + mesh->max) * 0.5f, 1.f));
+    float radius = length(mesh->max - mesh->min) * 0.5f;
+    mesh->lodLevel = shadingLod->select(center, radius, vec3(0.f), eyePoint,
+                                        projection, WINDOW_HEIGHT);
+  }
+
+  if (!depthOnly) {
+    trianglesDrawn = 0;
+  }
+
+  drawObject(mesh, tempModel, depthOnly);
+
+  // the mesh textures are still bound to units 13 and 14
+  if (gpuCuller) {
+    gpuCuller->draw(view, projection, eyePoint, lightColor, lightPosition, 13,
+                    14, 9);
+    trianglesDrawn += gpuCuller->nOfTriangles;
+  } else if (!arena) {
+    for (Instance &inst : boatInstances) {
+      if (inst.visible) {
+        drawObject(inst.mesh, inst.model, depthOnly);
+      }
+    }
+  }
+
+  for (int i = 0; i < nOfWalls; i++) {
+    drawObject(wallMesh, wallModel(i), depthOnly);
+  }
+
+  // collect the draws, then submit them all at once
+  if (arena && !depthOnly) {
+    arena->begin();
+
+    if (!gpuCuller) {
+      for (size_t i = 0; i < boatInstances.size(); i++) {
+        Instance &inst = boatInstances[i];
+        if (inst.visible) {
+          int handle = boatHandles[inst.mesh == boatMeshes[0] ? 0 : 1];
+          int m = materials ? i % materials->nOfLayers : 0;
+          arena->draw(handle, inst.model, view, projection, vec4(1.f), m);
+        }
+      }
+    }
+
+    for (int i = 0; i < nOfDistinct; i++) {
+      int m = materials ? i % materials->nOfLayers : 0;
+      arena->draw(distinctHandles[i], distinctModel(i), view, projection,
+                  materials ? vec4(1.f) : distinctColors[i], m);
+    }
+
+    // the mesh textures are still bound to units 13 and 14
+    arena->end(view, projection, eyePoint, lightColor, lightPosition, 13, 14);
+    trianglesDrawn += arena->nOfTriangles;
+  }
+
+  // the mesh textures are still bound to units 13 and 14
+  if (meshStreamer && !depthOnly) {
+    meshStreamer->draw(mat4(1.f), view, projection, eyePoint, lightColor,
+                       lightPosition, 13, 14);
+  }
+
+  // It is better to always use transform matrix
+  // to move, rotate and scale objects.
+  // This can avoid updating vertex buffers.
+  for (int r = 0; r < nOfQuads; r++) {
+    for (int c = 0; c < nOfQuads; c++) {
+      drawQuadObject(quadModel(r, c), depthOnly);
+    }
+  }
+
+  // the forward draws recorded above, in key order
+  if (renderQueue && !depthOnly && !gBuffer) {
+    renderQueue->flush(view, projection, eyePoint, lightColor, lightPosition);
+    trianglesDrawn += renderQueue->nOfTriangles;
+  }
+}
+
+// turned by --shadow-spin
+mat4 meshModel() {
+  mat4 tempModel = translate(mat4(1.f), vec3(2.5f, 0.f, 0.f));
+  return rotate(tempModel, meshAngle, vec3(0.f, 1.f, 0.f));
+}
+
+// the quad at row r, column c of the grid
+mat4 quadModel(int r, int c) {
+  mat4 tempModel = translate(mat4(1.f), vec3(-2.f * r, 0.f, 2.f * c));
+  return rotate(tempModel, -3.14f / 2.0f, vec3(1, 0, 0));
+}
+
+// walls of 8 x 3 units facing +x, in front of each row of boats
+mat4 wallModel(int i) {
+  mat4 tempModel = translate(mat4(1.f), vec3(1.5f - 3.f * i, 1.f, 0.f));
+  return scale(tempModel, vec3(0.1f, 1.5f, 4.f));
+}
+
+// distance of the model's origin in [0, 1] of the depth range, for keys
+float sortDepth(mat4 M) {
+  return length(vec3(M[3]) - eyePoint) / farPlane;
+}
+
+// on screen diameter of a bounding sphere in pixels
+float screenPixels(vec3 center, float radius) {
+  float dist = glm::max(length(center - eyePoint) - radius, nearPlane);
+  return radius * projection[1][1] * WINDOW_HEIGHT / dist;
+}
+
+// draw a mesh with the program of the current pass
+void drawObject(Mesh *m, mat4 M, bool depthOnly) {
+  // every mesh samples units 13 / 14, textured once across its bounds
+  if (residency && !depthOnly) {
+    vec3 center = vec3(M * vec4(0.f, 0.f, 0.f, 1.f));
+    float radius = length(vec3(M * vec4(1.f, 1.f, 1.f, 0.f)));
+    for (int id : meshTextures) {
+      residency->use(id, residency->levelFor(id, screenPixels(center, radius)));
+    }
+  }
+
+  if (depthOnly) {
+    prepass->drawMesh(m, M, view, projection);
+  } else if (gBuffer) {
+    gBuffer->drawMesh(m, M, view, projection, 13, 14);
+  } else if (renderQueue) {
+    uint64_t key = RenderQueue::makeKey(0, m->shader, m->vao, sortDepth(M));
+    renderQueue->add(key, m, M, 13, 14, 9);
+    return;
+  } else {
+    m->draw(M, view, projection, eyePoint, lightColor, lightPosition, 13, 14,
+            9);
+  }
+
+  if (!depthOnly) {
+    trianglesDrawn += m->triangleCount();
+  }
+}
+
+// draw the quad with the program of the current pass
+void drawQuadObject(mat4 M, bool depthOnly) {
+  // the quad spans [-1, 1] x [-1, 1] facing +z
+  if (shadingLod && !depthOnly) {
+    vec3 center = vec3(M * vec4(0.f, 0.f, 0.f, 1.f));
+    vec3 normal = vec3(M * vec4(0.f, 0.f, 1.f, 0.f));
+    float radius = length(vec3(M * vec4(1.f, 1.f, 0.f, 0.f)));
+    quad->lodLevel = shadingLod->select(center, radius, normal, eyePoint,
+                                        projection, WINDOW_HEIGHT);
+  }
+
+  if (residency && !depthOnly) {
+    vec3 center = vec3(M * vec4(0.f, 0.f, 0.f, 1.f));
+    float radius = length(vec3(M * vec4(1.f, 1.f, 0.f, 0.f)));
+    for (int id : quadTextures) {
+      residency->use(id, residency->levelFor(id, screenPixels(center, radius)));
+    }
+  }
+
+  if (depthOnly) {
+    prepass->drawQuad(quad, M, view, projection);
+  } else if (gBuffer) {
+    gBuffer->drawQuad(quad, M, view, projection, eyePoint, lightPosition, 10,
+                      11, 12);
+  } else if (renderQueue) {
+    uint64_t key =
+        RenderQueue::makeKey(0, quad->shader, quad->vao, sortDepth(M));
+    renderQueue->add(key, quad, M, 10, 11, 12);
+  } else {
+    quad->draw(M, view, projection, eyePoint, lightColor, lightPosition, 10,
+               11, 12);
+  }
+}
+
+void renderFrame() {
+  // reset
+  glClearColor(0.f, 0.f, 0.4f, 0.f);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  if (gBuffer) {
+    gBuffer->begin();
+  }
+
+  if (prepass) {
+    prepass->begin();
+    drawScene(true);
+    prepass->end();
+    prepass->beginMain();
+  }
+
+  fragmentCounter->begin();
+  drawScene(false);
+  fragmentCounter->end();
+
+  if (prepass) {
+    prepass->endMain();
+  }
+
+  if (gBuffer) {
+    gBuffer->end();
+    gBuffer->light(view, projection, eyePoint, lightColor, lightPosition);
+  }
+
+  if (pointShader != 0) {
+    glState.useProgram(pointShader);
+    glState.uniformMatrix4f(uniPointM, model);
+    glState.uniformMatrix4f(uniPointV, view);
+    glState.uniformMatrix4f(uniPointP, projection);
+    drawPoints(pts);
+  }
+}
+
+// the camera and the light of s, moved by the keys and the mouse
+void computeMatricesFromInputs(FrameSnapshot &s) {
   // glfwGetTime is called only once, the first time this function is called
   static float lastTime = glfwGetTime();
 
@@ -138,36 +950,113 @@ void computeMatricesFromInputs() {
   vec3 right = vec3(cos(horizontalAngle - 3.14 / 2.f), 0.f,
                     sin(horizontalAngle - 3.14 / 2.f));
 
-  // new up vector
-  vec3 newUp = cross(right, direction);
-
   // Move forward
   if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
-    eyePoint += direction * deltaTime * speed;
+    s.eyePoint += direction * deltaTime * speed;
   }
   // Move backward
   if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) {
-    eyePoint -= direction * deltaTime * speed;
+    s.eyePoint -= direction * deltaTime * speed;
   }
   // Strafe right
   if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
-    eyePoint += right * deltaTime * speed;
+    s.eyePoint += right * deltaTime * speed;
   }
   // Strafe left
   if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) {
-    eyePoint -= right * deltaTime * speed;
+    s.eyePoint -= right * deltaTime * speed;
   }
 
-  // float FoV = initialFoV;
-  projection = perspective(initialFoV, 1.f * WINDOW_WIDTH / WINDOW_HEIGHT,
-                           nearPlane, farPlane);
-  // Camera matrix
-  view = lookAt(eyePoint, eyePoint + direction, newUp);
+  // Move the point light over the ground
+  if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS) {
+    s.lightPosition.z -= deltaTime * speed * 0.5f;
+  }
+  if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS) {
+    s.lightPosition.z += deltaTime * speed * 0.5f;
+  }
+  if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS) {
+    s.lightPosition.x -= deltaTime * speed * 0.5f;
+  }
+  if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) {
+    s.lightPosition.x += deltaTime * speed * 0.5f;
+  }
+
+  cameraMatrices(s.eyePoint, s.view, s.projection);
 
   // For the next frame, the "last time" will be "now"
   lastTime = currentTime;
 }
 
+// view and projection from eyePoint and the view angles
+void updateMatrices() { cameraMatrices(eyePoint, view, projection); }
+
+// view V and projection P from eye and the view angles
+void cameraMatrices(vec3 eye, mat4 &V, mat4 &P) {
+  vec3 direction =
+      vec3(sin(verticalAngle) * cos(horizontalAngle), cos(verticalAngle),
+           sin(verticalAngle) * sin(horizontalAngle));
+  vec3 right = vec3(cos(horizontalAngle - 3.14 / 2.f), 0.f,
+                    sin(horizontalAngle - 3.14 / 2.f));
+  vec3 newUp = cross(right, direction);
+
+  // float FoV = initialFoV;
+  P = perspective(initialFoV, 1.f * WINDOW_WIDTH / WINDOW_HEIGHT, nearPlane,
+                  farPlane);
+  // Camera matrix
+  V = lookAt(eye, eye + direction, newUp);
+}
+
+// main thread, publishes what the next frame is drawn from
+void sampleInput() {
+  computeMatricesFromInputs(input);
+
+  if (spinMesh) {
+    input.meshAngle = 0.5f * glfwGetTime();
+  }
+  input.inputTime = glfwGetTime();
+
+  snapshots.write() = input;
+  snapshots.publish();
+}
+
+// GL thread, the key requests counted since the last call are carried out
+void applySnapshot(const FrameSnapshot &s) {
+  static GLenum polygonMode = GL_FILL;
+  static int nOfRebuilds = 0, nOfStatsPrints = 0, nOfRecordToggles = 0;
+
+  latchCamera(s);
+  lightPosition = s.lightPosition;
+  pts[0].pos = lightPosition;
+  meshAngle = s.meshAngle;
+
+  if (s.polygonMode != polygonMode) {
+    polygonMode = s.polygonMode;
+    glPolygonMode(GL_FRONT_AND_BACK, polygonMode);
+  }
+  if (s.nOfRebuilds != nOfRebuilds) {
+    nOfRebuilds = s.nOfRebuilds;
+    shaderQueue.rebuildAll();
+  }
+  if (s.nOfStatsPrints != nOfStatsPrints) {
+    nOfStatsPrints = s.nOfStatsPrints;
+    frameStats.print();
+  }
+  if (s.nOfRecordToggles != nOfRecordToggles) {
+    if (recorder && (s.nOfRecordToggles - nOfRecordToggles) % 2 != 0) {
+      recorder->recording = !recorder->recording;
+    }
+    nOfRecordToggles = s.nOfRecordToggles;
+  }
+}
+
+// only the camera, the rest of the frame is already under way
+void latchCamera(const FrameSnapshot &s) {
+  view = s.view;
+  projection = s.projection;
+  eyePoint = s.eyePoint;
+  latchedInputTime = s.inputTime;
+}
+
 void keyCallback(GLFWwindow *keyWnd, int key, int scancode, int action,
                  int mods) {
   if (action == GLFW_PRESS) {
@@ -176,16 +1065,29 @@ void keyCallback(GLFWwindow *keyWnd, int key, int scancode, int action,
       glfwSetWindowShouldClose(keyWnd, GLFW_TRUE);
       break;
     }
+    // GL work is requested through the snapshots, the GL thread does it
     case GLFW_KEY_F: {
-      glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+      input.polygonMode = GL_FILL;
       break;
     }
     case GLFW_KEY_L: {
-      glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+      input.polygonMode = GL_LINE;
+      break;
+    }
+    case GLFW_KEY_R: {
+      input.nOfRebuilds++;
+      break;
+    }
+    case GLFW_KEY_C: {
+      input.nOfRecordToggles++;
+      break;
+    }
+    case GLFW_KEY_P: {
+      input.nOfStatsPrints++;
       break;
     }
     case GLFW_KEY_I: {
-      std::cout << "eyePoint: " << to_string(eyePoint) << '\n';
+      std::cout << "eyePoint: " << to_string(input.eyePoint) << '\n';
       std::cout << "verticleAngle: " << fmod(verticalAngle, 6.28f) << ", "
                 << "horizontalAngle: " << fmod(horizontalAngle, 6.28f) << endl;
       break;
@@ -196,6 +1098,162 @@ void keyCallback(GLFWwindow *keyWnd, int key, int scancode, int action,
   }
 }
 
+void parseArgs(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc) {
+      nOfPointLights = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--bench-lights") == 0) {
+      benchLights = true;
+    } else if (strcmp(argv[i], "--quads") == 0 && i + 1 < argc) {
+      nOfQuads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--deferred") == 0) {
+      useDeferred = true;
+    } else if (strcmp(argv[i], "--prepass") == 0) {
+      usePrepass = true;
+    } else if (strcmp(argv[i], "--shading-lod") == 0) {
+      shadingLod = new ShadingLod();
+    } else if (strcmp(argv[i], "--boats") == 0 && i + 1 < argc) {
+      nOfBoats = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--lod-pixels") == 0 && i + 1 < argc) {
+      lodPixels = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--occlusion") == 0) {
+      useOcclusion = true;
+    } else if (strcmp(argv[i], "--walls") == 0 && i + 1 < argc) {
+      nOfWalls = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--gpu-cull") == 0) {
+      useGpuCull = true;
+    } else if (strcmp(argv[i], "--arena") == 0) {
+      useArena = true;
+    } else if (strcmp(argv[i], "--arena-loop") == 0) {
+      useArena = arenaLoop = true;
+    } else if (strcmp(argv[i], "--materials") == 0) {
+      useArena = useMaterials = true;
+    } else if (strcmp(argv[i], "--distinct") == 0 && i + 1 < argc) {
+      nOfDistinct = atoi(argv[++i]);
+      useArena = true;
+    } else if (strcmp(argv[i], "--vt") == 0 && i + 1 < argc) {
+      vtFile = argv[++i];
+    } else if (strcmp(argv[i], "--vt-bake") == 0 && i + 1 < argc) {
+      vtBakeSize = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--ooc") == 0 && i + 1 < argc) {
+      oocFile = argv[++i];
+    } else if (strcmp(argv[i], "--ooc-bake") == 0 && i + 1 < argc) {
+      oocObj = argv[++i];
+    } else if (strcmp(argv[i], "--ooc-pool") == 0 && i + 1 < argc) {
+      oocSlots = glm::max(atoi(argv[++i]), 1);
+    } else if (strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc) {
+      textureBudget = (size_t)atoi(argv[++i]) << 20;
+    } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      recordPattern = argv[++i];
+    } else if (strcmp(argv[i], "--record-frames") == 0 && i + 1 < argc) {
+      recordFrames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--sort-draws") == 0) {
+      sortDraws = true;
+    } else if (strcmp(argv[i], "--no-state-cache") == 0) {
+      glState.enabled = false;
+    } else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+      statsFile = argv[++i];
+    } else if (strcmp(argv[i], "--stats-interval") == 0 && i + 1 < argc) {
+      statsInterval = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+      batchFile = argv[++i];
+      nOfQuads = glm::max(nOfQuads, 1);
+    } else if (strcmp(argv[i], "--batch-orbit") == 0 && i + 1 < argc) {
+      batchOrbit = atoi(argv[++i]);
+      nOfQuads = glm::max(nOfQuads, 1);
+    } else if (strcmp(argv[i], "--dynamic-res") == 0 && i + 1 < argc) {
+      targetGpuTime = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--res-limits") == 0 && i + 2 < argc) {
+      minResScale = glm::clamp((float)atof(argv[++i]), 0.1f, 1.f);
+      maxResScale = glm::clamp((float)atof(argv[++i]), minResScale, 1.f);
+    } else if (strcmp(argv[i], "--bench-dynamic") == 0 && i + 1 < argc) {
+      benchDynamicFile = argv[++i];
+    } else if (strcmp(argv[i], "--packed") == 0) {
+      usePacked = true;
+    } else if (strcmp(argv[i], "--derive-normals") == 0) {
+      usePacked = deriveFromHeight = true;
+    } else if (strcmp(argv[i], "--check-normals") == 0) {
+      checkNormals = true;
+    } else if (strcmp(argv[i], "--displace") == 0 && i + 1 < argc) {
+      string what = argv[++i];
+      displaceQuads = what == "quads" || what == "all";
+      displaceMesh = what == "mesh" || what == "all";
+    } else if (strcmp(argv[i], "--tess-pixels") == 0 && i + 1 < argc) {
+      tessPixels = glm::max((float)atof(argv[++i]), 1.f);
+    } else if (strcmp(argv[i], "--bench-displace") == 0) {
+      benchDisplace = true;
+      nOfQuads = glm::max(nOfQuads, 1);
+    } else if (strcmp(argv[i], "--shadows") == 0 && i + 1 < argc) {
+      shadowSize = glm::max(atoi(argv[++i]), 16);
+    } else if (strcmp(argv[i], "--shadow-range") == 0 && i + 1 < argc) {
+      shadowRange = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--shadow-spin") == 0) {
+      spinMesh = true;
+    } else if (strcmp(argv[i], "--render-thread") == 0) {
+      useRenderThread = true;
+    } else if (strcmp(argv[i], "--bench-load") == 0 && i + 1 < argc) {
+      benchLoadFile = argv[++i];
+    } else if (strcmp(argv[i], "--bench-faces") == 0 && i + 1 < argc) {
+      benchFaces = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--soft") == 0 && i + 1 < argc) {
+      softFile = argv[++i];
+    } else if (strcmp(argv[i], "--compare-soft") == 0) {
+      compareSoft = true;
+    } else {
+      std::cout << "Unknown option: " << argv[i] << '\n';
+      std::cout << "Options:\n"
+                << "  --lights N      N clustered point lights\n"
+                << "  --bench-lights  frame time over the number of lights\n"
+                << "  --quads N       N x N grid of POM quads\n"
+                << "  --deferred      deferred shading instead of forward\n"
+                << "  --prepass       depth pre-pass before the main pass\n"
+                << "  --shading-lod   POM / normal mapping / flat per object\n"
+                << "  --boats N       N boats with mesh LODs\n"
+                << "  --lod-pixels X  screen space error of mesh LODs, 0: off\n"
+                << "  --occlusion     cull boats with a CPU depth buffer\n"
+                << "  --walls N       N walls in front of the rows of boats\n"
+                << "  --gpu-cull      cull and draw boats instanced on the GPU\n"
+                << "  --arena         draw from shared buffers, one multi-draw\n"
+                << "  --arena-loop    the arena with a draw call per mesh\n"
+                << "  --distinct N    N distinct meshes drawn by the arena\n"
+                << "  --materials     arena draws pick texture array layers\n"
+                << "  --vt FILE       page the quads' normal / height maps\n"
+                << "  --vt-bake SIZE  bake FILE (SIZE^2 texels) first\n"
+                << "  --ooc FILE      stream a clustered mesh from FILE\n"
+                << "  --ooc-bake OBJ  cluster OBJ into FILE first\n"
+                << "  --ooc-pool N    N clusters on the GPU, 128 default\n"
+                << "  --texture-budget MB  evict mips of unused textures\n"
+                << "  --record PATTERN  write frames, e.g. /tmp/f_%05d.png\n"
+                << "  --record-frames N  quit after recording N frames\n"
+                << "  --sort-draws    submit forward draws sorted by key\n"
+                << "  --no-state-cache  issue redundant binds and uniforms\n"
+                << "  --stats FILE    append frame stats to FILE as JSON\n"
+                << "  --stats-interval S  every S seconds, 1 default\n"
+                << "  --batch FILE    render the quads from the views of FILE\n"
+                << "  --batch-orbit N  render them from N orbiting views\n"
+                << "  --dynamic-res MS  scale the resolution to MS GPU time\n"
+                << "  --res-limits MIN MAX  its scale limits, 0.5 1 default\n"
+                << "  --bench-dynamic FILE  vertex update cost of an obj\n"
+                << "  --packed        normal and height in one texture\n"
+                << "  --derive-normals  derive the normals from the heights\n"
+                << "  --check-normals  compare 8-wide and scalar derivation\n"
+                << "  --displace WHAT  tessellate quads, mesh or all\n"
+                << "  --tess-pixels N  edge length of it on screen, 8 default\n"
+                << "  --bench-displace  POM against displacement by distance\n"
+                << "  --shadows SIZE  cube shadow maps of the point light\n"
+                << "  --shadow-range R  casters within R, 20 default\n"
+                << "  --shadow-spin   turn the mesh, a dynamic caster\n"
+                << "  --render-thread  draw on a thread apart from the input\n"
+                << "  --bench-load FILE  loading benchmarks as JSON, no GL\n"
+                << "  --bench-faces N  synthetic meshes up to N faces, 4M\n"
+                << "  --soft FILE     render on the CPU without GL into FILE\n"
+                << "  --compare-soft  compare the CPU renderer with GL"
+                << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
 void initGL() { // Initialise GLFW
   if (!glfwInit()) {
     fprintf(stderr, "Failed to initialize GLFW\n");
@@ -205,9 +1263,12 @@ void initGL() { // Initialise GLFW
 
   // without setting GLFW_CONTEXT_VERSION_MAJOR and _MINOR，
   // OpenGL 1.x will be used
+  // tessellation shaders need 4.0, 4.1 is the newest core profile of macOS
+  bool tessellation = displaceQuads || displaceMesh || benchDisplace;
+
   glfwWindowHint(GLFW_SAMPLES, 4);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, tessellation ? 4 : 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, tessellation ? 1 : 3);
 
   // must be used if OpenGL version >= 3.0
   glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
@@ -217,6 +1278,17 @@ void initGL() { // Initialise GLFW
   window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "With normal mapping",
                             NULL, NULL);
 
+  if (window == NULL && tessellation) {
+    std::cout << "No OpenGL 4.1 context, --displace and --bench-displace "
+              << "are ignored" << std::endl;
+    displaceQuads = displaceMesh = benchDisplace = false;
+
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT,
+                              "With normal mapping", NULL, NULL);
+  }
+
   if (window == NULL) {
     std::cout << "Failed to open GLFW window." << std::endl;
     glfwTerminate();
@@ -248,11 +1320,18 @@ void initGL() { // Initialise GLFW
 void initOthers() {
   FreeImage_Initialise(true);
 
-  pointShader = buildShader("./shader/vsPoint.glsl", "./shader/fsPoint.glsl");
-  glUseProgram(pointShader);
-  uniPointM = myGetUniformLocation(pointShader, "M");
-  uniPointV = myGetUniformLocation(pointShader, "V");
-  uniPointP = myGetUniformLocation(pointShader, "P");
+  // all programs are submitted up front and linked in the background
+  shaderQueue.init();
+  shaderQueue.watch("./shader");
+
+  pointShader = 0;
+  shaderQueue.submit("./shader/vsPoint.glsl", "./shader/fsPoint.glsl",
+                     [](GLuint exe) {
+                       pointShader = exe;
+                       uniPointM = myGetUniformLocation(pointShader, "M");
+                       uniPointV = myGetUniformLocation(pointShader, "V");
+                       uniPointP = myGetUniformLocation(pointShader, "P");
+                     });
 }
 
 void initMatrix() {
@@ -263,18 +1342,765 @@ void initMatrix() {
 }
 
 void initTexture() {
+  if (residency) {
+    // a texture which fails to load is left out
+    auto add = [](vector<int> &ids, int id) {
+      if (id >= 0) {
+        ids.push_back(id);
+      }
+    };
+    add(meshTextures, residency->load(mesh->tboBase, 13,
+                                      "./res/stone_basecolor.jpg", FIF_JPEG));
+    add(meshTextures, residency->load(mesh->tboNormal, 14,
+                                      "./res/stone_normal.jpg", FIF_JPEG));
+    if (quad) {
+      add(quadTextures, residency->load(quad->tboBase, 10,
+                                        "./res/stone_basecolor.jpg", FIF_JPEG));
+      add(quadTextures, residency->load(quad->tboNormal, 11,
+                                        "./res/stone_normal.jpg", FIF_JPEG));
+      add(quadTextures, residency->load(quad->tboHeight, 12,
+                                        "./res/stone_height.jpg", FIF_JPEG));
+    }
+    return;
+  }
+
   mesh->setTexture(mesh->tboBase, 13, "./res/stone_basecolor.jpg", FIF_JPEG);
-  mesh->setTexture(mesh->tboNormal, 14, "./res/stone_normal.jpg", FIF_JPEG);
+  if (usePacked && loadPackedMaterial(mesh->tboNormal, 14, "./res/stone",
+                                     deriveFromHeight)) {
+    mesh->setPacked(true);
+  } else {
+    mesh->setTexture(mesh->tboNormal, 14, "./res/stone_normal.jpg", FIF_JPEG);
+  }
+
+  if (quad) {
+    quad->setTexture(quad->tboBase, 10, "./res/stone_basecolor.jpg", FIF_JPEG);
+
+    // the pages of a virtual texture are packed already
+    if (usePacked && !virtualTexture &&
+        loadPackedMaterial(quad->tboNormal, 11, "./res/stone",
+                           deriveFromHeight)) {
+      quad->setPacked(true);
+    } else {
+      quad->setTexture(quad->tboNormal, 11, "./res/stone_normal.jpg",
+                       FIF_JPEG);
+      quad->setTexture(quad->tboHeight, 12, "./res/stone_height.jpg",
+                       FIF_JPEG);
+    }
+  }
+}
+
+// load the boat scene and simplify each mesh on its own thread
+void initBoats() {
+  const char *fileNames[] = {"./mesh/boat.obj", "./mesh/torus.obj"};
+
+  for (const char *fileName : fileNames) {
+    boatMeshes.push_back(new Mesh(fileName));
+  }
+
+  auto t0 = std::chrono::high_resolution_clock::now();
+
+  vector<std::future<void>> tasks;
+  for (Mesh *m : boatMeshes) {
+    tasks.push_back(threadPool.enqueue([m]() { m->buildLods(); }));
+  }
+  for (size_t i = 0; i < tasks.size(); i++) {
+    tasks[i].wait();
+  }
+
+  auto t1 = std::chrono::high_resolution_clock::now();
+  std::cout << "Mesh LODs built in "
+            << std::chrono::duration<double, std::milli>(t1 - t0).count()
+            << " ms" << std::endl;
+
+  for (size_t i = 0; i < boatMeshes.size(); i++) {
+    Mesh *m = boatMeshes[i];
+    m->initLodBuffers();
+    m->lodPixels = lodPixels;
+
+    // triangles (object space error) per level
+    std::cout << fileNames[i] << ":";
+    for (LodLevel &level : m->lods->levels) {
+      std::cout << " " << level.count / 3 << " (" << level.error << ")";
+    }
+    std::cout << std::endl;
+  }
+
+  // boats in rows of 4 moving away along -x, scaled to about 2 units
+  for (int i = 0; i < nOfBoats; i++) {
+    Mesh *m = (i % 4 == 3) ? boatMeshes[1] : boatMeshes[0];
+
+    mat4 tempModel = translate(mat4(1.f), vec3(-3.f * (i / 4), 0.f,
+                                               -3.f + 2.f * (i % 4)));
+    tempModel = scale(tempModel, vec3(2.f / length(m->max - m->min)));
+    boatInstances.push_back(makeInstance(m, tempModel));
+  }
+}
+
+// one group of instances per mesh
+void initGpuCull() {
+  gpuCuller = new GpuCuller();
+
+  for (Mesh *m : boatMeshes) {
+    vector<mat4> models;
+    for (Instance &inst : boatInstances) {
+      if (inst.mesh == m) {
+        models.push_back(inst.model);
+      }
+    }
+    gpuCuller->addGroup(m, models);
+  }
+}
+
+// boats and distinct meshes share the buffers of the arena
+void initArena() {
+  arena = new MeshArena(!arenaLoop);
+
+  for (Mesh *m : boatMeshes) {
+    boatHandles.push_back(arena->add(m));
+  }
+
+  // every cube is its own mesh, so the draws can't be instanced
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<float> u(0.f, 1.f);
+
+  for (int i = 0; i < nOfDistinct; i++) {
+    Mesh *m = new Mesh("./mesh/cube.obj", false);
+    for (vec3 &v : m->vertices) {
+      v += 0.2f * vec3(u(rng), u(rng), u(rng)) - 0.1f;
+    }
+    m->findAABB();
+
+    distinctMeshes.push_back(m);
+    distinctHandles.push_back(arena->add(m));
+    distinctColors.push_back(vec4(u(rng), u(rng), u(rng), 1.f));
+  }
+
+  if (useMaterials) {
+    const char *names[] = {"stone", "rock", "bricks2", "toy_box"};
+
+    materials = new MaterialArray(512, 512, 4);
+    for (const char *name : names) {
+      string prefix = string("./res/") + name;
+      materials->add(prefix + "_basecolor.jpg", prefix + "_normal.jpg",
+                     prefix + "_height.jpg", FIF_JPEG);
+    }
+
+    // draws pick layers modulo their number
+    if (materials->nOfLayers == 0) {
+      std::cout << "materials: none could be loaded" << std::endl;
+      delete materials;
+      materials = NULL;
+    } else {
+      arena->setMaterials(materials);
+    }
+  }
+}
+
+// distinct meshes in a square grid behind the mesh
+mat4 distinctModel(int i) {
+  int side = glm::max(int(ceil(sqrt(double(nOfDistinct)))), 1);
+  mat4 M = translate(mat4(1.f), vec3(4.f + 0.6f * (i / side), 0.2f,
+                                     0.6f * (i % side - side / 2)));
+  return scale(M, vec3(0.2f));
+}
+
+void initVirtualTexture() {
+  if (vtBakeSize > 0 &&
+      !bakeVirtualTexture("./res/stone_normal.jpg", "./res/stone_height.jpg",
+                          vtFile, vtBakeSize)) {
+    return;
+  }
+
+  virtualTexture = new VirtualTexture(vtFile);
+  if (!virtualTexture->valid()) {
+    delete virtualTexture;
+    virtualTexture = NULL;
+    return;
+  }
+
+  quad->setVirtualTexture(virtualTexture);
+}
+
+void initMeshStreamer() {
+  if (!oocObj.empty() && !bakeMeshClusters(oocObj, oocFile)) {
+    return;
+  }
+
+  meshStreamer = new MeshStreamer(oocFile, oocSlots);
+  if (!meshStreamer->valid()) {
+    delete meshStreamer;
+    meshStreamer = NULL;
+  }
+}
+
+// everything drawScene() draws through Mesh and Quad casts shadows, the
+// mesh is a dynamic caster when it spins
+void initShadows() {
+  shadowCube = new ShadowCube(shadowSize, shadowRange);
+  shadowCube->setLight(lightPosition);
+
+  meshCaster = shadowCube->addCaster(mesh, meshModel(), spinMesh);
+  mesh->setShadow(shadowCube);
+
+  for (int r = 0; r < nOfQuads; r++) {
+    for (int c = 0; c < nOfQuads; c++) {
+      shadowCube->addCaster(quad, quadModel(r, c));
+    }
+  }
+  if (quad) {
+    quad->setShadow(shadowCube);
+  }
+
+  for (int i = 0; i < nOfWalls; i++) {
+    shadowCube->addCaster(wallMesh, wallModel(i));
+  }
+  if (wallMesh) {
+    wallMesh->setShadow(shadowCube);
+  }
+
+  for (Instance &inst : boatInstances) {
+    shadowCube->addCaster(inst.mesh, inst.model);
+  }
+  for (Mesh *m : boatMeshes) {
+    m->setShadow(shadowCube);
+  }
+}
+
+// the pages the quads sample, into the virtual texture's feedback buffer
+void renderFeedback() {
+  if (!virtualTexture->beginFeedback(view, projection)) {
+    return;
+  }
+
+  for (int r = 0; r < nOfQuads; r++) {
+    for (int c = 0; c < nOfQuads; c++) {
+      virtualTexture->drawFeedback(quad, quadModel(r, c));
+    }
+  }
+
+  virtualTexture->endFeedback();
+}
+
+void initOcclusion() {
+  // a quarter of the window in each direction
+  culler = new OcclusionCuller(WINDOW_WIDTH / 4, WINDOW_HEIGHT / 4);
+
+  // the boats are thin and too detailed to be worth rasterizing
+  for (int i = 0; i < nOfWalls; i++) {
+    culler->addOccluder(wallMesh, wallModel(i));
+  }
+
+  std::cout << "Occluder triangles: " << culler->occluders.size() / 3
+            << std::endl;
+}
+
+// the forward scene of drawScene() (mesh and quads) on the CPU,
+// tex: base color, normal and height map
+void drawSoftScene(SoftRaster &raster, SoftTexture *tex) {
+  SoftDraw d;
+  d.base = &tex[0];
+  d.normal = &tex[1];
+  d.height = &tex[2];
+  d.parallax = mesh->parallax;
+  d.lodLevel = mesh->lodLevel;
+  d.eye = eyePoint;
+  d.lightColor = lightColor;
+  d.lightPosition = lightPosition;
+
+  raster.clear(vec3(0.f, 0.f, 0.4f));
+  raster.drawMesh(mesh, meshModel(), view, projection, d);
+
+  if (quad) {
+    d.lodLevel = quad->lodLevel;
+
+    for (int r = 0; r < nOfQuads; r++) {
+      for (int c = 0; c < nOfQuads; c++) {
+        raster.drawQuad(quad, quadModel(r, c), view, projection, d);
+      }
+    }
+  }
 
-  // quad->setTexture(quad->tboBase, 10, "./res/stone_basecolor.jpg", FIF_JPEG);
-  // quad->setTexture(quad->tboNormal, 11, "./res/stone_normal.jpg", FIF_JPEG);
-  // quad->setTexture(quad->tboHeight, 12, "./res/stone_height.jpg", FIF_JPEG);
+  raster.flush();
+}
+
+static void loadSoftTextures(SoftTexture *tex) {
+  tex[0].load("./res/stone_basecolor.jpg", FIF_JPEG);
+  tex[1].load("./res/stone_normal.jpg", FIF_JPEG);
+  tex[2].load("./res/stone_height.jpg", FIF_JPEG);
+}
+
+// time a few frames on the CPU and save the last one
+void renderSoft() {
+  const int nOfFrames = 10;
+
+  FreeImage_Initialise(true);
+
+  mesh = new Mesh("./mesh/quad.obj", false);
+  if (nOfQuads > 0) {
+    quad = new Quad(false);
+  }
+
+  updateMatrices();
+
+  SoftTexture tex[3];
+  loadSoftTextures(tex);
+  SoftRaster raster(WINDOW_WIDTH, WINDOW_HEIGHT);
+
+  // warm up
+  drawSoftScene(raster, tex);
+
+  auto t0 = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < nOfFrames; i++) {
+    drawSoftScene(raster, tex);
+  }
+  auto t1 = std::chrono::high_resolution_clock::now();
+
+  std::cout << "soft frame: "
+            << std::chrono::duration<double, std::milli>(t1 - t0).count() /
+                   nOfFrames
+            << " ms, " << raster.tris.size() << " triangles, "
+            << threadPool.size() << " threads" << std::endl;
+
+  if (!raster.save(softFile)) {
+    std::cout << "Failed to save " << softFile << std::endl;
+  }
+
+  delete mesh;
+  delete quad;
+  delete wallMesh;
+  FreeImage_DeInitialise();
+}
+
+// render the scene with GL into a single sampled target and on the CPU,
+// report the difference and the frame time of both.
+// Run with LIBGL_ALWAYS_SOFTWARE=1 to compare against llvmpipe.
+void compareSoftRaster() {
+  const int nOfFrames = 10;
+  const int tolerance = 8;
+  int w = WINDOW_WIDTH, h = WINDOW_HEIGHT;
+
+  shaderQueue.update();
+  shaderQueue.finish();
+  updateMatrices();
+
+  // the window has 4x MSAA, the CPU renderer does not
+  GLuint fbo, rbos[2];
+  glGenFramebuffers(1, &fbo);
+  glGenRenderbuffers(2, rbos);
+  glBindRenderbuffer(GL_RENDERBUFFER, rbos[0]);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+  glBindRenderbuffer(GL_RENDERBUFFER, rbos[1]);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, rbos[0]);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                            GL_RENDERBUFFER, rbos[1]);
+  glViewport(0, 0, w, h);
+
+  auto drawGL = []() {
+    glClearColor(0.f, 0.f, 0.4f, 0.f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    drawScene(false);
+  };
+
+  drawGL();
+  glFinish();
+
+  auto t0 = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < nOfFrames; i++) {
+    drawGL();
+  }
+  glFinish();
+  auto t1 = std::chrono::high_resolution_clock::now();
+
+  vector<uint32_t> pixels(w * h);
+  glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+
+  SoftTexture tex[3];
+  loadSoftTextures(tex);
+  SoftRaster raster(w, h);
+
+  drawSoftScene(raster, tex);
+
+  auto t2 = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < nOfFrames; i++) {
+    drawSoftScene(raster, tex);
+  }
+  auto t3 = std::chrono::high_resolution_clock::now();
+
+  // rgb only, both are RGBA8 and bottom up
+  int maxDiff = 0, nOfOff = 0;
+  double sumDiff = 0.0;
+
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      uint32_t a = pixels[y * w + x], b = raster.color[y * raster.pitch + x];
+      int diff = 0;
+
+      for (int c = 0; c < 3; c++) {
+        int ca = (a >> (8 * c)) & 255, cb = (b >> (8 * c)) & 255;
+        diff = std::max(diff, abs(ca - cb));
+        sumDiff += abs(ca - cb);
+      }
+
+      maxDiff = std::max(maxDiff, diff);
+      nOfOff += diff > tolerance;
+    }
+  }
+
+  std::cout << "GL (" << glGetString(GL_RENDERER) << ") frame: "
+            << std::chrono::duration<double, std::milli>(t1 - t0).count() /
+                   nOfFrames
+            << " ms" << std::endl;
+  std::cout << "soft (" << threadPool.size() << " threads) frame: "
+            << std::chrono::duration<double, std::milli>(t3 - t2).count() /
+                   nOfFrames
+            << " ms" << std::endl;
+  std::cout << "max difference: " << maxDiff
+            << ", mean: " << sumDiff / (w * h * 3) << ", pixels off by more than "
+            << tolerance << ": " << 100.0 * nOfOff / (w * h) << "%"
+            << std::endl;
+
+  raster.save("soft.png");
+
+  // reuse the raster to save the GL image
+  for (int y = 0; y < h; y++) {
+    std::copy(pixels.begin() + y * w, pixels.begin() + (y + 1) * w,
+              raster.color.begin() + y * raster.pitch);
+  }
+  raster.save("gl.png");
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDeleteRenderbuffers(2, rbos);
+  glDeleteFramebuffers(1, &fbo);
+}
+
+// scatter random point lights above the mesh
+void initLights(int nOfLights) {
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<float> u(0.f, 1.f);
+
+  pointLights.clear();
+
+  for (int i = 0; i < nOfLights; i++) {
+    PointLight l;
+    l.pos = vec3(1.5f + 2.f * u(rng), 0.05f + 0.5f * u(rng), -1.f + 2.f * u(rng));
+    l.radius = 0.2f + 0.4f * u(rng);
+    l.color = vec3(u(rng), u(rng), u(rng));
+    pointLights.push_back(l);
+  }
+}
+
+// render with a fixed camera while sweeping the number of lights
+void benchmarkLights() {
+  const int counts[] = {0, 16, 64, 256, 1024, 4096, 16384};
+  const int nOfWarmups = 10, nOfFrames = 100;
+
+  // every program must be ready before measuring
+  shaderQueue.update();
+  shaderQueue.finish();
+
+  std::cout << "lights, build (ms), frame (ms), lights per froxel"
+            << std::endl;
+
+  for (int count : counts) {
+    initLights(count);
+
+    double buildTime = 0.0, frameTime = 0.0;
+
+    for (int i = 0; i < nOfWarmups + nOfFrames; i++) {
+      glFinish();
+      auto t0 = std::chrono::high_resolution_clock::now();
+
+      lightCluster->build(pointLights, view, projection, nearPlane, farPlane);
+      auto t1 = std::chrono::high_resolution_clock::now();
+
+      renderFrame();
+      glFinish();
+      auto t2 = std::chrono::high_resolution_clock::now();
+
+      glfwSwapBuffers(window);
+      glfwPollEvents();
+
+      if (i >= nOfWarmups) {
+        buildTime += std::chrono::duration<double, std::milli>(t1 - t0).count();
+        frameTime += std::chrono::duration<double, std::milli>(t2 - t0).count();
+      }
+    }
+
+    float perFroxel = float(lightCluster->aIndices.size()) /
+                      (lightCluster->dimX * lightCluster->dimY *
+                       lightCluster->dimZ);
+
+    std::cout << count << ", " << buildTime / nOfFrames << ", "
+              << frameTime / nOfFrames << ", " << perFroxel << std::endl;
+  }
+}
+
+// edit a window of an obj's vertices every frame: SIMD transform + upload
+// of the dirty range against one vertex at a time + full re-upload
+void benchmarkDynamicMesh() {
+  const float fractions[] = {0.01f, 0.1f, 1.f};
+  const int nOfWarmups = 10, nOfFrames = 100;
+
+  std::cout << "vertices, edited, SIMD + partial (ms), scalar + full (ms)"
+            << std::endl;
+
+  for (float fraction : fractions) {
+    Mesh *m = new Mesh(benchDynamicFile);
+    DynamicMesh dynamic(m);
+    size_t count = std::max(size_t(dynamic.nOfVtxs * fraction), (size_t)1);
+
+    // a small rotation about the mesh's center, so it stays in place
+    vec3 center = (m->min + m->max) * 0.5f;
+    mat4 R = translate(mat4(1.f), center);
+    R = rotate(R, 0.01f, vec3(0.f, 1.f, 0.f));
+    R = translate(R, -center);
+
+    double simdTime = 0.0, scalarTime = 0.0;
+
+    for (int i = 0; i < nOfWarmups + nOfFrames; i++) {
+      // the edited window moves through the mesh
+      size_t first = (i * count / 2) % dynamic.nOfVtxs;
+
+      glFinish();
+      auto t0 = std::chrono::high_resolution_clock::now();
+      dynamic.transform(R, first, count);
+      dynamic.upload();
+      glFinish();
+      auto t1 = std::chrono::high_resolution_clock::now();
+      dynamic.transformScalar(inverse(R), first, count);
+      dynamic.uploadAll();
+      glFinish();
+      auto t2 = std::chrono::high_resolution_clock::now();
+
+      if (i >= nOfWarmups) {
+        simdTime += std::chrono::duration<double, std::milli>(t1 - t0).count();
+        scalarTime +=
+            std::chrono::duration<double, std::milli>(t2 - t1).count();
+      }
+    }
+
+    std::cout << dynamic.nOfVtxs << ", " << count << ", "
+              << simdTime / nOfFrames << ", " << scalarTime / nOfFrames
+              << std::endl;
+
+    delete m;
+  }
+}
+
+// one quad with POM and displaced, from near to far: frame and GPU time,
+// with the shader invocations of a frame when the driver counts them
+void benchmarkDisplacement() {
+  const float distances[] = {0.25f, 0.5f, 1.f, 2.f, 4.f, 8.f, 16.f, 32.f};
+  const int nOfWarmups = 10, nOfFrames = 100;
+
+  // ARB_pipeline_statistics_query, core in 4.6
+  const GLenum targets[] = {GL_TIME_ELAPSED, GL_VERTEX_SHADER_INVOCATIONS_ARB,
+                            GL_TESS_EVALUATION_SHADER_INVOCATIONS_ARB,
+                            GL_FRAGMENT_SHADER_INVOCATIONS_ARB};
+  int nOfQueries = GLEW_ARB_pipeline_statistics_query ? 4 : 1;
+
+  GLuint queries[4];
+  glGenQueries(4, queries);
+
+  // the quad faces +y, seen from 45 degrees above
+  mat4 M = quadModel(0, 0);
+  vec3 center = vec3(M[3]);
+  vec3 direction = normalize(vec3(0.f, 1.f, 1.f));
+  quad->lodLevel = 0.f;
+
+  std::cout << "distance, mode, frame (ms), GPU (ms), vertex, tess eval, "
+            << "fragment invocations" << std::endl;
+
+  for (float distance : distances) {
+    eyePoint = center + direction * distance;
+    view = lookAt(eyePoint, center, up);
+
+    for (int displaced = 0; displaced < 2; displaced++) {
+      quad->setDisplacement(displaced);
+
+      // every program must be ready before measuring
+      shaderQueue.update();
+      shaderQueue.finish();
+
+      double frameTime = 0.0;
+      GLuint64 sums[4] = {0, 0, 0, 0};
+
+      for (int i = 0; i < nOfWarmups + nOfFrames; i++) {
+        glFinish();
+        auto t0 = std::chrono::high_resolution_clock::now();
+
+        glClearColor(0.f, 0.f, 0.4f, 0.f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        for (int q = 0; q < nOfQueries; q++) {
+          glBeginQuery(targets[q], queries[q]);
+        }
+        quad->draw(M, view, projection, eyePoint, lightColor, lightPosition,
+                   10, 11, 12);
+        for (int q = 0; q < nOfQueries; q++) {
+          glEndQuery(targets[q]);
+        }
+
+        glFinish();
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        glfwSwapBuffers(window);
+        glfwPollEvents();
+
+        if (i >= nOfWarmups) {
+          frameTime += std::chrono::duration<double, std::milli>(t1 - t0).count();
+          for (int q = 0; q < nOfQueries; q++) {
+            GLuint64 value = 0;
+            glGetQueryObjectui64v(queries[q], GL_QUERY_RESULT, &value);
+            sums[q] += value;
+          }
+        }
+      }
+
+      std::cout << distance << ", " << (displaced ? "displaced" : "POM")
+                << ", " << frameTime / nOfFrames << ", "
+                << sums[0] / 1e6 / nOfFrames;
+      for (int q = 1; q < 4; q++) {
+        std::cout << ", ";
+        if (q < nOfQueries) {
+          std::cout << sums[q] / nOfFrames;
+        } else {
+          std::cout << "-";
+        }
+      }
+      std::cout << std::endl;
+    }
+  }
+
+  glDeleteQueries(4, queries);
 }
 
 void releaseResource() {
+  delete shadingLod;
+  delete prepass;
+  delete fragmentCounter;
+  delete gBuffer;
+  delete lightCluster;
+  delete culler;
+  delete gpuCuller;
+  delete arena;
+  delete materials;
+  delete virtualTexture;
+  delete meshStreamer;
+  delete residency;
+  delete recorder;
+  delete dynamicRes;
+  delete renderQueue;
+  delete shadowCube;
+  delete latency;
+
+  // their destructors delete GL objects, the context must still be there
+  delete mesh;
+  delete quad;
+  delete wallMesh;
+  for (Mesh *m : boatMeshes) {
+    delete m;
+  }
+  for (Mesh *m : distinctMeshes) {
+    delete m;
+  }
+
+  frameStats.close();
+  shaderQueue.release();
   glfwTerminate();
   FreeImage_DeInitialise();
+}
 
-  delete mesh;
-  // delete quad;
+// render every view through the layered framebuffer, NUM_BATCH_VIEWS per
+// pass, then once more a view per pass with the quad's own program, and
+// report images per second of both. Only the layered images are recorded.
+void runBatch() {
+  int w, h;
+  glfwGetFramebufferSize(window, &w, &h);
+  float aspect = 1.f * w / h;
+
+  vector<BatchView> views;
+  if (!batchFile.empty()) {
+    views = loadBatchViews(batchFile, aspect, nearPlane, farPlane);
+  } else {
+    vec3 center = vec3(1.f - nOfQuads, 0.f, nOfQuads - 1.f);
+    views = orbitBatchViews(batchOrbit, center, 2.f * nOfQuads + 1.f,
+                            radians(initialFoV), aspect, nearPlane, farPlane);
+  }
+  if (views.empty()) {
+    return;
+  }
+
+  MultiView multiView(w, h);
+
+  // a whole pass of views in flight per slot of the default recorder
+  FrameRecorder *batchRecorder = NULL;
+  if (!recordPattern.empty()) {
+    batchRecorder = new FrameRecorder(recordPattern, w, h,
+                                      NUM_CAPTURE_SLOTS * NUM_BATCH_VIEWS);
+  }
+
+  shaderQueue.update();
+  shaderQueue.finish();
+
+  auto drawLayered = [&]() {
+    for (size_t first = 0; first < views.size(); first += NUM_BATCH_VIEWS) {
+      if (!multiView.begin(views, first)) {
+        return;
+      }
+      for (int r = 0; r < nOfQuads; r++) {
+        for (int c = 0; c < nOfQuads; c++) {
+          multiView.drawQuad(quad, quadModel(r, c), lightColor, 10, 11, 12);
+        }
+      }
+      multiView.end();
+
+      if (batchRecorder) {
+        for (int i = 0; i < multiView.nOfViews; i++) {
+          batchRecorder->capture(multiView.layerFbos[i]);
+        }
+      }
+    }
+  };
+
+  auto drawSingle = [&]() {
+    quad->lodLevel = 0.f;
+    for (size_t i = 0; i < views.size(); i++) {
+      BatchView &v = views[i];
+      multiView.beginLayer(i % NUM_BATCH_VIEWS);
+      for (int r = 0; r < nOfQuads; r++) {
+        for (int c = 0; c < nOfQuads; c++) {
+          quad->draw(quadModel(r, c), v.view, v.projection, v.eye, lightColor,
+                     v.light, 10, 11, 12);
+        }
+      }
+      multiView.end();
+    }
+  };
+
+  auto t0 = std::chrono::high_resolution_clock::now();
+  drawLayered();
+  glFinish();
+  auto t1 = std::chrono::high_resolution_clock::now();
+  drawSingle();
+  glFinish();
+  auto t2 = std::chrono::high_resolution_clock::now();
+
+  double layered = std::chrono::duration<double>(t1 - t0).count();
+  double single = std::chrono::duration<double>(t2 - t1).count();
+
+  std::cout << views.size() << " views, layered: "
+            << views.size() / std::max(layered, 1e-9) << " images/s, "
+            << "single view: " << views.size() / std::max(single, 1e-9)
+            << " images/s" << std::endl;
+
+  if (batchRecorder) {
+    batchRecorder->flush();
+    std::cout << batchRecorder->nOfWritten << " images written to "
+              << recordPattern << std::endl;
+    delete batchRecorder;
+  }
 }
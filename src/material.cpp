@@ -0,0 +1,131 @@
+#include "material.h"
+#include "glState.h"
+#include "stats.h"
+
+MaterialArray::MaterialArray(int w, int h, int layers) {
+  width = w;
+  height = h;
+  maxLayers = layers;
+  nOfLayers = 0;
+  mipmapsDirty = false;
+
+  nOfLevels = 1;
+  while ((glm::max(width, height) >> nOfLevels) > 0) {
+    nOfLevels++;
+  }
+
+  unitBase = 22;
+  unitNormal = 23;
+  unitHeight = 24;
+
+  GLint maxArrayLayers;
+  glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxArrayLayers);
+  if (maxLayers > maxArrayLayers) {
+    std::cout << "materials: " << maxLayers
+              << " layers exceed GL_MAX_ARRAY_TEXTURE_LAYERS" << std::endl;
+    maxLayers = maxArrayLayers;
+  }
+
+  initArray(tboBase);
+  initArray(tboNormal);
+  initArray(tboHeight);
+}
+
+MaterialArray::~MaterialArray() {
+  frameStats.releaseTexture(tboBase);
+  frameStats.releaseTexture(tboNormal);
+  frameStats.releaseTexture(tboHeight);
+  glDeleteTextures(1, &tboBase);
+  glDeleteTextures(1, &tboNormal);
+  glDeleteTextures(1, &tboHeight);
+}
+
+// every mip level of every layer, filled by add()
+void MaterialArray::initArray(GLuint &tbo) {
+  glGenTextures(1, &tbo);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, tbo);
+
+  size_t bytes = 0;
+  for (int l = 0; l < nOfLevels; l++) {
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, l, GL_RGB8,
+                 glm::max(width >> l, 1), glm::max(height >> l, 1),
+                 maxLayers, 0, GL_BGR, GL_UNSIGNED_BYTE, NULL);
+    bytes += (size_t)4 * glm::max(width >> l, 1) * glm::max(height >> l, 1) *
+             maxLayers;
+  }
+  frameStats.setTexture(tbo, bytes);
+
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+                  GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+// level 0 only, bind() builds the other levels once for all layers
+bool MaterialArray::loadLayer(GLuint tbo, int layer, const string texDir,
+                              FREE_IMAGE_FORMAT imgType) {
+  FIBITMAP *loaded = FreeImage_Load(imgType, texDir.c_str());
+  if (!loaded) {
+    std::cout << "materials: can't load " << texDir << std::endl;
+    return false;
+  }
+
+  FIBITMAP *texImage = FreeImage_ConvertTo24Bits(loaded);
+  FreeImage_Unload(loaded);
+
+  // all layers have the size of the array
+  if ((int)FreeImage_GetWidth(texImage) != width ||
+      (int)FreeImage_GetHeight(texImage) != height) {
+    FIBITMAP *scaled =
+        FreeImage_Rescale(texImage, width, height, FILTER_BILINEAR);
+    FreeImage_Unload(texImage);
+    texImage = scaled;
+  }
+
+  glBindTexture(GL_TEXTURE_2D_ARRAY, tbo);
+  glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, width, height, 1,
+                  GL_BGR, GL_UNSIGNED_BYTE, (void *)FreeImage_GetBits(texImage));
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+  FreeImage_Unload(texImage);
+  return true;
+}
+
+// returns the index of the material, -1 when the arrays are full or a
+// map fails to load; the layer is then reused by the next add()
+int MaterialArray::add(const string base, const string normal,
+                       const string heightMap, FREE_IMAGE_FORMAT imgType) {
+  if (nOfLayers == maxLayers) {
+    return -1;
+  }
+
+  int layer = nOfLayers;
+  if (!loadLayer(tboBase, layer, base, imgType) ||
+      !loadLayer(tboNormal, layer, normal, imgType) ||
+      !loadLayer(tboHeight, layer, heightMap, imgType)) {
+    return -1;
+  }
+  nOfLayers++;
+  names.push_back(base);
+  mipmapsDirty = true;
+
+  return layer;
+}
+
+void MaterialArray::bind() {
+  glState.bindTexture(unitBase, GL_TEXTURE_2D_ARRAY, tboBase);
+  glState.bindTexture(unitNormal, GL_TEXTURE_2D_ARRAY, tboNormal);
+  glState.bindTexture(unitHeight, GL_TEXTURE_2D_ARRAY, tboHeight);
+
+  // the layers added since the last bind, all at once
+  if (mipmapsDirty) {
+    for (int unit : {unitBase, unitNormal, unitHeight}) {
+      glActiveTexture(GL_TEXTURE0 + unit);
+      glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    }
+    mipmapsDirty = false;
+  }
+}
@@ -0,0 +1,427 @@
+#include "meshArena.h"
+#include "shaderQueue.h"
+#include "glState.h"
+#include "stats.h"
+#include <cstddef>
+#include <numeric>
+
+RangeAllocator::RangeAllocator(GLuint cap) {
+  capacity = 0;
+  grow(cap);
+}
+
+// first fit, false when no free range is large enough
+bool RangeAllocator::alloc(GLuint size, GLuint &offset) {
+  for (auto it = freeRanges.begin(); it != freeRanges.end(); ++it) {
+    if (it->second < size) {
+      continue;
+    }
+
+    offset = it->first;
+    GLuint rest = it->second - size;
+    freeRanges.erase(it);
+    if (rest > 0) {
+      freeRanges[offset + size] = rest;
+    }
+    return true;
+  }
+
+  return false;
+}
+
+void RangeAllocator::free(GLuint offset, GLuint size) {
+  if (size == 0) {
+    return;
+  }
+
+  // merge with the following range
+  auto next = freeRanges.lower_bound(offset);
+  if (next != freeRanges.end() && offset + size == next->first) {
+    size += next->second;
+    next = freeRanges.erase(next);
+  }
+
+  // and with the preceding one
+  if (next != freeRanges.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == offset) {
+      prev->second += size;
+      return;
+    }
+  }
+
+  freeRanges[offset] = size;
+}
+
+// the new tail is free, merged with a free range ending at the old one
+void RangeAllocator::grow(GLuint newCapacity) {
+  if (newCapacity <= capacity) {
+    return;
+  }
+
+  GLuint oldCapacity = capacity;
+  capacity = newCapacity;
+  free(oldCapacity, newCapacity - oldCapacity);
+}
+
+MeshArena::MeshArena(bool allowMultiDraw) {
+  vboVertices = iboIndices = vboIds = 0;
+  nOfIds = 0;
+  unitDraws = 21;
+  nOfCalls = nOfTriangles = 0;
+  materials = NULL;
+
+  // GL 4.3 core, baseInstance comes with GL_ARB_base_instance
+  multiDraw = allowMultiDraw &&
+              hasExtension("GL_ARB_multi_draw_indirect") &&
+              hasExtension("GL_ARB_base_instance");
+
+  std::cout << "mesh arena: "
+            << (multiDraw ? "glMultiDrawElementsIndirect"
+                          : "a glDrawElementsBaseVertex per draw")
+            << std::endl;
+
+  glGenVertexArrays(1, &vao);
+  glGenBuffers(1, &bufCommands);
+
+  // per draw data, the buffer texture follows reallocations of its store
+  glGenBuffers(1, &vboDraws);
+  glBindBuffer(GL_TEXTURE_BUFFER, vboDraws);
+  glBufferData(GL_TEXTURE_BUFFER, sizeof(vec4) * 5, NULL, GL_STREAM_DRAW);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  frameStats.setBuffer(vboDraws, sizeof(vec4) * 5);
+
+  glGenTextures(1, &tboDraws);
+  glBindTexture(GL_TEXTURE_BUFFER, tboDraws);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, vboDraws);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+  growVertices(1 << 16);
+  growIndices(1 << 18);
+  growIds(1024);
+
+  initShader();
+}
+
+MeshArena::~MeshArena() {
+  shaderQueue.remove(program);
+  frameStats.releaseBuffer(vboVertices);
+  frameStats.releaseBuffer(iboIndices);
+  frameStats.releaseBuffer(vboIds);
+  frameStats.releaseBuffer(vboDraws);
+  frameStats.releaseBuffer(bufCommands);
+  glDeleteBuffers(1, &vboVertices);
+  glDeleteBuffers(1, &iboIndices);
+  glDeleteBuffers(1, &vboIds);
+  glDeleteBuffers(1, &vboDraws);
+  glDeleteBuffers(1, &bufCommands);
+  glDeleteTextures(1, &tboDraws);
+  glState.deleteVaos(1, &vao);
+}
+
+void MeshArena::initShader() {
+  shader = 0;
+
+  program = shaderQueue.submit(
+      "./shader/vsPhong.glsl", "./shader/fsPhong.glsl",
+      [this](GLuint exe) {
+        shader = exe;
+        uniView = myGetUniformLocation(shader, "V");
+        uniProjection = myGetUniformLocation(shader, "P");
+        uniEyePoint = myGetUniformLocation(shader, "eyePoint");
+        uniLightColor = myGetUniformLocation(shader, "lightColor");
+        uniLightPosition = myGetUniformLocation(shader, "lightPosition");
+        uniTexBase = myGetUniformLocation(shader, "texBase");
+        uniTexNormal = myGetUniformLocation(shader, "texNormal");
+        uniInstances = myGetUniformLocation(shader, "instances");
+      },
+      shaderDefines());
+}
+
+// sample the layers of the draws' materials instead of the bound textures
+void MeshArena::setMaterials(MaterialArray *m) {
+  materials = m;
+  shaderQueue.setDefines(program, shaderDefines());
+}
+
+string MeshArena::shaderDefines() {
+  string defines = "#define INSTANCED\n#define DRAW_MATERIAL\n";
+
+  if (materials) {
+    defines += "#define MATERIAL_ARRAY\n";
+  }
+
+  return defines;
+}
+
+void MeshArena::initVao() {
+  GLsizei stride = sizeof(ArenaVertex);
+
+  glState.bindVao(vao);
+
+  glBindBuffer(GL_ARRAY_BUFFER, vboVertices);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride,
+                        (GLvoid *)offsetof(ArenaVertex, pos));
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride,
+                        (GLvoid *)offsetof(ArenaVertex, uv));
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride,
+                        (GLvoid *)offsetof(ArenaVertex, n));
+  glEnableVertexAttribArray(2);
+
+  // draw index i for instance i, offset by the baseInstance of a command
+  if (vboIds) {
+    glBindBuffer(GL_ARRAY_BUFFER, vboIds);
+    glVertexAttribIPointer(5, 1, GL_UNSIGNED_INT, 0, 0);
+    glVertexAttribDivisor(5, 1);
+  }
+  if (multiDraw && vboIds) {
+    glEnableVertexAttribArray(5);
+  } else {
+    // the loop sets the current value of the attribute instead
+    glDisableVertexAttribArray(5);
+  }
+
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboIndices);
+
+  glState.bindVao(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// copy into a larger buffer, offsets of the packed meshes stay valid
+static GLuint growBuffer(GLuint old, GLsizeiptr oldSize, GLsizeiptr size) {
+  GLuint buf;
+  glGenBuffers(1, &buf);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, buf);
+  glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STATIC_DRAW);
+
+  if (old) {
+    glBindBuffer(GL_COPY_READ_BUFFER, old);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                        oldSize);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    frameStats.releaseBuffer(old);
+    glDeleteBuffers(1, &old);
+  }
+
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  frameStats.setBuffer(buf, size);
+  return buf;
+}
+
+void MeshArena::growVertices(GLuint capacity) {
+  vboVertices = growBuffer(vboVertices,
+                           sizeof(ArenaVertex) * vertexRanges.capacity,
+                           sizeof(ArenaVertex) * capacity);
+  vertexRanges.grow(capacity);
+  initVao();
+}
+
+void MeshArena::growIndices(GLuint capacity) {
+  iboIndices = growBuffer(iboIndices, sizeof(GLuint) * indexRanges.capacity,
+                          sizeof(GLuint) * capacity);
+  indexRanges.grow(capacity);
+  initVao();
+}
+
+void MeshArena::growIds(GLuint count) {
+  vector<GLuint> ids(count);
+  std::iota(ids.begin(), ids.end(), 0);
+
+  if (!vboIds) {
+    glGenBuffers(1, &vboIds);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, vboIds);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint) * count, ids.data(),
+               GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  frameStats.setBuffer(vboIds, sizeof(GLuint) * count);
+
+  nOfIds = count;
+  initVao();
+}
+
+// pack the vertices and every LOD level of a mesh, returns its handle
+int MeshArena::add(Mesh *mesh) {
+  ArenaMesh am;
+  am.mesh = mesh;
+  am.alive = true;
+
+  vector<ArenaVertex> vtxs;
+  vector<GLuint> indices;
+
+  if (mesh->lods) {
+    LodChain *lods = mesh->lods;
+    for (size_t i = 0; i < lods->vtxs.size(); i++) {
+      ArenaVertex v = {lods->vtxs[i], lods->uvs[i], lods->nms[i]};
+      vtxs.push_back(v);
+    }
+    indices = lods->indices;
+    am.levels = lods->levels;
+  } else {
+    // the triangle soup of Mesh::initBuffers()
+    for (Face &f : mesh->faces) {
+      ArenaVertex v1 = {mesh->vertices[f.v1], mesh->uvs[f.vt1],
+                        mesh->faceNormals[f.vn1]};
+      ArenaVertex v2 = {mesh->vertices[f.v2], mesh->uvs[f.vt2],
+                        mesh->faceNormals[f.vn2]};
+      ArenaVertex v3 = {mesh->vertices[f.v3], mesh->uvs[f.vt3],
+                        mesh->faceNormals[f.vn3]};
+      vtxs.push_back(v1);
+      vtxs.push_back(v2);
+      vtxs.push_back(v3);
+    }
+    indices.resize(vtxs.size());
+    std::iota(indices.begin(), indices.end(), 0);
+
+    LodLevel level = {0, (GLuint)indices.size(), 0.f};
+    am.levels.push_back(level);
+  }
+
+  am.nOfVertices = vtxs.size();
+  am.nOfIndices = indices.size();
+
+  while (!vertexRanges.alloc(am.nOfVertices, am.baseVertex)) {
+    growVertices(vertexRanges.capacity * 2);
+  }
+  while (!indexRanges.alloc(am.nOfIndices, am.firstIndex)) {
+    growIndices(indexRanges.capacity * 2);
+  }
+
+  // not through GL_ELEMENT_ARRAY_BUFFER, which would touch the bound VAO
+  glBindBuffer(GL_COPY_WRITE_BUFFER, vboVertices);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, sizeof(ArenaVertex) * am.baseVertex,
+                  sizeof(ArenaVertex) * vtxs.size(), vtxs.data());
+  glBindBuffer(GL_COPY_WRITE_BUFFER, iboIndices);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, sizeof(GLuint) * am.firstIndex,
+                  sizeof(GLuint) * indices.size(), indices.data());
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  // reuse the handle of a removed mesh
+  for (size_t i = 0; i < meshes.size(); i++) {
+    if (!meshes[i].alive) {
+      meshes[i] = am;
+      return i;
+    }
+  }
+
+  meshes.push_back(am);
+  return meshes.size() - 1;
+}
+
+// the ranges are reused by later add()s
+void MeshArena::remove(int handle) {
+  ArenaMesh &am = meshes[handle];
+
+  if (!am.alive) {
+    return;
+  }
+
+  vertexRanges.free(am.baseVertex, am.nOfVertices);
+  indexRanges.free(am.firstIndex, am.nOfIndices);
+  am.mesh = NULL;
+  am.levels.clear();
+  am.alive = false;
+}
+
+void MeshArena::begin() {
+  commands.clear();
+  drawData.clear();
+  nOfTriangles = 0;
+}
+
+// queue a draw, the LOD level is chosen now like Mesh::draw()
+// material: layer of the MaterialArray, ignored without one
+void MeshArena::draw(int handle, mat4 M, mat4 V, mat4 P, vec4 tint,
+                     int material) {
+  ArenaMesh &am = meshes[handle];
+
+  int level = 0;
+  if (am.levels.size() > 1) {
+    am.mesh->selectLod(M, V, P);
+    level = am.mesh->lodIndex;
+  }
+  LodLevel &lod = am.levels[level];
+
+  DrawElementsCommand cmd = {lod.count, 1, am.firstIndex + lod.offset,
+                             (GLint)am.baseVertex, (GLuint)commands.size()};
+  commands.push_back(cmd);
+  nOfTriangles += lod.count / 3;
+
+  for (int c = 0; c < 4; c++) {
+    drawData.push_back(M[c]);
+  }
+  drawData.push_back(vec4(vec3(tint), float(material)));
+}
+
+// submit the draws queued since begin()
+void MeshArena::end(mat4 V, mat4 P, vec3 eye, vec3 lightColor,
+                    vec3 lightPos, int unitBase, int unitNormal) {
+  nOfCalls = 0;
+
+  if (commands.empty() || shader == 0) {
+    return;
+  }
+
+  if (multiDraw && commands.size() > nOfIds) {
+    GLuint count = nOfIds;
+    while (count < commands.size()) {
+      count *= 2;
+    }
+    growIds(count);
+  }
+
+  // orphan the store, the previous frame may still read it
+  glBindBuffer(GL_TEXTURE_BUFFER, vboDraws);
+  glBufferData(GL_TEXTURE_BUFFER, sizeof(vec4) * drawData.size(), NULL,
+               GL_STREAM_DRAW);
+  glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(vec4) * drawData.size(),
+                  drawData.data());
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  frameStats.setBuffer(vboDraws, sizeof(vec4) * drawData.size());
+
+  glState.useProgram(shader);
+
+  glState.uniformMatrix4f(uniView, V);
+  glState.uniformMatrix4f(uniProjection, P);
+  glState.uniform3f(uniEyePoint, eye);
+  glState.uniform3f(uniLightColor, lightColor);
+  glState.uniform3f(uniLightPosition, lightPos);
+  if (materials) {
+    materials->bind();
+    unitBase = materials->unitBase;
+    unitNormal = materials->unitNormal;
+  }
+  glState.uniform1i(uniTexBase, unitBase);
+  glState.uniform1i(uniTexNormal, unitNormal);
+
+  glState.bindTexture(unitDraws, GL_TEXTURE_BUFFER, tboDraws);
+  glState.uniform1i(uniInstances, unitDraws);
+
+  glState.bindVao(vao);
+
+  if (multiDraw) {
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, bufCommands);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER,
+                 sizeof(DrawElementsCommand) * commands.size(),
+                 commands.data(), GL_STREAM_DRAW);
+    frameStats.setBuffer(bufCommands,
+                         sizeof(DrawElementsCommand) * commands.size());
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0,
+                                commands.size(), 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    nOfCalls = 1;
+  } else {
+    for (size_t i = 0; i < commands.size(); i++) {
+      DrawElementsCommand &cmd = commands[i];
+      glVertexAttribI1ui(5, i);
+      glDrawElementsBaseVertex(GL_TRIANGLES, cmd.count, GL_UNSIGNED_INT,
+                               (GLvoid *)(sizeof(GLuint) * cmd.firstIndex),
+                               cmd.baseVertex);
+    }
+    nOfCalls = commands.size();
+  }
+
+  glState.bindVao(0);
+}
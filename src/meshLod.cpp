@@ -0,0 +1,418 @@
+#include "meshLod.h"
+#include <map>
+#include <queue>
+#include <tuple>
+
+// plane penalty of open borders, relative to the squared edge length
+static const double borderWeight = 10.0;
+
+// a collapse may not turn a triangle further than this (cos of the angle)
+static const float minNormalDot = 0.2f;
+
+/* A candidate half-edge collapse u -> v */
+typedef struct {
+  float cost;
+  GLuint u, v;
+  int versionU, versionV;
+} Collapse;
+
+struct CollapseGreater {
+  bool operator()(const Collapse &a, const Collapse &b) const {
+    return a.cost > b.cost;
+  }
+};
+
+static void addPlane(Quadric &q, dvec4 p, double w) {
+  q.a[0] += w * p.x * p.x;
+  q.a[1] += w * p.x * p.y;
+  q.a[2] += w * p.x * p.z;
+  q.a[3] += w * p.x * p.w;
+  q.a[4] += w * p.y * p.y;
+  q.a[5] += w * p.y * p.z;
+  q.a[6] += w * p.y * p.w;
+  q.a[7] += w * p.z * p.z;
+  q.a[8] += w * p.z * p.w;
+  q.a[9] += w * p.w * p.w;
+}
+
+static void addQuadric(Quadric &q, const Quadric &r) {
+  for (int i = 0; i < 10; i++) {
+    q.a[i] += r.a[i];
+  }
+  q.weight += r.weight;
+}
+
+// p^T Q p with p = (x, y, z, 1)
+static double evaluate(const Quadric &q, vec3 v) {
+  double x = v.x, y = v.y, z = v.z;
+
+  return q.a[0] * x * x + 2.0 * q.a[1] * x * y + 2.0 * q.a[2] * x * z +
+         2.0 * q.a[3] * x + q.a[4] * y * y + 2.0 * q.a[5] * y * z +
+         2.0 * q.a[6] * y + q.a[7] * z * z + 2.0 * q.a[8] * z + q.a[9];
+}
+
+LodChain::LodChain() {
+  ratio = 0.5f;
+  maxLevels = 6;
+  minTriangles = 32;
+}
+
+void LodChain::build(Mesh *mesh) {
+  weld(mesh);
+  initQuadrics();
+
+  int nOfPos = positions.size();
+  int nOfTris = tris.size();
+
+  alive.assign(nOfTris, true);
+  nOfAlive = nOfTris;
+  versions.assign(nOfPos, 0);
+
+  posTris.assign(nOfPos, vector<GLuint>());
+  for (int t = 0; t < nOfTris; t++) {
+    for (int k = 0; k < 3; k++) {
+      posTris[vtxPos[tris[t][k]]].push_back(t);
+    }
+  }
+
+  emitLevel(0.f);
+
+  // both directions of every edge, duplicates are harmless
+  std::priority_queue<Collapse, vector<Collapse>, CollapseGreater> heap;
+
+  for (int t = 0; t < nOfTris; t++) {
+    for (int k = 0; k < 3; k++) {
+      GLuint a = vtxPos[tris[t][k]];
+      GLuint b = vtxPos[tris[t][(k + 1) % 3]];
+
+      heap.push({cost(a, b), a, b, 0, 0});
+      heap.push({cost(b, a), b, a, 0, 0});
+    }
+  }
+
+  float maxError = 0.f;
+
+  while ((int)levels.size() < maxLevels && nOfAlive > minTriangles) {
+    int target = glm::max(int(nOfAlive * ratio), minTriangles);
+    int before = nOfAlive;
+
+    while (nOfAlive > target && !heap.empty()) {
+      Collapse c = heap.top();
+      heap.pop();
+
+      // one of the vertices changed since the collapse was queued
+      if (versions[c.u] != c.versionU || versions[c.v] != c.versionV) {
+        continue;
+      }
+
+      Quadric q = quadrics[c.u];
+      addQuadric(q, quadrics[c.v]);
+
+      if (!collapse(c.u, c.v)) {
+        continue;
+      }
+
+      double err = std::max(evaluate(q, positions[c.v]), 0.0);
+      maxError = glm::max(maxError,
+                          float(sqrt(err / std::max(q.weight, 1e-12))));
+
+      // the quadric of v changed, queue its edges again
+      std::map<GLuint, bool> ring;
+      for (GLuint t : posTris[c.v]) {
+        for (int k = 0; k < 3; k++) {
+          GLuint n = vtxPos[tris[t][k]];
+          if (n != c.v) {
+            ring[n] = true;
+          }
+        }
+      }
+
+      for (auto &it : ring) {
+        GLuint n = it.first;
+        heap.push({cost(c.v, n), c.v, n, versions[c.v], versions[n]});
+        heap.push({cost(n, c.v), n, c.v, versions[n], versions[c.v]});
+      }
+    }
+
+    // less than 10% gained, the rest is locked by seams or borders
+    if (nOfAlive > before * 0.9f) {
+      break;
+    }
+
+    emitLevel(maxError);
+  }
+
+  // only the output is kept
+  positions.clear();
+  quadrics.clear();
+  tris.clear();
+  alive.clear();
+  posTris.clear();
+  versions.clear();
+}
+
+// one vertex per distinct v/vt/vn triple of the obj faces
+void LodChain::weld(Mesh *mesh) {
+  std::map<std::tuple<GLuint, GLuint, GLuint>, GLuint> welded;
+
+  positions = mesh->vertices;
+
+  vtxs.clear();
+  uvs.clear();
+  nms.clear();
+  vtxPos.clear();
+  tris.clear();
+
+  for (size_t i = 0; i < mesh->faces.size(); i++) {
+    Face &f = mesh->faces[i];
+    GLuint v[3] = {f.v1, f.v2, f.v3};
+    GLuint vt[3] = {f.vt1, f.vt2, f.vt3};
+    GLuint vn[3] = {f.vn1, f.vn2, f.vn3};
+    uvec3 tri;
+
+    for (int k = 0; k < 3; k++) {
+      auto key = std::make_tuple(v[k], vt[k], vn[k]);
+      auto it = welded.find(key);
+
+      if (it == welded.end()) {
+        it = welded.insert({key, (GLuint)vtxs.size()}).first;
+        vtxs.push_back(mesh->vertices[v[k]]);
+        uvs.push_back(mesh->uvs[vt[k]]);
+        nms.push_back(mesh->faceNormals[vn[k]]);
+        vtxPos.push_back(v[k]);
+      }
+
+      tri[k] = it->second;
+    }
+
+    tris.push_back(tri);
+  }
+}
+
+// area weighted face planes, plus penalty planes along open borders
+void LodChain::initQuadrics() {
+  Quadric zero;
+  for (int i = 0; i < 10; i++) {
+    zero.a[i] = 0.0;
+  }
+  zero.weight = 0.0;
+
+  quadrics.assign(positions.size(), zero);
+
+  // faces of each undirected edge, by position
+  std::map<std::pair<GLuint, GLuint>, int> edgeFaces;
+  std::map<std::pair<GLuint, GLuint>, GLuint> edgeTri;
+
+  for (size_t t = 0; t < tris.size(); t++) {
+    GLuint p[3];
+    for (int k = 0; k < 3; k++) {
+      p[k] = vtxPos[tris[t][k]];
+    }
+
+    vec3 n = cross(positions[p[1]] - positions[p[0]],
+                   positions[p[2]] - positions[p[0]]);
+    float len = length(n);
+
+    if (len > 1e-12f) {
+      n /= len;
+      double area = 0.5 * len;
+      dvec4 plane(n.x, n.y, n.z, -dot(n, positions[p[0]]));
+
+      for (int k = 0; k < 3; k++) {
+        addPlane(quadrics[p[k]], plane, area);
+        quadrics[p[k]].weight += area;
+      }
+    }
+
+    for (int k = 0; k < 3; k++) {
+      GLuint a = p[k], b = p[(k + 1) % 3];
+      auto key = std::make_pair(std::min(a, b), std::max(a, b));
+      edgeFaces[key]++;
+      edgeTri[key] = t;
+    }
+  }
+
+  for (auto &it : edgeFaces) {
+    if (it.second != 1) {
+      continue;
+    }
+
+    GLuint a = it.first.first, b = it.first.second;
+    uvec3 &tri = tris[edgeTri[it.first]];
+    vec3 faceN = cross(positions[vtxPos[tri[1]]] - positions[vtxPos[tri[0]]],
+                       positions[vtxPos[tri[2]]] - positions[vtxPos[tri[0]]]);
+    vec3 e = positions[b] - positions[a];
+
+    // the plane through the edge, perpendicular to the face
+    vec3 n = cross(e, faceN);
+    float len = length(n);
+
+    if (len < 1e-12f) {
+      continue;
+    }
+
+    n /= len;
+    dvec4 plane(n.x, n.y, n.z, -dot(n, positions[a]));
+    double w = borderWeight * dot(e, e);
+
+    addPlane(quadrics[a], plane, w);
+    addPlane(quadrics[b], plane, w);
+  }
+}
+
+float LodChain::cost(GLuint u, GLuint v) {
+  Quadric q = quadrics[u];
+  addQuadric(q, quadrics[v]);
+
+  return float(std::max(evaluate(q, positions[v]), 0.0));
+}
+
+// move position u onto v, false if the collapse is not allowed
+bool LodChain::collapse(GLuint u, GLuint v) {
+  vector<GLuint> shared, moved;
+
+  for (GLuint t : posTris[u]) {
+    if (!alive[t]) {
+      continue;
+    }
+
+    bool hasU = false, hasV = false;
+    for (int k = 0; k < 3; k++) {
+      hasU |= vtxPos[tris[t][k]] == u;
+      hasV |= vtxPos[tris[t][k]] == v;
+    }
+
+    if (hasU && hasV) {
+      shared.push_back(t);
+    } else if (hasU) {
+      moved.push_back(t);
+    }
+  }
+
+  // no longer an edge, or a non-manifold one
+  if (shared.empty() || shared.size() > 2) {
+    return false;
+  }
+
+  // attribute copies of u are replaced by the copies of v
+  // on the same side of the edge
+  std::map<GLuint, GLuint> remap;
+
+  for (GLuint t : shared) {
+    GLuint wu = 0, wv = 0;
+    for (int k = 0; k < 3; k++) {
+      if (vtxPos[tris[t][k]] == u) {
+        wu = tris[t][k];
+      } else if (vtxPos[tris[t][k]] == v) {
+        wv = tris[t][k];
+      }
+    }
+
+    auto it = remap.find(wu);
+    if (it != remap.end() && it->second != wv) {
+      // a seam of u would be welded shut
+      return false;
+    }
+    remap[wu] = wv;
+  }
+
+  // link condition: u and v may only share the opposite vertices of the
+  // shared triangles, otherwise the collapse pinches the surface
+  std::map<GLuint, int> ring;
+  for (GLuint t : moved) {
+    for (int k = 0; k < 3; k++) {
+      ring[vtxPos[tris[t][k]]] |= 1;
+    }
+  }
+  for (GLuint t : posTris[v]) {
+    if (!alive[t]) {
+      continue;
+    }
+    for (int k = 0; k < 3; k++) {
+      ring[vtxPos[tris[t][k]]] |= 2;
+    }
+  }
+
+  size_t nOfCommon = 0;
+  for (auto &it : ring) {
+    if (it.second == 3 && it.first != u && it.first != v) {
+      nOfCommon++;
+    }
+  }
+  if (nOfCommon > shared.size()) {
+    return false;
+  }
+
+  for (GLuint t : moved) {
+    vec3 p[3], q[3];
+
+    for (int k = 0; k < 3; k++) {
+      GLuint w = tris[t][k];
+
+      // a copy of u away from the edge, e.g. across a uv seam
+      if (vtxPos[w] == u && remap.find(w) == remap.end()) {
+        return false;
+      }
+
+      p[k] = positions[vtxPos[w]];
+      q[k] = (vtxPos[w] == u) ? positions[v] : p[k];
+    }
+
+    // the triangle must not flip or collapse to a sliver
+    vec3 n0 = cross(p[1] - p[0], p[2] - p[0]);
+    vec3 n1 = cross(q[1] - q[0], q[2] - q[0]);
+    float l0 = length(n0), l1 = length(n1);
+
+    if (l1 < 1e-12f || dot(n0, n1) < minNormalDot * l0 * l1) {
+      return false;
+    }
+  }
+
+  // apply
+  for (GLuint t : shared) {
+    alive[t] = false;
+    nOfAlive--;
+  }
+
+  for (GLuint t : moved) {
+    for (int k = 0; k < 3; k++) {
+      if (vtxPos[tris[t][k]] == u) {
+        tris[t][k] = remap[tris[t][k]];
+      }
+    }
+    posTris[v].push_back(t);
+  }
+
+  // drop the dead triangles of v
+  vector<GLuint> live;
+  for (GLuint t : posTris[v]) {
+    if (alive[t]) {
+      live.push_back(t);
+    }
+  }
+  posTris[v] = live;
+  posTris[u].clear();
+
+  addQuadric(quadrics[v], quadrics[u]);
+  versions[u] = -1;
+  versions[v]++;
+
+  return true;
+}
+
+void LodChain::emitLevel(float error) {
+  LodLevel level;
+  level.offset = indices.size();
+  level.error = error;
+
+  for (size_t t = 0; t < tris.size(); t++) {
+    if (alive[t]) {
+      indices.push_back(tris[t][0]);
+      indices.push_back(tris[t][1]);
+      indices.push_back(tris[t][2]);
+    }
+  }
+
+  level.count = indices.size() - level.offset;
+  levels.push_back(level);
+}
@@ -0,0 +1,685 @@
+#include "meshStream.h"
+#include "shaderQueue.h"
+#include "glState.h"
+#include "stats.h"
+#include "threadPool.h"
+#include <cfloat>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* A run of triangles of one cell in the spill file */
+typedef struct {
+  int cell;
+  uint64_t offset;
+  uint32_t nOfVertices;
+} McBlock;
+
+// a temporary file of floats mapped read only, NULL if empty
+static const float *mapFloats(const string fileName, size_t &size, int &fd) {
+  size = 0;
+  fd = open(fileName.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+    return NULL;
+  }
+
+  void *mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (mapped == MAP_FAILED) {
+    return NULL;
+  }
+  size = st.st_size;
+
+  return (const float *)mapped;
+}
+
+static void unmapFloats(const float *p, size_t size, int fd) {
+  if (p) {
+    munmap((void *)p, size);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+static vec3 toVec3(const float *p) { return vec3(p[0], p[1], p[2]); }
+
+// obj indices start at 1, negative ones count back from the last element
+static long objIndex(long i, size_t n) { return i < 0 ? (long)n + i : i - 1; }
+
+// bounds of the vertices [0, n) into a table entry
+static void clusterBounds(const McVertex *v, size_t n, McCluster &c) {
+  for (int k = 0; k < 3; k++) {
+    c.min[k] = FLT_MAX;
+    c.max[k] = -FLT_MAX;
+  }
+  for (size_t i = 0; i < n; i++) {
+    for (int k = 0; k < 3; k++) {
+      c.min[k] = std::min(c.min[k], v[i].pos[k]);
+      c.max[k] = std::max(c.max[k], v[i].pos[k]);
+    }
+  }
+}
+
+/* The files of a bake: whichever are still open are closed and the
+ * temporary ones removed on every way out of bakeMeshClusters */
+class BakeFiles {
+public:
+  FILE *v, *vt, *vn, *spill, *out;
+  vector<string> temps;
+
+  BakeFiles() { v = vt = vn = spill = out = NULL; }
+
+  ~BakeFiles() {
+    closeFile(v);
+    closeFile(vt);
+    closeFile(vn);
+    closeFile(spill);
+    closeFile(out);
+    for (const string &t : temps) {
+      remove(t.c_str());
+    }
+  }
+
+  static void closeFile(FILE *&f) {
+    if (f) {
+      fclose(f);
+      f = NULL;
+    }
+  }
+};
+
+bool bakeMeshClusters(const string objFile, const string outFile, int grid,
+                      size_t memory) {
+  string vFile = outFile + ".v.tmp", vtFile = outFile + ".vt.tmp";
+  string vnFile = outFile + ".vn.tmp", spillFile = outFile + ".spill.tmp";
+  BakeFiles files;
+
+  // pass 1: attributes to flat files, nothing is kept in memory
+  std::ifstream in(objFile);
+  if (!in) {
+    std::cout << "clustered mesh: can't open " << objFile << std::endl;
+    return false;
+  }
+
+  files.temps = {vFile, vtFile, vnFile, spillFile};
+  FILE *vOut = files.v = fopen(vFile.c_str(), "wb");
+  FILE *vtOut = files.vt = fopen(vtFile.c_str(), "wb");
+  FILE *vnOut = files.vn = fopen(vnFile.c_str(), "wb");
+  if (!vOut || !vtOut || !vnOut) {
+    std::cout << "clustered mesh: can't write next to " << outFile
+              << std::endl;
+    return false;
+  }
+
+  vec3 lo(FLT_MAX), hi(-FLT_MAX);
+  size_t nOfFaces = 0;
+  string line, type;
+
+  while (std::getline(in, line)) {
+    std::istringstream ss(line);
+    ss >> type;
+
+    if (type == "v") {
+      vec3 p;
+      ss >> p.x >> p.y >> p.z;
+      fwrite(&p, sizeof(vec3), 1, vOut);
+      lo = glm::min(lo, p);
+      hi = glm::max(hi, p);
+    } else if (type == "vt") {
+      vec2 uv;
+      ss >> uv.x >> uv.y;
+      fwrite(&uv, sizeof(vec2), 1, vtOut);
+    } else if (type == "vn") {
+      vec3 n;
+      ss >> n.x >> n.y >> n.z;
+      fwrite(&n, sizeof(vec3), 1, vnOut);
+    } else if (type == "f") {
+      nOfFaces++;
+    }
+    type.clear();
+  }
+
+  BakeFiles::closeFile(files.v);
+  BakeFiles::closeFile(files.vt);
+  BakeFiles::closeFile(files.vn);
+
+  // before the mappings, which would leak on its failure
+  FILE *spill = files.spill = fopen(spillFile.c_str(), "wb+");
+  if (!spill) {
+    std::cout << "clustered mesh: can't write next to " << outFile
+              << std::endl;
+    return false;
+  }
+
+  size_t vSize, vtSize, vnSize;
+  int vFd, vtFd, vnFd;
+  const float *vs = mapFloats(vFile, vSize, vFd);
+  const float *vts = mapFloats(vtFile, vtSize, vtFd);
+  const float *vns = mapFloats(vnFile, vnSize, vnFd);
+  size_t nOfVs = vSize / sizeof(vec3), nOfVts = vtSize / sizeof(vec2);
+  size_t nOfVns = vnSize / sizeof(vec3);
+
+  // pass 2: triangles binned into cells by their centroid, each cell's
+  // buffer spilled when it reaches its share of the memory
+  int nOfCells = grid * grid * grid;
+  size_t bucketVertices =
+      std::max(memory / nOfCells / sizeof(McVertex) / 3 * 3, (size_t)192);
+  vector<vector<McVertex>> buckets(nOfCells);
+  vector<McBlock> blocks;
+  uint64_t spilled = 0;
+
+  auto flush = [&](int cell) {
+    vector<McVertex> &b = buckets[cell];
+    if (b.empty()) {
+      return;
+    }
+    fwrite(b.data(), sizeof(McVertex), b.size(), spill);
+    blocks.push_back({cell, spilled, (uint32_t)b.size()});
+    spilled += sizeof(McVertex) * b.size();
+    b.clear();
+  };
+
+  vec3 extent = glm::max(hi - lo, vec3(1e-6f));
+
+  in.clear();
+  in.seekg(0);
+
+  vector<long> fv, fvt, fvn;
+
+  while (std::getline(in, line)) {
+    if (line.size() < 2 || line[0] != 'f' || line[1] != ' ') {
+      continue;
+    }
+
+    // v, v/vt, v//vn or v/vt/vn
+    std::istringstream ss(line.substr(2));
+    string corner;
+    fv.clear();
+    fvt.clear();
+    fvn.clear();
+    while (ss >> corner) {
+      long v = 0, vt = 0, vn = 0;
+      const char *c = corner.c_str();
+      char *end;
+      v = strtol(c, &end, 10);
+      if (*end == '/') {
+        c = end + 1;
+        vt = strtol(c, &end, 10);
+        if (*end == '/') {
+          vn = strtol(end + 1, &end, 10);
+        }
+      }
+      fv.push_back(objIndex(v, nOfVs));
+      fvt.push_back(vt != 0 ? objIndex(vt, nOfVts) : -1);
+      fvn.push_back(vn != 0 ? objIndex(vn, nOfVns) : -1);
+    }
+
+    // polygons as fans
+    for (size_t k = 1; k + 1 < fv.size(); k++) {
+      size_t corners[3] = {0, k, k + 1};
+      McVertex tri[3];
+      bool ok = true;
+
+      for (int j = 0; j < 3; j++) {
+        size_t c = corners[j];
+        if (fv[c] < 0 || fv[c] >= (long)nOfVs) {
+          ok = false;
+          break;
+        }
+        memcpy(tri[j].pos, vs + 3 * fv[c], sizeof(vec3));
+
+        if (fvt[c] >= 0 && fvt[c] < (long)nOfVts) {
+          memcpy(tri[j].uv, vts + 2 * fvt[c], sizeof(vec2));
+        } else {
+          tri[j].uv[0] = tri[j].uv[1] = 0.f;
+        }
+
+        if (fvn[c] >= 0 && fvn[c] < (long)nOfVns) {
+          memcpy(tri[j].n, vns + 3 * fvn[c], sizeof(vec3));
+        } else {
+          tri[j].n[0] = tri[j].n[1] = tri[j].n[2] = 0.f;
+        }
+      }
+      if (!ok) {
+        continue;
+      }
+
+      vec3 a = toVec3(tri[0].pos), b = toVec3(tri[1].pos);
+      vec3 c = toVec3(tri[2].pos);
+
+      // flat normals where the file has none
+      vec3 fn = cross(b - a, c - a);
+      fn = length(fn) > 0.f ? normalize(fn) : vec3(0.f, 1.f, 0.f);
+      for (int j = 0; j < 3; j++) {
+        if (tri[j].n[0] == 0.f && tri[j].n[1] == 0.f && tri[j].n[2] == 0.f) {
+          memcpy(tri[j].n, value_ptr(fn), sizeof(vec3));
+        }
+      }
+
+      vec3 centroid = (a + b + c) / 3.f;
+      ivec3 cell = clamp(ivec3((centroid - lo) / extent * float(grid)),
+                         ivec3(0), ivec3(grid - 1));
+      int id = (cell.z * grid + cell.y) * grid + cell.x;
+
+      buckets[id].insert(buckets[id].end(), tri, tri + 3);
+      if (buckets[id].size() >= bucketVertices) {
+        flush(id);
+      }
+    }
+  }
+
+  for (int cell = 0; cell < nOfCells; cell++) {
+    flush(cell);
+    vector<McVertex>().swap(buckets[cell]);
+  }
+
+  unmapFloats(vs, vSize, vFd);
+  unmapFloats(vts, vtSize, vtFd);
+  unmapFloats(vns, vnSize, vnFd);
+  remove(vFile.c_str());
+  remove(vtFile.c_str());
+  remove(vnFile.c_str());
+
+  // pass 3: each cell's blocks cut into clusters, the table at the end
+  FILE *out = files.out = fopen(outFile.c_str(), "wb");
+  if (!out) {
+    std::cout << "clustered mesh: can't write " << outFile << std::endl;
+    return false;
+  }
+
+  McHeader header;
+  memcpy(header.magic, "MCL1", 4);
+  header.nOfClusters = 0;
+  header.tableOffset = 0;
+  for (int k = 0; k < 3; k++) {
+    header.min[k] = lo[k];
+    header.max[k] = hi[k];
+  }
+  fwrite(&header, sizeof(header), 1, out);
+
+  std::stable_sort(blocks.begin(), blocks.end(),
+                   [](const McBlock &a, const McBlock &b) {
+                     return a.cell < b.cell;
+                   });
+
+  vector<McCluster> table;
+  vector<McVertex> cluster;
+  cluster.reserve(CLUSTER_TRIANGLES * 3);
+  uint64_t written = sizeof(header);
+
+  auto emit = [&]() {
+    if (cluster.empty()) {
+      return;
+    }
+    McCluster c;
+    c.offset = written;
+    c.nOfVertices = cluster.size();
+    clusterBounds(cluster.data(), cluster.size(), c);
+    fwrite(cluster.data(), sizeof(McVertex), cluster.size(), out);
+    written += sizeof(McVertex) * cluster.size();
+    table.push_back(c);
+    cluster.clear();
+  };
+
+  for (size_t i = 0; i < blocks.size(); i++) {
+    McBlock &block = blocks[i];
+    fseek(spill, block.offset, SEEK_SET);
+
+    uint32_t left = block.nOfVertices;
+    while (left > 0) {
+      size_t n = std::min((size_t)left, CLUSTER_TRIANGLES * 3 - cluster.size());
+      size_t first = cluster.size();
+      cluster.resize(first + n);
+      if (fread(cluster.data() + first, sizeof(McVertex), n, spill) != n) {
+        std::cout << "clustered mesh: short read of the spill file"
+                  << std::endl;
+        cluster.resize(first);
+        left = 0;
+        break;
+      }
+      left -= n;
+
+      if (cluster.size() == CLUSTER_TRIANGLES * 3) {
+        emit();
+      }
+    }
+
+    // clusters never span two cells
+    if (i + 1 == blocks.size() || blocks[i + 1].cell != block.cell) {
+      emit();
+    }
+  }
+
+  header.nOfClusters = table.size();
+  header.tableOffset = written;
+  fwrite(table.data(), sizeof(McCluster), table.size(), out);
+  fseek(out, 0, SEEK_SET);
+  fwrite(&header, sizeof(header), 1, out);
+  BakeFiles::closeFile(files.out);
+
+  std::cout << "clustered mesh: " << nOfFaces << " faces, " << table.size()
+            << " clusters, " << (written >> 20) << " MB" << std::endl;
+
+  return true;
+}
+
+MeshStreamer::MeshStreamer(const string fileName, int slots) {
+  data = NULL;
+  dataSize = 0;
+  vao = vbo = 0;
+  nOfSlots = slots;
+  frame = 0;
+  maxPending = 32;
+  maxUploads = 8;
+  nOfVisible = nOfResident = nOfUploaded = 0;
+  shader = 0;
+  program = -1;
+
+  fd = open(fileName.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 ||
+      st.st_size < (off_t)sizeof(McHeader)) {
+    std::cout << "clustered mesh: can't open " << fileName << std::endl;
+    return;
+  }
+
+  dataSize = st.st_size;
+  void *mapped = mmap(NULL, dataSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (mapped == MAP_FAILED) {
+    std::cout << "clustered mesh: can't map " << fileName << std::endl;
+    return;
+  }
+  data = (uint8_t *)mapped;
+
+  // clusters are read in no particular order
+  madvise(mapped, dataSize, MADV_RANDOM);
+
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, "MCL1", 4) != 0 ||
+      header.tableOffset + sizeof(McCluster) * header.nOfClusters >
+          dataSize) {
+    std::cout << "clustered mesh: " << fileName << " is not a clustered mesh"
+              << std::endl;
+    munmap(data, dataSize);
+    data = NULL;
+    return;
+  }
+
+  clusters.resize(header.nOfClusters);
+  memcpy(clusters.data(), data + header.tableOffset,
+         sizeof(McCluster) * header.nOfClusters);
+
+  clusterSlots.assign(clusters.size(), -1);
+  lastVisible.assign(clusters.size(), -1);
+  distances.assign(clusters.size(), 0.f);
+  slotClusters.assign(nOfSlots, -1);
+
+  // one buffer for the whole pool, a slot holds a full cluster
+  glGenBuffers(1, &vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBufferData(GL_ARRAY_BUFFER,
+               sizeof(McVertex) * CLUSTER_TRIANGLES * 3 * nOfSlots, NULL,
+               GL_DYNAMIC_DRAW);
+  frameStats.setBuffer(vbo,
+                       sizeof(McVertex) * CLUSTER_TRIANGLES * 3 * nOfSlots);
+
+  glGenVertexArrays(1, &vao);
+  glState.bindVao(vao);
+  GLsizei stride = sizeof(McVertex);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride,
+                        (void *)offsetof(McVertex, pos));
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride,
+                        (void *)offsetof(McVertex, uv));
+  glEnableVertexAttribArray(2);
+  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride,
+                        (void *)offsetof(McVertex, n));
+  glState.bindVao(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  initShader();
+}
+
+MeshStreamer::~MeshStreamer() {
+  shaderQueue.remove(program);
+  if (!data) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return;
+  }
+
+  // loaders still read the mapping
+  for (std::future<void> &f : loads) {
+    f.wait();
+  }
+
+  glDeleteBuffers(1, &vbo);
+  glState.deleteVaos(1, &vao);
+  frameStats.releaseBuffer(vbo);
+
+  munmap(data, dataSize);
+  close(fd);
+}
+
+void MeshStreamer::initShader() {
+  program = shaderQueue.submit(
+      "./shader/vsPhong.glsl", "./shader/fsPhong.glsl",
+      [this](GLuint exe) {
+        shader = exe;
+        uniModel = myGetUniformLocation(shader, "M");
+        uniView = myGetUniformLocation(shader, "V");
+        uniProjection = myGetUniformLocation(shader, "P");
+        uniEyePoint = myGetUniformLocation(shader, "eyePoint");
+        uniLightColor = myGetUniformLocation(shader, "lightColor");
+        uniLightPosition = myGetUniformLocation(shader, "lightPosition");
+        uniTexBase = myGetUniformLocation(shader, "texBase");
+        uniTexNormal = myGetUniformLocation(shader, "texNormal");
+      });
+}
+
+// a free slot, else the one of the least recently visible cluster, the
+// farthest among equals; -1 if every slot is drawn this frame
+int MeshStreamer::findSlot() {
+  int best = -1;
+
+  for (int s = 0; s < nOfSlots; s++) {
+    int c = slotClusters[s];
+    if (c < 0) {
+      return s;
+    }
+    if (lastVisible[c] == frame) {
+      continue;
+    }
+    if (best < 0) {
+      best = s;
+      continue;
+    }
+
+    int b = slotClusters[best];
+    if (lastVisible[c] < lastVisible[b] ||
+        (lastVisible[c] == lastVisible[b] && distances[c] > distances[b])) {
+      best = s;
+    }
+  }
+
+  if (best >= 0) {
+    clusterSlots[slotClusters[best]] = -1;
+  }
+
+  return best;
+}
+
+void MeshStreamer::request(int id) {
+  if (pending.count(id) || (int)pending.size() >= maxPending) {
+    return;
+  }
+
+  pending.insert(id);
+
+  // reading the mapping faults the cluster in from disk on a pool thread
+  const McVertex *src = (const McVertex *)(data + clusters[id].offset);
+  uint32_t n = clusters[id].nOfVertices;
+  loads.push_back(threadPool.enqueue([this, id, src, n]() {
+    StreamedCluster cluster;
+    cluster.id = id;
+    cluster.vertices.assign(src, src + n);
+
+    std::lock_guard<std::mutex> lock(arrivedMutex);
+    arrived.push_back(std::move(cluster));
+  }));
+}
+
+// cull, request the missing visible clusters nearest first and upload
+// the ones read since the last frame, before drawing
+void MeshStreamer::update(mat4 M, mat4 V, mat4 P) {
+  if (!data) {
+    return;
+  }
+
+  frame++;
+
+  // the frustum's planes in the model's space, see GpuCuller
+  mat4 PVM = P * V * M;
+  vec4 planes[6];
+  for (int i = 0; i < 3; i++) {
+    vec4 row = vec4(PVM[0][i], PVM[1][i], PVM[2][i], PVM[3][i]);
+    vec4 w = vec4(PVM[0][3], PVM[1][3], PVM[2][3], PVM[3][3]);
+    planes[2 * i] = w + row;
+    planes[2 * i + 1] = w - row;
+  }
+  for (vec4 &p : planes) {
+    p /= length(vec3(p));
+  }
+
+  vec3 eye = vec3(inverse(V * M) * vec4(0.f, 0.f, 0.f, 1.f));
+
+  vector<int> missing;
+  nOfVisible = 0;
+
+  for (int c = 0; c < (int)clusters.size(); c++) {
+    vec3 lo = toVec3(clusters[c].min), hi = toVec3(clusters[c].max);
+    vec3 center = (lo + hi) * 0.5f, half = (hi - lo) * 0.5f;
+
+    distances[c] = std::max(length(center - eye) - length(half), 0.f);
+
+    bool inside = true;
+    for (vec4 &p : planes) {
+      float r = dot(half, abs(vec3(p)));
+      if (dot(vec3(p), center) + p.w < -r) {
+        inside = false;
+        break;
+      }
+    }
+    if (!inside) {
+      continue;
+    }
+
+    nOfVisible++;
+    lastVisible[c] = frame;
+    if (clusterSlots[c] < 0) {
+      missing.push_back(c);
+    }
+  }
+
+  std::sort(missing.begin(), missing.end(), [this](int a, int b) {
+    return distances[a] < distances[b];
+  });
+  for (int c : missing) {
+    request(c);
+  }
+
+  vector<StreamedCluster> loaded;
+  {
+    std::lock_guard<std::mutex> lock(arrivedMutex);
+    int n = std::min((int)arrived.size(), maxUploads);
+    loaded.assign(std::make_move_iterator(arrived.begin()),
+                  std::make_move_iterator(arrived.begin() + n));
+    arrived.erase(arrived.begin(), arrived.begin() + n);
+  }
+
+  nOfUploaded = 0;
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  for (StreamedCluster &cluster : loaded) {
+    pending.erase(cluster.id);
+
+    // out of view since it was requested, a later frame asks again
+    if (lastVisible[cluster.id] != frame) {
+      continue;
+    }
+
+    int s = findSlot();
+    if (s < 0) {
+      continue;
+    }
+
+    glBufferSubData(GL_ARRAY_BUFFER,
+                    sizeof(McVertex) * CLUSTER_TRIANGLES * 3 * s,
+                    sizeof(McVertex) * cluster.vertices.size(),
+                    cluster.vertices.data());
+    slotClusters[s] = cluster.id;
+    clusterSlots[cluster.id] = s;
+    nOfUploaded++;
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  while (!loads.empty() && loads.front().wait_for(std::chrono::seconds(0)) ==
+                               std::future_status::ready) {
+    loads.pop_front();
+  }
+
+  firsts.clear();
+  counts.clear();
+  nOfResident = 0;
+  for (int s = 0; s < nOfSlots; s++) {
+    int c = slotClusters[s];
+    if (c < 0) {
+      continue;
+    }
+    nOfResident++;
+
+    if (lastVisible[c] == frame) {
+      firsts.push_back(CLUSTER_TRIANGLES * 3 * s);
+      counts.push_back(clusters[c].nOfVertices);
+    }
+  }
+}
+
+void MeshStreamer::draw(mat4 M, mat4 V, mat4 P, vec3 eye, vec3 lightColor,
+                        vec3 lightPosition, int unitBaseColor,
+                        int unitNormal) {
+  if (!data || shader == 0 || firsts.empty()) {
+    return;
+  }
+
+  glState.useProgram(shader);
+
+  glState.uniformMatrix4f(uniModel, M);
+  glState.uniformMatrix4f(uniView, V);
+  glState.uniformMatrix4f(uniProjection, P);
+  glState.uniform3f(uniEyePoint, eye);
+  glState.uniform3f(uniLightColor, lightColor);
+  glState.uniform3f(uniLightPosition, lightPosition);
+  glState.uniform1i(uniTexBase, unitBaseColor);
+  glState.uniform1i(uniTexNormal, unitNormal);
+
+  glState.bindVao(vao);
+  glMultiDrawArrays(GL_TRIANGLES, firsts.data(), counts.data(),
+                    firsts.size());
+  glState.bindVao(0);
+
+  // one call for all of the clusters
+  size_t vertices = 0;
+  for (GLsizei n : counts) {
+    vertices += n;
+  }
+  frameStats.draw(GL_TRIANGLES, vertices);
+}
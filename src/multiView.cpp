@@ -0,0 +1,206 @@
+#include "multiView.h"
+#include "shaderQueue.h"
+#include "glState.h"
+#include "stats.h"
+#include <fstream>
+#include <sstream>
+
+vector<BatchView> loadBatchViews(const string fileName, float aspect,
+                                 float near, float far) {
+  vector<BatchView> views;
+  std::ifstream in(fileName);
+
+  if (!in) {
+    std::cout << "Can't read views from " << fileName << std::endl;
+    return views;
+  }
+
+  string line;
+  while (std::getline(in, line)) {
+    line = line.substr(0, line.find('#'));
+
+    std::istringstream ss(line);
+    vec3 eye, target, light;
+    float fovy;
+    if (!(ss >> eye.x >> eye.y >> eye.z >> target.x >> target.y >> target.z >>
+          fovy >> light.x >> light.y >> light.z)) {
+      continue;
+    }
+
+    BatchView v;
+    v.view = lookAt(eye, target, vec3(0.f, 1.f, 0.f));
+    v.projection = perspective(radians(fovy), aspect, near, far);
+    v.eye = eye;
+    v.light = light;
+    views.push_back(v);
+  }
+
+  return views;
+}
+
+vector<BatchView> orbitBatchViews(int n, vec3 center, float radius,
+                                  float fovy, float aspect, float near,
+                                  float far) {
+  vector<BatchView> views;
+
+  for (int i = 0; i < n; i++) {
+    float a = 6.2831853f * i / n;
+    // cameras go up and down a little, lights circle the other way
+    float up = radius * (0.5f + 0.25f * sin(3.f * a));
+    vec3 eye = center + vec3(radius * cos(a), up, radius * sin(a));
+    vec3 light = center + vec3(radius * 0.5f * cos(-2.f * a), 1.f,
+                               radius * 0.5f * sin(-2.f * a));
+
+    BatchView v;
+    v.view = lookAt(eye, center, vec3(0.f, 1.f, 0.f));
+    v.projection = perspective(fovy, aspect, near, far);
+    v.eye = eye;
+    v.light = light;
+    views.push_back(v);
+  }
+
+  return views;
+}
+
+MultiView::MultiView(int w, int h) {
+  width = w;
+  height = h;
+  nOfViews = 0;
+
+  glGenTextures(1, &tboColor);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, tboColor);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height,
+               NUM_BATCH_VIEWS, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  frameStats.setTexture(tboColor, (size_t)width * height * NUM_BATCH_VIEWS * 4);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+  glGenTextures(1, &tboDepth);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, tboDepth);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, width, height,
+               NUM_BATCH_VIEWS, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+  frameStats.setTexture(tboDepth, (size_t)width * height * NUM_BATCH_VIEWS * 4);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+  // every layer at once, gl_Layer picks one
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, tboColor, 0);
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, tboDepth, 0);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    std::cout << "Layered framebuffer is not complete" << std::endl;
+  }
+
+  glGenFramebuffers(NUM_BATCH_VIEWS, layerFbos);
+  for (int i = 0; i < NUM_BATCH_VIEWS; i++) {
+    glBindFramebuffer(GL_FRAMEBUFFER, layerFbos[i]);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, tboColor,
+                              0, i);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, tboDepth, 0,
+                              i);
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  initShader();
+}
+
+MultiView::~MultiView() {
+  shaderQueue.remove(program);
+  glDeleteFramebuffers(NUM_BATCH_VIEWS, layerFbos);
+  glDeleteFramebuffers(1, &fbo);
+  frameStats.releaseTexture(tboColor);
+  frameStats.releaseTexture(tboDepth);
+  glDeleteTextures(1, &tboColor);
+  glDeleteTextures(1, &tboDepth);
+}
+
+void MultiView::initShader() {
+  shader = 0;
+
+  vector<ShaderStage> stages = {
+      {GL_VERTEX_SHADER, "./shader/vsPOM.glsl"},
+      {GL_GEOMETRY_SHADER, "./shader/gsMultiView.glsl"},
+      {GL_FRAGMENT_SHADER, "./shader/fsPOM.glsl"}};
+
+  program = shaderQueue.submit(
+      stages,
+      [this](GLuint exe) {
+        shader = exe;
+        uniModel = myGetUniformLocation(shader, "M");
+        uniViewProjections = myGetUniformLocation(shader, "viewProjections");
+        uniEyes = myGetUniformLocation(shader, "eyes");
+        uniLights = myGetUniformLocation(shader, "lights");
+        uniNOfViews = myGetUniformLocation(shader, "nOfViews");
+        uniLightColor = myGetUniformLocation(shader, "lightColor");
+        uniTexBase = myGetUniformLocation(shader, "texBase");
+        uniTexNormal = myGetUniformLocation(shader, "texNormal");
+        uniTexHeight = myGetUniformLocation(shader, "texHeight");
+        uniLodLevel = myGetUniformLocation(shader, "lodLevel");
+      },
+      "#define MULTI_VIEW\n");
+}
+
+// the layered pass of views[first, first + NUM_BATCH_VIEWS)
+bool MultiView::begin(vector<BatchView> &views, int first) {
+  if (shader == 0) {
+    return false;
+  }
+
+  nOfViews = glm::min((int)views.size() - first, NUM_BATCH_VIEWS);
+
+  mat4 viewProjections[NUM_BATCH_VIEWS];
+  vec3 eyes[NUM_BATCH_VIEWS], lights[NUM_BATCH_VIEWS];
+  for (int i = 0; i < nOfViews; i++) {
+    BatchView &v = views[first + i];
+    viewProjections[i] = v.projection * v.view;
+    eyes[i] = v.eye;
+    lights[i] = v.light;
+  }
+
+  glGetIntegerv(GL_VIEWPORT, savedViewport);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glViewport(0, 0, width, height);
+
+  // clears every layer
+  glClearColor(0.f, 0.f, 0.4f, 0.f);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  glState.useProgram(shader);
+  glUniformMatrix4fv(uniViewProjections, nOfViews, GL_FALSE,
+                     value_ptr(viewProjections[0]));
+  glUniform3fv(uniEyes, nOfViews, value_ptr(eyes[0]));
+  glUniform3fv(uniLights, nOfViews, value_ptr(lights[0]));
+  glState.uniform1i(uniNOfViews, nOfViews);
+  glState.uniform1f(uniLodLevel, 0.f);
+
+  return true;
+}
+
+// draw the quad into every layer of the pass
+void MultiView::drawQuad(Quad *quad, mat4 M, vec3 lightColor,
+                         int unitBaseColor, int unitNormal, int unitHeight) {
+  glState.uniformMatrix4f(uniModel, M);
+  glState.uniform3f(uniLightColor, lightColor);
+  glState.uniform1i(uniTexBase, unitBaseColor);
+  glState.uniform1i(uniTexNormal, unitNormal);
+  glState.uniform1i(uniTexHeight, unitHeight);
+  quad->drawGeometry();
+}
+
+// render into a single layer with any program, the single view path
+void MultiView::beginLayer(int layer) {
+  glGetIntegerv(GL_VIEWPORT, savedViewport);
+  glBindFramebuffer(GL_FRAMEBUFFER, layerFbos[layer]);
+  glViewport(0, 0, width, height);
+
+  glClearColor(0.f, 0.f, 0.4f, 0.f);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void MultiView::end() {
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(savedViewport[0], savedViewport[1], savedViewport[2],
+             savedViewport[3]);
+}
@@ -0,0 +1,329 @@
+#include "occlusion.h"
+#include "meshLod.h"
+#include "simd8.h"
+#include "threadPool.h"
+
+// results of OcclusionCuller::test()
+enum { CULL_VISIBLE, CULL_OUTSIDE, CULL_OCCLUDED };
+
+// rows rasterized by one task
+static const int bandHeight = 8;
+
+Instance makeInstance(Mesh *mesh, mat4 M) {
+  Instance inst;
+  inst.mesh = mesh;
+  inst.model = M;
+  inst.visible = true;
+
+  for (int i = 0; i < 8; i++) {
+    vec3 corner((i & 1) ? mesh->max.x : mesh->min.x,
+                (i & 2) ? mesh->max.y : mesh->min.y,
+                (i & 4) ? mesh->max.z : mesh->min.z);
+    vec3 p = vec3(M * vec4(corner, 1.f));
+
+    inst.min = (i == 0) ? p : glm::min(inst.min, p);
+    inst.max = (i == 0) ? p : glm::max(inst.max, p);
+  }
+
+  return inst;
+}
+
+OcclusionCuller::OcclusionCuller(int w, int h) {
+  width = w;
+  height = h;
+  pitch = (width + 7) & ~7;
+  nOfTested = nOfOutside = nOfOccluded = 0;
+
+  // down to a single texel
+  ivec2 size(pitch, height);
+  while (true) {
+    levelSizes.push_back(size);
+    levels.push_back(vector<float>(size.x * size.y, 1.f));
+
+    if (size.x == 1 && size.y == 1) {
+      break;
+    }
+    size = ivec2((size.x + 1) / 2, (size.y + 1) / 2);
+  }
+}
+
+void OcclusionCuller::clearOccluders() { occluders.clear(); }
+
+// maxError: object space error allowed for a simplified LOD, 0: full mesh
+void OcclusionCuller::addOccluder(Mesh *mesh, mat4 M, float maxError) {
+  LodChain *lods = mesh->lods;
+
+  if (lods && maxError > 0.f) {
+    LodLevel level = lods->levels[0];
+    for (LodLevel &l : lods->levels) {
+      if (l.error <= maxError) {
+        level = l;
+      }
+    }
+
+    for (GLuint i = 0; i < level.count; i++) {
+      vec3 v = lods->vtxs[lods->indices[level.offset + i]];
+      occluders.push_back(vec3(M * vec4(v, 1.f)));
+    }
+    return;
+  }
+
+  for (Face &f : mesh->faces) {
+    occluders.push_back(vec3(M * vec4(mesh->vertices[f.v1], 1.f)));
+    occluders.push_back(vec3(M * vec4(mesh->vertices[f.v2], 1.f)));
+    occluders.push_back(vec3(M * vec4(mesh->vertices[f.v3], 1.f)));
+  }
+}
+
+// clip against z >= -w, returns the number of vertices of the polygon
+static int clipNear(vec4 *v, vec4 *poly) {
+  int n = 0;
+
+  for (int k = 0; k < 3; k++) {
+    vec4 &a = v[k];
+    vec4 &b = v[(k + 1) % 3];
+    float da = a.z + a.w;
+    float db = b.z + b.w;
+
+    if (da >= 0.f) {
+      poly[n++] = a;
+    }
+
+    if ((da >= 0.f) != (db >= 0.f)) {
+      poly[n++] = mix(a, b, da / (da - db));
+    }
+  }
+
+  return n;
+}
+
+void OcclusionCuller::render(mat4 V, mat4 P) {
+  viewProjection = P * V;
+
+  int nOfTris = occluders.size() / 3;
+  vector<OccluderTriangle> out(nOfTris * 2);
+  vector<char> valid(nOfTris * 2, 0);
+
+  threadPool.parallelFor(nOfTris, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      vec4 v[3], poly[4];
+
+      for (int k = 0; k < 3; k++) {
+        v[k] = viewProjection * vec4(occluders[i * 3 + k], 1.f);
+      }
+
+      int n = clipNear(v, poly);
+
+      for (int k = 1; k + 1 < n; k++) {
+        vec4 t[3] = {poly[0], poly[k], poly[k + 1]};
+        valid[i * 2 + k - 1] = setup(t, out[i * 2 + k - 1]);
+      }
+    }
+  }, 256);
+
+  tris.clear();
+  for (size_t i = 0; i < out.size(); i++) {
+    if (valid[i]) {
+      tris.push_back(out[i]);
+    }
+  }
+
+  std::fill(levels[0].begin(), levels[0].end(), 1.f);
+
+  int nOfBands = (height + bandHeight - 1) / bandHeight;
+  threadPool.parallelFor(nOfBands, [&](size_t begin, size_t end) {
+    rasterRows(begin * bandHeight,
+               glm::min(int(end) * bandHeight, height));
+  });
+
+  buildPyramid();
+}
+
+// returns false for empty triangles or triangles off screen
+bool OcclusionCuller::setup(vec4 *v, OccluderTriangle &t) {
+  vec3 win[3];
+
+  for (int k = 0; k < 3; k++) {
+    vec3 ndc = vec3(v[k]) / v[k].w;
+    win[k] = vec3((ndc.x * 0.5f + 0.5f) * width,
+                  (ndc.y * 0.5f + 0.5f) * height, ndc.z * 0.5f + 0.5f);
+  }
+
+  vec2 d1(win[1].x - win[0].x, win[1].y - win[0].y);
+  vec2 d2(win[2].x - win[0].x, win[2].y - win[0].y);
+  float area = d1.x * d2.y - d2.x * d1.y;
+
+  // occluders are two sided, wind every triangle counter-clockwise
+  if (area < 0.f) {
+    std::swap(win[1], win[2]);
+    std::swap(d1, d2);
+    area = -area;
+  }
+
+  if (!(area > 0.f)) {
+    return false;
+  }
+
+  float minX = glm::min(win[0].x, glm::min(win[1].x, win[2].x));
+  float maxX = glm::max(win[0].x, glm::max(win[1].x, win[2].x));
+  float minY = glm::min(win[0].y, glm::min(win[1].y, win[2].y));
+  float maxY = glm::max(win[0].y, glm::max(win[1].y, win[2].y));
+
+  if (maxX < 0.f || maxY < 0.f || minX > width || minY > height) {
+    return false;
+  }
+
+  t.x0 = glm::clamp(int(floor(minX)), 0, width - 1);
+  t.x1 = glm::clamp(int(ceil(maxX)), 0, width - 1);
+  t.y0 = glm::clamp(int(floor(minY)), 0, height - 1);
+  t.y1 = glm::clamp(int(ceil(maxY)), 0, height - 1);
+
+  for (int k = 0; k < 3; k++) {
+    vec3 &a = win[k];
+    vec3 &b = win[(k + 1) % 3];
+    float dx = b.x - a.x, dy = b.y - a.y;
+
+    t.edgeA[k] = -dy;
+    t.edgeB[k] = dx;
+    t.edgeC[k] = dy * a.x - dx * a.y;
+  }
+
+  float z1 = win[1].z - win[0].z, z2 = win[2].z - win[0].z;
+  t.zA = (z1 * d2.y - z2 * d1.y) / area;
+  t.zB = (z2 * d1.x - z1 * d2.x) / area;
+  t.zC = win[0].z - t.zA * win[0].x - t.zB * win[0].y;
+
+  return true;
+}
+
+// rows [y0, y1) of the depth buffer, nearest depth wins
+void OcclusionCuller::rasterRows(int y0, int y1) {
+  vector<float> &depth = levels[0];
+
+  for (OccluderTriangle &t : tris) {
+    int ys = glm::max(t.y0, y0);
+    int ye = glm::min(t.y1, y1 - 1);
+    int xs = t.x0 & ~7;
+
+    for (int y = ys; y <= ye; y++) {
+      F8 py = float(y) + 0.5f;
+      float *row = &depth[y * pitch];
+
+      for (int x = xs; x <= t.x1; x += 8) {
+        F8 px = F8(float(x) + 0.5f) + F8::iota();
+        M8 inside = M8::all();
+
+        // shared edges may be covered twice, which is harmless for depth
+        for (int k = 0; k < 3; k++) {
+          F8 e = fmadd(F8(t.edgeA[k]), px,
+                       fmadd(F8(t.edgeB[k]), py, F8(t.edgeC[k])));
+          inside = inside & (e >= F8(0.f));
+        }
+
+        if (!inside.any()) {
+          continue;
+        }
+
+        F8 z = fmadd(F8(t.zA), px, fmadd(F8(t.zB), py, F8(t.zC)));
+        F8 d = F8::load(row + x);
+        select(inside, min(z, d), d).store(row + x);
+      }
+    }
+  }
+}
+
+// each texel keeps the farthest depth of the 2x2 texels below it
+void OcclusionCuller::buildPyramid() {
+  for (size_t l = 1; l < levels.size(); l++) {
+    vector<float> &src = levels[l - 1];
+    vector<float> &dst = levels[l];
+    ivec2 s = levelSizes[l - 1], d = levelSizes[l];
+
+    for (int y = 0; y < d.y; y++) {
+      int y0 = y * 2, y1 = glm::min(y * 2 + 1, s.y - 1);
+
+      for (int x = 0; x < d.x; x++) {
+        int x0 = x * 2, x1 = glm::min(x * 2 + 1, s.x - 1);
+
+        dst[y * d.x + x] =
+            glm::max(glm::max(src[y0 * s.x + x0], src[y0 * s.x + x1]),
+                     glm::max(src[y1 * s.x + x0], src[y1 * s.x + x1]));
+      }
+    }
+  }
+}
+
+int OcclusionCuller::test(vec3 boxMin, vec3 boxMax) {
+  float minX = 0.f, maxX = 0.f, minY = 0.f, maxY = 0.f, minZ = 0.f;
+
+  for (int i = 0; i < 8; i++) {
+    vec3 corner((i & 1) ? boxMax.x : boxMin.x, (i & 2) ? boxMax.y : boxMin.y,
+                (i & 4) ? boxMax.z : boxMin.z);
+    vec4 clip = viewProjection * vec4(corner, 1.f);
+
+    // crosses the near plane, the eye may be inside
+    if (clip.z < -clip.w) {
+      return CULL_VISIBLE;
+    }
+
+    vec3 ndc = vec3(clip) / clip.w;
+    float x = (ndc.x * 0.5f + 0.5f) * width;
+    float y = (ndc.y * 0.5f + 0.5f) * height;
+    float z = ndc.z * 0.5f + 0.5f;
+
+    minX = (i == 0) ? x : glm::min(minX, x);
+    maxX = (i == 0) ? x : glm::max(maxX, x);
+    minY = (i == 0) ? y : glm::min(minY, y);
+    maxY = (i == 0) ? y : glm::max(maxY, y);
+    minZ = (i == 0) ? z : glm::min(minZ, z);
+  }
+
+  if (maxX < 0.f || maxY < 0.f || minX >= width || minY >= height ||
+      minZ > 1.f) {
+    return CULL_OUTSIDE;
+  }
+
+  int x0 = glm::clamp(int(minX), 0, width - 1);
+  int x1 = glm::clamp(int(maxX), 0, width - 1);
+  int y0 = glm::clamp(int(minY), 0, height - 1);
+  int y1 = glm::clamp(int(maxY), 0, height - 1);
+
+  // the level where the rectangle spans a few texels
+  int l = 0;
+  while (l + 1 < (int)levels.size() &&
+         glm::max(x1 - x0, y1 - y0) >> l >= 4) {
+    l++;
+  }
+
+  vector<float> &level = levels[l];
+  int levelWidth = levelSizes[l].x;
+
+  for (int y = y0 >> l; y <= y1 >> l; y++) {
+    for (int x = x0 >> l; x <= x1 >> l; x++) {
+      if (minZ <= level[y * levelWidth + x]) {
+        return CULL_VISIBLE;
+      }
+    }
+  }
+
+  return CULL_OCCLUDED;
+}
+
+// test the instances against the occluders of the last render()
+void OcclusionCuller::cull(vector<Instance> &instances) {
+  vector<int> results(instances.size());
+
+  threadPool.parallelFor(instances.size(), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      results[i] = test(instances[i].min, instances[i].max);
+      instances[i].visible = results[i] == CULL_VISIBLE;
+    }
+  }, 64);
+
+  nOfTested = instances.size();
+  nOfOutside = nOfOccluded = 0;
+  for (int r : results) {
+    nOfOutside += r == CULL_OUTSIDE;
+    nOfOccluded += r == CULL_OCCLUDED;
+  }
+}
@@ -0,0 +1,291 @@
+#include "packedMaterial.h"
+#include "simd8.h"
+#include "stats.h"
+#include "threadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+
+// normal of the slopes (dx, dy) of the surface, into a texel
+static inline void storeNormal(float nx, float ny, float nz, uint8_t *t) {
+  t[FI_RGBA_RED] = uint8_t(glm::clamp(nx * 127.5f + 128.f, 0.f, 255.f));
+  t[FI_RGBA_GREEN] = uint8_t(glm::clamp(ny * 127.5f + 128.f, 0.f, 255.f));
+  t[FI_RGBA_BLUE] = uint8_t(glm::clamp(nz * 127.5f + 128.f, 0.f, 255.f));
+}
+
+// the normal at x of the rows below (r0), at (r1) and above (r2) y
+static inline void scharrTexel(const float *r0, const float *r1,
+                               const float *r2, int x, int w, float sx,
+                               float sy, uint8_t *t) {
+  int xm = (x + w - 1) % w, xp = (x + 1) % w;
+
+  float gx = 3.f * (r0[xp] - r0[xm]) + 10.f * (r1[xp] - r1[xm]) +
+             3.f * (r2[xp] - r2[xm]);
+  float gy = 3.f * (r2[xm] - r0[xm]) + 10.f * (r2[x] - r0[x]) +
+             3.f * (r2[xp] - r0[xp]);
+
+  // the surface is at -depth, its normal leans towards the deeper side
+  float nx = gx * sx, ny = gy * sy;
+  float inv = 1.f / std::sqrt(nx * nx + ny * ny + 1.f);
+  storeNormal(nx * inv, ny * inv, inv, t);
+}
+
+// one row, the borders one texel at a time
+static void scharrRow(const vector<float> &depths, int y, int w, int h,
+                      float sx, float sy, uint8_t *out, bool simd) {
+  const float *r0 = &depths[((y + h - 1) % h) * w];
+  const float *r1 = &depths[y * w];
+  const float *r2 = &depths[((y + 1) % h) * w];
+  uint8_t *row = out + (size_t)y * w * 4;
+
+  int x = 0;
+  if (simd) {
+    scharrTexel(r0, r1, r2, 0, w, sx, sy, row);
+    x = 1;
+
+    for (; x + 9 <= w; x += 8) {
+      F8 gx = fmadd(F8(3.f), F8::load(r0 + x + 1) - F8::load(r0 + x - 1),
+                    fmadd(F8(10.f), F8::load(r1 + x + 1) - F8::load(r1 + x - 1),
+                          F8(3.f) * (F8::load(r2 + x + 1) -
+                                     F8::load(r2 + x - 1))));
+      F8 gy = fmadd(F8(3.f), F8::load(r2 + x - 1) - F8::load(r0 + x - 1),
+                    fmadd(F8(10.f), F8::load(r2 + x) - F8::load(r0 + x),
+                          F8(3.f) * (F8::load(r2 + x + 1) -
+                                     F8::load(r0 + x + 1))));
+
+      F8 nx = gx * F8(sx), ny = gy * F8(sy);
+      F8 inv = F8(1.f) / sqrt(fmadd(nx, nx, fmadd(ny, ny, F8(1.f))));
+
+      float fx[8], fy[8], fz[8];
+      (nx * inv).store(fx);
+      (ny * inv).store(fy);
+      inv.store(fz);
+      for (int i = 0; i < 8; i++) {
+        storeNormal(fx[i], fy[i], fz[i], row + (x + i) * 4);
+      }
+    }
+  }
+
+  for (; x < w; x++) {
+    scharrTexel(r0, r1, r2, x, w, sx, sy, row + x * 4);
+  }
+}
+
+// the kernel's weights sum to 32 over two texels, depth scale in uv
+static void scharr(const uint8_t *depth, int w, int h, float scale,
+                   uint8_t *out, bool simd) {
+  vector<float> depths((size_t)w * h);
+  for (size_t i = 0; i < depths.size(); i++) {
+    depths[i] = depth[i] / 255.f;
+  }
+
+  float sx = scale * w / 32.f, sy = scale * h / 32.f;
+
+  if (simd) {
+    threadPool.parallelFor(
+        h,
+        [&](size_t begin, size_t end) {
+          for (size_t y = begin; y < end; y++) {
+            scharrRow(depths, y, w, h, sx, sy, out, true);
+          }
+        },
+        16);
+  } else {
+    for (int y = 0; y < h; y++) {
+      scharrRow(depths, y, w, h, sx, sy, out, false);
+    }
+  }
+}
+
+void deriveNormals(const uint8_t *depth, int w, int h, float scale,
+                   uint8_t *out) {
+  scharr(depth, w, h, scale, out, true);
+}
+
+// one texel at a time on this thread, to compare with
+void deriveNormalsScalar(const uint8_t *depth, int w, int h, float scale,
+                         uint8_t *out) {
+  scharr(depth, w, h, scale, out, false);
+}
+
+static bool fileExists(const string fileName, long *mtime = NULL) {
+  struct stat st;
+  if (stat(fileName.c_str(), &st) != 0) {
+    return false;
+  }
+  if (mtime) {
+    *mtime = st.st_mtime;
+  }
+  return true;
+}
+
+// 24 bit copy of an image file, rows bottom up
+static FIBITMAP *loadRgb(const string fileName) {
+  FIBITMAP *img = FreeImage_Load(FreeImage_GetFileType(fileName.c_str()),
+                                 fileName.c_str());
+  if (!img) {
+    std::cout << "packed material: can't load " << fileName << std::endl;
+    return NULL;
+  }
+
+  FIBITMAP *rgb = FreeImage_ConvertTo24Bits(img);
+  FreeImage_Unload(img);
+  return rgb;
+}
+
+// the height map of a material as one byte per texel, rows bottom up
+static bool loadDepth(const string fileName, vector<uint8_t> &depth, int &w,
+                      int &h) {
+  FIBITMAP *img = loadRgb(fileName);
+  if (!img) {
+    return false;
+  }
+
+  w = FreeImage_GetWidth(img);
+  h = FreeImage_GetHeight(img);
+  depth.resize((size_t)w * h);
+  for (int y = 0; y < h; y++) {
+    BYTE *row = FreeImage_GetBits(img) + y * FreeImage_GetPitch(img);
+    for (int x = 0; x < w; x++) {
+      depth[(size_t)y * w + x] = row[x * 3 + FI_RGBA_RED];
+    }
+  }
+  FreeImage_Unload(img);
+  return true;
+}
+
+bool compareDerivedNormals(const string prefix) {
+  vector<uint8_t> depth;
+  int w, h;
+  if (!loadDepth(prefix + "_height.jpg", depth, w, h)) {
+    return false;
+  }
+
+  vector<uint8_t> simd((size_t)w * h * 4, 0), scalar((size_t)w * h * 4, 0);
+  deriveNormals(depth.data(), w, h, PACKED_DEPTH_SCALE, simd.data());
+  deriveNormalsScalar(depth.data(), w, h, PACKED_DEPTH_SCALE, scalar.data());
+
+  size_t nOfDiffs = 0;
+  int maxDiff = 0;
+  for (size_t i = 0; i < simd.size(); i++) {
+    int d = std::abs(int(simd[i]) - int(scalar[i]));
+    nOfDiffs += d != 0;
+    maxDiff = std::max(maxDiff, d);
+  }
+
+  std::cout << "derived normals of " << prefix << " (" << w << "x" << h
+            << "): " << nOfDiffs << " of " << simd.size() / 4 * 3
+            << " bytes differ, by at most " << maxDiff << std::endl;
+  return maxDiff <= 1;
+}
+
+bool packMaterial(const string prefix, vector<uint8_t> &texels, int &width,
+                  int &height, bool derive) {
+  vector<uint8_t> depth;
+  if (!loadDepth(prefix + "_height.jpg", depth, width, height)) {
+    return false;
+  }
+
+  texels.assign((size_t)width * height * 4, 0);
+  for (size_t i = 0; i < depth.size(); i++) {
+    texels[i * 4 + FI_RGBA_ALPHA] = depth[i];
+  }
+
+  string normalFile = prefix + "_normal.jpg";
+  FIBITMAP *normalImage =
+      !derive && fileExists(normalFile) ? loadRgb(normalFile) : NULL;
+
+  if (!normalImage) {
+    auto t0 = std::chrono::high_resolution_clock::now();
+    deriveNormals(depth.data(), width, height, PACKED_DEPTH_SCALE,
+                  texels.data());
+    auto t1 = std::chrono::high_resolution_clock::now();
+
+    std::cout << "packed material: normals of " << prefix
+              << " derived from the height map in "
+              << std::chrono::duration<double, std::milli>(t1 - t0).count()
+              << " ms" << std::endl;
+    return true;
+  }
+
+  // the height map's size wins
+  if ((int)FreeImage_GetWidth(normalImage) != width ||
+      (int)FreeImage_GetHeight(normalImage) != height) {
+    FIBITMAP *scaled =
+        FreeImage_Rescale(normalImage, width, height, FILTER_BILINEAR);
+    FreeImage_Unload(normalImage);
+    normalImage = scaled;
+  }
+
+  for (int y = 0; y < height; y++) {
+    BYTE *row = FreeImage_GetBits(normalImage) +
+                y * FreeImage_GetPitch(normalImage);
+    for (int x = 0; x < width; x++) {
+      uint8_t *t = &texels[((size_t)y * width + x) * 4];
+      t[FI_RGBA_RED] = row[x * 3 + FI_RGBA_RED];
+      t[FI_RGBA_GREEN] = row[x * 3 + FI_RGBA_GREEN];
+      t[FI_RGBA_BLUE] = row[x * 3 + FI_RGBA_BLUE];
+    }
+  }
+  FreeImage_Unload(normalImage);
+
+  return true;
+}
+
+bool loadPackedMaterial(GLuint &tbo, int unit, const string prefix,
+                        bool derive) {
+  string packedFile = prefix + (derive ? "_derived.png" : "_packed.png");
+  long packedTime = 0, heightTime = 0, normalTime = 0;
+  bool cached = fileExists(packedFile, &packedTime) &&
+                fileExists(prefix + "_height.jpg", &heightTime) &&
+                packedTime >= heightTime &&
+                (!fileExists(prefix + "_normal.jpg", &normalTime) ||
+                 packedTime >= normalTime);
+
+  FIBITMAP *image = NULL;
+
+  if (cached) {
+    FIBITMAP *img = FreeImage_Load(FIF_PNG, packedFile.c_str());
+    if (img) {
+      image = FreeImage_ConvertTo32Bits(img);
+      FreeImage_Unload(img);
+    }
+  }
+
+  if (!image) {
+    vector<uint8_t> texels;
+    int w, h;
+    if (!packMaterial(prefix, texels, w, h, derive)) {
+      return false;
+    }
+
+    image = FreeImage_Allocate(w, h, 32);
+    for (int y = 0; y < h; y++) {
+      memcpy(FreeImage_GetBits(image) + y * FreeImage_GetPitch(image),
+             &texels[(size_t)y * w * 4], (size_t)w * 4);
+    }
+
+    // read instead of packed the next time
+    if (!FreeImage_Save(FIF_PNG, image, packedFile.c_str())) {
+      std::cout << "packed material: can't write " << packedFile
+                << std::endl;
+    }
+  }
+
+  int w = FreeImage_GetWidth(image), h = FreeImage_GetHeight(image);
+
+  glActiveTexture(GL_TEXTURE0 + unit);
+  glGenTextures(1, &tbo);
+  glBindTexture(GL_TEXTURE_2D, tbo);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_BGRA, GL_UNSIGNED_BYTE,
+               (void *)FreeImage_GetBits(image));
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  frameStats.setTexture(tbo, (size_t)w * h * 4);
+
+  FreeImage_Unload(image);
+
+  return true;
+}
@@ -0,0 +1,112 @@
+#include "prepass.h"
+#include "shaderQueue.h"
+#include "glState.h"
+
+DepthPrepass::DepthPrepass() { initShader(); }
+
+DepthPrepass::~DepthPrepass() { shaderQueue.remove(program); }
+
+void DepthPrepass::initShader() {
+  shader = 0;
+  program = shaderQueue.submit(
+      "./shader/vsDepth.glsl", "./shader/fsDepth.glsl",
+      [this](GLuint exe) {
+        shader = exe;
+        uniModel = myGetUniformLocation(shader, "M");
+        uniView = myGetUniformLocation(shader, "V");
+        uniProjection = myGetUniformLocation(shader, "P");
+      });
+}
+
+void DepthPrepass::begin() {
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  glDepthMask(GL_TRUE);
+  glDepthFunc(GL_LESS);
+}
+
+void DepthPrepass::drawMesh(Mesh *mesh, mat4 M, mat4 V, mat4 P) {
+  if (shader == 0) {
+    return;
+  }
+
+  glState.useProgram(shader);
+  glUniformMatrix4fv(uniModel, 1, GL_FALSE, value_ptr(M));
+  glUniformMatrix4fv(uniView, 1, GL_FALSE, value_ptr(V));
+  glUniformMatrix4fv(uniProjection, 1, GL_FALSE, value_ptr(P));
+
+  mesh->selectLod(M, V, P);
+  mesh->drawGeometry();
+}
+
+void DepthPrepass::drawQuad(Quad *quad, mat4 M, mat4 V, mat4 P) {
+  if (shader == 0) {
+    return;
+  }
+
+  glState.useProgram(shader);
+  glUniformMatrix4fv(uniModel, 1, GL_FALSE, value_ptr(M));
+  glUniformMatrix4fv(uniView, 1, GL_FALSE, value_ptr(V));
+  glUniformMatrix4fv(uniProjection, 1, GL_FALSE, value_ptr(P));
+
+  quad->drawGeometry();
+}
+
+void DepthPrepass::end() {
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+// only fragments lying exactly on the pre-pass depth are shaded
+void DepthPrepass::beginMain() {
+  // until the depth program is ready, the pre-pass wrote nothing
+  if (shader == 0) {
+    return;
+  }
+
+  glDepthFunc(GL_EQUAL);
+  glDepthMask(GL_FALSE);
+}
+
+void DepthPrepass::endMain() {
+  glDepthFunc(GL_LESS);
+  glDepthMask(GL_TRUE);
+}
+
+FragmentCounter::FragmentCounter() {
+  glGenQueries(nOfQueries, queries);
+
+  for (int i = 0; i < nOfQueries; i++) {
+    issued[i] = false;
+  }
+
+  current = 0;
+  shadedFragments = 0;
+
+  glGetIntegerv(GL_SAMPLES, &nOfSamples);
+  nOfSamples = std::max(nOfSamples, 1);
+}
+
+FragmentCounter::~FragmentCounter() { glDeleteQueries(nOfQueries, queries); }
+
+void FragmentCounter::begin() {
+  // the oldest query has had nOfQueries - 1 frames to finish
+  if (issued[current]) {
+    GLuint available = GL_FALSE;
+    glGetQueryObjectuiv(queries[current], GL_QUERY_RESULT_AVAILABLE,
+                        &available);
+
+    if (available) {
+      GLuint64 samples;
+      glGetQueryObjectui64v(queries[current], GL_QUERY_RESULT, &samples);
+      shadedFragments = samples / nOfSamples;
+    }
+  }
+
+  glBeginQuery(GL_SAMPLES_PASSED, queries[current]);
+}
+
+void FragmentCounter::end() {
+  glEndQuery(GL_SAMPLES_PASSED);
+
+  issued[current] = true;
+  current = (current + 1) % nOfQueries;
+}
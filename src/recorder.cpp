@@ -0,0 +1,138 @@
+#include "recorder.h"
+#include "stats.h"
+#include "threadPool.h"
+#include <chrono>
+#include <cstring>
+
+FrameRecorder::FrameRecorder(const string p, int w, int h, int nOfSlots) {
+  pattern = p;
+  type = FreeImage_GetFIFFromFilename(pattern.c_str());
+  if (type != FIF_PNG && type != FIF_JPEG) {
+    std::cout << "Recording needs a .png or .jpg pattern: " << pattern
+              << '\n';
+    type = FIF_UNKNOWN;
+  }
+
+  // GL_BGR rows padded to GL_PACK_ALIGNMENT 4, like a 24 bit FIBITMAP
+  width = w;
+  height = h;
+  pitch = (width * 3 + 3) & ~3;
+
+  pbos.resize(nOfSlots);
+  fences.assign(nOfSlots, 0);
+  frames.assign(nOfSlots, -1);
+
+  glGenBuffers(nOfSlots, pbos.data());
+  for (int i = 0; i < nOfSlots; i++) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i]);
+    glBufferData(GL_PIXEL_PACK_BUFFER, pitch * height, NULL, GL_STREAM_READ);
+    frameStats.setBuffer(pbos[i], (size_t)pitch * height);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  slot = 0;
+  maxEncodes = glm::max(threadPool.size(), 1) * 2;
+  recording = true;
+  nOfFrames = 0;
+  nOfWritten = nOfFailed = 0;
+}
+
+FrameRecorder::~FrameRecorder() {
+  flush();
+  for (GLuint pbo : pbos) {
+    frameStats.releaseBuffer(pbo);
+  }
+  glDeleteBuffers(pbos.size(), pbos.data());
+}
+
+// map a slot, copy its pixels out and encode them on the thread pool
+void FrameRecorder::readSlot(int s) {
+  // only blocks if the GPU is a whole ring of captures behind
+  glClientWaitSync(fences[s], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+  glDeleteSync(fences[s]);
+  fences[s] = 0;
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[s]);
+  BYTE *pixels = (BYTE *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                          pitch * height, GL_MAP_READ_BIT);
+  if (!pixels) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    nOfFailed++;
+    return;
+  }
+
+  FIBITMAP *img = FreeImage_Allocate(width, height, 24);
+  // both are bottom up
+  if (FreeImage_GetPitch(img) == (unsigned)pitch) {
+    memcpy(FreeImage_GetBits(img), pixels, pitch * height);
+  } else {
+    for (int y = 0; y < height; y++) {
+      memcpy(FreeImage_GetScanLine(img, y), pixels + y * pitch, width * 3);
+    }
+  }
+  glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  char fileName[1024];
+  snprintf(fileName, sizeof(fileName), pattern.c_str(), frames[s]);
+  frames[s] = -1;
+
+  while (!encodes.empty() &&
+         (encodes.front().wait_for(std::chrono::seconds(0)) ==
+              std::future_status::ready ||
+          (int)encodes.size() >= maxEncodes)) {
+    encodes.front().wait();
+    encodes.pop_front();
+  }
+
+  string file = fileName;
+  FREE_IMAGE_FORMAT t = type;
+  encodes.push_back(threadPool.enqueue([this, img, file, t]() {
+    // fast PNG compression, the encoders have to keep up with the frames
+    int flags = t == FIF_PNG ? PNG_Z_BEST_SPEED : JPEG_DEFAULT;
+    if (FreeImage_Save(t, img, file.c_str(), flags)) {
+      nOfWritten++;
+    } else {
+      nOfFailed++;
+    }
+    FreeImage_Unload(img);
+  }));
+}
+
+// after the frame is drawn, before swapping buffers,
+// fbo: read its first color attachment instead of the back buffer
+void FrameRecorder::capture(GLuint fbo) {
+  if (!recording || !valid()) {
+    return;
+  }
+
+  // the slot written next holds the oldest frame
+  if (fences[slot]) {
+    readSlot(slot);
+  }
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+  glReadBuffer(fbo ? GL_COLOR_ATTACHMENT0 : GL_BACK);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[slot]);
+  glReadPixels(0, 0, width, height, GL_BGR, GL_UNSIGNED_BYTE, 0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  frames[slot] = nOfFrames++;
+  slot = (slot + 1) % pbos.size();
+}
+
+// read the frames still in flight and wait for every encoder
+void FrameRecorder::flush() {
+  for (size_t k = 0; k < pbos.size(); k++) {
+    int s = (slot + k) % pbos.size();
+    if (fences[s]) {
+      readSlot(s);
+    }
+  }
+
+  for (std::future<void> &f : encodes) {
+    f.wait();
+  }
+  encodes.clear();
+}
@@ -0,0 +1,104 @@
+#include "renderQueue.h"
+#include <cstring>
+
+RenderQueue::RenderQueue() { nOfTriangles = 0; }
+
+// depth in [0, 1], 0 at the eye
+uint64_t RenderQueue::makeKey(int pass, GLuint program, int material,
+                              float depth) {
+  uint64_t d = uint64_t(glm::clamp(depth, 0.f, 1.f) *
+                        float((1 << KEY_DEPTH_BITS) - 1));
+
+  return (uint64_t(pass & 0xff) << KEY_PASS_SHIFT) |
+         (uint64_t(program & 0xffff) << KEY_PROGRAM_SHIFT) |
+         (uint64_t(material & 0xffff) << KEY_MATERIAL_SHIFT) | d;
+}
+
+void RenderQueue::add(uint64_t key, Mesh *mesh, mat4 M, int unitBaseColor,
+                      int unitNormal, int unitHeight) {
+  keys.push_back(key);
+  order.push_back(items.size());
+  items.push_back({mesh, NULL, M, mesh->lodLevel, unitBaseColor, unitNormal,
+                   unitHeight});
+}
+
+void RenderQueue::add(uint64_t key, Quad *quad, mat4 M, int unitBaseColor,
+                      int unitNormal, int unitHeight) {
+  keys.push_back(key);
+  order.push_back(items.size());
+  items.push_back({NULL, quad, M, quad->lodLevel, unitBaseColor, unitNormal,
+                   unitHeight});
+}
+
+// stable, one counting pass per byte that differs between the keys
+void RenderQueue::sort() {
+  size_t n = keys.size();
+  if (n < 2) {
+    return;
+  }
+
+  uint64_t all = ~0ull, any = 0;
+  for (uint64_t k : keys) {
+    all &= k;
+    any |= k;
+  }
+  uint64_t differ = all ^ any;
+
+  keysTmp.resize(n);
+  orderTmp.resize(n);
+
+  for (int shift = 0; shift < 64; shift += 8) {
+    if (((differ >> shift) & 0xff) == 0) {
+      continue;
+    }
+
+    size_t counts[257];
+    memset(counts, 0, sizeof(counts));
+    for (uint64_t k : keys) {
+      counts[((k >> shift) & 0xff) + 1]++;
+    }
+    for (int b = 0; b < 256; b++) {
+      counts[b + 1] += counts[b];
+    }
+
+    for (size_t i = 0; i < n; i++) {
+      size_t to = counts[(keys[i] >> shift) & 0xff]++;
+      keysTmp[to] = keys[i];
+      orderTmp[to] = order[i];
+    }
+    keys.swap(keysTmp);
+    order.swap(orderTmp);
+  }
+}
+
+// sort and draw everything recorded, then clear
+void RenderQueue::flush(mat4 V, mat4 P, vec3 eye, vec3 lightColor,
+                        vec3 lightPosition) {
+  sort();
+
+  nOfTriangles = 0;
+  for (uint32_t i : order) {
+    RenderItem &item = items[i];
+
+    // shading LODs are picked per draw when it is recorded
+    if (item.mesh) {
+      item.mesh->lodLevel = item.lodLevel;
+      item.mesh->draw(item.model, V, P, eye, lightColor, lightPosition,
+                      item.unitBaseColor, item.unitNormal, item.unitHeight);
+      nOfTriangles += item.mesh->triangleCount();
+    } else {
+      item.quad->lodLevel = item.lodLevel;
+      item.quad->draw(item.model, V, P, eye, lightColor, lightPosition,
+                      item.unitBaseColor, item.unitNormal, item.unitHeight);
+      nOfTriangles += 2;
+    }
+  }
+
+  clear();
+}
+
+void RenderQueue::clear() {
+  items.clear();
+  keys.clear();
+  order.clear();
+}
@@ -0,0 +1,253 @@
+#include "residency.h"
+#include "stats.h"
+#include "threadPool.h"
+#include <chrono>
+
+TextureResidency::TextureResidency(size_t b) {
+  budget = b;
+  residentBytes = 0;
+  keepSize = 64;
+  maxStreams = 2;
+  frame = 0;
+  nOfEvictions = nOfRestreams = 0;
+}
+
+TextureResidency::~TextureResidency() {
+  for (std::future<void> &f : loads) {
+    f.wait();
+  }
+}
+
+// drivers pad RGB8 to 4 bytes per texel
+size_t TextureResidency::levelBytes(ResidentTexture &t, int level) {
+  return (size_t)4 * glm::max(t.width >> level, 1) *
+         glm::max(t.height >> level, 1);
+}
+
+// the resident levels, for the memory stats
+void TextureResidency::reportBytes(ResidentTexture &t) {
+  size_t bytes = 0;
+  for (int l = t.baseLevel; l < t.nOfLevels; l++) {
+    bytes += levelBytes(t, l);
+  }
+  frameStats.setTexture(t.tbo, bytes);
+}
+
+// like Mesh::setTexture() with a mip chain, returns the texture's id,
+// -1 if the file can't be loaded
+int TextureResidency::load(GLuint &tbo, int texUnit, const string texDir,
+                           FREE_IMAGE_FORMAT imgType) {
+  FIBITMAP *loaded = FreeImage_Load(imgType, texDir.c_str());
+  if (!loaded) {
+    std::cout << "residency: can't load " << texDir << std::endl;
+    tbo = 0;
+    return -1;
+  }
+  FIBITMAP *texImage = FreeImage_ConvertTo24Bits(loaded);
+  FreeImage_Unload(loaded);
+
+  glActiveTexture(GL_TEXTURE0 + texUnit);
+
+  ResidentTexture t;
+  t.unit = texUnit;
+  t.file = texDir;
+  t.type = imgType;
+  t.width = FreeImage_GetWidth(texImage);
+  t.height = FreeImage_GetHeight(texImage);
+  t.nOfLevels = 1;
+  while ((glm::max(t.width, t.height) >> t.nOfLevels) > 0) {
+    t.nOfLevels++;
+  }
+  t.baseLevel = 0;
+  t.keepLevel = 0;
+  while (t.keepLevel + 1 < t.nOfLevels &&
+         glm::max(t.width, t.height) >> t.keepLevel > keepSize) {
+    t.keepLevel++;
+  }
+  t.wantedLevel = t.nOfLevels;
+  t.lastUsed = frame;
+  t.streaming = false;
+
+  glGenTextures(1, &tbo);
+  glBindTexture(GL_TEXTURE_2D, tbo);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, t.width, t.height, 0, GL_BGR,
+               GL_UNSIGNED_BYTE, (void *)FreeImage_GetBits(texImage));
+  glGenerateMipmap(GL_TEXTURE_2D);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                  GL_LINEAR_MIPMAP_LINEAR);
+  t.tbo = tbo;
+
+  FreeImage_Unload(texImage);
+
+  for (int l = 0; l < t.nOfLevels; l++) {
+    residentBytes += levelBytes(t, l);
+  }
+  reportBytes(t);
+
+  textures.push_back(t);
+  return textures.size() - 1;
+}
+
+// level: the finest level a draw of this frame samples
+void TextureResidency::use(int id, int level) {
+  ResidentTexture &t = textures[id];
+  t.lastUsed = frame;
+  t.wantedLevel = glm::min(t.wantedLevel, level);
+}
+
+// the level sampled across pixels on screen, like hardware mip selection
+int TextureResidency::levelFor(int id, float pixels) {
+  ResidentTexture &t = textures[id];
+  float ratio = glm::max(t.width, t.height) / glm::max(pixels, 1.f);
+  return glm::clamp(int(floor(log2(ratio))), 0, t.nOfLevels - 1);
+}
+
+// release the finest level of the least recently used texture,
+// onlyUnused: only levels not sampled since the last update()
+bool TextureResidency::evictOne(bool onlyUnused) {
+  int best = -1;
+
+  for (int i = 0; i < (int)textures.size(); i++) {
+    ResidentTexture &t = textures[i];
+    // used textures only give up levels finer than they sampled
+    if (t.baseLevel >= t.keepLevel || t.streaming ||
+        (onlyUnused && t.lastUsed >= frame && t.baseLevel >= t.wantedLevel)) {
+      continue;
+    }
+
+    // older first, the larger level of the two on a tie
+    if (best < 0 || t.lastUsed < textures[best].lastUsed ||
+        (t.lastUsed == textures[best].lastUsed &&
+         levelBytes(t, t.baseLevel) >
+             levelBytes(textures[best], textures[best].baseLevel))) {
+      best = i;
+    }
+  }
+
+  if (best < 0) {
+    return false;
+  }
+
+  ResidentTexture &t = textures[best];
+  int level = t.baseLevel++;
+
+  glActiveTexture(GL_TEXTURE0 + t.unit);
+  glBindTexture(GL_TEXTURE_2D, t.tbo);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, t.baseLevel);
+  glTexImage2D(GL_TEXTURE_2D, level, GL_RGB, 0, 0, 0, GL_BGR,
+               GL_UNSIGNED_BYTE, NULL);
+
+  residentBytes -= levelBytes(t, level);
+  reportBytes(t);
+  nOfEvictions++;
+
+  return true;
+}
+
+// decode the next finer level on the thread pool
+void TextureResidency::restream(int id) {
+  ResidentTexture &t = textures[id];
+  int level = t.baseLevel - 1;
+  int w = glm::max(t.width >> level, 1), h = glm::max(t.height >> level, 1);
+
+  t.streaming = true;
+  residentBytes += levelBytes(t, level);
+
+  string file = t.file;
+  FREE_IMAGE_FORMAT type = t.type;
+
+  loads.push_back(threadPool.enqueue([this, id, level, w, h, file, type]() {
+    StreamedLevel s;
+    s.id = id;
+    s.level = level;
+    s.width = w;
+    s.height = h;
+
+    // a file gone since load() arrives without texels, see update()
+    FIBITMAP *loaded = FreeImage_Load(type, file.c_str());
+    if (loaded) {
+      FIBITMAP *img = FreeImage_ConvertTo24Bits(loaded);
+      FreeImage_Unload(loaded);
+      FIBITMAP *scaled = FreeImage_Rescale(img, w, h, FILTER_BOX);
+
+      // rows are 4 byte aligned, the default GL_UNPACK_ALIGNMENT
+      BYTE *bits = FreeImage_GetBits(scaled);
+      s.texels.assign(bits, bits + FreeImage_GetPitch(scaled) * h);
+
+      FreeImage_Unload(scaled);
+      FreeImage_Unload(img);
+    }
+
+    std::lock_guard<std::mutex> lock(arrivedMutex);
+    arrived.push_back(std::move(s));
+  }));
+}
+
+// once per frame, after the draws of the frame reported their levels
+void TextureResidency::update() {
+  vector<StreamedLevel> levels;
+  {
+    std::lock_guard<std::mutex> lock(arrivedMutex);
+    levels.swap(arrived);
+  }
+
+  for (StreamedLevel &s : levels) {
+    ResidentTexture &t = textures[s.id];
+    t.streaming = false;
+
+    // the bytes restream() counted in advance are returned, the texture
+    // keeps the levels it has and is not streamed again
+    if (s.texels.empty()) {
+      std::cout << "residency: can't restream " << t.file << std::endl;
+      residentBytes -= levelBytes(t, s.level);
+      t.file.clear();
+      continue;
+    }
+
+    glActiveTexture(GL_TEXTURE0 + t.unit);
+    glBindTexture(GL_TEXTURE_2D, t.tbo);
+    glTexImage2D(GL_TEXTURE_2D, s.level, GL_RGB, s.width, s.height, 0,
+                 GL_BGR, GL_UNSIGNED_BYTE, s.texels.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, s.level);
+
+    t.baseLevel = s.level;
+    reportBytes(t);
+    nOfRestreams++;
+  }
+
+  while (!loads.empty() && loads.front().wait_for(std::chrono::seconds(0)) ==
+                               std::future_status::ready) {
+    loads.pop_front();
+  }
+
+  while (residentBytes > budget && evictOne(false)) {
+  }
+
+  // finer levels for textures that were drawn, unused ones make room
+  int nOfStreams = 0;
+  for (ResidentTexture &t : textures) {
+    nOfStreams += t.streaming;
+  }
+
+  for (int i = 0; i < (int)textures.size() && nOfStreams < maxStreams; i++) {
+    ResidentTexture &t = textures[i];
+    if (t.lastUsed < frame || t.streaming || t.wantedLevel >= t.baseLevel ||
+        t.file.empty()) {
+      continue;
+    }
+
+    size_t bytes = levelBytes(t, t.baseLevel - 1);
+    while (residentBytes + bytes > budget && evictOne(true)) {
+    }
+
+    if (residentBytes + bytes <= budget) {
+      restream(i);
+      nOfStreams++;
+    }
+  }
+
+  for (ResidentTexture &t : textures) {
+    t.wantedLevel = t.nOfLevels;
+  }
+  frame++;
+}
@@ -0,0 +1,358 @@
+#include "shaderQueue.h"
+#include "glState.h"
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+ShaderQueue shaderQueue;
+
+ShaderQueue::ShaderQueue() {
+  parallel = false;
+  frame = 0;
+  deferFrames = 2;
+  inotifyFd = -1;
+  watchFd = -1;
+  pollInterval = 30;
+}
+
+ShaderQueue::~ShaderQueue() {
+  if (inotifyFd >= 0) {
+    close(inotifyFd);
+  }
+}
+
+// must be called after glewInit()
+void ShaderQueue::init() {
+  parallel = hasExtension("GL_KHR_parallel_shader_compile") ||
+             hasExtension("GL_ARB_parallel_shader_compile");
+
+  // Note: the number of compiler threads is left to the driver,
+  // which is the initial value of GL_MAX_SHADER_COMPILER_THREADS_KHR
+  std::cout << "Shader compile: "
+            << (parallel ? "parallel (GL_KHR_parallel_shader_compile)"
+                         : "deferred status polling")
+            << std::endl;
+}
+
+int ShaderQueue::submit(string vsDir, string fsDir,
+                        std::function<void(GLuint)> onReady, string defines) {
+  vector<ShaderStage> stages = {{GL_VERTEX_SHADER, vsDir},
+                                {GL_FRAGMENT_SHADER, fsDir}};
+
+  return submit(stages, onReady, defines);
+}
+
+// return a handle of the program,
+// onReady is called from update() whenever a new build is ready
+int ShaderQueue::submit(vector<ShaderStage> stages,
+                        std::function<void(GLuint)> onReady, string defines,
+                        vector<string> varyings) {
+  ShaderProgram prog;
+  prog.stages = stages;
+  prog.defines = defines;
+  prog.varyings = varyings;
+  prog.exe = 0;
+  prog.pending = 0;
+  prog.submitFrame = frame;
+  prog.onReady = onReady;
+  prog.removed = false;
+
+  compile(prog);
+  programs.push_back(prog);
+
+  return programs.size() - 1;
+}
+
+void ShaderQueue::compile(ShaderProgram &prog) {
+  prog.objs.clear();
+
+  for (size_t i = 0; i < prog.stages.size(); i++) {
+    GLuint obj = submitShader(prog.stages[i].fileName, prog.stages[i].type,
+                              prog.defines);
+
+    if (obj == 0) {
+      // the source can not be read (e.g. an editor is saving it),
+      // keep the current program and wait for the next change
+      for (size_t j = 0; j < prog.objs.size(); j++) {
+        glDeleteShader(prog.objs[j]);
+      }
+      prog.objs.clear();
+      prog.pending = 0;
+      return;
+    }
+
+    prog.objs.push_back(obj);
+  }
+
+  // issue the link right away, a failed compile makes the link fail
+  prog.pending = submitProgram(prog.objs, prog.varyings);
+  prog.submitFrame = frame;
+}
+
+void ShaderQueue::rebuild(int handle) {
+  ShaderProgram &prog = programs[handle];
+  if (prog.removed) {
+    return;
+  }
+
+  // a build is still in flight, drop it in favour of the new source
+  if (prog.pending != 0) {
+    for (size_t i = 0; i < prog.objs.size(); i++) {
+      glDeleteShader(prog.objs[i]);
+    }
+    glDeleteProgram(prog.pending);
+    glState.forgetProgram(prog.pending);
+    prog.pending = 0;
+  }
+
+  compile(prog);
+}
+
+// delete the program of an owner going away, its callback is dropped so
+// later rebuilds never reach the owner; -1 and released handles are ignored
+void ShaderQueue::remove(int handle) {
+  if (handle < 0 || handle >= (int)programs.size()) {
+    return;
+  }
+
+  ShaderProgram &prog = programs[handle];
+
+  for (size_t i = 0; i < prog.objs.size(); i++) {
+    glDeleteShader(prog.objs[i]);
+  }
+  if (prog.pending != 0) {
+    glDeleteProgram(prog.pending);
+    glState.forgetProgram(prog.pending);
+  }
+  if (prog.exe != 0) {
+    glDeleteProgram(prog.exe);
+    glState.forgetProgram(prog.exe);
+  }
+
+  prog.objs.clear();
+  prog.pending = prog.exe = 0;
+  prog.stages.clear();
+  prog.onReady = nullptr;
+  prog.removed = true;
+}
+
+// switch a program to another shader variant,
+// the current variant is used until the new one is ready
+void ShaderQueue::setDefines(int handle, string defines) {
+  if (programs[handle].defines == defines) {
+    return;
+  }
+
+  programs[handle].defines = defines;
+  rebuild(handle);
+}
+
+// switch a program to other source files
+void ShaderQueue::setStages(int handle, vector<ShaderStage> stages) {
+  programs[handle].stages = stages;
+  rebuild(handle);
+}
+
+void ShaderQueue::rebuildAll() {
+  for (size_t i = 0; i < programs.size(); i++) {
+    rebuild(i);
+  }
+}
+
+// rebuild every program using the file, only the file name is compared
+void ShaderQueue::rebuildFile(const string fileName) {
+  for (size_t i = 0; i < programs.size(); i++) {
+    vector<ShaderStage> &stages = programs[i].stages;
+
+    for (size_t j = 0; j < stages.size(); j++) {
+      const string &dir = stages[j].fileName;
+      size_t pos = dir.find_last_of('/');
+      string name = (pos == string::npos) ? dir : dir.substr(pos + 1);
+
+      if (name == fileName) {
+        std::cout << "Rebuild shader: " << dir << std::endl;
+        rebuild(i);
+        break;
+      }
+    }
+  }
+}
+
+bool ShaderQueue::isPending(int handle) {
+  return programs[handle].pending != 0;
+}
+
+bool ShaderQueue::isReady(ShaderProgram &prog) {
+  if (parallel) {
+    GLint done = GL_FALSE;
+    glGetProgramiv(prog.pending, GL_COMPLETION_STATUS_KHR, &done);
+
+    return done == GL_TRUE;
+  }
+
+  return frame - prog.submitFrame >= deferFrames;
+}
+
+void ShaderQueue::complete(ShaderProgram &prog) {
+  bool ok = true;
+
+  // the logs of the stages explain a failed link better
+  for (size_t i = 0; i < prog.objs.size(); i++) {
+    if (!checkShader(prog.objs[i], prog.stages[i].fileName)) {
+      ok = false;
+    }
+  }
+
+  if (ok && !checkProgram(prog.pending)) {
+    ok = false;
+  }
+
+  for (size_t i = 0; i < prog.objs.size(); i++) {
+    glDetachShader(prog.pending, prog.objs[i]);
+    glDeleteShader(prog.objs[i]);
+  }
+  prog.objs.clear();
+
+  if (!ok) {
+    // keep using the previous program
+    glDeleteProgram(prog.pending);
+    glState.forgetProgram(prog.pending);
+    prog.pending = 0;
+    return;
+  }
+
+  GLuint old = prog.exe;
+  prog.exe = prog.pending;
+  prog.pending = 0;
+
+  if (prog.onReady) {
+    prog.onReady(prog.exe);
+  }
+
+  if (old != 0) {
+    glDeleteProgram(old);
+    glState.forgetProgram(old);
+  }
+}
+
+// call once per frame
+void ShaderQueue::update() {
+  checkWatch();
+
+  for (size_t i = 0; i < programs.size(); i++) {
+    ShaderProgram &prog = programs[i];
+
+    if (prog.pending != 0 && isReady(prog)) {
+      complete(prog);
+    }
+  }
+
+  frame++;
+}
+
+// block until every submitted program is ready
+void ShaderQueue::finish() {
+  for (size_t i = 0; i < programs.size(); i++) {
+    if (programs[i].pending != 0) {
+      complete(programs[i]);
+    }
+  }
+}
+
+// rebuild programs whose source files in dir change
+void ShaderQueue::watch(const string dir) {
+  watchDir = dir;
+
+#ifdef __linux__
+  inotifyFd = inotify_init1(IN_NONBLOCK);
+
+  if (inotifyFd >= 0) {
+    // editors either rewrite a file or move a temporary file onto it
+    watchFd = inotify_add_watch(inotifyFd, dir.c_str(),
+                                IN_CLOSE_WRITE | IN_MOVED_TO);
+  }
+
+  if (watchFd < 0) {
+    std::cout << "Failed to watch " << dir << ", fall back to polling"
+              << std::endl;
+  }
+#endif
+}
+
+void ShaderQueue::checkWatch() {
+  if (watchDir.empty()) {
+    return;
+  }
+
+#ifdef __linux__
+  if (watchFd >= 0) {
+    // non-blocking, returns -1 immediately when nothing has changed
+    char buf[4096]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    while ((len = read(inotifyFd, buf, sizeof(buf))) > 0) {
+      for (char *ptr = buf; ptr < buf + len;) {
+        struct inotify_event *event = (struct inotify_event *)ptr;
+
+        if (event->len > 0) {
+          rebuildFile(event->name);
+        }
+
+        ptr += sizeof(struct inotify_event) + event->len;
+      }
+    }
+
+    return;
+  }
+#endif
+
+  if (frame % pollInterval != 0) {
+    return;
+  }
+
+  for (size_t i = 0; i < programs.size(); i++) {
+    vector<ShaderStage> &stages = programs[i].stages;
+
+    for (size_t j = 0; j < stages.size(); j++) {
+      const string &dir = stages[j].fileName;
+      struct stat st;
+
+      if (stat(dir.c_str(), &st) != 0) {
+        continue;
+      }
+
+      long mtime = (long)st.st_mtime;
+
+      if (mtimes.count(dir) && mtimes[dir] != mtime) {
+        std::cout << "Rebuild shader: " << dir << std::endl;
+        rebuild(i);
+      }
+
+      mtimes[dir] = mtime;
+    }
+  }
+}
+
+void ShaderQueue::release() {
+  for (size_t i = 0; i < programs.size(); i++) {
+    ShaderProgram &prog = programs[i];
+
+    for (size_t j = 0; j < prog.objs.size(); j++) {
+      glDeleteShader(prog.objs[j]);
+    }
+    if (prog.pending != 0) {
+      glDeleteProgram(prog.pending);
+      glState.forgetProgram(prog.pending);
+    }
+    if (prog.exe != 0) {
+      glDeleteProgram(prog.exe);
+      glState.forgetProgram(prog.exe);
+    }
+  }
+
+  programs.clear();
+}
@@ -0,0 +1,59 @@
+#include "shadingLod.h"
+
+ShadingLod::ShadingLod() {
+  shadowPixels = 6.f;
+  parallaxPixels = 2.f;
+  flatPixels = 16.f;
+  heightScale = 0.1f;
+  fade = 1.5f;
+
+  resetCounts();
+}
+
+void ShadingLod::resetCounts() {
+  for (int i = 0; i < NUM_SHADING_LODS; i++) {
+    drawCounts[i] = 0;
+  }
+}
+
+// 0 above fade x threshold, 1 below threshold, linear in between
+float ShadingLod::fadeLevel(float value, float threshold) {
+  float upper = threshold * fade;
+
+  return glm::clamp((upper - value) / (upper - threshold), 0.f, 1.f);
+}
+
+// center, radius: bounding sphere in world space
+// normal: surface normal in world space, or vec3(0) for non-planar meshes
+// eye: camera position, P: projection, viewportHeight: in pixels
+// return a level in [0, NUM_SHADING_LODS - 1]
+float ShadingLod::select(vec3 center, float radius, vec3 normal, vec3 eye,
+                         mat4 &P, float viewportHeight) {
+  vec3 toEye = eye - center;
+  float dist = glm::max(length(toEye), 1e-4f);
+
+  // projected diameter in pixels, P[1][1] = 1 / tan(fov / 2)
+  float pixels = radius * P[1][1] / dist * viewportHeight;
+
+  // tan of the angle between the view direction and the surface normal,
+  // curved meshes see every angle, so assume 45 degrees
+  float tanAngle = 1.f;
+  if (length(normal) > 0.f) {
+    float c = glm::clamp(std::abs(dot(normalize(normal), toEye / dist)),
+                         0.05f, 1.f);
+    tanAngle = glm::min(std::sqrt(1.f - c * c) / c, 4.f);
+  }
+
+  float shift = pixels * heightScale * tanAngle;
+
+  // 0 to 2 from the parallax shift
+  float level = fadeLevel(shift, shadowPixels) + fadeLevel(shift, parallaxPixels);
+
+  // small objects leave the POM levels and fade towards flat shading
+  float flat = fadeLevel(pixels, flatPixels);
+  level = glm::max(level, 2.f * flat) + flat;
+
+  drawCounts[int(level)]++;
+
+  return level;
+}
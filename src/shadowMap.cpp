@@ -0,0 +1,222 @@
+#include "shadowMap.h"
+#include "shaderQueue.h"
+#include "glState.h"
+#include "stats.h"
+
+ShadowCube::ShadowCube(int s, float r) {
+  size = s;
+  nearPlane = 0.05f;
+  range = r;
+  lightPosition = vec3(0.f);
+  nOfCastersDrawn = 0;
+
+  glGenTextures(NUM_SHADOW_LAYERS, cubes);
+  glGenFramebuffers(NUM_SHADOW_LAYERS, fbos);
+
+  for (int l = 0; l < NUM_SHADOW_LAYERS; l++) {
+    units[l] = 28 + l;
+    dirty[l] = true;
+    nOfRenders[l] = 0;
+
+    // compared in hardware, linear filtering blends 4 of the results
+    glActiveTexture(GL_TEXTURE0 + units[l]);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, cubes[l]);
+    for (int face = 0; face < 6; face++) {
+      glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0,
+                   GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT,
+                   GL_FLOAT, NULL);
+    }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_MODE,
+                    GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    frameStats.setTexture(cubes[l], (size_t)size * size * 6 * 4);
+
+    // every face at once, gl_Layer picks one
+    glBindFramebuffer(GL_FRAMEBUFFER, fbos[l]);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, cubes[l], 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+      std::cout << "Shadow cube framebuffer is not complete" << std::endl;
+    }
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  initShader();
+}
+
+ShadowCube::~ShadowCube() {
+  shaderQueue.remove(program);
+  glDeleteFramebuffers(NUM_SHADOW_LAYERS, fbos);
+  for (int l = 0; l < NUM_SHADOW_LAYERS; l++) {
+    frameStats.releaseTexture(cubes[l]);
+  }
+  glDeleteTextures(NUM_SHADOW_LAYERS, cubes);
+}
+
+void ShadowCube::initShader() {
+  shader = 0;
+
+  vector<ShaderStage> stages = {
+      {GL_VERTEX_SHADER, "./shader/vsShadow.glsl"},
+      {GL_GEOMETRY_SHADER, "./shader/gsShadow.glsl"},
+      {GL_FRAGMENT_SHADER, "./shader/fsShadow.glsl"}};
+
+  program = shaderQueue.submit(stages, [this](GLuint exe) {
+    shader = exe;
+    uniModel = myGetUniformLocation(shader, "M");
+    uniFaces = myGetUniformLocation(shader, "faces");
+    uniLightPosition = myGetUniformLocation(shader, "lightPosition");
+    uniRange = myGetUniformLocation(shader, "range");
+
+    // whatever was rendered before is stale
+    for (int l = 0; l < NUM_SHADOW_LAYERS; l++) {
+      dirty[l] = true;
+    }
+  });
+}
+
+int ShadowCube::addCaster(Mesh *mesh, mat4 M, bool dynamic) {
+  return add({mesh, NULL, M, vec3(0.f), 0.f,
+              dynamic ? SHADOW_DYNAMIC : SHADOW_STATIC});
+}
+
+int ShadowCube::addCaster(Quad *quad, mat4 M, bool dynamic) {
+  return add({NULL, quad, M, vec3(0.f), 0.f,
+              dynamic ? SHADOW_DYNAMIC : SHADOW_STATIC});
+}
+
+int ShadowCube::add(ShadowCaster c) {
+  bounds(c);
+  if (inRange(c)) {
+    dirty[c.layer] = true;
+  }
+
+  casters.push_back(c);
+  return casters.size() - 1;
+}
+
+// a caster's cube is redrawn if it was or is within range
+void ShadowCube::moveCaster(int id, mat4 M) {
+  ShadowCaster &c = casters[id];
+  if (M == c.model) {
+    return;
+  }
+
+  bool before = inRange(c);
+  c.model = M;
+  bounds(c);
+
+  if (before || inRange(c)) {
+    dirty[c.layer] = true;
+  }
+}
+
+void ShadowCube::setLight(vec3 position) {
+  if (position == lightPosition) {
+    return;
+  }
+
+  lightPosition = position;
+  for (int l = 0; l < NUM_SHADOW_LAYERS; l++) {
+    dirty[l] = true;
+  }
+}
+
+// a sphere around the mesh's AABB or the quad's [-1, 1]^2
+void ShadowCube::bounds(ShadowCaster &c) {
+  vec3 lo = c.mesh ? c.mesh->min : vec3(-1.f, -1.f, 0.f);
+  vec3 hi = c.mesh ? c.mesh->max : vec3(1.f, 1.f, 0.f);
+
+  float scale = glm::max(length(vec3(c.model[0])),
+                         glm::max(length(vec3(c.model[1])),
+                                  length(vec3(c.model[2]))));
+
+  c.center = vec3(c.model * vec4((lo + hi) * 0.5f, 1.f));
+  c.radius = length(hi - lo) * 0.5f * scale;
+}
+
+bool ShadowCube::inRange(ShadowCaster &c) {
+  return length(c.center - lightPosition) - c.radius < range;
+}
+
+// render the cubes invalidated since the last call
+void ShadowCube::update() {
+  if (shader == 0) {
+    return;
+  }
+
+  for (int l = 0; l < NUM_SHADOW_LAYERS; l++) {
+    if (dirty[l]) {
+      render(l);
+      dirty[l] = false;
+      nOfRenders[l]++;
+    }
+  }
+}
+
+void ShadowCube::render(int layer) {
+  // view projections of the faces, in the order of GL_TEXTURE_CUBE_MAP_*
+  const vec3 dirs[6] = {vec3(1.f, 0.f, 0.f),  vec3(-1.f, 0.f, 0.f),
+                        vec3(0.f, 1.f, 0.f),  vec3(0.f, -1.f, 0.f),
+                        vec3(0.f, 0.f, 1.f),  vec3(0.f, 0.f, -1.f)};
+  const vec3 ups[6] = {vec3(0.f, -1.f, 0.f), vec3(0.f, -1.f, 0.f),
+                       vec3(0.f, 0.f, 1.f),  vec3(0.f, 0.f, -1.f),
+                       vec3(0.f, -1.f, 0.f), vec3(0.f, -1.f, 0.f)};
+
+  mat4 P = perspective(radians(90.f), 1.f, nearPlane, range);
+  mat4 faces[6];
+  for (int f = 0; f < 6; f++) {
+    faces[f] = P * lookAt(lightPosition, lightPosition + dirs[f], ups[f]);
+  }
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbos[layer]);
+  glViewport(0, 0, size, size);
+  glClear(GL_DEPTH_BUFFER_BIT);
+
+  // quads are one sided, their back faces cast shadows too
+  glDisable(GL_CULL_FACE);
+
+  glState.useProgram(shader);
+  glUniformMatrix4fv(uniFaces, 6, GL_FALSE, value_ptr(faces[0]));
+  glState.uniform3f(uniLightPosition, lightPosition);
+  glState.uniform1f(uniRange, range);
+
+  for (ShadowCaster &c : casters) {
+    if (c.layer != layer || !inRange(c)) {
+      continue;
+    }
+
+    glState.uniformMatrix4f(uniModel, c.model);
+    if (c.mesh) {
+      c.mesh->drawGeometry();
+    } else {
+      c.quad->drawGeometry();
+    }
+    nOfCastersDrawn++;
+  }
+
+  glEnable(GL_CULL_FACE);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+// bind both cubes for a receiver's program
+void ShadowCube::setUniforms(GLint uniStatic, GLint uniDynamic,
+                             GLint uniShadowLight) {
+  glState.bindTexture(units[SHADOW_STATIC], GL_TEXTURE_CUBE_MAP,
+                      cubes[SHADOW_STATIC]);
+  glState.bindTexture(units[SHADOW_DYNAMIC], GL_TEXTURE_CUBE_MAP,
+                      cubes[SHADOW_DYNAMIC]);
+
+  glState.uniform1i(uniStatic, units[SHADOW_STATIC]);
+  glState.uniform1i(uniDynamic, units[SHADOW_DYNAMIC]);
+  glState.uniform4f(uniShadowLight, vec4(lightPosition, range));
+}
@@ -0,0 +1,673 @@
+#include "softRaster.h"
+#include "simd8.h"
+#include "threadPool.h"
+#include <atomic>
+
+/* Texture */
+SoftTexture::SoftTexture() {
+  width = height = 0;
+}
+
+SoftTexture::SoftTexture(const string texDir, FREE_IMAGE_FORMAT imgType) {
+  width = height = 0;
+  load(texDir, imgType);
+}
+
+bool SoftTexture::load(const string texDir, FREE_IMAGE_FORMAT imgType) {
+  FIBITMAP *img = FreeImage_Load(imgType, texDir.c_str());
+
+  if (!img) {
+    std::cout << "failed to load texture : " << texDir << std::endl;
+    return false;
+  }
+
+  FIBITMAP *texImage = FreeImage_ConvertTo24Bits(img);
+  FreeImage_Unload(img);
+
+  width = FreeImage_GetWidth(texImage);
+  height = FreeImage_GetHeight(texImage);
+  int pitch = FreeImage_GetPitch(texImage);
+  BYTE *bits = FreeImage_GetBits(texImage);
+
+  // BGR rows, bottom up, the same bytes glTexImage2D gets
+  texels.resize(width * height);
+  for (int y = 0; y < height; y++) {
+    BYTE *row = bits + y * pitch;
+
+    for (int x = 0; x < width; x++) {
+      texels[y * width + x] = row[x * 3 + 2] | (row[x * 3 + 1] << 8) |
+                              (row[x * 3 + 0] << 16);
+    }
+  }
+
+  FreeImage_Unload(texImage);
+
+  return true;
+}
+
+// texel indices and weights of a bilinear fetch with GL_REPEAT
+static void texelCoords(SoftTexture *tex, F8 u, F8 v, I8 idx[4], F8 &fx,
+                        F8 &fy) {
+  F8 w = float(tex->width), h = float(tex->height);
+
+  // wrap first, NaN lanes (e.g. of a degenerate uv mapping) read texel 0
+  u = u - floor(u);
+  v = v - floor(v);
+  u = select(u == u, u, F8(0.f));
+  v = select(v == v, v, F8(0.f));
+
+  F8 x = u * w - F8(0.5f), y = v * h - F8(0.5f);
+  F8 x0 = floor(x), y0 = floor(y);
+  fx = x - x0;
+  fy = y - y0;
+
+  x0 = select(x0 < F8(0.f), w - F8(1.f), x0);
+  y0 = select(y0 < F8(0.f), h - F8(1.f), y0);
+  F8 x1 = x0 + F8(1.f), y1 = y0 + F8(1.f);
+  x1 = select(x1 >= w, F8(0.f), x1);
+  y1 = select(y1 >= h, F8(0.f), y1);
+
+  I8 row0 = toInt(y0) * I8(tex->width), row1 = toInt(y1) * I8(tex->width);
+  I8 col0 = toInt(x0), col1 = toInt(x1);
+
+  idx[0] = row0 + col0;
+  idx[1] = row0 + col1;
+  idx[2] = row1 + col0;
+  idx[3] = row1 + col1;
+}
+
+static F8 channel(I8 texel, int c) {
+  return toFloat((texel >> (8 * c)) & I8(255)) * F8(1.f / 255.f);
+}
+
+static F8 bilinear(F8 t00, F8 t10, F8 t01, F8 t11, F8 fx, F8 fy) {
+  F8 a = fmadd(t10 - t00, fx, t00);
+  F8 b = fmadd(t11 - t01, fx, t01);
+
+  return fmadd(b - a, fy, a);
+}
+
+static V8 sampleRGB(SoftTexture *tex, F8 u, F8 v) {
+  I8 idx[4], t[4];
+  F8 fx, fy;
+
+  texelCoords(tex, u, v, idx, fx, fy);
+  for (int i = 0; i < 4; i++) {
+    t[i] = gather(tex->texels.data(), idx[i]);
+  }
+
+  F8 rgb[3];
+  for (int c = 0; c < 3; c++) {
+    rgb[c] = bilinear(channel(t[0], c), channel(t[1], c), channel(t[2], c),
+                      channel(t[3], c), fx, fy);
+  }
+
+  return V8(rgb[0], rgb[1], rgb[2]);
+}
+
+// .r only, for the height map
+static F8 sampleR(SoftTexture *tex, F8 u, F8 v) {
+  I8 idx[4], t[4];
+  F8 fx, fy;
+
+  texelCoords(tex, u, v, idx, fx, fy);
+  for (int i = 0; i < 4; i++) {
+    t[i] = gather(tex->texels.data(), idx[i]);
+  }
+
+  return bilinear(channel(t[0], 0), channel(t[1], 0), channel(t[2], 0),
+                  channel(t[3], 0), fx, fy);
+}
+
+/* Ports of the fragment shaders, 8 pixels at a time */
+
+// mat3(t, b, n) * v
+static V8 tbnMul(V8 t, V8 b, V8 n, V8 v) { return t * v.x + b * v.y + n * v.z; }
+
+static V8 getNormalFromMap(SoftTexture *tex, F8 u, F8 v, V8 t, V8 b, V8 n) {
+  V8 tn = sampleRGB(tex, u, v);
+  tn = V8(tn.x * F8(2.f) - F8(1.f), tn.y * F8(2.f) - F8(1.f),
+          tn.z * F8(2.f) - F8(1.f));
+
+  return normalize(tbnMul(t, b, n, tn));
+}
+
+// pow(x, 20)
+static F8 pow20(F8 x) {
+  F8 x2 = x * x;
+  F8 x4 = x2 * x2;
+  F8 x8 = x4 * x4;
+
+  return x8 * x8 * x4;
+}
+
+// parallaxOcclusionMapping() of fsPOM.glsl,
+// each lane leaves the march on its own, the loop runs while any is left
+static void parallaxOcclusionMapping(SoftTexture *tex, F8 &u, F8 &v,
+                                     V8 viewDir, M8 active) {
+  const float minLayers = 8.f, maxLayers = 32.f;
+  const float heightScale = 0.1f;
+
+  F8 numLayers = F8(maxLayers) + F8(minLayers - maxLayers) * abs(viewDir.z);
+  F8 layerDepth = F8(1.f) / numLayers;
+  F8 currentLayerDepth = 0.f;
+
+  F8 deltaU = viewDir.x / viewDir.z * F8(heightScale) / numLayers;
+  F8 deltaV = viewDir.y / viewDir.z * F8(heightScale) / numLayers;
+
+  F8 cu = u, cv = v;
+  F8 currentDepthMapValue = sampleR(tex, cu, cv);
+
+  active = active & (currentLayerDepth < currentDepthMapValue);
+
+  // the shader exits after numLayers + 1 steps at most
+  for (int i = 0; i < 64 && active.any(); i++) {
+    cu = select(active, cu - deltaU, cu);
+    cv = select(active, cv - deltaV, cv);
+    currentDepthMapValue =
+        select(active, sampleR(tex, cu, cv), currentDepthMapValue);
+    currentLayerDepth = select(active, currentLayerDepth + layerDepth,
+                               currentLayerDepth);
+
+    active = active & (currentLayerDepth < currentDepthMapValue);
+  }
+
+  F8 prevU = cu + deltaU, prevV = cv + deltaV;
+
+  F8 afterDepth = currentDepthMapValue - currentLayerDepth;
+  F8 beforeDepth =
+      sampleR(tex, prevU, prevV) - currentLayerDepth + layerDepth;
+
+  F8 weight = afterDepth / (afterDepth - beforeDepth);
+  u = prevU * weight + cu * (F8(1.f) - weight);
+  v = prevV * weight + cv * (F8(1.f) - weight);
+}
+
+// calcShadow() of fsPOM.glsl
+static F8 calcShadow(SoftTexture *tex, F8 u, F8 v, V8 lightDir, M8 active) {
+  const float minLayers = 8.f, maxLayers = 32.f;
+  const float heightScale = 0.1f;
+
+  F8 selfShadowFactor = 1.f;
+
+  F8 numLayers = F8(maxLayers) + F8(minLayers - maxLayers) * abs(lightDir.z);
+
+  F8 cu = u, cv = v;
+  F8 currentDepthMapValue = sampleR(tex, cu, cv);
+  F8 currentLayerDepth = currentDepthMapValue;
+
+  F8 layerDepth = F8(1.f) / numLayers;
+  F8 deltaU = lightDir.x / lightDir.z * F8(heightScale) / numLayers;
+  F8 deltaV = lightDir.y / lightDir.z * F8(heightScale) / numLayers;
+
+  active = active & (currentLayerDepth > F8(0.f));
+
+  for (int i = 0; i < 64 && active.any(); i++) {
+    cu = select(active, cu + deltaU, cu);
+    cv = select(active, cv + deltaV, cv);
+    currentDepthMapValue = sampleR(tex, cu, cv);
+    currentLayerDepth =
+        select(active, currentLayerDepth - layerDepth, currentLayerDepth);
+
+    M8 occluded = active & (currentDepthMapValue < currentLayerDepth);
+    selfShadowFactor =
+        select(occluded,
+               selfShadowFactor -
+                   (currentLayerDepth - currentDepthMapValue) / layerDepth,
+               selfShadowFactor);
+
+    active = active & (currentLayerDepth > F8(0.f));
+  }
+
+  return max(F8(0.f), selfShadowFactor);
+}
+
+// main() of fsPhong.glsl (main light only) and fsPOM.glsl
+static V8 shade(SoftDraw &d, F8 u, F8 v, V8 worldPos, V8 worldN, V8 t,
+                V8 b, M8 mask) {
+  V8 eye(d.eye.x, d.eye.y, d.eye.z);
+  V8 lightPosition(d.lightPosition.x, d.lightPosition.y, d.lightPosition.z);
+
+  V8 n = normalize(worldN);
+  V8 N;
+  F8 shadow = 1.f;
+  V8 texColor;
+
+  if (d.parallax) {
+    // lodLevel is uniform, as in the shader
+    float shadowFade = glm::clamp(1.f - d.lodLevel, 0.f, 1.f);
+    float parallaxFade = glm::clamp(2.f - d.lodLevel, 0.f, 1.f);
+    float flatFade = glm::clamp(d.lodLevel - 2.f, 0.f, 1.f);
+
+    F8 du = u, dv = v;
+
+    if (parallaxFade > 0.f) {
+      V8 tanViewDir = normalize(tbnMul(t, b, n, eye - worldPos));
+      parallaxOcclusionMapping(d.height, du, dv, tanViewDir, mask);
+      du = u + (du - u) * F8(parallaxFade);
+      dv = v + (dv - v) * F8(parallaxFade);
+    }
+
+    texColor = sampleRGB(d.base, du, dv);
+
+    N = n;
+    if (flatFade < 1.f) {
+      V8 mapped = getNormalFromMap(d.normal, du, dv, t, b, n);
+      N = normalize(mapped + (n - mapped) * F8(flatFade));
+    }
+
+    if (shadowFade > 0.f) {
+      V8 tanLightDir = normalize(tbnMul(t, b, n, lightPosition - worldPos));
+      F8 s = calcShadow(d.height, du, dv, tanLightDir, mask);
+      shadow = F8(1.f) + (s - F8(1.f)) * F8(shadowFade);
+    }
+  } else {
+    texColor = sampleRGB(d.base, u, v);
+    N = getNormalFromMap(d.normal, u, v, t, b, n);
+  }
+
+  texColor = texColor * F8(0.75f);
+
+  V8 L = normalize(lightPosition - worldPos);
+  V8 V = normalize(eye - worldPos);
+  V8 H = normalize(L + V);
+
+  const float ka = 0.2f, kd = 0.75f, ks = 0.55f;
+
+  // Note: L is normalized already, so is the attenuation of the shaders
+  F8 dist = sqrt(dot(L, L));
+  F8 attenuation = F8(1.f) / (dist * dist);
+  F8 dc = max(dot(N, L), F8(0.f));
+  F8 sc = pow20(max(dot(H, N), F8(0.f)));
+
+  F8 diffuse = dc * attenuation * shadow * F8(kd) + F8(ka);
+  F8 specular = sc * attenuation * shadow * F8(ks);
+
+  return V8(fmadd(texColor.x, diffuse, specular * F8(d.lightColor.x)),
+            fmadd(texColor.y, diffuse, specular * F8(d.lightColor.y)),
+            fmadd(texColor.z, diffuse, specular * F8(d.lightColor.z)));
+}
+
+static I8 packColor(V8 c) {
+  F8 r = min(max(c.x, F8(0.f)), F8(1.f)) * F8(255.f) + F8(0.5f);
+  F8 g = min(max(c.y, F8(0.f)), F8(1.f)) * F8(255.f) + F8(0.5f);
+  F8 b = min(max(c.z, F8(0.f)), F8(1.f)) * F8(255.f) + F8(0.5f);
+
+  return toInt(r) + toInt(g) * I8(1 << 8) + toInt(b) * I8(1 << 16) +
+         I8(int32_t(0xff000000u));
+}
+
+/* Renderer */
+SoftRaster::SoftRaster(int w, int h) {
+  width = w;
+  height = h;
+  tilesX = (width + tileSize - 1) / tileSize;
+  tilesY = (height + tileSize - 1) / tileSize;
+
+  // whole tiles, so 8-wide spans never leave the buffers
+  pitch = tilesX * tileSize;
+  color.resize(pitch * tilesY * tileSize);
+  depth.resize(pitch * tilesY * tileSize);
+  ids.resize(pitch * tilesY * tileSize);
+  bins.resize(tilesX * tilesY);
+}
+
+void SoftRaster::clear(vec3 c) {
+  uint32_t packed = uint32_t(c.r * 255.f + 0.5f) |
+                    (uint32_t(c.g * 255.f + 0.5f) << 8) |
+                    (uint32_t(c.b * 255.f + 0.5f) << 16) | (255u << 24);
+
+  std::fill(color.begin(), color.end(), packed);
+  std::fill(depth.begin(), depth.end(), 1.f);
+  std::fill(ids.begin(), ids.end(), -1);
+
+  draws.clear();
+  tris.clear();
+}
+
+void SoftRaster::drawMesh(Mesh *mesh, mat4 M, mat4 V, mat4 P, SoftDraw d) {
+  vector<SoftVertex> vtxs(mesh->faces.size() * 3);
+
+  for (size_t i = 0; i < mesh->faces.size(); i++) {
+    Face &f = mesh->faces[i];
+    GLuint v[3] = {f.v1, f.v2, f.v3};
+    GLuint vt[3] = {f.vt1, f.vt2, f.vt3};
+    GLuint vn[3] = {f.vn1, f.vn2, f.vn3};
+
+    for (int k = 0; k < 3; k++) {
+      SoftVertex &sv = vtxs[i * 3 + k];
+      sv.clip = vec4(mesh->vertices[v[k]], 1.f);
+      sv.uv = mesh->uvs[vt[k]];
+      sv.worldN = mesh->faceNormals[vn[k]];
+    }
+  }
+
+  draws.push_back(d);
+  drawTriangles(vtxs, M, V, P, draws.size() - 1);
+}
+
+void SoftRaster::drawQuad(Quad *quad, mat4 M, mat4 V, mat4 P, SoftDraw d) {
+  const int order[6] = {0, 1, 2, 0, 2, 3};
+  vector<SoftVertex> vtxs(6);
+
+  for (int i = 0; i < 6; i++) {
+    vtxs[i].clip = vec4(quad->vtxs[order[i]], 1.f);
+    vtxs[i].uv = quad->uvs[order[i]];
+    vtxs[i].worldN = quad->nms[order[i]];
+  }
+
+  d.parallax = true;
+  draws.push_back(d);
+  drawTriangles(vtxs, M, V, P, draws.size() - 1);
+}
+
+// vertex stage, clipping and setup of a triangle list, in parallel
+void SoftRaster::drawTriangles(vector<SoftVertex> &vtxs, mat4 M, mat4 V,
+                               mat4 P, int draw) {
+  int nOfTris = vtxs.size() / 3;
+  mat4 PVM = P * V * M;
+  mat4 invM = inverse(M);
+
+  // a clipped triangle becomes 2 at most
+  vector<SoftTriangle> out(nOfTris * 2);
+  vector<char> valid(nOfTris * 2, 0);
+
+  threadPool.parallelFor(nOfTris, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      SoftVertex v[3], poly[4];
+
+      // vsPhong.glsl / vsPOM.glsl
+      for (int k = 0; k < 3; k++) {
+        SoftVertex &src = vtxs[i * 3 + k];
+        vec4 pos = src.clip;
+
+        v[k].clip = PVM * pos;
+        v[k].uv = src.uv;
+        v[k].worldPos = vec3(M * pos);
+        v[k].worldN = normalize(vec3(vec4(src.worldN, 1.f) * invM));
+      }
+
+      int n = clipNear(v, poly);
+
+      for (int k = 1; k + 1 < n; k++) {
+        SoftVertex t[3] = {poly[0], poly[k], poly[k + 1]};
+        valid[i * 2 + k - 1] = setup(t, draw, out[i * 2 + k - 1]);
+      }
+    }
+  }, 256);
+
+  for (size_t i = 0; i < out.size(); i++) {
+    if (valid[i]) {
+      tris.push_back(out[i]);
+    }
+  }
+}
+
+// clip against z >= -w, returns the number of vertices of the polygon
+int SoftRaster::clipNear(SoftVertex *v, SoftVertex *poly) {
+  int n = 0;
+
+  for (int k = 0; k < 3; k++) {
+    SoftVertex &a = v[k];
+    SoftVertex &b = v[(k + 1) % 3];
+    float da = a.clip.z + a.clip.w;
+    float db = b.clip.z + b.clip.w;
+
+    if (da >= 0.f) {
+      poly[n++] = a;
+    }
+
+    if ((da >= 0.f) != (db >= 0.f)) {
+      float t = da / (da - db);
+      SoftVertex &c = poly[n++];
+      c.clip = mix(a.clip, b.clip, t);
+      c.uv = mix(a.uv, b.uv, t);
+      c.worldPos = mix(a.worldPos, b.worldPos, t);
+      c.worldN = mix(a.worldN, b.worldN, t);
+    }
+  }
+
+  return n;
+}
+
+// returns false for culled or empty triangles
+bool SoftRaster::setup(SoftVertex *v, int draw, SoftTriangle &t) {
+  vec3 win[3];
+  float invW[3];
+
+  for (int k = 0; k < 3; k++) {
+    invW[k] = 1.f / v[k].clip.w;
+    vec3 ndc = vec3(v[k].clip) * invW[k];
+    win[k] = vec3((ndc.x * 0.5f + 0.5f) * width,
+                  (ndc.y * 0.5f + 0.5f) * height, ndc.z * 0.5f + 0.5f);
+  }
+
+  vec2 d1(win[1].x - win[0].x, win[1].y - win[0].y);
+  vec2 d2(win[2].x - win[0].x, win[2].y - win[0].y);
+  float area = d1.x * d2.y - d2.x * d1.y;
+
+  // back faces (GL_CULL_FACE, counter-clockwise front faces) and NaNs
+  if (!(area > 0.f)) {
+    return false;
+  }
+
+  float minX = glm::min(win[0].x, glm::min(win[1].x, win[2].x));
+  float maxX = glm::max(win[0].x, glm::max(win[1].x, win[2].x));
+  float minY = glm::min(win[0].y, glm::min(win[1].y, win[2].y));
+  float maxY = glm::max(win[0].y, glm::max(win[1].y, win[2].y));
+
+  if (maxX < 0.f || maxY < 0.f || minX > width || minY > height) {
+    return false;
+  }
+
+  t.x0 = glm::clamp(int(floor(minX)), 0, width - 1);
+  t.x1 = glm::clamp(int(ceil(maxX)), 0, width - 1);
+  t.y0 = glm::clamp(int(floor(minY)), 0, height - 1);
+  t.y1 = glm::clamp(int(ceil(maxY)), 0, height - 1);
+  t.draw = draw;
+
+  for (int k = 0; k < 3; k++) {
+    vec3 &a = win[k];
+    vec3 &b = win[(k + 1) % 3];
+    float dx = b.x - a.x, dy = b.y - a.y;
+
+    t.edgeA[k] = -dy;
+    t.edgeB[k] = dx;
+    t.edgeC[k] = dy * a.x - dx * a.y;
+
+    // y points up, so left edges go down and top edges go left
+    t.topLeft[k] = dy < 0.f || (dy == 0.f && dx < 0.f);
+  }
+
+  // perspective correct attributes are interpolated as f / w
+  float f[3][SOFT_NUM_PLANES];
+  for (int k = 0; k < 3; k++) {
+    float *p = f[k];
+    p[0] = win[k].z;
+    p[1] = invW[k];
+    p[2] = v[k].uv.x * invW[k];
+    p[3] = v[k].uv.y * invW[k];
+    p[4] = v[k].worldPos.x * invW[k];
+    p[5] = v[k].worldPos.y * invW[k];
+    p[6] = v[k].worldPos.z * invW[k];
+    p[7] = v[k].worldN.x * invW[k];
+    p[8] = v[k].worldN.y * invW[k];
+    p[9] = v[k].worldN.z * invW[k];
+  }
+
+  for (int i = 0; i < SOFT_NUM_PLANES; i++) {
+    float f1 = f[1][i] - f[0][i], f2 = f[2][i] - f[0][i];
+
+    t.planeA[i] = (f1 * d2.y - f2 * d1.y) / area;
+    t.planeB[i] = (f2 * d1.x - f1 * d2.x) / area;
+    t.planeC[i] = f[0][i] - t.planeA[i] * win[0].x - t.planeB[i] * win[0].y;
+  }
+
+  // dFdx / dFdy in computeTBN() reduce to the uv gradients of the
+  // triangle's plane, the sign flips cancel for front faces
+  vec3 e1 = v[1].worldPos - v[0].worldPos, e2 = v[2].worldPos - v[0].worldPos;
+  vec2 uv1 = v[1].uv - v[0].uv, uv2 = v[2].uv - v[0].uv;
+  vec3 tangent = e1 * uv2.y - e2 * uv1.y;
+  vec3 bitangent = -e1 * uv2.x + e2 * uv1.x;
+
+  t.tangent = (length(tangent) > 0.f) ? normalize(tangent) : vec3(0.f);
+  t.bitangent = (length(bitangent) > 0.f) ? normalize(bitangent) : vec3(0.f);
+
+  return true;
+}
+
+void SoftRaster::flush() {
+  for (size_t i = 0; i < bins.size(); i++) {
+    bins[i].clear();
+  }
+
+  for (size_t i = 0; i < tris.size(); i++) {
+    SoftTriangle &t = tris[i];
+
+    for (int ty = t.y0 / tileSize; ty <= t.y1 / tileSize; ty++) {
+      for (int tx = t.x0 / tileSize; tx <= t.x1 / tileSize; tx++) {
+        bins[ty * tilesX + tx].push_back(i);
+      }
+    }
+  }
+
+  // tiles differ a lot in cost (POM), so workers take them one by one
+  std::atomic<int> next(0);
+  int nOfTiles = bins.size();
+
+  threadPool.parallelFor(threadPool.size(), [&](size_t, size_t) {
+    for (int tile = next++; tile < nOfTiles; tile = next++) {
+      rasterTile(tile);
+    }
+  });
+}
+
+// the pixels of mask in the 8 from (x, y), of a triangle of draw d
+static void shadeSpan(SoftDraw &d, SoftTriangle &t, int x, int y, M8 mask,
+                      uint32_t *out) {
+  F8 px = F8(float(x) + 0.5f) + F8::iota();
+  F8 py = float(y) + 0.5f;
+  F8 p[SOFT_NUM_PLANES];
+
+  for (int i = 1; i < SOFT_NUM_PLANES; i++) {
+    p[i] = fmadd(F8(t.planeA[i]), px,
+                 fmadd(F8(t.planeB[i]), py, F8(t.planeC[i])));
+  }
+
+  F8 w = F8(1.f) / p[1];
+  F8 u = p[2] * w, v = p[3] * w;
+  V8 worldPos(p[4] * w, p[5] * w, p[6] * w);
+  V8 worldN(p[7] * w, p[8] * w, p[9] * w);
+
+  V8 tangent(t.tangent.x, t.tangent.y, t.tangent.z);
+  V8 bitangent(t.bitangent.x, t.bitangent.y, t.bitangent.z);
+
+  V8 c = shade(d, u, v, worldPos, worldN, tangent, bitangent, mask);
+
+  int32_t *dst = (int32_t *)out;
+  select(mask, packColor(c), I8::load(dst)).store(dst);
+}
+
+void SoftRaster::rasterTile(int tile) {
+  int tx0 = (tile % tilesX) * tileSize;
+  int ty0 = (tile / tilesX) * tileSize;
+  vector<int> &bin = bins[tile];
+
+  // pass 1: the nearest triangle of each pixel
+  for (size_t i = 0; i < bin.size(); i++) {
+    SoftTriangle &t = tris[bin[i]];
+    I8 id(bin[i]);
+
+    // spans start 8-aligned and never cross the tile
+    int xs = glm::max(t.x0, tx0) & ~7;
+    int xe = glm::min(t.x1, tx0 + tileSize - 1);
+    int ys = glm::max(t.y0, ty0);
+    int ye = glm::min(t.y1, ty0 + tileSize - 1);
+
+    M8 topLeft[3];
+    for (int k = 0; k < 3; k++) {
+      topLeft[k] = t.topLeft[k] ? M8::all() : M8::none();
+    }
+
+    for (int y = ys; y <= ye; y++) {
+      F8 py = float(y) + 0.5f;
+      float *rowDepth = &depth[y * pitch];
+      int32_t *rowIds = &ids[y * pitch];
+
+      for (int x = xs; x <= xe; x += 8) {
+        F8 px = F8(float(x) + 0.5f) + F8::iota();
+        M8 inside = M8::all();
+
+        for (int k = 0; k < 3; k++) {
+          F8 e = fmadd(F8(t.edgeA[k]), px,
+                       fmadd(F8(t.edgeB[k]), py, F8(t.edgeC[k])));
+          inside = inside & ((e > F8(0.f)) | ((e == F8(0.f)) & topLeft[k]));
+        }
+
+        if (!inside.any()) {
+          continue;
+        }
+
+        F8 z = fmadd(F8(t.planeA[0]), px,
+                     fmadd(F8(t.planeB[0]), py, F8(t.planeC[0])));
+        F8 d = F8::load(rowDepth + x);
+
+        // GL_LESS, and the far plane
+        M8 pass = inside & (z < d) & (z <= F8(1.f));
+        if (!pass.any()) {
+          continue;
+        }
+
+        select(pass, z, d).store(rowDepth + x);
+        select(pass, id, I8::load(rowIds + x)).store(rowIds + x);
+      }
+    }
+  }
+
+  // pass 2: shade the pixels each triangle won
+  for (size_t i = 0; i < bin.size(); i++) {
+    SoftTriangle &t = tris[bin[i]];
+    I8 id(bin[i]);
+
+    int xs = glm::max(t.x0, tx0) & ~7;
+    int xe = glm::min(t.x1, tx0 + tileSize - 1);
+    int ys = glm::max(t.y0, ty0);
+    int ye = glm::min(t.y1, ty0 + tileSize - 1);
+
+    for (int y = ys; y <= ye; y++) {
+      int32_t *rowIds = &ids[y * pitch];
+
+      for (int x = xs; x <= xe; x += 8) {
+        M8 mask = I8::load(rowIds + x) == id;
+
+        if (mask.any()) {
+          shadeSpan(draws[t.draw], t, x, y, mask, &color[y * pitch + x]);
+        }
+      }
+    }
+  }
+}
+
+bool SoftRaster::save(const string fileName) {
+  FIBITMAP *img = FreeImage_Allocate(width, height, 24);
+  int imgPitch = FreeImage_GetPitch(img);
+  BYTE *bits = FreeImage_GetBits(img);
+
+  // both are bottom up
+  for (int y = 0; y < height; y++) {
+    BYTE *row = bits + y * imgPitch;
+
+    for (int x = 0; x < width; x++) {
+      uint32_t c = color[y * pitch + x];
+      row[x * 3 + 0] = (c >> 16) & 255;
+      row[x * 3 + 1] = (c >> 8) & 255;
+      row[x * 3 + 2] = c & 255;
+    }
+  }
+
+  bool ok = FreeImage_Save(FreeImage_GetFIFFromFilename(fileName.c_str()), img,
+                           fileName.c_str());
+  FreeImage_Unload(img);
+
+  return ok;
+}
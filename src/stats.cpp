@@ -0,0 +1,175 @@
+#include "stats.h"
+#include <cstring>
+
+FrameStats frameStats;
+
+static double seconds(std::chrono::steady_clock::duration d) {
+  return std::chrono::duration<double>(d).count();
+}
+
+FrameStats::FrameStats() {
+  memset(&frame, 0, sizeof(frame));
+  memset(&last, 0, sizeof(last));
+  memset(&sum, 0, sizeof(sum));
+  nOfFrames = 0;
+  sumTime = lastTime = 0.0;
+  totalFrames = 0;
+  bufferBytes = textureBytes = 0;
+  log = NULL;
+  interval = 1.0;
+  start = frameStart = lastFlush = std::chrono::steady_clock::now();
+}
+
+FrameStats::~FrameStats() { close(); }
+
+// append a line every seconds to fileName
+bool FrameStats::open(const string fileName, double seconds) {
+  close();
+
+  log = fopen(fileName.c_str(), "a");
+  if (!log) {
+    std::cout << "stats: can't write " << fileName << std::endl;
+    return false;
+  }
+  interval = seconds;
+  lastFlush = std::chrono::steady_clock::now();
+
+  return true;
+}
+
+void FrameStats::close() {
+  if (!log) {
+    return;
+  }
+  if (nOfFrames > 0) {
+    writeLine();
+  }
+  fclose(log);
+  log = NULL;
+}
+
+// count vertices of mode, instances times
+void FrameStats::draw(GLenum mode, size_t count, size_t instances) {
+  frame.drawCalls++;
+  frame.vertices += count * instances;
+
+  switch (mode) {
+  case GL_TRIANGLES:
+  case GL_PATCHES: // triangle patches, see Mesh::setDisplacement
+    frame.triangles += count / 3 * instances;
+    break;
+  case GL_TRIANGLE_STRIP:
+  case GL_TRIANGLE_FAN:
+    frame.triangles += (count > 2 ? count - 2 : 0) * instances;
+    break;
+  default:
+    break;
+  }
+}
+
+void FrameStats::setBuffer(GLuint id, size_t bytes) {
+  size_t &b = buffers[id];
+  bufferBytes += bytes - b;
+  b = bytes;
+}
+
+void FrameStats::releaseBuffer(GLuint id) {
+  auto it = buffers.find(id);
+  if (it != buffers.end()) {
+    bufferBytes -= it->second;
+    buffers.erase(it);
+  }
+}
+
+void FrameStats::setTexture(GLuint id, size_t bytes) {
+  size_t &b = textures[id];
+  textureBytes += bytes - b;
+  b = bytes;
+}
+
+void FrameStats::releaseTexture(GLuint id) {
+  auto it = textures.find(id);
+  if (it != textures.end()) {
+    textureBytes -= it->second;
+    textures.erase(it);
+  }
+}
+
+void FrameStats::setRenderbuffer(GLuint id, size_t bytes) {
+  size_t &b = renderbuffers[id];
+  textureBytes += bytes - b;
+  b = bytes;
+}
+
+void FrameStats::releaseRenderbuffer(GLuint id) {
+  auto it = renderbuffers.find(id);
+  if (it != renderbuffers.end()) {
+    textureBytes -= it->second;
+    renderbuffers.erase(it);
+  }
+}
+
+// after the frame's last draw
+void FrameStats::endFrame() {
+  auto now = std::chrono::steady_clock::now();
+  lastTime = seconds(now - frameStart) * 1000.0;
+  frameStart = now;
+
+  last = frame;
+  sum.drawCalls += frame.drawCalls;
+  sum.vertices += frame.vertices;
+  sum.triangles += frame.triangles;
+  sum.programBinds += frame.programBinds;
+  sum.vaoBinds += frame.vaoBinds;
+  sum.textureBinds += frame.textureBinds;
+  sum.uniformUploads += frame.uniformUploads;
+  sum.elidedChanges += frame.elidedChanges;
+  sumTime += lastTime;
+  nOfFrames++;
+  totalFrames++;
+  memset(&frame, 0, sizeof(frame));
+
+  if (log && seconds(now - lastFlush) >= interval) {
+    writeLine();
+    lastFlush = now;
+  }
+}
+
+// averages per frame since the last line, memory as it is now
+void FrameStats::writeLine() {
+  double n = glm::max(nOfFrames, 1);
+
+  fprintf(log,
+          "{\"time\": %.3f, \"frame\": %zu, \"frames\": %d, \"ms\": %.3f, "
+          "\"drawCalls\": %.1f, \"triangles\": %.1f, \"vertices\": %.1f, "
+          "\"programBinds\": %.1f, \"vaoBinds\": %.1f, "
+          "\"textureBinds\": %.1f, \"uniformUploads\": %.1f, "
+          "\"elidedChanges\": %.1f, "
+          "\"bufferBytes\": %zu, \"textureBytes\": %zu}\n",
+          seconds(std::chrono::steady_clock::now() - start), totalFrames,
+          nOfFrames, sumTime / n, sum.drawCalls / n, sum.triangles / n,
+          sum.vertices / n, sum.programBinds / n, sum.vaoBinds / n,
+          sum.textureBinds / n, sum.uniformUploads / n,
+          sum.elidedChanges / n, bufferBytes,
+          textureBytes);
+  fflush(log);
+
+  memset(&sum, 0, sizeof(sum));
+  sumTime = 0.0;
+  nOfFrames = 0;
+}
+
+// the last frame and the memory, to the console
+void FrameStats::print() {
+  std::cout << "frame " << totalFrames << ": " << lastTime << " ms, "
+            << last.drawCalls << " draw calls, " << last.triangles
+            << " triangles, " << last.vertices << " vertices\n"
+            << "  binds: " << last.programBinds << " programs, "
+            << last.vaoBinds << " VAOs, " << last.textureBinds
+            << " textures, uniform uploads: " << last.uniformUploads
+            << ", elided changes: " << last.elidedChanges << "\n"
+            << "  memory: " << buffers.size() << " buffers "
+            << (bufferBytes >> 10) << " KB, " << textures.size()
+            << " textures and " << renderbuffers.size() << " renderbuffers "
+            << (textureBytes >> 10) << " KB" << std::endl;
+}
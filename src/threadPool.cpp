@@ -0,0 +1,98 @@
+#include "threadPool.h"
+
+ThreadPool threadPool;
+
+// nOfThreads <= 0 uses one thread per hardware thread
+ThreadPool::ThreadPool(int nOfThreads) {
+  stop = false;
+
+  if (nOfThreads <= 0) {
+    nOfThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  for (int i = 0; i < nOfThreads; i++) {
+    workers.emplace_back(&ThreadPool::work, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    stop = true;
+  }
+  cv.notify_all();
+
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+}
+
+int ThreadPool::size() { return workers.size(); }
+
+void ThreadPool::work() {
+  while (true) {
+    std::function<void()> task;
+
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      cv.wait(lock, [this] { return stop || !tasks.empty(); });
+
+      if (stop && tasks.empty()) {
+        return;
+      }
+
+      task = std::move(tasks.front());
+      tasks.pop();
+    }
+
+    task();
+  }
+}
+
+std::future<void> ThreadPool::enqueue(std::function<void()> func) {
+  auto task = std::make_shared<std::packaged_task<void()>>(func);
+  std::future<void> result = task->get_future();
+
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    tasks.push([task] { (*task)(); });
+  }
+  cv.notify_one();
+
+  return result;
+}
+
+// split [0, count) into chunks of at least grain items,
+// run func(begin, end) on the workers and wait for all of them
+// Note: must not be called from a task running on this pool
+void ThreadPool::parallelFor(size_t count,
+                             std::function<void(size_t, size_t)> func,
+                             size_t grain) {
+  if (count == 0) {
+    return;
+  }
+
+  size_t nOfChunks = std::min(count / std::max(grain, (size_t)1),
+                              (size_t)workers.size() * 4);
+  nOfChunks = std::max(nOfChunks, (size_t)1);
+
+  if (nOfChunks == 1) {
+    func(0, count);
+    return;
+  }
+
+  size_t chunk = (count + nOfChunks - 1) / nOfChunks;
+  std::vector<std::future<void>> results;
+
+  for (size_t begin = chunk; begin < count; begin += chunk) {
+    size_t end = std::min(begin + chunk, count);
+    results.push_back(enqueue([=] { func(begin, end); }));
+  }
+
+  // the calling thread takes the first chunk
+  func(0, std::min(chunk, count));
+
+  for (size_t i = 0; i < results.size(); i++) {
+    results[i].get();
+  }
+}
@@ -0,0 +1,641 @@
+#include "virtualTexture.h"
+#include "shaderQueue.h"
+#include "glState.h"
+#include "stats.h"
+#include "threadPool.h"
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// a square power of two RGBA8 image and its mip chain
+typedef vector<vector<uint8_t>> MipChain;
+
+// rgb from the normal map, a from the height map, size x size texels
+static bool loadSource(const string normalFile, const string heightFile,
+                       int size, MipChain &mips) {
+  FIBITMAP *images[2];
+  const string files[2] = {normalFile, heightFile};
+
+  for (int i = 0; i < 2; i++) {
+    FIBITMAP *img = FreeImage_Load(
+        FreeImage_GetFileType(files[i].c_str()), files[i].c_str());
+    if (!img) {
+      std::cout << "virtual texture: can't load " << files[i] << std::endl;
+      if (i == 1) {
+        FreeImage_Unload(images[0]);
+      }
+      return false;
+    }
+
+    FIBITMAP *rgb = FreeImage_ConvertTo24Bits(img);
+    FreeImage_Unload(img);
+    images[i] = FreeImage_Rescale(rgb, size, size, FILTER_BILINEAR);
+    FreeImage_Unload(rgb);
+  }
+
+  // rows bottom up like the textures of Mesh::setTexture()
+  vector<uint8_t> level(size * size * 4);
+  for (int y = 0; y < size; y++) {
+    BYTE *normal =
+        FreeImage_GetBits(images[0]) + y * FreeImage_GetPitch(images[0]);
+    BYTE *height =
+        FreeImage_GetBits(images[1]) + y * FreeImage_GetPitch(images[1]);
+
+    for (int x = 0; x < size; x++) {
+      uint8_t *t = &level[(y * size + x) * 4];
+      t[0] = normal[x * 3 + FI_RGBA_RED];
+      t[1] = normal[x * 3 + FI_RGBA_GREEN];
+      t[2] = normal[x * 3 + FI_RGBA_BLUE];
+      t[3] = height[x * 3 + FI_RGBA_RED];
+    }
+  }
+  FreeImage_Unload(images[0]);
+  FreeImage_Unload(images[1]);
+
+  // box filtered down to a single texel
+  mips.clear();
+  mips.push_back(level);
+  for (int s = size / 2; s >= 1; s /= 2) {
+    vector<uint8_t> &src = mips.back();
+    vector<uint8_t> dst(s * s * 4);
+
+    for (int y = 0; y < s; y++) {
+      for (int x = 0; x < s; x++) {
+        for (int c = 0; c < 4; c++) {
+          int sum = src[((y * 2) * s * 2 + x * 2) * 4 + c] +
+                    src[((y * 2) * s * 2 + x * 2 + 1) * 4 + c] +
+                    src[((y * 2 + 1) * s * 2 + x * 2) * 4 + c] +
+                    src[((y * 2 + 1) * s * 2 + x * 2 + 1) * 4 + c];
+          dst[(y * s + x) * 4 + c] = (sum + 2) / 4;
+        }
+      }
+    }
+    mips.push_back(dst);
+  }
+
+  return true;
+}
+
+static bool isPowerOfTwo(int n) { return n > 0 && (n & (n - 1)) == 0; }
+
+bool bakeVirtualTexture(const string normalFile, const string heightFile,
+                        const string outFile, int size, int tileSize,
+                        int border) {
+  if (!isPowerOfTwo(size) || !isPowerOfTwo(tileSize) || size < tileSize) {
+    std::cout << "virtual texture: size and tile size must be powers of two"
+              << std::endl;
+    return false;
+  }
+
+  // repeating the maps commutes with box filtering, so each level is the
+  // source level of the same index repeated
+  MipChain mips;
+  if (!loadSource(normalFile, heightFile, glm::min(size, 1024), mips)) {
+    return false;
+  }
+
+  FILE *file = fopen(outFile.c_str(), "wb");
+  if (!file) {
+    std::cout << "virtual texture: can't write " << outFile << std::endl;
+    return false;
+  }
+
+  VtHeader header;
+  memcpy(header.magic, "VTEX", 4);
+  header.size = size;
+  header.tileSize = tileSize;
+  header.border = border;
+  header.nOfLevels = 1;
+  while ((size >> header.nOfLevels) >= tileSize) {
+    header.nOfLevels++;
+  }
+  fwrite(&header, sizeof(header), 1, file);
+
+  int padded = tileSize + 2 * border;
+  vector<uint8_t> texels(padded * padded * 4);
+
+  auto t0 = std::chrono::high_resolution_clock::now();
+
+  for (int l = 0; l < (int)header.nOfLevels; l++) {
+    int levelSize = size >> l;
+    int pages = levelSize / tileSize;
+    int sl = glm::min(l, (int)mips.size() - 1);
+    int srcSize = glm::min(size, 1024) >> sl;
+    vector<uint8_t> &src = mips[sl];
+
+    for (int py = 0; py < pages; py++) {
+      for (int px = 0; px < pages; px++) {
+        for (int y = 0; y < padded; y++) {
+          // borders wrap around the texture
+          int vy = (py * tileSize + y - border + levelSize) % levelSize;
+
+          for (int x = 0; x < padded; x++) {
+            int vx = (px * tileSize + x - border + levelSize) % levelSize;
+            memcpy(&texels[(y * padded + x) * 4],
+                   &src[((vy % srcSize) * srcSize + vx % srcSize) * 4], 4);
+          }
+        }
+        fwrite(texels.data(), 1, texels.size(), file);
+      }
+    }
+  }
+
+  fclose(file);
+
+  auto t1 = std::chrono::high_resolution_clock::now();
+  std::cout << "virtual texture: baked " << size << " x " << size << ", "
+            << header.nOfLevels << " levels into " << outFile << " in "
+            << std::chrono::duration<double>(t1 - t0).count() << " s"
+            << std::endl;
+
+  return true;
+}
+
+VirtualTexture::VirtualTexture(const string fileName, int slotsX, int scale) {
+  data = NULL;
+  dataSize = 0;
+  fd = -1;
+  frame = 0;
+  nOfRequested = nOfUploaded = nOfResident = 0;
+  maxPending = 32;
+  maxUploads = 8;
+  unitPhysical = 25;
+  unitIndirection = 26;
+  nOfSlotsX = slotsX;
+  feedbackScale = scale;
+  shader = 0;
+  program = -1;
+
+  fd = open(fileName.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(VtHeader)) {
+    std::cout << "virtual texture: can't open " << fileName << std::endl;
+    return;
+  }
+
+  dataSize = st.st_size;
+  void *mapped = mmap(NULL, dataSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (mapped == MAP_FAILED) {
+    std::cout << "virtual texture: can't map " << fileName << std::endl;
+    return;
+  }
+  data = (uint8_t *)mapped;
+
+  // pages are read in no particular order
+  madvise(mapped, dataSize, MADV_RANDOM);
+
+  memcpy(&header, data, sizeof(header));
+  nOfPagesX = header.size / std::max(header.tileSize, 1u);
+  paddedSize = header.tileSize + 2 * header.border;
+  pageBytes = (size_t)paddedSize * paddedSize * 4;
+
+  size_t offset = sizeof(VtHeader);
+  for (int l = 0; l < (int)header.nOfLevels; l++) {
+    levelOffsets.push_back(offset);
+    offset += pageBytes * pagesAt(l) * pagesAt(l);
+  }
+
+  if (memcmp(header.magic, "VTEX", 4) != 0 || offset > dataSize) {
+    std::cout << "virtual texture: " << fileName << " is not a tiled texture"
+              << std::endl;
+    munmap(data, dataSize);
+    data = NULL;
+    return;
+  }
+
+  for (int l = 0; l < (int)header.nOfLevels; l++) {
+    int n = pagesAt(l);
+    pageSlots.push_back(vector<int>(n * n, -1));
+    indirection.push_back(vector<uint8_t>(n * n * 4, 0));
+  }
+
+  VtSlot empty = {-1, -1, false};
+  slots.assign(nOfSlotsX * nOfSlotsX, empty);
+  indirectionDirty = false;
+
+  // physical pages
+  int physicalSize = nOfSlotsX * paddedSize;
+  glGenTextures(1, &tboPhysical);
+  glBindTexture(GL_TEXTURE_2D, tboPhysical);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, physicalSize, physicalSize, 0,
+               GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  frameStats.setTexture(tboPhysical, (size_t)physicalSize * physicalSize * 4);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  // a texel per page of every level, integer textures are never filtered
+  glGenTextures(1, &tboIndirection);
+  glBindTexture(GL_TEXTURE_2D, tboIndirection);
+  size_t indirectionBytes = 0;
+  for (int l = 0; l < (int)header.nOfLevels; l++) {
+    glTexImage2D(GL_TEXTURE_2D, l, GL_RGBA8UI, pagesAt(l), pagesAt(l), 0,
+                 GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, NULL);
+    indirectionBytes += (size_t)pagesAt(l) * pagesAt(l) * 4;
+  }
+  frameStats.setTexture(tboIndirection, indirectionBytes);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header.nOfLevels - 1);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                  GL_NEAREST_MIPMAP_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  // the fallback of every page
+  int top = header.nOfLevels - 1;
+  upload(pageKey(top, 0, 0), page(top, 0, 0), true);
+  buildIndirection();
+
+  // feedback buffer
+  feedbackWidth = glm::max(WINDOW_WIDTH / feedbackScale, 1);
+  feedbackHeight = glm::max(WINDOW_HEIGHT / feedbackScale, 1);
+
+  glGenTextures(1, &tboFeedback);
+  glBindTexture(GL_TEXTURE_2D, tboFeedback);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16UI, feedbackWidth, feedbackHeight,
+               0, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, NULL);
+  frameStats.setTexture(tboFeedback,
+                        (size_t)feedbackWidth * feedbackHeight * 8);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  glGenRenderbuffers(1, &rboDepth);
+  glBindRenderbuffer(GL_RENDERBUFFER, rboDepth);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, feedbackWidth,
+                        feedbackHeight);
+  frameStats.setRenderbuffer(rboDepth,
+                             (size_t)feedbackWidth * feedbackHeight * 4);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                         tboFeedback, 0);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                            GL_RENDERBUFFER, rboDepth);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    std::cout << "virtual texture: feedback framebuffer is incomplete"
+              << std::endl;
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  glGenBuffers(NUM_FEEDBACK_SLOTS, pbos);
+  for (int i = 0; i < NUM_FEEDBACK_SLOTS; i++) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i]);
+    glBufferData(GL_PIXEL_PACK_BUFFER,
+                 sizeof(GLushort) * 4 * feedbackWidth * feedbackHeight, NULL,
+                 GL_STREAM_READ);
+    frameStats.setBuffer(pbos[i], sizeof(GLushort) * 4 * feedbackWidth *
+                                      feedbackHeight);
+    fences[i] = 0;
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  feedbackSlot = 0;
+
+  std::cout << "virtual texture: " << header.size << " x " << header.size
+            << ", " << header.nOfLevels << " levels, cache of "
+            << slots.size() << " pages" << std::endl;
+
+  initShader();
+}
+
+VirtualTexture::~VirtualTexture() {
+  shaderQueue.remove(program);
+  if (!data) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return;
+  }
+
+  // loaders still read the mapping
+  for (std::future<void> &f : loads) {
+    f.wait();
+  }
+
+  for (int i = 0; i < NUM_FEEDBACK_SLOTS; i++) {
+    if (fences[i]) {
+      glDeleteSync(fences[i]);
+    }
+  }
+  for (int i = 0; i < NUM_FEEDBACK_SLOTS; i++) {
+    frameStats.releaseBuffer(pbos[i]);
+  }
+  frameStats.releaseRenderbuffer(rboDepth);
+  frameStats.releaseTexture(tboFeedback);
+  frameStats.releaseTexture(tboPhysical);
+  frameStats.releaseTexture(tboIndirection);
+  glDeleteBuffers(NUM_FEEDBACK_SLOTS, pbos);
+  glDeleteFramebuffers(1, &fbo);
+  glDeleteRenderbuffers(1, &rboDepth);
+  glDeleteTextures(1, &tboFeedback);
+  glDeleteTextures(1, &tboPhysical);
+  glDeleteTextures(1, &tboIndirection);
+
+  munmap(data, dataSize);
+  close(fd);
+}
+
+void VirtualTexture::initShader() {
+  program = shaderQueue.submit(
+      "./shader/vsPOM.glsl", "./shader/fsVtFeedback.glsl",
+      [this](GLuint exe) {
+        shader = exe;
+        uniModel = myGetUniformLocation(shader, "M");
+        uniView = myGetUniformLocation(shader, "V");
+        uniProjection = myGetUniformLocation(shader, "P");
+        uniVtSize = myGetUniformLocation(shader, "vtSize");
+        uniVtPage = myGetUniformLocation(shader, "vtPage");
+        uniVtBias = myGetUniformLocation(shader, "vtBias");
+      });
+}
+
+// for the programs sampling through the indirection, see fsPOM.glsl
+void VirtualTexture::setUniforms(GLint uniIndirection, GLint uniPhysical,
+                                 GLint uniSize, GLint uniPage,
+                                 GLint uniBias) {
+  glState.bindTexture(unitPhysical, GL_TEXTURE_2D, tboPhysical);
+  glState.bindTexture(unitIndirection, GL_TEXTURE_2D, tboIndirection);
+
+  glState.uniform1i(uniPhysical, unitPhysical);
+  glState.uniform1i(uniIndirection, unitIndirection);
+  glState.uniform1f(uniSize, header.size);
+  glState.uniform4f(uniPage, vec4(header.tileSize, header.border,
+                                  nOfSlotsX * paddedSize, header.nOfLevels));
+  glState.uniform1f(uniBias, 0.f);
+}
+
+uint32_t VirtualTexture::pageKey(int level, int x, int y) {
+  return (level << 24) | (y << 12) | x;
+}
+
+int VirtualTexture::pagesAt(int level) {
+  return glm::max(nOfPagesX >> level, 1);
+}
+
+const uint8_t *VirtualTexture::page(int level, int x, int y) {
+  return data + levelOffsets[level] +
+         pageBytes * (y * pagesAt(level) + x);
+}
+
+// a free slot, or the least recently used one not needed this frame
+int VirtualTexture::findSlot() {
+  int best = -1;
+
+  for (int i = 0; i < (int)slots.size(); i++) {
+    VtSlot &s = slots[i];
+    if (s.key < 0) {
+      return i;
+    }
+    if (!s.pinned && s.lastUsed < frame &&
+        (best < 0 || s.lastUsed < slots[best].lastUsed)) {
+      best = i;
+    }
+  }
+
+  if (best >= 0) {
+    uint32_t key = slots[best].key;
+    int level = key >> 24, y = (key >> 12) & 0xfff, x = key & 0xfff;
+    pageSlots[level][y * pagesAt(level) + x] = -1;
+    slots[best].key = -1;
+  }
+
+  return best;
+}
+
+void VirtualTexture::upload(uint32_t key, const uint8_t *texels,
+                            bool pinned) {
+  int level = key >> 24, y = (key >> 12) & 0xfff, x = key & 0xfff;
+  if (pageSlots[level][y * pagesAt(level) + x] >= 0) {
+    return;
+  }
+
+  int slot = findSlot();
+  if (slot < 0) {
+    return;
+  }
+
+  glActiveTexture(GL_TEXTURE0 + unitPhysical);
+  glBindTexture(GL_TEXTURE_2D, tboPhysical);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % nOfSlotsX) * paddedSize,
+                  (slot / nOfSlotsX) * paddedSize, paddedSize, paddedSize,
+                  GL_RGBA, GL_UNSIGNED_BYTE, texels);
+
+  VtSlot s = {key, frame, pinned};
+  slots[slot] = s;
+  pageSlots[level][y * pagesAt(level) + x] = slot;
+  indirectionDirty = true;
+}
+
+// the page and the pages above it, which are its fallbacks
+void VirtualTexture::touch(int level, int x, int y) {
+  for (; level < (int)header.nOfLevels; level++, x /= 2, y /= 2) {
+    int slot = pageSlots[level][y * pagesAt(level) + x];
+    if (slot >= 0) {
+      slots[slot].lastUsed = frame;
+    }
+  }
+}
+
+// load the coarsest missing page above a page first, then refine
+void VirtualTexture::request(int level, int x, int y) {
+  while (level + 1 < (int)header.nOfLevels &&
+         pageSlots[level + 1][(y / 2) * pagesAt(level + 1) + x / 2] < 0) {
+    level++;
+    x /= 2;
+    y /= 2;
+  }
+
+  uint32_t key = pageKey(level, x, y);
+  if (pageSlots[level][y * pagesAt(level) + x] >= 0 || pending.count(key) ||
+      (int)pending.size() >= maxPending) {
+    return;
+  }
+
+  pending.insert(key);
+
+  // reading the mapping faults the page in from disk on a pool thread
+  const uint8_t *src = page(level, x, y);
+  loads.push_back(threadPool.enqueue([this, key, src]() {
+    VtTile tile;
+    tile.key = key;
+    tile.texels.assign(src, src + pageBytes);
+
+    std::lock_guard<std::mutex> lock(arrivedMutex);
+    arrived.push_back(std::move(tile));
+  }));
+}
+
+void VirtualTexture::readFeedback(int slot) {
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[slot]);
+  GLushort *texels = (GLushort *)glMapBufferRange(
+      GL_PIXEL_PACK_BUFFER, 0,
+      sizeof(GLushort) * 4 * feedbackWidth * feedbackHeight,
+      GL_MAP_READ_BIT);
+
+  std::unordered_set<uint32_t> seen;
+
+  if (texels) {
+    for (int i = 0; i < feedbackWidth * feedbackHeight; i++) {
+      GLushort *t = texels + i * 4;
+
+      // nothing virtually textured was drawn there
+      if (t[3] == 0 || t[2] >= header.nOfLevels ||
+          t[0] >= pagesAt(t[2]) || t[1] >= pagesAt(t[2])) {
+        continue;
+      }
+      if (seen.insert(pageKey(t[2], t[0], t[1])).second) {
+        touch(t[2], t[0], t[1]);
+        request(t[2], t[0], t[1]);
+      }
+    }
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  }
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  nOfRequested = seen.size();
+}
+
+// each page points at itself if resident, else at its parent's page
+void VirtualTexture::buildIndirection() {
+  glActiveTexture(GL_TEXTURE0 + unitIndirection);
+  glBindTexture(GL_TEXTURE_2D, tboIndirection);
+
+  for (int l = header.nOfLevels - 1; l >= 0; l--) {
+    int n = pagesAt(l);
+    vector<uint8_t> &entries = indirection[l];
+
+    for (int y = 0; y < n; y++) {
+      for (int x = 0; x < n; x++) {
+        uint8_t *e = &entries[(y * n + x) * 4];
+        int slot = pageSlots[l][y * n + x];
+
+        if (slot >= 0) {
+          e[0] = slot % nOfSlotsX;
+          e[1] = slot / nOfSlotsX;
+          e[2] = l;
+          e[3] = 255;
+        } else if (l + 1 < (int)header.nOfLevels) {
+          int pn = pagesAt(l + 1);
+          memcpy(e, &indirection[l + 1][((y / 2) * pn + x / 2) * 4], 4);
+        }
+      }
+    }
+
+    glTexSubImage2D(GL_TEXTURE_2D, l, 0, 0, n, n, GL_RGBA_INTEGER,
+                    GL_UNSIGNED_BYTE, entries.data());
+  }
+
+  indirectionDirty = false;
+}
+
+// read finished feedback, upload arrived pages, before drawing the frame
+void VirtualTexture::update() {
+  if (!data) {
+    return;
+  }
+
+  frame++;
+
+  // oldest first, the slot written next is the oldest
+  for (int k = 0; k < NUM_FEEDBACK_SLOTS; k++) {
+    int s = (feedbackSlot + k) % NUM_FEEDBACK_SLOTS;
+    if (!fences[s]) {
+      continue;
+    }
+
+    GLenum status = glClientWaitSync(fences[s], 0, 0);
+    if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+      glDeleteSync(fences[s]);
+      fences[s] = 0;
+      readFeedback(s);
+    }
+  }
+
+  vector<VtTile> tiles;
+  {
+    std::lock_guard<std::mutex> lock(arrivedMutex);
+    int n = glm::min((int)arrived.size(), maxUploads);
+    tiles.assign(std::make_move_iterator(arrived.begin()),
+                 std::make_move_iterator(arrived.begin() + n));
+    arrived.erase(arrived.begin(), arrived.begin() + n);
+  }
+
+  for (VtTile &tile : tiles) {
+    pending.erase(tile.key);
+    upload(tile.key, tile.texels.data(), false);
+  }
+  nOfUploaded = tiles.size();
+
+  while (!loads.empty() && loads.front().wait_for(std::chrono::seconds(0)) ==
+                               std::future_status::ready) {
+    loads.pop_front();
+  }
+
+  if (indirectionDirty) {
+    buildIndirection();
+  }
+
+  nOfResident = 0;
+  for (VtSlot &s : slots) {
+    nOfResident += s.key >= 0;
+  }
+}
+
+// false while the feedback program is not ready
+bool VirtualTexture::beginFeedback(mat4 V, mat4 P) {
+  if (!data || shader == 0) {
+    return false;
+  }
+
+  glGetIntegerv(GL_VIEWPORT, savedViewport);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glViewport(0, 0, feedbackWidth, feedbackHeight);
+
+  GLuint none[4] = {0, 0, 0, 0};
+  glClearBufferuiv(GL_COLOR, 0, none);
+  glClear(GL_DEPTH_BUFFER_BIT);
+
+  glState.useProgram(shader);
+  glUniformMatrix4fv(uniView, 1, GL_FALSE, value_ptr(V));
+  glUniformMatrix4fv(uniProjection, 1, GL_FALSE, value_ptr(P));
+  glUniform1f(uniVtSize, header.size);
+  glUniform4f(uniVtPage, header.tileSize, header.border,
+              nOfSlotsX * paddedSize, header.nOfLevels);
+
+  // derivatives are feedbackScale times larger than in the window
+  glUniform1f(uniVtBias, log2(float(feedbackScale)));
+
+  return true;
+}
+
+void VirtualTexture::drawFeedback(Quad *quad, mat4 M) {
+  glUniformMatrix4fv(uniModel, 1, GL_FALSE, value_ptr(M));
+  quad->drawGeometry();
+}
+
+// start reading the feedback back, update() picks it up when it is done
+void VirtualTexture::endFeedback() {
+  int s = feedbackSlot;
+
+  // never read, the newer ones are more useful
+  if (fences[s]) {
+    glDeleteSync(fences[s]);
+  }
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[s]);
+  glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA_INTEGER,
+               GL_UNSIGNED_SHORT, 0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  fences[s] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  feedbackSlot = (s + 1) % NUM_FEEDBACK_SLOTS;
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(savedViewport[0], savedViewport[1], savedViewport[2],
+             savedViewport[3]);
+}